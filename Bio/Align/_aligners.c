@@ -10,6 +10,8 @@
 #define PY_SSIZE_T_CLEAN
 #include "Python.h"
 #include "float.h"
+#include "stddef.h"
+#include "time.h"
 
 
 #define HORIZONTAL 0x1
@@ -28,6 +30,11 @@
 
 #define MISSING_LETTER -1
 
+#define FREE_LEFT_A 0x1
+#define FREE_RIGHT_A 0x2
+#define FREE_LEFT_B 0x4
+#define FREE_RIGHT_B 0x8
+
 #define SAFE_ADD(t, s) \
 {   if (s != OVERFLOW_ERROR) { \
         term = t; \
@@ -42,7 +49,7 @@ typedef enum {NeedlemanWunschSmithWaterman,
               WatermanSmithBeyer,
               Unknown} Algorithm;
 
-typedef enum {Global, Local} Mode;
+typedef enum {Global, Local, Semiglobal, Glocal, Overlap} Mode;
 
 typedef struct {
     unsigned char trace : 5;
@@ -61,6 +68,35 @@ typedef struct {
     int* IxIy;
 } TraceGapsWatermanSmithBeyer;
 
+/* Counters collected by the aligner if statistics collection is switched on.
+ * Path generators created by the aligner while collection is on keep a
+ * pointer to these counters, and a reference to the aligner owning them.
+ */
+typedef struct {
+    int enabled;
+    const char* algorithm;
+    long long score_calls;
+    long long align_calls;
+    long long cells;
+    long long trace_bytes;
+    long long count_bytes;
+    long long paths;
+    double fill_time;
+    double traceback_time;
+} Statistics;
+
+static double
+_get_time(void)
+{
+    struct timespec ts;
+#ifdef _WIN32
+    timespec_get(&ts, TIME_UTC);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return ts.tv_sec + 1.e-9 * ts.tv_nsec;
+}
+
 typedef struct {
     PyObject_HEAD
     Trace** M;
@@ -74,6 +110,8 @@ typedef struct {
     Algorithm algorithm;
     Py_ssize_t length;
     unsigned char strand;
+    Statistics* statistics;
+    PyObject* aligner;
 } PathGenerator;
 
 static PyObject*
@@ -612,9 +650,31 @@ exit:
     return count;
 }
 
+static long long
+_get_count_bytes(Algorithm algorithm, long long nA, long long nB)
+{
+    /* number of bytes allocated for the counts while calculating the number
+     * of optimal alignments */
+    switch (algorithm) {
+        case NeedlemanWunschSmithWaterman:
+            return (nB+1)*sizeof(Py_ssize_t);
+        case Gotoh:
+            return 3*(nB+1)*sizeof(Py_ssize_t);
+        case WatermanSmithBeyer:
+            return 3*((nA+1)*sizeof(Py_ssize_t*)
+                     +(nA+1)*(nB+1)*sizeof(Py_ssize_t));
+        case Unknown:
+        default:
+            return 0;
+    }
+}
+
 static Py_ssize_t PathGenerator_length(PathGenerator* self) {
     Py_ssize_t length = self->length;
     if (length == 0) {
+        Statistics* statistics = self->statistics;
+        double start = 0;
+        if (statistics) start = _get_time();
         switch (self->algorithm) {
             case NeedlemanWunschSmithWaterman:
                 switch (self->mode) {
@@ -670,6 +730,11 @@ static Py_ssize_t PathGenerator_length(PathGenerator* self) {
                 return -1;
         }
         self->length = length;
+        if (statistics) {
+            statistics->traceback_time += _get_time() - start;
+            statistics->count_bytes += _get_count_bytes(self->algorithm,
+                                                        self->nA, self->nB);
+        }
     }
     switch (length) {
         case OVERFLOW_ERROR:
@@ -743,9 +808,65 @@ PathGenerator_dealloc(PathGenerator* self)
             PyErr_WriteUnraisable((PyObject*)self);
             break;
     }
+    Py_XDECREF(self->aligner);
     Py_TYPE(self)->tp_free((PyObject*)self);
 }
 
+static long long
+PathGenerator_trace_bytes(PathGenerator* self)
+{
+    /* number of bytes allocated for the trace matrices */
+    int i;
+    int j;
+    const int nA = self->nA;
+    const int nB = self->nB;
+    long long size = (nA+1)*(sizeof(Trace*)+(nB+1)*sizeof(Trace));
+    switch (self->algorithm) {
+        case NeedlemanWunschSmithWaterman:
+            break;
+        case Gotoh:
+            size += (nA+1)*(sizeof(TraceGapsGotoh*)
+                           +(nB+1)*sizeof(TraceGapsGotoh));
+            break;
+        case WatermanSmithBeyer: {
+            int k;
+            int* trace;
+            TraceGapsWatermanSmithBeyer** gaps = self->gaps.waterman_smith_beyer;
+            size += (nA+1)*(sizeof(TraceGapsWatermanSmithBeyer*)
+                           +(nB+1)*sizeof(TraceGapsWatermanSmithBeyer));
+            for (i = 0; i <= nA; i++) {
+                for (j = 0; j <= nB; j++) {
+                    trace = gaps[i][j].MIx;
+                    if (trace) {
+                        for (k = 0; trace[k]; k++);
+                        size += (k+1)*sizeof(int);
+                    }
+                    trace = gaps[i][j].IyIx;
+                    if (trace) {
+                        for (k = 0; trace[k]; k++);
+                        size += (k+1)*sizeof(int);
+                    }
+                    trace = gaps[i][j].MIy;
+                    if (trace) {
+                        for (k = 0; trace[k]; k++);
+                        size += (k+1)*sizeof(int);
+                    }
+                    trace = gaps[i][j].IxIy;
+                    if (trace) {
+                        for (k = 0; trace[k]; k++);
+                        size += (k+1)*sizeof(int);
+                    }
+                }
+            }
+            break;
+        }
+        case Unknown:
+        default:
+            break;
+    }
+    return size;
+}
+
 static PyObject* PathGenerator_next_needlemanwunsch(PathGenerator* self)
 {
     int i = 0;
@@ -1586,7 +1707,7 @@ PathGenerator_next_waterman_smith_beyer_local(PathGenerator* self)
 }
 
 static PyObject *
-PathGenerator_next(PathGenerator* self)
+PathGenerator_next_path(PathGenerator* self)
 {
     const Mode mode = self->mode;
     const Algorithm algorithm = self->algorithm;
@@ -1594,6 +1715,9 @@ PathGenerator_next(PathGenerator* self)
         case NeedlemanWunschSmithWaterman:
             switch (mode) {
                 case Global:
+                case Semiglobal:
+                case Glocal:
+                case Overlap:
                     return PathGenerator_next_needlemanwunsch(self);
                 case Local:
                     return PathGenerator_next_smithwaterman(self);
@@ -1601,6 +1725,9 @@ PathGenerator_next(PathGenerator* self)
         case Gotoh:
             switch (mode) {
                 case Global:
+                case Semiglobal:
+                case Glocal:
+                case Overlap:
                     return PathGenerator_next_gotoh_global(self);
                 case Local:
                     return PathGenerator_next_gotoh_local(self);
@@ -1608,6 +1735,9 @@ PathGenerator_next(PathGenerator* self)
         case WatermanSmithBeyer:
             switch (mode) {
                 case Global:
+                case Semiglobal:
+                case Glocal:
+                case Overlap:
                     return PathGenerator_next_waterman_smith_beyer_global(self);
                 case Local:
                     return PathGenerator_next_waterman_smith_beyer_local(self);
@@ -1619,6 +1749,20 @@ PathGenerator_next(PathGenerator* self)
     }
 }
 
+static PyObject *
+PathGenerator_next(PathGenerator* self)
+{
+    PyObject* path;
+    double start;
+    Statistics* statistics = self->statistics;
+    if (!statistics) return PathGenerator_next_path(self);
+    start = _get_time();
+    path = PathGenerator_next_path(self);
+    statistics->traceback_time += _get_time() - start;
+    if (path) statistics->paths++;
+    return path;
+}
+
 static const char PathGenerator_reset__doc__[] = "reset the iterator";
 
 static PyObject*
@@ -1628,6 +1772,9 @@ PathGenerator_reset(PathGenerator* self)
         case Local:
             self->iA = 0;
             self->iB = 0;
+        case Semiglobal:
+        case Glocal:
+        case Overlap:
         case Global: {
             Trace** M = self->M;
             switch (self->algorithm) {
@@ -1726,6 +1873,8 @@ typedef struct {
     PyObject* alphabet;
     int* mapping;
     int wildcard;
+    long long memory_limit;
+    Statistics statistics;
 } Aligner;
 
 
@@ -1842,6 +1991,8 @@ Aligner_init(Aligner *self, PyObject *args, PyObject *kwds)
     self->alphabet = NULL;
     self->mapping = NULL;
     self->wildcard = -1;
+    self->memory_limit = -1;
+    memset(&self->statistics, 0, sizeof(Statistics));
     return 0;
 }
 
@@ -1851,7 +2002,7 @@ Aligner_dealloc(Aligner* self)
     Py_XDECREF(self->query_gap_function);
     if (self->substitution_matrix.obj) PyBuffer_Release(&self->substitution_matrix);
     Py_XDECREF(self->alphabet);
-    Py_XDECREF(self->mapping);
+    if (self->mapping) PyMem_Free(self->mapping);
     Py_TYPE(self)->tp_free((PyObject*)self);
 }
 
@@ -1931,13 +2082,16 @@ Aligner_str(Aligner* self)
     switch (self->mode) {
         case Global: sprintf(p, "  mode: global\n"); break;
         case Local: sprintf(p, "  mode: local\n"); break;
+        case Semiglobal: sprintf(p, "  mode: semiglobal\n"); break;
+        case Glocal: sprintf(p, "  mode: glocal\n"); break;
+        case Overlap: sprintf(p, "  mode: overlap\n"); break;
     }
     s = PyUnicode_FromFormat(text, args[0], args[1], args[2]);
     Py_XDECREF(wildcard);
     return s;
 }
 
-static char Aligner_mode__doc__[] = "alignment mode ('global' or 'local')";
+static char Aligner_mode__doc__[] = "alignment mode ('global', 'local', 'semiglobal', 'glocal', or 'overlap')";
 
 static PyObject*
 Aligner_get_mode(Aligner* self, void* closure)
@@ -1945,6 +2099,9 @@ Aligner_get_mode(Aligner* self, void* closure)
     switch (self->mode) {
         case Global: message = "global"; break;
         case Local: message = "local"; break;
+        case Semiglobal: message = "semiglobal"; break;
+        case Glocal: message = "glocal"; break;
+        case Overlap: message = "overlap"; break;
     }
     return PyUnicode_FromString(message);
 }
@@ -1961,9 +2118,22 @@ Aligner_set_mode(Aligner* self, PyObject* value, void* closure)
             self->mode = Local;
             return 0;
         }
+        if (PyUnicode_CompareWithASCIIString(value, "semiglobal") == 0) {
+            self->mode = Semiglobal;
+            return 0;
+        }
+        if (PyUnicode_CompareWithASCIIString(value, "glocal") == 0) {
+            self->mode = Glocal;
+            return 0;
+        }
+        if (PyUnicode_CompareWithASCIIString(value, "overlap") == 0) {
+            self->mode = Overlap;
+            return 0;
+        }
     }
     PyErr_SetString(PyExc_ValueError,
-                    "invalid mode (expected 'global' or 'local'");
+                    "invalid mode (expected 'global', 'local', 'semiglobal', "
+                    "'glocal', or 'overlap')");
     return -1;
 }
 
@@ -3758,42 +3928,37 @@ static Algorithm _get_algorithm(Aligner* self)
 }
 
 
-static char Aligner_algorithm__doc__[] = "alignment algorithm";
-
-static PyObject*
-Aligner_get_algorithm(Aligner* self, void* closure)
+static const char*
+_get_algorithm_name(Algorithm algorithm, Mode mode)
 {
-    const char* s = NULL;
-    const Mode mode = self->mode;
-    const Algorithm algorithm = _get_algorithm(self);
     switch (algorithm) {
         case NeedlemanWunschSmithWaterman:
             switch (mode) {
-                case Global:
-                    s = "Needleman-Wunsch";
-                    break;
-                case Local:
-                    s = "Smith-Waterman";
-                    break;
+                case Global: return "Needleman-Wunsch";
+                case Local: return "Smith-Waterman";
+                case Semiglobal: return "semiglobal Needleman-Wunsch";
+                case Glocal: return "glocal Needleman-Wunsch";
+                case Overlap: return "overlap Needleman-Wunsch";
             }
             break;
         case Gotoh:
             switch (mode) {
-                case Global:
-                    s = "Gotoh global alignment algorithm";
-                    break;
-                case Local:
-                    s = "Gotoh local alignment algorithm";
-                    break;
+                case Global: return "Gotoh global alignment algorithm";
+                case Local: return "Gotoh local alignment algorithm";
+                case Semiglobal: return "Gotoh semiglobal alignment algorithm";
+                case Glocal: return "Gotoh glocal alignment algorithm";
+                case Overlap: return "Gotoh overlap alignment algorithm";
             }
             break;
         case WatermanSmithBeyer:
             switch (mode) {
                 case Global:
-                    s = "Waterman-Smith-Beyer global alignment algorithm";
-                    break;
+                    return "Waterman-Smith-Beyer global alignment algorithm";
                 case Local:
-                    s = "Waterman-Smith-Beyer local alignment algorithm";
+                    return "Waterman-Smith-Beyer local alignment algorithm";
+                case Semiglobal:
+                case Glocal:
+                case Overlap:
                     break;
             }
             break;
@@ -3801,9 +3966,97 @@ Aligner_get_algorithm(Aligner* self, void* closure)
         default:
             break;
     }
+    return NULL;
+}
+
+static char Aligner_algorithm__doc__[] = "alignment algorithm";
+
+static PyObject*
+Aligner_get_algorithm(Aligner* self, void* closure)
+{
+    const Mode mode = self->mode;
+    const Algorithm algorithm = _get_algorithm(self);
+    const char* s = _get_algorithm_name(algorithm, mode);
+    if (!s && algorithm == WatermanSmithBeyer) {
+        PyErr_SetString(PyExc_ValueError,
+            "semiglobal, glocal, and overlap alignment modes "
+            "are not available with gap score functions");
+        return NULL;
+    }
     return PyUnicode_FromString(s);
 }
 
+static char Aligner_memory_limit__doc__[] = "maximum number of bytes to allocate for an alignment (None for no limit)";
+
+static PyObject*
+Aligner_get_memory_limit(Aligner* self, void* closure)
+{
+    if (self->memory_limit < 0) {
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+    return PyLong_FromLongLong(self->memory_limit);
+}
+
+static int
+Aligner_set_memory_limit(Aligner* self, PyObject* value, void* closure)
+{
+    long long memory_limit;
+    if (value == Py_None) {
+        self->memory_limit = -1;
+        return 0;
+    }
+    if (!PyLong_Check(value)) {
+        PyErr_SetString(PyExc_TypeError,
+                        "memory limit should be an integer or None");
+        return -1;
+    }
+    memory_limit = PyLong_AsLongLong(value);
+    if (memory_limit == -1 && PyErr_Occurred()) return -1;
+    if (memory_limit < 0) {
+        PyErr_SetString(PyExc_ValueError,
+                        "memory limit should be non-negative");
+        return -1;
+    }
+    self->memory_limit = memory_limit;
+    return 0;
+}
+
+static char Aligner_collect_statistics__doc__[] = "collect statistics on the alignments (True/False)";
+
+static PyObject*
+Aligner_get_collect_statistics(Aligner* self, void* closure)
+{
+    return PyBool_FromLong(self->statistics.enabled);
+}
+
+static int
+Aligner_set_collect_statistics(Aligner* self, PyObject* value, void* closure)
+{
+    const int enabled = PyObject_IsTrue(value);
+    if (enabled < 0) return -1;
+    self->statistics.enabled = enabled;
+    return 0;
+}
+
+static char Aligner_statistics__doc__[] = "statistics collected on the alignments (dictionary)";
+
+static PyObject*
+Aligner_get_statistics(Aligner* self, void* closure)
+{
+    const Statistics* statistics = &self->statistics;
+    return Py_BuildValue("{s:z,s:L,s:L,s:L,s:L,s:L,s:L,s:d,s:d}",
+                         "algorithm", statistics->algorithm,
+                         "score_calls", statistics->score_calls,
+                         "align_calls", statistics->align_calls,
+                         "cells", statistics->cells,
+                         "trace_bytes", statistics->trace_bytes,
+                         "count_bytes", statistics->count_bytes,
+                         "paths", statistics->paths,
+                         "fill_time", statistics->fill_time,
+                         "traceback_time", statistics->traceback_time);
+}
+
 static PyGetSetDef Aligner_getset[] = {
     {"mode",
         (getter)Aligner_get_mode,
@@ -4025,6 +4278,18 @@ static PyGetSetDef Aligner_getset[] = {
         (getter)Aligner_get_algorithm,
         (setter)NULL,
         Aligner_algorithm__doc__, NULL},
+    {"memory_limit",
+        (getter)Aligner_get_memory_limit,
+        (setter)Aligner_set_memory_limit,
+        Aligner_memory_limit__doc__, NULL},
+    {"collect_statistics",
+        (getter)Aligner_get_collect_statistics,
+        (setter)Aligner_set_collect_statistics,
+        Aligner_collect_statistics__doc__, NULL},
+    {"statistics",
+        (getter)Aligner_get_statistics,
+        (setter)NULL,
+        Aligner_statistics__doc__, NULL},
     {NULL}  /* Sentinel */
 };
 
@@ -4299,6 +4564,47 @@ static PyGetSetDef Aligner_getset[] = {
 
 /* ----------------- alignment algorithms ----------------- */
 
+/* In semiglobal, glocal, and overlap mode, some of the end gaps are free:
+ *
+ * semiglobal: end gaps in both sequences are free;
+ * glocal:     the query is aligned completely to a substring of the target,
+ *             so end gaps in the query are free;
+ * overlap:    a suffix of the target is aligned to a prefix of the query,
+ *             so left end gaps in the query and right end gaps in the
+ *             target are free.
+ *
+ * Here A refers to the target and B to the query, after taking the strand
+ * into account.
+ */
+static int
+_get_free_end_gaps(Mode mode)
+{
+    switch (mode) {
+        case Semiglobal:
+            return FREE_LEFT_A | FREE_RIGHT_A | FREE_LEFT_B | FREE_RIGHT_B;
+        case Glocal:
+            return FREE_LEFT_B | FREE_RIGHT_B;
+        case Overlap:
+            return FREE_RIGHT_A | FREE_LEFT_B;
+        case Global:
+        case Local:
+        default:
+            return 0;
+    }
+}
+
+/* Set the end gap scores that are free in this mode to zero. */
+static void
+_free_end_gaps(Mode mode, double* left_A, double* right_A,
+                          double* left_B, double* right_B)
+{
+    const int free_ends = _get_free_end_gaps(mode);
+    if (free_ends & FREE_LEFT_A) *left_A = 0;
+    if (free_ends & FREE_RIGHT_A) *right_A = 0;
+    if (free_ends & FREE_LEFT_B) *left_B = 0;
+    if (free_ends & FREE_RIGHT_B) *right_B = 0;
+}
+
 #define NEEDLEMANWUNSCH_SCORE(align_score) \
     int i; \
     int j; \
@@ -4378,6 +4684,119 @@ static PyGetSetDef Aligner_getset[] = {
     return PyFloat_FromDouble(score);
 
 
+#define NEEDLEMANWUNSCH_SEMIGLOBAL_SCORE(align_score) \
+    int i; \
+    int j; \
+    int kA; \
+    int kB; \
+    const double gap_extend_A = self->target_internal_extend_gap_score; \
+    const double gap_extend_B = self->query_internal_extend_gap_score; \
+    const int free_ends = _get_free_end_gaps(self->mode); \
+    double score; \
+    double temp; \
+    double maximum = -DBL_MAX; \
+    double* row; \
+    double left_gap_extend_A; \
+    double right_gap_extend_A; \
+    double left_gap_extend_B; \
+    double right_gap_extend_B; \
+    switch (strand) { \
+        case '+': \
+            left_gap_extend_A = self->target_left_extend_gap_score; \
+            right_gap_extend_A = self->target_right_extend_gap_score; \
+            left_gap_extend_B = self->query_left_extend_gap_score; \
+            right_gap_extend_B = self->query_right_extend_gap_score; \
+            break; \
+        case '-': \
+            left_gap_extend_A = self->target_right_extend_gap_score; \
+            right_gap_extend_A = self->target_left_extend_gap_score; \
+            left_gap_extend_B = self->query_right_extend_gap_score; \
+            right_gap_extend_B = self->query_left_extend_gap_score; \
+            break; \
+        default: \
+            PyErr_SetString(PyExc_RuntimeError, "strand was neither '+' nor '-'"); \
+            return NULL; \
+    } \
+\
+    /* Needleman-Wunsch algorithm with free end gaps. Instead of aligning \
+     * the free end gaps at the right end, we take the maximum score along \
+     * the last row and/or column of the score matrix. \
+     */ \
+    row = PyMem_Malloc((nB+1)*sizeof(double)); \
+    if (!row) return PyErr_NoMemory(); \
+\
+    row[0] = 0.0; \
+    if (free_ends & FREE_LEFT_A) \
+        for (j = 1; j <= nB; j++) row[j] = 0.0; \
+    else \
+        for (j = 1; j <= nB; j++) row[j] = j * left_gap_extend_A; \
+    if (free_ends & FREE_RIGHT_B) maximum = row[nB]; \
+    for (i = 1; i < nA; i++) { \
+        kA = sA[i-1]; \
+        temp = row[0]; \
+        row[0] = (free_ends & FREE_LEFT_B) ? 0.0 : i * left_gap_extend_B; \
+        for (j = 1; j < nB; j++) { \
+            kB = sB[j-1]; \
+            SELECT_SCORE_GLOBAL(temp + (align_score), \
+                                row[j] + gap_extend_B, \
+                                row[j-1] + gap_extend_A); \
+            temp = row[j]; \
+            row[j] = score; \
+        } \
+        kB = sB[nB-1]; \
+        if (free_ends & FREE_RIGHT_B) { \
+            score = temp + (align_score); \
+            temp = row[nB-1] + gap_extend_A; \
+            if (temp > score) score = temp; \
+            if (score > maximum) maximum = score; \
+        } \
+        else { \
+            SELECT_SCORE_GLOBAL(temp + (align_score), \
+                                row[nB] + right_gap_extend_B, \
+                                row[nB-1] + gap_extend_A); \
+        } \
+        row[nB] = score; \
+    } \
+    kA = sA[nA-1]; \
+    temp = row[0]; \
+    row[0] = (free_ends & FREE_LEFT_B) ? 0.0 : nA * left_gap_extend_B; \
+    if (free_ends & FREE_RIGHT_A) { \
+        if (row[0] > maximum) maximum = row[0]; \
+        for (j = 1; j < nB; j++) { \
+            kB = sB[j-1]; \
+            score = temp + (align_score); \
+            temp = row[j] + gap_extend_B; \
+            if (temp > score) score = temp; \
+            if (score > maximum) maximum = score; \
+            temp = row[j]; \
+            row[j] = score; \
+        } \
+    } \
+    else { \
+        for (j = 1; j < nB; j++) { \
+            kB = sB[j-1]; \
+            SELECT_SCORE_GLOBAL(temp + (align_score), \
+                                row[j] + gap_extend_B, \
+                                row[j-1] + right_gap_extend_A); \
+            temp = row[j]; \
+            row[j] = score; \
+        } \
+    } \
+    kB = sB[nB-1]; \
+    score = temp + (align_score); \
+    if (!(free_ends & FREE_RIGHT_B)) { \
+        temp = row[nB] + right_gap_extend_B; \
+        if (temp > score) score = temp; \
+    } \
+    if (!(free_ends & FREE_RIGHT_A)) { \
+        temp = row[nB-1] + right_gap_extend_A; \
+        if (temp > score) score = temp; \
+    } \
+    if (score > maximum) maximum = score; \
+    PyMem_Free(row); \
+    return PyFloat_FromDouble(maximum);
+
+
 #define SMITHWATERMAN_SCORE(align_score) \
     int i; \
     int j; \
@@ -4464,6 +4883,8 @@ static PyGetSetDef Aligner_getset[] = {
             PyErr_SetString(PyExc_RuntimeError, "strand was neither '+' nor '-'"); \
             return NULL; \
     } \
+    _free_end_gaps(self->mode, &left_gap_extend_A, &right_gap_extend_A, \
+                               &left_gap_extend_B, &right_gap_extend_B); \
 \
     /* Needleman-Wunsch algorithm */ \
     paths = PathGenerator_create_NWSW(nA, nB, Global, strand); \
@@ -4754,7 +5175,7 @@ exit: \
     return PyErr_NoMemory(); \
 
 
-#define GOTOH_LOCAL_SCORE(align_score) \
+#define GOTOH_SEMIGLOBAL_SCORE(align_score) \
     int i; \
     int j; \
     int kA; \
@@ -4763,6 +5184,15 @@ exit: \
     const double gap_open_B = self->query_internal_open_gap_score; \
     const double gap_extend_A = self->target_internal_extend_gap_score; \
     const double gap_extend_B = self->query_internal_extend_gap_score; \
+    const int free_ends = _get_free_end_gaps(self->mode); \
+    double left_gap_open_A; \
+    double left_gap_open_B; \
+    double left_gap_extend_A; \
+    double left_gap_extend_B; \
+    double right_gap_open_A; \
+    double right_gap_open_B; \
+    double right_gap_extend_A; \
+    double right_gap_extend_B; \
     double* M_row = NULL; \
     double* Ix_row = NULL; \
     double* Iy_row = NULL; \
@@ -4771,18 +5201,200 @@ exit: \
     double M_temp; \
     double Ix_temp; \
     double Iy_temp; \
-    double maximum = 0.0; \
+    double maximum = -DBL_MAX; \
+    switch (strand) { \
+        case '+': \
+            left_gap_open_A = self->target_left_open_gap_score; \
+            left_gap_open_B = self->query_left_open_gap_score; \
+            left_gap_extend_A = self->target_left_extend_gap_score; \
+            left_gap_extend_B = self->query_left_extend_gap_score; \
+            right_gap_open_A = self->target_right_open_gap_score; \
+            right_gap_open_B = self->query_right_open_gap_score; \
+            right_gap_extend_A = self->target_right_extend_gap_score; \
+            right_gap_extend_B = self->query_right_extend_gap_score; \
+            break; \
+        case '-': \
+            left_gap_open_A = self->target_right_open_gap_score; \
+            left_gap_open_B = self->query_right_open_gap_score; \
+            left_gap_extend_A = self->target_right_extend_gap_score; \
+            left_gap_extend_B = self->query_right_extend_gap_score; \
+            right_gap_open_A = self->target_left_open_gap_score; \
+            right_gap_open_B = self->query_left_open_gap_score; \
+            right_gap_extend_A = self->target_left_extend_gap_score; \
+            right_gap_extend_B = self->query_left_extend_gap_score; \
+            break; \
+        default: \
+            PyErr_SetString(PyExc_RuntimeError, "strand was neither '+' nor '-'"); \
+            return NULL; \
+    } \
 \
-    /* Gotoh algorithm with three states */ \
+    /* Gotoh algorithm with three states and free end gaps. Instead of \
+     * aligning the free end gaps at the right end, we take the maximum \
+     * score along the last row and/or column of the score matrices. \
+     */ \
     M_row = PyMem_Malloc((nB+1)*sizeof(double)); \
     if (!M_row) goto exit; \
     Ix_row = PyMem_Malloc((nB+1)*sizeof(double)); \
     if (!Ix_row) goto exit; \
     Iy_row = PyMem_Malloc((nB+1)*sizeof(double)); \
     if (!Iy_row) goto exit; \
- \
-    /* The top row of the score matrix is a special case, \
-     * as there are no previously aligned characters. \
+\
+    M_row[0] = 0; \
+    Ix_row[0] = -DBL_MAX; \
+    Iy_row[0] = -DBL_MAX; \
+    for (j = 1; j <= nB; j++) { \
+        M_row[j] = -DBL_MAX; \
+        Ix_row[j] = -DBL_MAX; \
+        if (free_ends & FREE_LEFT_A) Iy_row[j] = 0; \
+        else Iy_row[j] = left_gap_open_A + left_gap_extend_A * (j-1); \
+    } \
+    if (free_ends & FREE_RIGHT_B) maximum = Iy_row[nB]; \
+\
+    for (i = 1; i < nA; i++) { \
+        M_temp = M_row[0]; \
+        Ix_temp = Ix_row[0]; \
+        Iy_temp = Iy_row[0]; \
+        M_row[0] = -DBL_MAX; \
+        if (free_ends & FREE_LEFT_B) Ix_row[0] = 0; \
+        else Ix_row[0] = left_gap_open_B + left_gap_extend_B * (i-1); \
+        Iy_row[0] = -DBL_MAX; \
+        kA = sA[i-1]; \
+        for (j = 1; j < nB; j++) { \
+            kB = sB[j-1]; \
+            SELECT_SCORE_GLOBAL(M_temp, \
+                                Ix_temp, \
+                                Iy_temp); \
+            M_temp = M_row[j]; \
+            M_row[j] = score + (align_score); \
+            SELECT_SCORE_GLOBAL(M_temp + gap_open_B, \
+                                Ix_row[j] + gap_extend_B, \
+                                Iy_row[j] + gap_open_B); \
+            Ix_temp = Ix_row[j]; \
+            Ix_row[j] = score; \
+            SELECT_SCORE_GLOBAL(M_row[j-1] + gap_open_A, \
+                                Ix_row[j-1] + gap_open_A, \
+                                Iy_row[j-1] + gap_extend_A); \
+            Iy_temp = Iy_row[j]; \
+            Iy_row[j] = score; \
+        } \
+        kB = sB[nB-1]; \
+        SELECT_SCORE_GLOBAL(M_temp, \
+                            Ix_temp, \
+                            Iy_temp); \
+        M_temp = M_row[nB]; \
+        M_row[nB] = score + (align_score); \
+        if (!(free_ends & FREE_RIGHT_B)) { \
+            SELECT_SCORE_GLOBAL(M_temp + right_gap_open_B, \
+                                Ix_row[nB] + right_gap_extend_B, \
+                                Iy_row[nB] + right_gap_open_B); \
+            Ix_row[nB] = score; \
+        } \
+        SELECT_SCORE_GLOBAL(M_row[nB-1] + gap_open_A, \
+                            Iy_row[nB-1] + gap_extend_A, \
+                            Ix_row[nB-1] + gap_open_A); \
+        Iy_row[nB] = score; \
+        if (free_ends & FREE_RIGHT_B) { \
+            if (M_row[nB] > maximum) maximum = M_row[nB]; \
+            if (Iy_row[nB] > maximum) maximum = Iy_row[nB]; \
+        } \
+    } \
+\
+    M_temp = M_row[0]; \
+    Ix_temp = Ix_row[0]; \
+    Iy_temp = Iy_row[0]; \
+    M_row[0] = -DBL_MAX; \
+    if (free_ends & FREE_LEFT_B) Ix_row[0] = 0; \
+    else Ix_row[0] = left_gap_open_B + left_gap_extend_B * (nA-1); \
+    Iy_row[0] = -DBL_MAX; \
+    if (free_ends & FREE_RIGHT_A) { \
+        if (Ix_row[0] > maximum) maximum = Ix_row[0]; \
+    } \
+    kA = sA[nA-1]; \
+    for (j = 1; j < nB; j++) { \
+        kB = sB[j-1]; \
+        SELECT_SCORE_GLOBAL(M_temp, \
+                            Ix_temp, \
+                            Iy_temp); \
+        M_temp = M_row[j]; \
+        M_row[j] = score + (align_score); \
+        SELECT_SCORE_GLOBAL(M_temp + gap_open_B, \
+                            Ix_row[j] + gap_extend_B, \
+                            Iy_row[j] + gap_open_B); \
+        Ix_temp = Ix_row[j]; \
+        Ix_row[j] = score; \
+        Iy_temp = Iy_row[j]; \
+        if (free_ends & FREE_RIGHT_A) { \
+            if (M_row[j] > maximum) maximum = M_row[j]; \
+            if (Ix_row[j] > maximum) maximum = Ix_row[j]; \
+        } \
+        else { \
+            SELECT_SCORE_GLOBAL(M_row[j-1] + right_gap_open_A, \
+                                Iy_row[j-1] + right_gap_extend_A, \
+                                Ix_row[j-1] + right_gap_open_A); \
+            Iy_row[j] = score; \
+        } \
+    } \
+\
+    kB = sB[nB-1]; \
+    SELECT_SCORE_GLOBAL(M_temp, \
+                        Ix_temp, \
+                        Iy_temp); \
+    M_temp = M_row[nB]; \
+    M_row[nB] = score + (align_score); \
+    if (M_row[nB] > maximum) maximum = M_row[nB]; \
+    if (!(free_ends & FREE_RIGHT_B)) { \
+        SELECT_SCORE_GLOBAL(M_temp + right_gap_open_B, \
+                            Ix_row[nB] + right_gap_extend_B, \
+                            Iy_row[nB] + right_gap_open_B); \
+        if (score > maximum) maximum = score; \
+    } \
+    if (!(free_ends & FREE_RIGHT_A)) { \
+        SELECT_SCORE_GLOBAL(M_row[nB-1] + right_gap_open_A, \
+                            Ix_row[nB-1] + right_gap_open_A, \
+                            Iy_row[nB-1] + right_gap_extend_A); \
+        if (score > maximum) maximum = score; \
+    } \
+    PyMem_Free(M_row); \
+    PyMem_Free(Ix_row); \
+    PyMem_Free(Iy_row); \
+    return PyFloat_FromDouble(maximum); \
+\
+exit: \
+    if (M_row) PyMem_Free(M_row); \
+    if (Ix_row) PyMem_Free(Ix_row); \
+    if (Iy_row) PyMem_Free(Iy_row); \
+    return PyErr_NoMemory(); \
+
+
+#define GOTOH_LOCAL_SCORE(align_score) \
+    int i; \
+    int j; \
+    int kA; \
+    int kB; \
+    const double gap_open_A = self->target_internal_open_gap_score; \
+    const double gap_open_B = self->query_internal_open_gap_score; \
+    const double gap_extend_A = self->target_internal_extend_gap_score; \
+    const double gap_extend_B = self->query_internal_extend_gap_score; \
+    double* M_row = NULL; \
+    double* Ix_row = NULL; \
+    double* Iy_row = NULL; \
+    double score; \
+    double temp; \
+    double M_temp; \
+    double Ix_temp; \
+    double Iy_temp; \
+    double maximum = 0.0; \
+\
+    /* Gotoh algorithm with three states */ \
+    M_row = PyMem_Malloc((nB+1)*sizeof(double)); \
+    if (!M_row) goto exit; \
+    Ix_row = PyMem_Malloc((nB+1)*sizeof(double)); \
+    if (!Ix_row) goto exit; \
+    Iy_row = PyMem_Malloc((nB+1)*sizeof(double)); \
+    if (!Iy_row) goto exit; \
+ \
+    /* The top row of the score matrix is a special case, \
+     * as there are no previously aligned characters. \
      */ \
     M_row[0] = 0; \
     Ix_row[0] = -DBL_MAX; \
@@ -4920,6 +5532,10 @@ exit: \
             PyErr_SetString(PyExc_RuntimeError, "strand was neither '+' nor '-'"); \
             return NULL; \
     } \
+    _free_end_gaps(self->mode, &left_gap_open_A, &right_gap_open_A, \
+                               &left_gap_open_B, &right_gap_open_B); \
+    _free_end_gaps(self->mode, &left_gap_extend_A, &right_gap_extend_A, \
+                               &left_gap_extend_B, &right_gap_extend_B); \
 \
     /* Gotoh algorithm with three states */ \
     paths = PathGenerator_create_Gotoh(nA, nB, Global, strand); \
@@ -5783,7 +6399,10 @@ PathGenerator_create_NWSW(Py_ssize_t nA, Py_ssize_t nB, Mode mode, unsigned char
     paths->M = M;
     if (!M) goto exit;
     switch (mode) {
-        case Global: trace = VERTICAL; break;
+        case Global:
+        case Semiglobal:
+        case Glocal:
+        case Overlap: trace = VERTICAL; break;
         case Local: trace = STARTPOINT; break;
     }
     for (i = 0; i <= nA; i++) {
@@ -5938,6 +6557,9 @@ PathGenerator_create_WSB(Py_ssize_t nA, Py_ssize_t nB, Mode mode, unsigned char
         M[i][0].path = 0;
         switch (mode) {
             case Global:
+            case Semiglobal:
+            case Glocal:
+            case Overlap:
                 M[i][0].trace = 0;
                 trace = PyMem_Malloc(2*sizeof(int));
                 if (!trace) goto exit;
@@ -5957,6 +6579,9 @@ PathGenerator_create_WSB(Py_ssize_t nA, Py_ssize_t nB, Mode mode, unsigned char
     for (i = 1; i <= nB; i++) {
         switch (mode) {
             case Global:
+            case Semiglobal:
+            case Glocal:
+            case Overlap:
                 M[0][i].trace = 0;
                 trace = PyMem_Malloc(2*sizeof(int));
                 if (!trace) goto exit;
@@ -5987,6 +6612,206 @@ exit:
 #define COMPARE_SCORE (kA == wildcard || kB == wildcard) ? 0 : (kA == kB) ? match : mismatch
 
 
+/* Check if the scores correspond to the unit-cost edit distance (match 0,
+ * mismatch -1, gap -1), for which the bit-parallel algorithm can be used.
+ * In glocal mode, end gaps in the query are free and can have any score.
+ */
+static int
+_is_edit_distance(Aligner* self)
+{
+    if (self->substitution_matrix.obj) return 0;
+    if (self->match != 0.0) return 0;
+    if (self->mismatch != -1.0) return 0;
+    if (self->target_internal_extend_gap_score != -1.0) return 0;
+    if (self->target_left_extend_gap_score != -1.0) return 0;
+    if (self->target_right_extend_gap_score != -1.0) return 0;
+    if (self->query_internal_extend_gap_score != -1.0) return 0;
+    switch (self->mode) {
+        case Global:
+            if (self->query_left_extend_gap_score != -1.0) return 0;
+            if (self->query_right_extend_gap_score != -1.0) return 0;
+            return 1;
+        case Glocal:
+            return 1;
+        case Local:
+        case Semiglobal:
+        case Overlap:
+        default:
+            return 0;
+    }
+}
+
+static int
+_compare_ints(const void* a, const void* b)
+{
+    const int x = *(const int*)a;
+    const int y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+/* Advance one 64-bit block of the bit-vector algorithm by one column,
+ * given the horizontal difference hin (-1, 0, or +1) entering the block
+ * at its top row. Returns the horizontal difference at the row selected
+ * by highbit, which is the bottom row of the block.
+ */
+static int
+_myers_advance_block(uint64_t* Pv, uint64_t* Mv, uint64_t Eq, int hin,
+                     uint64_t highbit)
+{
+    uint64_t Xv;
+    uint64_t Xh;
+    uint64_t Ph;
+    uint64_t Mh;
+    int hout = 0;
+
+    Xv = Eq | *Mv;
+    if (hin < 0) Eq |= 1;
+    Xh = (((Eq & *Pv) + *Pv) ^ *Pv) | Eq;
+    Ph = *Mv | ~(Xh | *Pv);
+    Mh = *Pv & Xh;
+    if (Ph & highbit) hout = +1;
+    else if (Mh & highbit) hout = -1;
+    Ph <<= 1;
+    Mh <<= 1;
+    if (hin < 0) Mh |= 1;
+    else if (hin > 0) Ph |= 1;
+    *Pv = Mh | ~(Xv | Ph);
+    *Mv = Ph & Xv;
+    return hout;
+}
+
+/* The number of 64-bit words of the score matrix calculated by
+ * Aligner_myers_score, which processes 64 cells in each word operation.
+ */
+static long long
+_myers_words(Mode mode, Py_ssize_t nA, Py_ssize_t nB)
+{
+    const Py_ssize_t m = (mode == Glocal || nB <= nA) ? nB : nA;
+    const Py_ssize_t n = (mode == Glocal || nB <= nA) ? nA : nB;
+    return (long long)((m + 63) / 64) * n;
+}
+
+/* Myers' bit-vector algorithm for the unit-cost edit distance (Myers 1999),
+ * using blocks of 64 rows for patterns longer than 64 (Hyyro 2003). The
+ * pattern is stored along the rows, such that one column of 64 cells is
+ * calculated by a few word operations.
+ *
+ * In global mode, the shorter sequence is used as the pattern. In glocal
+ * mode, the query is the pattern, the top row of the score matrix is zero,
+ * and the distance is the minimum along the bottom row.
+ */
+static PyObject*
+Aligner_myers_score(Aligner* self,
+                    const int* sA, Py_ssize_t nA,
+                    const int* sB, Py_ssize_t nB)
+{
+    const int wildcard = self->wildcard;
+    const Mode mode = self->mode;
+    const int* pattern;
+    const int* text;
+    Py_ssize_t m;
+    Py_ssize_t n;
+    Py_ssize_t i;
+    Py_ssize_t j;
+    Py_ssize_t k;
+    Py_ssize_t b;
+    Py_ssize_t nwords;
+    Py_ssize_t nsymbols;
+    int c;
+    int* symbols = NULL;
+    int* index;
+    uint64_t* Peq = NULL;
+    uint64_t* Pv = NULL;
+    uint64_t* Mv = NULL;
+    const uint64_t* Eq;
+    uint64_t lastbit;
+    int hin;
+    Py_ssize_t score;
+    Py_ssize_t minimum;
+    PyObject* result = NULL;
+
+    if (mode == Glocal || nB <= nA) {
+        pattern = sB;
+        m = nB;
+        text = sA;
+        n = nA;
+    }
+    else {
+        pattern = sA;
+        m = nA;
+        text = sB;
+        n = nB;
+    }
+    nwords = (m + 63) / 64;
+    lastbit = ((uint64_t)1) << ((m - 1) % 64);
+
+    /* Collect the distinct letters in the pattern. */
+    symbols = PyMem_Malloc(m*sizeof(int));
+    if (!symbols) goto exit;
+    memcpy(symbols, pattern, m*sizeof(int));
+    qsort(symbols, m, sizeof(int), _compare_ints);
+    nsymbols = 0;
+    for (i = 0; i < m; i++) {
+        if (nsymbols > 0 && symbols[i] == symbols[nsymbols-1]) continue;
+        symbols[nsymbols++] = symbols[i];
+    }
+
+    /* One match bit-vector per distinct letter, followed by one for letters
+     * not in the pattern, and one for a wildcard in the text. */
+    Peq = PyMem_Calloc((nsymbols+2)*nwords, sizeof(uint64_t));
+    if (!Peq) goto exit;
+    for (i = 0; i < m; i++) {
+        const uint64_t bit = ((uint64_t)1) << (i % 64);
+        c = pattern[i];
+        if (c == wildcard) {
+            for (k = 0; k <= nsymbols; k++) Peq[k*nwords + i/64] |= bit;
+        }
+        else {
+            index = bsearch(&c, symbols, nsymbols, sizeof(int), _compare_ints);
+            Peq[(index - symbols)*nwords + i/64] |= bit;
+        }
+    }
+    for (b = 0; b < nwords; b++) Peq[(nsymbols+1)*nwords + b] = ~((uint64_t)0);
+
+    Pv = PyMem_Malloc(nwords*sizeof(uint64_t));
+    if (!Pv) goto exit;
+    Mv = PyMem_Malloc(nwords*sizeof(uint64_t));
+    if (!Mv) goto exit;
+    for (b = 0; b < nwords; b++) {
+        Pv[b] = ~((uint64_t)0);
+        Mv[b] = 0;
+    }
+
+    score = m;
+    minimum = m;
+    for (j = 0; j < n; j++) {
+        c = text[j];
+        if (c == wildcard) k = nsymbols + 1;
+        else {
+            index = bsearch(&c, symbols, nsymbols, sizeof(int), _compare_ints);
+            k = index ? index - symbols : nsymbols;
+        }
+        Eq = Peq + k*nwords;
+        hin = (mode == Glocal) ? 0 : 1;
+        for (b = 0; b < nwords - 1; b++)
+            hin = _myers_advance_block(&Pv[b], &Mv[b], Eq[b], hin,
+                                       ((uint64_t)1) << 63);
+        score += _myers_advance_block(&Pv[b], &Mv[b], Eq[b], hin, lastbit);
+        if (score < minimum) minimum = score;
+    }
+    if (mode == Glocal) score = minimum;
+    result = PyFloat_FromDouble(-(double)score);
+
+exit:
+    if (symbols) PyMem_Free(symbols);
+    if (Peq) PyMem_Free(Peq);
+    if (Pv) PyMem_Free(Pv);
+    if (Mv) PyMem_Free(Mv);
+    if (!result && !PyErr_Occurred()) PyErr_NoMemory();
+    return result;
+}
+
+
 static PyObject*
 Aligner_needlemanwunsch_score_compare(Aligner* self,
                                       const int* sA, Py_ssize_t nA,
@@ -6010,6 +6835,29 @@ Aligner_needlemanwunsch_score_matrix(Aligner* self,
     NEEDLEMANWUNSCH_SCORE(MATRIX_SCORE);
 }
 
+static PyObject*
+Aligner_needlemanwunsch_semiglobal_score_compare(Aligner* self,
+                                                 const int* sA, Py_ssize_t nA,
+                                                 const int* sB, Py_ssize_t nB,
+                                                 unsigned char strand)
+{
+    const double match = self->match;
+    const double mismatch = self->mismatch;
+    const int wildcard = self->wildcard;
+    NEEDLEMANWUNSCH_SEMIGLOBAL_SCORE(COMPARE_SCORE);
+}
+
+static PyObject*
+Aligner_needlemanwunsch_semiglobal_score_matrix(Aligner* self,
+                                                const int* sA, Py_ssize_t nA,
+                                                const int* sB, Py_ssize_t nB,
+                                                unsigned char strand)
+{
+    const Py_ssize_t n = self->substitution_matrix.shape[0];
+    const double* scores = self->substitution_matrix.buf;
+    NEEDLEMANWUNSCH_SEMIGLOBAL_SCORE(MATRIX_SCORE);
+}
+
 static PyObject*
 Aligner_smithwaterman_score_compare(Aligner* self,
                                     const int* sA, Py_ssize_t nA,
@@ -6100,6 +6948,29 @@ Aligner_gotoh_global_score_matrix(Aligner* self,
     GOTOH_GLOBAL_SCORE(MATRIX_SCORE);
 }
 
+static PyObject*
+Aligner_gotoh_semiglobal_score_compare(Aligner* self,
+                                       const int* sA, Py_ssize_t nA,
+                                       const int* sB, Py_ssize_t nB,
+                                       unsigned char strand)
+{
+    const double match = self->match;
+    const double mismatch = self->mismatch;
+    const int wildcard = self->wildcard;
+    GOTOH_SEMIGLOBAL_SCORE(COMPARE_SCORE);
+}
+
+static PyObject*
+Aligner_gotoh_semiglobal_score_matrix(Aligner* self,
+                                      const int* sA, Py_ssize_t nA,
+                                      const int* sB, Py_ssize_t nB,
+                                      unsigned char strand)
+{
+    const Py_ssize_t n = self->substitution_matrix.shape[0];
+    const double* scores = self->substitution_matrix.buf;
+    GOTOH_SEMIGLOBAL_SCORE(MATRIX_SCORE);
+}
+
 static PyObject*
 Aligner_gotoh_local_score_compare(Aligner* self,
                                   const int* sA, Py_ssize_t nA,
@@ -6693,6 +7564,63 @@ error:
     return 0;
 }
 
+static long long
+_get_memory_estimate(Algorithm algorithm, long long nA, long long nB, int align)
+{
+    /* Estimate the number of bytes needed to calculate the alignment score
+     * (align = 0) or the alignments (align = 1), not including memory of
+     * size O(nA + nB). For the Waterman-Smith-Beyer algorithm, the estimate
+     * is a lower bound, as the size of the gap traces depends on the number
+     * of gaps that give the same score. */
+    long long size = 0;
+    if (algorithm == WatermanSmithBeyer)
+        /* score matrices */
+        size += 3 * (nA+1) * (sizeof(double*) + (nB+1) * sizeof(double));
+    if (!align) return size;
+    size += (nA+1) * (sizeof(Trace*) + (nB+1) * sizeof(Trace));
+    switch (algorithm) {
+        case NeedlemanWunschSmithWaterman:
+            break;
+        case Gotoh:
+            size += (nA+1) * (sizeof(TraceGapsGotoh*)
+                             + (nB+1) * sizeof(TraceGapsGotoh));
+            break;
+        case WatermanSmithBeyer:
+            size += (nA+1) * (sizeof(TraceGapsWatermanSmithBeyer*)
+                             + (nB+1) * (sizeof(TraceGapsWatermanSmithBeyer)
+                                         + 4 * sizeof(int)));
+            break;
+        case Unknown:
+        default:
+            break;
+    }
+    size += _get_count_bytes(algorithm, nA, nB);
+    return size;
+}
+
+static int
+_check_memory_limit(Aligner* self, Algorithm algorithm,
+                    Py_ssize_t nA, Py_ssize_t nB, int align)
+{
+    long long size;
+    const long long memory_limit = self->memory_limit;
+    if (memory_limit < 0) return 1;
+    size = _get_memory_estimate(algorithm, nA, nB, align);
+    if (size <= memory_limit) return 1;
+    if (align)
+        PyErr_Format(PyExc_MemoryError,
+                     "aligning sequences of length %zd and %zd requires an "
+                     "estimated %lld bytes, exceeding the memory limit of "
+                     "%lld bytes; use the score method to calculate the "
+                     "alignment score only", nA, nB, size, memory_limit);
+    else
+        PyErr_Format(PyExc_MemoryError,
+                     "scoring sequences of length %zd and %zd requires an "
+                     "estimated %lld bytes, exceeding the memory limit of "
+                     "%lld bytes", nA, nB, size, memory_limit);
+    return 0;
+}
+
 static const char Aligner_score__doc__[] = "calculates the alignment score";
 
 static PyObject*
@@ -6707,6 +7635,8 @@ Aligner_score(Aligner* self, PyObject* args, PyObject* keywords)
     const Mode mode = self->mode;
     const Algorithm algorithm = _get_algorithm(self);
     char strand = '+';
+    double start = 0;
+    int myers = 0;
     PyObject* result = NULL;
     PyObject* substitution_matrix = self->substitution_matrix.obj;
 
@@ -6725,11 +7655,23 @@ Aligner_score(Aligner* self, PyObject* args, PyObject* keywords)
     sB = bB.buf;
     nB = bB.len / bB.itemsize;
 
+    if (!_check_memory_limit(self, algorithm, nA, nB, 0)) {
+        sequence_converter(NULL, &bA);
+        sequence_converter(NULL, &bB);
+        return NULL;
+    }
+
+    if (self->statistics.enabled) start = _get_time();
+
     switch (algorithm) {
         case NeedlemanWunschSmithWaterman:
             switch (mode) {
                 case Global:
-                    if (substitution_matrix)
+                    if (_is_edit_distance(self)) {
+                        myers = 1;
+                        result = Aligner_myers_score(self, sA, nA, sB, nB);
+                    }
+                    else if (substitution_matrix)
                         result = Aligner_needlemanwunsch_score_matrix(self, sA, nA, sB, nB, strand);
                     else
                         result = Aligner_needlemanwunsch_score_compare(self, sA, nA, sB, nB, strand);
@@ -6740,6 +7682,18 @@ Aligner_score(Aligner* self, PyObject* args, PyObject* keywords)
                     else
                         result = Aligner_smithwaterman_score_compare(self, sA, nA, sB, nB);
                     break;
+                case Semiglobal:
+                case Glocal:
+                case Overlap:
+                    if (_is_edit_distance(self)) {
+                        myers = 1;
+                        result = Aligner_myers_score(self, sA, nA, sB, nB);
+                    }
+                    else if (substitution_matrix)
+                        result = Aligner_needlemanwunsch_semiglobal_score_matrix(self, sA, nA, sB, nB, strand);
+                    else
+                        result = Aligner_needlemanwunsch_semiglobal_score_compare(self, sA, nA, sB, nB, strand);
+                    break;
             }
             break;
         case Gotoh:
@@ -6756,6 +7710,14 @@ Aligner_score(Aligner* self, PyObject* args, PyObject* keywords)
                     else
                         result = Aligner_gotoh_local_score_compare(self, sA, nA, sB, nB);
                     break;
+                case Semiglobal:
+                case Glocal:
+                case Overlap:
+                    if (substitution_matrix)
+                        result = Aligner_gotoh_semiglobal_score_matrix(self, sA, nA, sB, nB, strand);
+                    else
+                        result = Aligner_gotoh_semiglobal_score_compare(self, sA, nA, sB, nB, strand);
+                    break;
             }
             break;
         case WatermanSmithBeyer:
@@ -6772,6 +7734,13 @@ Aligner_score(Aligner* self, PyObject* args, PyObject* keywords)
                     else
                         result = Aligner_watermansmithbeyer_local_score_compare(self, sA, nA, sB, nB, strand);
                     break;
+                case Semiglobal:
+                case Glocal:
+                case Overlap:
+                    PyErr_SetString(PyExc_ValueError,
+                        "semiglobal, glocal, and overlap alignment modes "
+                        "are not available with gap score functions");
+                    break;
             }
             break;
         case Unknown:
@@ -6780,6 +7749,20 @@ Aligner_score(Aligner* self, PyObject* args, PyObject* keywords)
             break;
     }
 
+    if (result && self->statistics.enabled) {
+        Statistics* statistics = &self->statistics;
+        statistics->fill_time += _get_time() - start;
+        statistics->score_calls++;
+        if (myers) {
+            statistics->algorithm = "Myers bit-vector algorithm";
+            statistics->cells += _myers_words(mode, nA, nB);
+        }
+        else {
+            statistics->algorithm = _get_algorithm_name(algorithm, mode);
+            statistics->cells += (long long)nA * nB;
+        }
+    }
+
     sequence_converter(NULL, &bA);
     sequence_converter(NULL, &bB);
 
@@ -6800,6 +7783,7 @@ Aligner_align(Aligner* self, PyObject* args, PyObject* keywords)
     const Mode mode = self->mode;
     const Algorithm algorithm = _get_algorithm(self);
     char strand = '+';
+    double start = 0;
     PyObject* result = NULL;
     PyObject* substitution_matrix = self->substitution_matrix.obj;
 
@@ -6818,10 +7802,21 @@ Aligner_align(Aligner* self, PyObject* args, PyObject* keywords)
     sB = bB.buf;
     nB = bB.len / bB.itemsize;
 
+    if (!_check_memory_limit(self, algorithm, nA, nB, 1)) {
+        sequence_converter(NULL, &bA);
+        sequence_converter(NULL, &bB);
+        return NULL;
+    }
+
+    if (self->statistics.enabled) start = _get_time();
+
     switch (algorithm) {
         case NeedlemanWunschSmithWaterman:
             switch (mode) {
                 case Global:
+                case Semiglobal:
+                case Glocal:
+                case Overlap:
                     if (substitution_matrix)
                         result = Aligner_needlemanwunsch_align_matrix(self, sA, nA, sB, nB, strand);
                     else
@@ -6838,6 +7833,9 @@ Aligner_align(Aligner* self, PyObject* args, PyObject* keywords)
         case Gotoh:
             switch (mode) {
                 case Global:
+                case Semiglobal:
+                case Glocal:
+                case Overlap:
                     if (substitution_matrix)
                         result = Aligner_gotoh_global_align_matrix(self, sA, nA, sB, nB, strand);
                     else
@@ -6865,6 +7863,13 @@ Aligner_align(Aligner* self, PyObject* args, PyObject* keywords)
                     else
                         result = Aligner_watermansmithbeyer_local_align_compare(self, sA, nA, sB, nB, strand);
                     break;
+                case Semiglobal:
+                case Glocal:
+                case Overlap:
+                    PyErr_SetString(PyExc_ValueError,
+                        "semiglobal, glocal, and overlap alignment modes "
+                        "are not available with gap score functions");
+                    break;
             }
             break;
         case Unknown:
@@ -6873,12 +7878,304 @@ Aligner_align(Aligner* self, PyObject* args, PyObject* keywords)
             break;
     }
 
+    if (result && self->statistics.enabled) {
+        Statistics* statistics = &self->statistics;
+        PathGenerator* paths = (PathGenerator*)PyTuple_GET_ITEM(result, 1);
+        statistics->fill_time += _get_time() - start;
+        statistics->algorithm = _get_algorithm_name(algorithm, mode);
+        statistics->align_calls++;
+        statistics->cells += (long long)nA * nB;
+        statistics->trace_bytes += PathGenerator_trace_bytes(paths);
+        paths->statistics = statistics;
+        Py_INCREF(self);
+        paths->aligner = (PyObject*)self;
+    }
+
     sequence_converter(NULL, &bA);
     sequence_converter(NULL, &bB);
 
     return result;
 }
 
+/* ----------------- pickling ----------------- */
+
+/* The aligner state is stored as a tuple of a bytes object, containing the
+ * scores, mode, algorithm, wildcard, and the letter mapping, followed by the
+ * Python objects (alphabet, substitution matrix, and gap functions) held by
+ * the aligner. Numbers are stored in little-endian order, so the state does
+ * not depend on the platform. Restoring the state does not go through the
+ * attribute setters, and the letter mapping is restored directly instead of
+ * being recalculated from the alphabet.
+ */
+
+#define ALIGNER_STATE_MAGIC "PWA"
+#define ALIGNER_STATE_VERSION 1
+
+static const size_t Aligner_state_scores[] = {
+    offsetof(Aligner, match),
+    offsetof(Aligner, mismatch),
+    offsetof(Aligner, epsilon),
+    offsetof(Aligner, target_internal_open_gap_score),
+    offsetof(Aligner, target_internal_extend_gap_score),
+    offsetof(Aligner, target_left_open_gap_score),
+    offsetof(Aligner, target_left_extend_gap_score),
+    offsetof(Aligner, target_right_open_gap_score),
+    offsetof(Aligner, target_right_extend_gap_score),
+    offsetof(Aligner, query_internal_open_gap_score),
+    offsetof(Aligner, query_internal_extend_gap_score),
+    offsetof(Aligner, query_left_open_gap_score),
+    offsetof(Aligner, query_left_extend_gap_score),
+    offsetof(Aligner, query_right_open_gap_score),
+    offsetof(Aligner, query_right_extend_gap_score),
+};
+
+#define ALIGNER_STATE_NSCORES \
+    ((Py_ssize_t)(sizeof(Aligner_state_scores) / sizeof(Aligner_state_scores[0])))
+
+/* magic, version, mode, algorithm, scores, memory limit, wildcard, mapping
+ * size, and number of letters; followed by one code point for each letter. */
+#define ALIGNER_STATE_HEADER_SIZE (3 + 1 + 1 + 1 + 8 * ALIGNER_STATE_NSCORES + 8 + 4 + 4 + 4)
+
+static unsigned char*
+_pack_uint64(unsigned char* p, uint64_t value)
+{
+    int k;
+    for (k = 0; k < 8; k++) *(p++) = (value >> (8 * k)) & 0xff;
+    return p;
+}
+
+static unsigned char*
+_pack_int32(unsigned char* p, int32_t value)
+{
+    const uint32_t u = value;
+    int k;
+    for (k = 0; k < 4; k++) *(p++) = (u >> (8 * k)) & 0xff;
+    return p;
+}
+
+static const unsigned char*
+_unpack_uint64(const unsigned char* p, uint64_t* value)
+{
+    int k;
+    uint64_t u = 0;
+    for (k = 0; k < 8; k++) u |= ((uint64_t)p[k]) << (8 * k);
+    *value = u;
+    return p + 8;
+}
+
+static const unsigned char*
+_unpack_int32(const unsigned char* p, int32_t* value)
+{
+    int k;
+    uint32_t u = 0;
+    for (k = 0; k < 4; k++) u |= ((uint32_t)p[k]) << (8 * k);
+    *value = (int32_t)u;
+    return p + 4;
+}
+
+static Py_ssize_t
+_get_mapping_size(PyObject* alphabet)
+{
+    switch (PyUnicode_KIND(alphabet)) {
+        case PyUnicode_1BYTE_KIND: return 1 << 8 * sizeof(Py_UCS1);
+        case PyUnicode_2BYTE_KIND: return 1 << 8 * sizeof(Py_UCS2);
+        case PyUnicode_4BYTE_KIND: return 0x110000;
+        default: return -1;
+    }
+}
+
+static const char Aligner_getstate__doc__[] = "return the aligner state for pickling";
+
+static PyObject*
+Aligner_getstate(Aligner* self, PyObject* args)
+{
+    Py_ssize_t i;
+    Py_ssize_t nletters = 0;
+    Py_ssize_t mapping_size = 0;
+    PyObject* alphabet = self->alphabet;
+    PyObject* bytes;
+    unsigned char* p;
+    uint64_t bits;
+
+    if (self->mapping) {
+        nletters = PyUnicode_GET_LENGTH(alphabet);
+        mapping_size = _get_mapping_size(alphabet);
+    }
+    bytes = PyBytes_FromStringAndSize(NULL,
+                                      ALIGNER_STATE_HEADER_SIZE + 4 * nletters);
+    if (!bytes) return NULL;
+    p = (unsigned char*)PyBytes_AS_STRING(bytes);
+    memcpy(p, ALIGNER_STATE_MAGIC, 3);
+    p += 3;
+    *(p++) = ALIGNER_STATE_VERSION;
+    *(p++) = (unsigned char)self->mode;
+    *(p++) = (unsigned char)_get_algorithm(self);
+    for (i = 0; i < ALIGNER_STATE_NSCORES; i++) {
+        memcpy(&bits, (char*)self + Aligner_state_scores[i], sizeof(double));
+        p = _pack_uint64(p, bits);
+    }
+    p = _pack_uint64(p, (uint64_t)self->memory_limit);
+    p = _pack_int32(p, self->wildcard);
+    p = _pack_int32(p, (int32_t)mapping_size);
+    p = _pack_int32(p, (int32_t)nletters);
+    for (i = 0; i < nletters; i++)
+        p = _pack_int32(p, PyUnicode_READ_CHAR(alphabet, i));
+
+    return Py_BuildValue("NOOOO",
+        bytes,
+        alphabet ? alphabet : Py_None,
+        self->substitution_matrix.obj ? self->substitution_matrix.obj : Py_None,
+        self->target_gap_function ? self->target_gap_function : Py_None,
+        self->query_gap_function ? self->query_gap_function : Py_None);
+}
+
+static const char Aligner_setstate__doc__[] = "restore the aligner state when unpickling";
+
+static PyObject*
+Aligner_setstate(Aligner* self, PyObject* state)
+{
+    Py_ssize_t i;
+    Py_ssize_t length;
+    const unsigned char* p;
+    const char* data;
+    PyObject* alphabet;
+    PyObject* substitution_matrix;
+    PyObject* target_gap_function;
+    PyObject* query_gap_function;
+    Py_buffer view = {0};
+    int* mapping = NULL;
+    int32_t value;
+    int32_t mapping_size;
+    int32_t nletters;
+    uint64_t bits;
+    int64_t memory_limit;
+    double scores[ALIGNER_STATE_NSCORES];
+    Mode mode;
+    Algorithm algorithm;
+
+    if (PyDict_Check(state)) {
+        /* state stored by earlier versions of Biopython */
+        PyObject* key;
+        PyObject* value;
+        Py_ssize_t pos = 0;
+        while (PyDict_Next(state, &pos, &key, &value)) {
+            if (PyObject_SetAttr((PyObject*)self, key, value) < 0) return NULL;
+        }
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+    if (!PyArg_ParseTuple(state, "y#OOOO:__setstate__",
+                          &data, &length, &alphabet, &substitution_matrix,
+                          &target_gap_function, &query_gap_function))
+        return NULL;
+    p = (const unsigned char*)data;
+    if (length < ALIGNER_STATE_HEADER_SIZE
+     || memcmp(p, ALIGNER_STATE_MAGIC, 3) != 0) {
+        PyErr_SetString(PyExc_ValueError, "invalid aligner state");
+        return NULL;
+    }
+    p += 3;
+    if (*p != ALIGNER_STATE_VERSION) {
+        PyErr_Format(PyExc_ValueError,
+                     "unknown aligner state version %d", *p);
+        return NULL;
+    }
+    p++;
+    mode = *(p++);
+    algorithm = *(p++);
+    if (mode > Overlap || algorithm > Unknown) {
+        PyErr_SetString(PyExc_ValueError, "invalid aligner state");
+        return NULL;
+    }
+    for (i = 0; i < ALIGNER_STATE_NSCORES; i++) {
+        p = _unpack_uint64(p, &bits);
+        memcpy(&scores[i], &bits, sizeof(double));
+    }
+    p = _unpack_uint64(p, &bits);
+    memory_limit = (int64_t)bits;
+    if (memory_limit < -1) {
+        PyErr_SetString(PyExc_ValueError, "invalid aligner state");
+        return NULL;
+    }
+    p = _unpack_int32(p, &value);
+    p = _unpack_int32(p, &mapping_size);
+    p = _unpack_int32(p, &nletters);
+    if (nletters < 0 || length != ALIGNER_STATE_HEADER_SIZE + 4 * nletters) {
+        PyErr_SetString(PyExc_ValueError, "invalid aligner state");
+        return NULL;
+    }
+    if (nletters > 0) {
+        if (!PyUnicode_Check(alphabet) || mapping_size <= 0) {
+            PyErr_SetString(PyExc_ValueError, "invalid aligner state");
+            return NULL;
+        }
+        mapping = PyMem_Malloc(mapping_size * sizeof(int));
+        if (!mapping) return PyErr_NoMemory();
+        for (i = 0; i < mapping_size; i++) mapping[i] = MISSING_LETTER;
+        for (i = 0; i < nletters; i++) {
+            int32_t character;
+            p = _unpack_int32(p, &character);
+            if (character < 0 || character >= mapping_size) {
+                PyMem_Free(mapping);
+                PyErr_SetString(PyExc_ValueError, "invalid aligner state");
+                return NULL;
+            }
+            mapping[character] = i;
+        }
+    }
+    if (substitution_matrix != Py_None) {
+        if (PyObject_GetBuffer(substitution_matrix, &view,
+                               PyBUF_FORMAT | PyBUF_ND) != 0) {
+            if (mapping) PyMem_Free(mapping);
+            return NULL;
+        }
+    }
+
+    /* Everything has been validated; now replace the aligner state. */
+    for (i = 0; i < ALIGNER_STATE_NSCORES; i++)
+        memcpy((char*)self + Aligner_state_scores[i], &scores[i], sizeof(double));
+    self->mode = mode;
+    self->algorithm = algorithm;
+    self->wildcard = value;
+    self->memory_limit = memory_limit;
+    if (self->mapping) PyMem_Free(self->mapping);
+    self->mapping = mapping;
+    Py_XDECREF(self->alphabet);
+    if (alphabet == Py_None) self->alphabet = NULL;
+    else {
+        Py_INCREF(alphabet);
+        self->alphabet = alphabet;
+    }
+    if (self->substitution_matrix.obj) PyBuffer_Release(&self->substitution_matrix);
+    self->substitution_matrix = view;
+    Py_XDECREF(self->target_gap_function);
+    if (target_gap_function == Py_None) self->target_gap_function = NULL;
+    else {
+        Py_INCREF(target_gap_function);
+        self->target_gap_function = target_gap_function;
+    }
+    Py_XDECREF(self->query_gap_function);
+    if (query_gap_function == Py_None) self->query_gap_function = NULL;
+    else {
+        Py_INCREF(query_gap_function);
+        self->query_gap_function = query_gap_function;
+    }
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static const char Aligner_reset_statistics__doc__[] = "reset the statistics collected on the alignments";
+
+static PyObject*
+Aligner_reset_statistics(Aligner* self, PyObject* args)
+{
+    const int enabled = self->statistics.enabled;
+    memset(&self->statistics, 0, sizeof(Statistics));
+    self->statistics.enabled = enabled;
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
 static char Aligner_doc[] =
 "Aligner.\n";
 
@@ -6893,6 +8190,21 @@ static PyMethodDef Aligner_methods[] = {
      METH_VARARGS | METH_KEYWORDS,
      Aligner_align__doc__
     },
+    {"__getstate__",
+     (PyCFunction)Aligner_getstate,
+     METH_NOARGS,
+     Aligner_getstate__doc__
+    },
+    {"__setstate__",
+     (PyCFunction)Aligner_setstate,
+     METH_O,
+     Aligner_setstate__doc__
+    },
+    {"reset_statistics",
+     (PyCFunction)Aligner_reset_statistics,
+     METH_NOARGS,
+     Aligner_reset_statistics__doc__
+    },
     {NULL}  /* Sentinel */
 };
 
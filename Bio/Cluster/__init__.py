@@ -13,6 +13,7 @@ M. de Hoon et al. (2004) https://doi.org/10.1093/bioinformatics/bth078
 """
 
 import numbers
+import os
 
 try:
     import numpy
@@ -111,6 +112,9 @@ def kcluster(
     method="a",
     dist="e",
     initialid=None,
+    threads=None,
+    seed=None,
+    initialization="random",
 ):
     """Perform k-means clustering.
 
@@ -153,6 +157,25 @@ def kcluster(
        order in which items are assigned to clusters (i.e., using
        the same order as in the data matrix). In that case, the
        k-means algorithm is fully deterministic.
+     - threads: the number of threads used to run the npass passes
+       (by default, the number of CPUs).
+     - seed: the seed of the random number generator, a nonnegative integer
+       smaller than 2**64. Each pass uses its own stream of random numbers
+       derived from the seed, so that the result is reproducible for a
+       given seed, independent of the number of threads. By default, a
+       random seed is used.
+     - initialization: specifies how the initial clustering of each pass
+       is chosen if initialid is None:
+       - initialization == 'random': items are assigned to clusters at
+         random (default);
+       - initialization == 'kmeans++': the initial cluster centers are
+         chosen by k-means++, each with a probability proportional to its
+         distance to the closest center chosen so far;
+       - initialization == 'kmeans||': the initial cluster centers are
+         chosen by k-means|| (scalable k-means++), which samples several
+         candidate centers in each of a few rounds.
+       With 'kmeans++' or 'kmeans||', fewer passes are typically needed to
+       find a good clustering solution.
 
     Return values:
      - clusterid: array containing the number of the cluster to which each
@@ -171,13 +194,28 @@ def kcluster(
     mask = __check_mask(mask, shape)
     weight = __check_weight(weight, ndata)
     clusterid, npass = __check_initialid(initialid, npass, nitems)
+    threads = __check_threads(threads)
+    seed = __check_seed(seed)
     error, nfound = _cluster.kcluster(
-        data, nclusters, mask, weight, transpose, npass, method, dist, clusterid
+        data,
+        nclusters,
+        mask,
+        weight,
+        transpose,
+        npass,
+        method,
+        dist,
+        clusterid,
+        threads,
+        seed,
+        initialization,
     )
     return clusterid, error, nfound
 
 
-def kmedoids(distance, nclusters=2, npass=1, initialid=None):
+def kmedoids(
+    distance, nclusters=2, npass=1, initialid=None, threads=None, seed=None
+):
     """Perform k-medoids clustering.
 
     This function performs k-medoids clustering, and returns the cluster
@@ -210,7 +248,11 @@ def kmedoids(distance, nclusters=2, npass=1, initialid=None):
            ...             array([2.3, 4.5])]
 
 
-       These three correspond to the same distance matrix.
+       These three correspond to the same distance matrix. The distances
+       are stored in single precision if distance is a float32 array (or a
+       list of float32 arrays), and in double precision otherwise. The 1D
+       array can also be a numpy.memmap, to use a distance matrix stored on
+       disk.
      - nclusters: number of clusters (the 'k' in k-medoids)
      - npass: the number of times the k-medoids clustering algorithm
        is performed, each time with a different (random) initial
@@ -224,6 +266,13 @@ def kmedoids(distance, nclusters=2, npass=1, initialid=None):
        without randomizing the order in which items are assigned to
        clusters (i.e., using the same order as in the data matrix).
        In that case, the k-medoids algorithm is fully deterministic.
+     - threads: the number of threads used to run the npass passes
+       (by default, the number of CPUs).
+     - seed: the seed of the random number generator, a nonnegative integer
+       smaller than 2**64. Each pass uses its own stream of random numbers
+       derived from the seed, so that the result is reproducible for a
+       given seed, independent of the number of threads. By default, a
+       random seed is used.
 
     Return values:
      - clusterid: array containing the number of the cluster to which each
@@ -235,8 +284,15 @@ def kmedoids(distance, nclusters=2, npass=1, initialid=None):
     """
     distance = __check_distancematrix(distance)
     nitems = len(distance)
+    if isinstance(distance, numpy.ndarray) and distance.ndim == 1:
+        # The distances are stored consecutively; nitems*(nitems-1)/2 of them
+        nitems = int(round((1 + (1 + 8 * nitems) ** 0.5) / 2))
     clusterid, npass = __check_initialid(initialid, npass, nitems)
-    error, nfound = _cluster.kmedoids(distance, nclusters, npass, clusterid)
+    threads = __check_threads(threads)
+    seed = __check_seed(seed)
+    error, nfound = _cluster.kmedoids(
+        distance, nclusters, npass, clusterid, threads, seed
+    )
     return clusterid, error, nfound
 
 
@@ -248,6 +304,8 @@ def treecluster(
     method="m",
     dist="e",
     distancematrix=None,
+    threads=None,
+    dtype="d",
 ):
     """Perform hierarchical clustering, and return a Tree object.
 
@@ -299,13 +357,24 @@ def treecluster(
            ...             array([1.1]),
            ...             array([2.3, 4.5])]
 
-       These three correspond to the same distance matrix.
+       These three correspond to the same distance matrix. The distances
+       are stored in single precision if distancematrix is a float32 array
+       (or a list of float32 arrays), and in double precision otherwise. The
+       1D array can also be a writable numpy.memmap (opened with mode "r+"
+       or "c"), to use a distance matrix stored on disk; a read-only array
+       is copied first.
 
        PLEASE NOTE:
        As the treecluster routine may shuffle the values in the
        distance matrix as part of the clustering algorithm, be sure
        to save this array in a different variable before calling
        treecluster if you need it later.
+     - threads: the number of threads used to calculate the distance
+       matrix from the data (by default, the number of CPUs).
+     - dtype: the data type used to store the distance matrix calculated
+       from the data; use "f" (float32) to halve the memory needed, at the
+       cost of storing the distances in single precision. By default, the
+       distances are stored in double precision ("d", float64).
 
     Either data or distancematrix should be None. If distancematrix is None,
     the hierarchical clustering solution is calculated from the values stored
@@ -330,14 +399,25 @@ def treecluster(
         mask = __check_mask(mask, shape)
         weight = __check_weight(weight, ndata)
     if distancematrix is not None:
-        distancematrix = __check_distancematrix(distancematrix)
+        distancematrix = __check_distancematrix(distancematrix, writable=True)
         if mask is not None:
             raise ValueError("mask is ignored if distancematrix is used")
         if weight is not None:
             raise ValueError("weight is ignored if distancematrix is used")
+    threads = __check_threads(threads)
+    single = __check_dtype(dtype) == numpy.float32
     tree = Tree()
     _cluster.treecluster(
-        tree, data, mask, weight, transpose, method, dist, distancematrix
+        tree,
+        data,
+        mask,
+        weight,
+        transpose,
+        method,
+        dist,
+        distancematrix,
+        threads,
+        single,
     )
     return tree
 
@@ -352,6 +432,9 @@ def somcluster(
     inittau=0.02,
     niter=1,
     dist="e",
+    seed=None,
+    batch=False,
+    threads=None,
 ):
     """Calculate a Self-Organizing Map.
 
@@ -368,7 +451,8 @@ def somcluster(
      - nxgrid: the horizontal dimension of the rectangular SOM map
      - nygrid: the vertical dimension of the rectangular SOM map
      - inittau: the initial value of tau (the neighborbood function)
-     - niter: the number of iterations
+     - niter: the number of iterations, or the number of epochs if batch is
+       True
      - dist: specifies the distance function to be used:
        - dist == 'e': Euclidean distance
        - dist == 'b': City Block distance
@@ -378,6 +462,19 @@ def somcluster(
        - dist == 'x': absolute uncentered correlation
        - dist == 's': Spearman's rank correlation
        - dist == 'k': Kendall's tau
+     - seed: the seed of the random number generator used to initialize the
+       SOM and to choose the order in which items are used, a nonnegative
+       integer smaller than 2**64. By default, a random seed is used.
+     - batch: if False, the SOM is updated after each item (the online
+       algorithm). If True, the batch algorithm is used: in each epoch,
+       all items are assigned to their closest node, after which each node
+       is replaced by a weighted mean of the items assigned to the nodes in
+       its neighborhood. The inittau argument is ignored by the batch
+       algorithm.
+     - threads: the number of threads used to find the closest node of each
+       item, in each epoch of the batch algorithm and when assigning the
+       items to nodes at the end. The result does not depend on the number
+       of threads. By default, the number of CPUs is used.
 
     Return values:
 
@@ -406,8 +503,21 @@ def somcluster(
         raise ValueError("nygrid should be a positive integer (default is 1)")
     clusterids = numpy.ones((nitems, 2), dtype="intc")
     celldata = numpy.empty((nxgrid, nygrid, ndata), dtype="d")
+    seed = __check_seed(seed)
+    threads = __check_threads(threads)
     _cluster.somcluster(
-        clusterids, celldata, data, mask, weight, transpose, inittau, niter, dist
+        clusterids,
+        celldata,
+        data,
+        mask,
+        weight,
+        transpose,
+        inittau,
+        niter,
+        dist,
+        seed,
+        batch,
+        threads,
     )
     return clusterids, celldata
 
@@ -518,7 +628,15 @@ def clustercentroids(data, mask=None, clusterid=None, method="a", transpose=Fals
     return cdata, cmask
 
 
-def distancematrix(data, mask=None, weight=None, transpose=False, dist="e"):
+def distancematrix(
+    data,
+    mask=None,
+    weight=None,
+    transpose=False,
+    dist="e",
+    threads=None,
+    dtype=None,
+):
     """Calculate and return a distance matrix from the data.
 
     This function returns the distance matrix calculated from the data.
@@ -539,10 +657,16 @@ def distancematrix(data, mask=None, weight=None, transpose=False, dist="e"):
        - dist == 'x': absolute uncentered correlation
        - dist == 's': Spearman's rank correlation
        - dist == 'k': Kendall's tau
+     - threads: the number of threads used to calculate the distances
+       (by default, the number of CPUs). The result does not depend on
+       the number of threads.
+     - dtype: if None (default), the distance matrix is returned as a list
+       of arrays; otherwise, it is returned as a condensed 1D array of this
+       data type, which should be "d" (float64) or "f" (float32).
 
     Return value:
     The distance matrix is returned as a list of 1D arrays containing the
-    distance matrix calculated from the data. The number of columns in eac
+    distance matrix calculated from the data. The number of columns in each
     row is equal to the row number. Hence, the first row has zero length.
     For example:
 
@@ -568,6 +692,16 @@ def distancematrix(data, mask=None, weight=None, transpose=False, dist="e"):
         [16.,  0., 16.,  9.]
         [64., 16.,  0., 49.]
         [ 1.,  9., 49.,  0.]
+
+    If dtype is given, these rows are stored consecutively in a single 1D
+    array of size n*(n-1)/2, where n is the number of items. The distance
+    between items i and j, with i > j, is then stored at index i*(i-1)/2 + j.
+    A float32 array uses half the memory of the list of arrays, and can be
+    passed directly to treecluster and kmedoids:
+
+    >>> distances = distancematrix(data, dist='e', dtype='f')
+    >>> distances
+    array([ 16.,  64.,  16.,   1.,   9.,  49.], dtype=float32)
     """
     data = __check_data(data)
     shape = data.shape
@@ -577,8 +711,13 @@ def distancematrix(data, mask=None, weight=None, transpose=False, dist="e"):
     else:
         nitems, ndata = shape
     weight = __check_weight(weight, ndata)
-    matrix = [numpy.empty(i, dtype="d") for i in range(nitems)]
-    _cluster.distancematrix(data, mask, weight, transpose, dist, matrix)
+    threads = __check_threads(threads)
+    if dtype is None:
+        matrix = [numpy.empty(i, dtype="d") for i in range(nitems)]
+    else:
+        dtype = __check_dtype(dtype)
+        matrix = numpy.empty(nitems * (nitems - 1) // 2, dtype=dtype)
+    _cluster.distancematrix(data, mask, weight, transpose, dist, matrix, threads)
     return matrix
 
 
@@ -738,7 +877,9 @@ class Record:
         if self.gorder:
             self.gorder = numpy.array(self.gorder)
 
-    def treecluster(self, transpose=False, method="m", dist="e"):
+    def treecluster(
+        self, transpose=False, method="m", dist="e", threads=None, dtype="d"
+    ):
         """Apply hierarchical clustering and return a Tree object.
 
         The pairwise single, complete, centroid, and average linkage
@@ -761,6 +902,10 @@ class Record:
            - method == 'm': Complete (maximum) pairwise linkage (default)
            - method == 'c': Centroid linkage
            - method == 'a': Average pairwise linkage
+         - threads: the number of threads used to calculate the distance
+           matrix (by default, the number of CPUs).
+         - dtype: the data type used to store the distance matrix; "d"
+           (float64, default) or "f" (float32, using half the memory).
 
         See the description of the Tree class for more information about
         the Tree object returned by this method.
@@ -769,7 +914,16 @@ class Record:
             weight = self.gweight
         else:
             weight = self.eweight
-        return treecluster(self.data, self.mask, weight, transpose, method, dist)
+        return treecluster(
+            self.data,
+            self.mask,
+            weight,
+            transpose,
+            method,
+            dist,
+            threads=threads,
+            dtype=dtype,
+        )
 
     def kcluster(
         self,
@@ -779,6 +933,9 @@ class Record:
         method="a",
         dist="e",
         initialid=None,
+        threads=None,
+        seed=None,
+        initialization="random",
     ):
         """Apply k-means or k-median clustering.
 
@@ -810,6 +967,14 @@ class Record:
            initial clustering and without randomizing the order in which items
            are assigned to clusters (i.e., using the same order as in the data
            matrix). In that case, the k-means algorithm is fully deterministic.
+         - threads: the number of threads used to run the npass passes
+           (by default, the number of CPUs).
+         - seed: the seed of the random number generator; for a given seed,
+           the result does not depend on the number of threads. By default,
+           a random seed is used.
+         - initialization: specifies how the initial clustering of each pass
+           is chosen if initialid is None: 'random' (default), 'kmeans++', or
+           'kmeans||' (scalable k-means++).
 
         Return values:
          - clusterid: array containing the number of the cluster to which each
@@ -833,10 +998,22 @@ class Record:
             method,
             dist,
             initialid,
+            threads,
+            seed,
+            initialization,
         )
 
     def somcluster(
-        self, transpose=False, nxgrid=2, nygrid=1, inittau=0.02, niter=1, dist="e"
+        self,
+        transpose=False,
+        nxgrid=2,
+        nygrid=1,
+        inittau=0.02,
+        niter=1,
+        dist="e",
+        seed=None,
+        batch=False,
+        threads=None,
     ):
         """Calculate a self-organizing map on a rectangular grid.
 
@@ -848,7 +1025,8 @@ class Record:
          - nxgrid: the horizontal dimension of the rectangular SOM map
          - nygrid: the vertical dimension of the rectangular SOM map
          - inittau: the initial value of tau (the neighborbood function)
-         - niter: the number of iterations
+         - niter: the number of iterations, or the number of epochs if batch
+           is True
          - dist: specifies the distance function to be used:
            - dist == 'e': Euclidean distance
            - dist == 'b': City Block distance
@@ -858,6 +1036,13 @@ class Record:
            - dist == 'x': absolute uncentered correlation
            - dist == 's': Spearman's rank correlation
            - dist == 'k': Kendall's tau
+         - seed: the seed of the random number generator. By default, a
+           random seed is used.
+         - batch: if True, use the batch algorithm instead of updating the
+           SOM after each item; inittau is then ignored.
+         - threads: the number of threads used to find the closest node of
+           each item (by default, the number of CPUs). The result does not
+           depend on the number of threads.
 
         Return values:
          - clusterid: array with two columns, while the number of rows is equal
@@ -886,6 +1071,9 @@ class Record:
             inittau,
             niter,
             dist,
+            seed,
+            batch,
+            threads,
         )
 
     def clustercentroids(self, clusterid=None, method="a", transpose=False):
@@ -961,7 +1149,7 @@ class Record:
             self.data, self.mask, weight, index1, index2, method, dist, transpose
         )
 
-    def distancematrix(self, transpose=False, dist="e"):
+    def distancematrix(self, transpose=False, dist="e", threads=None, dtype=None):
         """Calculate the distance matrix and return it as a list of arrays.
 
         Keyword arguments:
@@ -977,6 +1165,11 @@ class Record:
            - dist == 'x': absolute uncentered correlation
            - dist == 's': Spearman's rank correlation
            - dist == 'k': Kendall's tau
+         - threads: the number of threads used to calculate the distances
+           (by default, the number of CPUs).
+         - dtype: if None (default), return the distance matrix as a list
+           of arrays; otherwise, return it as a condensed 1D array of this
+           data type ("d" or "f"). See the distancematrix function.
 
         Return value:
 
@@ -1002,7 +1195,9 @@ class Record:
             weight = self.gweight
         else:
             weight = self.eweight
-        return distancematrix(self.data, self.mask, weight, transpose, dist)
+        return distancematrix(
+            self.data, self.mask, weight, transpose, dist, threads=threads, dtype=dtype
+        )
 
     def save(self, jobname, geneclusters=None, expclusters=None):
         """Save the clustering results.
@@ -1237,6 +1432,31 @@ def __check_weight(weight, ndata):
     return weight
 
 
+def __check_threads(threads):
+    if threads is None:
+        return os.cpu_count() or 1
+    if threads < 1:
+        raise ValueError("threads should be a positive integer")
+    return threads
+
+
+def __check_seed(seed):
+    if seed is None:
+        return int.from_bytes(os.urandom(8), "little")
+    if not isinstance(seed, numbers.Integral):
+        raise TypeError("seed should be an integer")
+    if seed < 0 or seed >= 2**64:
+        raise ValueError("seed should be a nonnegative integer smaller than 2**64")
+    return int(seed)
+
+
+def __check_dtype(dtype):
+    dtype = numpy.dtype(dtype)
+    if dtype not in (numpy.float64, numpy.float32):
+        raise ValueError("dtype should be float64 ('d') or float32 ('f')")
+    return dtype
+
+
 def __check_initialid(initialid, npass, nitems):
     if initialid is None:
         if npass <= 0:
@@ -1259,22 +1479,35 @@ def __check_index(index):
         return numpy.array(index, dtype="intc")
 
 
-def __check_distancematrix(distancematrix):
+def __check_distancematrix(distancematrix, writable=False):
     if distancematrix is None:
         return distancematrix
+    # treecluster modifies the distance matrix in place; copy it if it is
+    # read-only, for example a numpy.memmap opened with mode="r"
+    requirements = "CW" if writable else "C"
     if isinstance(distancematrix, numpy.ndarray):
-        distancematrix = numpy.require(distancematrix, dtype="d", requirements="C")
+        # Keep single precision distance matrices in single precision
+        dtype = "f" if distancematrix.dtype == numpy.float32 else "d"
+        distancematrix = numpy.require(
+            distancematrix, dtype=dtype, requirements=requirements
+        )
     else:
         try:
             distancematrix = numpy.array(distancematrix, dtype="d")
         except ValueError:
             n = len(distancematrix)
             d = [None] * n
+            dtype = "d"
+            if all(
+                isinstance(row, numpy.ndarray) and row.dtype == numpy.float32
+                for row in distancematrix
+            ):
+                dtype = "f"
             for i, row in enumerate(distancematrix):
                 if isinstance(row, numpy.ndarray):
-                    row = numpy.require(row, dtype="d", requirements="C")
+                    row = numpy.require(row, dtype=dtype, requirements=requirements)
                 else:
-                    row = numpy.array(row, dtype="d")
+                    row = numpy.array(row, dtype=dtype)
                 if row.ndim != 1:
                     raise ValueError("row %d is not one-dimensional" % i) from None
                 m = len(row)
@@ -48,18 +48,17 @@
 
 static const int INF = INT_MAX; // 2^31 - 1
 
-static int TEMP_SWAP_INT;
-#define swap_int(x,y) {TEMP_SWAP_INT = (x); (x) = (y); (y) = TEMP_SWAP_INT;}
+#define swap_int(x,y) {const int temp = (x); (x) = (y); (y) = temp;}
 
-/* For quicksort, we need to choose a random pivot. Any random function should work. Even bad ones. */
+/* For quicksort, we need to choose a random pivot. Any random function should work. Even bad ones.
+ * The state is kept by the caller, so that concurrent sorts do not share it. */
 static int
-cheap_random()
+cheap_random(int* seed)
 {
     const int base = 2 * 100 * 1000 * 1000 + 33;
-    static int seed = 0;
-    seed = seed * 7 + 13;
-    if (seed > base) seed %= base;
-    return seed;
+    *seed = *seed * 7 + 13;
+    if (*seed > base) *seed %= base;
+    return *seed;
 }
 
 static inline int
@@ -114,14 +113,14 @@ insertion_sort_index(const double a[], int index[], int l, int r)
 
 //***************
 static void
-fastsort_partition_index(const double a[], int index[], const int left, const int right, int* first_end_ptr, int* second_start_ptr) {
+fastsort_partition_index(const double a[], int index[], const int left, const int right, int* first_end_ptr, int* second_start_ptr, int* seed) {
     int low, high, i, pivot, mid;
     double value;
     int increasing = 1, decreasing = 1;
 
     /*******/
     /* choose a random way to choose pivot, to prevent all possible worst-cases*/
-    if ((right - left) & 1) pivot = left + cheap_random() % (right - left);
+    if ((right - left) & 1) pivot = left + cheap_random(seed) % (right - left);
     else pivot = median_index_of3_index(a, index, left, (left + right) >> 1, right);
     value = a[index[pivot]];
 
@@ -203,7 +202,7 @@ fastsort_partition_index(const double a[], int index[], const int left, const in
 
 //***************
 static void
-fastsort_recursive_index(const double a[], int index[], int l, int r)
+fastsort_recursive_index(const double a[], int index[], int l, int r, int* seed)
 {
     int first_end, second_start;
     while (l < r) {
@@ -212,16 +211,16 @@ fastsort_recursive_index(const double a[], int index[], int l, int r)
             return;
         }
 
-        fastsort_partition_index(a, index, l, r, &first_end, &second_start);
+        fastsort_partition_index(a, index, l, r, &first_end, &second_start, seed);
         if (first_end == INF) return; /* sorted */
 
         /* Recurse into smaller branch to avoid stack overflow */
         if (first_end - l < r - second_start) {
-            fastsort_recursive_index(a, index, l, first_end);
+            fastsort_recursive_index(a, index, l, first_end, seed);
             l = second_start;
         }
         else {
-            fastsort_recursive_index(a, index, second_start, r);
+            fastsort_recursive_index(a, index, second_start, r, seed);
             r = first_end;
         }
     }
@@ -365,8 +364,9 @@ sort_index(int n, const double data[], int index[])
  */
 {
     int i;
+    int seed = 0;
     for (i = 0; i < n; i++) index[i] = i;
-    fastsort_recursive_index(data, index, 0, n - 1);
+    fastsort_recursive_index(data, index, 0, n - 1, &seed);
 }
 
 /* ********************************************************************** */
@@ -480,48 +480,280 @@ freedatamask(int n, double** data, int** mask)
 
 /* ---------------------------------------------------------------------- */
 
+typedef struct {
+    int nrows;          /* the number of items */
+    int ncols;          /* the number of data values of each item */
+    int ld;             /* the leading dimension (the stride between rows) */
+    double* data;       /* value j of item i is stored in data[i*ld+j] */
+    int* mask;          /* mask[i*ld+j] == 0 if data[i*ld+j] is missing */
+    double** rows;      /* rows[i] == data + i*ld */
+    int** maskrows;     /* maskrows[i] == mask + i*ld */
+} Matrix;
+/* A Matrix stores the data and mask of a set of items in contiguous row-major
+ * memory, with one row per item. The row pointers allow the matrix to be
+ * passed to the routines taking double** data and int** mask, with
+ * transpose == 0. */
+
+static void
+freematrix(Matrix* matrix)
+{
+    if (matrix->data) free(matrix->data);
+    if (matrix->mask) free(matrix->mask);
+    if (matrix->rows) free(matrix->rows);
+    if (matrix->maskrows) free(matrix->maskrows);
+}
+
+static int
+transposedmatrix(Matrix* matrix, double** data, int** mask, int ndata,
+    int first, int last)
+/* Store the columns first, ..., last-1 of the data and mask as the rows of a
+ * contiguous row-major matrix, so that columns can be clustered with the same
+ * memory access pattern as rows. Returns 0 if a memory allocation failed. */
+{
+    int i, j, k;
+    const int n = last - first;
+    const int ld = ndata;
+
+    matrix->nrows = n;
+    matrix->ncols = ndata;
+    matrix->ld = ld;
+    matrix->data = malloc(max(n*ld, 1)*sizeof(double));
+    matrix->mask = malloc(max(n*ld, 1)*sizeof(int));
+    matrix->rows = malloc(max(n, 1)*sizeof(double*));
+    matrix->maskrows = malloc(max(n, 1)*sizeof(int*));
+    if (!matrix->data || !matrix->mask || !matrix->rows
+     || !matrix->maskrows) {
+        freematrix(matrix);
+        return 0;
+    }
+    for (i = 0; i < n; i++) {
+        matrix->rows[i] = matrix->data + i*ld;
+        matrix->maskrows[i] = matrix->mask + i*ld;
+    }
+    /* Copy strips of 64 columns, reading each row of the strip consecutively
+     * while writing to 64 rows of the matrix */
+    for (i = 0; i < n; i += 64) {
+        const int m = min(64, n - i);
+        for (k = 0; k < ndata; k++) {
+            const double* x = data[k] + first + i;
+            const int* f = mask[k] + first + i;
+            double* y = matrix->data + i*ld + k;
+            int* g = matrix->mask + i*ld + k;
+            for (j = 0; j < m; j++) {
+                y[j*ld] = x[j];
+                g[j*ld] = f[j];
+            }
+        }
+    }
+    return 1;
+}
+
+/* ---------------------------------------------------------------------- */
+
+static inline double
+getdistance(const Distances* distances, int i, int j)
+/* Return the distance between elements i and j, with i > j. */
+{
+    if (distances->fvalues) return distances->fvalues[i][j];
+    return distances->values[i][j];
+}
+
+static inline void
+setdistance(const Distances* distances, int i, int j, double distance)
+/* Store the distance between elements i and j, with i > j. */
+{
+    if (distances->fvalues) distances->fvalues[i][j] = (float) distance;
+    else distances->values[i][j] = distance;
+}
+
+/* ---------------------------------------------------------------------- */
+
+int
+allocate_distances(int n, int single, Distances* distances)
+/*
+Purpose
+=======
+
+The allocate_distances routine allocates memory for the lower triangle of a
+distance matrix of n elements. The n*(n-1)/2 distances are stored in a single
+contiguous block in condensed form, in double precision or, if single is
+nonzero, in single precision, which needs half the memory. Row i of
+distances->values (or distances->fvalues) points to the i distances between
+element i and elements 0..i-1 in this block; the other pointer is set to NULL.
+The memory should be released by calling free_distances.
+
+Return value
+============
+
+If no errors occur, allocate_distances returns 1.
+If a memory error occurs, allocate_distances returns 0.
+
+========================================================================
+*/
+{
+    int i;
+    const size_t size = (size_t)n * (n-1) / 2;
+
+    distances->values = NULL;
+    distances->fvalues = NULL;
+    if (n < 1) return 0;
+    if (single) {
+        float* p;
+        float** rows = malloc(n*sizeof(float*));
+        if (!rows) return 0;
+        p = malloc((size > 0 ? size : 1)*sizeof(float));
+        if (!p) {
+            free(rows);
+            return 0;
+        }
+        for (i = 0; i < n; p += i, i++) rows[i] = p;
+        distances->fvalues = rows;
+    }
+    else {
+        double* p;
+        double** rows = malloc(n*sizeof(double*));
+        if (!rows) return 0;
+        p = malloc((size > 0 ? size : 1)*sizeof(double));
+        if (!p) {
+            free(rows);
+            return 0;
+        }
+        for (i = 0; i < n; p += i, i++) rows[i] = p;
+        distances->values = rows;
+    }
+    return 1;
+}
+
+void
+free_distances(Distances* distances)
+/* Release the memory allocated by allocate_distances. */
+{
+    if (distances->values) {
+        free(distances->values[0]);
+        free(distances->values);
+        distances->values = NULL;
+    }
+    if (distances->fvalues) {
+        free(distances->fvalues[0]);
+        free(distances->fvalues);
+        distances->fvalues = NULL;
+    }
+}
+
+/* ---------------------------------------------------------------------- */
+
+static void
+find_row_minimum(int i, const Distances* distances, double mindistance[],
+                 int minindex[])
+/*
+This function finds the shortest distance in row i of the distance matrix,
+and stores it in mindistance[i], with its column in minindex[i]. Among equal
+distances, the one in the leftmost column is chosen.
+*/
+{
+    int j;
+    double distance = getdistance(distances, i, 0);
+    int index = 0;
+
+    for (j = 1; j < i; j++) {
+        const double value = getdistance(distances, i, j);
+        if (value < distance) {
+            distance = value;
+            index = j;
+        }
+    }
+    mindistance[i] = distance;
+    minindex[i] = index;
+}
+
+/* ---------------------------------------------------------------------- */
+
 static double
-find_closest_pair(int n, double** distmatrix, int* ip, int* jp)
+find_closest_pair(int n, const double mindistance[], const int minindex[],
+                  int* ip, int* jp)
 /*
 This function searches the distance matrix to find the pair with the shortest
 distance between them. The indices of the pair are returned in ip and jp; the
-distance itself is returned by the function.
+distance itself is returned by the function. Instead of scanning the complete
+distance matrix, it uses the shortest distance in each row, as stored in
+mindistance and minindex, which is O(n) instead of O(n^2). Ties are resolved
+in the same way as by a scan of the complete distance matrix row by row.
 
-n          (input) int
+n           (input) int
 The number of elements in the distance matrix.
 
-distmatrix (input) double**
-A ragged array containing the distance matrix. The number of columns in each
-row is one less than the row index.
+mindistance (input) const double[n]
+The shortest distance in each row of the distance matrix, for rows 1 to n-1.
 
-ip         (output) int*
+minindex    (input) const int[n]
+The column containing the shortest distance in each row of the distance
+matrix, for rows 1 to n-1.
+
+ip          (output) int*
 A pointer to the integer that is to receive the first index of the pair with
 the shortest distance.
 
-jp         (output) int*
+jp          (output) int*
 A pointer to the integer that is to receive the second index of the pair with
 the shortest distance.
 */
 {
-    int i, j;
-    double temp;
-    double distance = distmatrix[1][0];
+    int i;
+    double distance = mindistance[1];
 
     *ip = 1;
-    *jp = 0;
-    for (i = 1; i < n; i++) {
-        for (j = 0; j < i; j++) {
-            temp = distmatrix[i][j];
-            if (temp<distance) {
-                distance = temp;
-                *ip = i;
-                *jp = j;
-            }
+    for (i = 2; i < n; i++) {
+        if (mindistance[i] < distance) {
+            distance = mindistance[i];
+            *ip = i;
         }
     }
+    *jp = minindex[*ip];
     return distance;
 }
 
+/* ---------------------------------------------------------------------- */
+
+static void
+update_row_minima(int n, const Distances* distances, int is, int js,
+                  double mindistance[], int minindex[])
+/*
+This function updates the shortest distance in each row of the distance
+matrix after clusters is and js (with is > js) were joined. The new cluster
+is stored in row and column js; row and column is have been overwritten by
+the last row and column of the distance matrix, which now has n rows.
+Rows are searched again only if their shortest distance was to cluster js or
+is; otherwise, it is sufficient to compare to the new distances in columns js
+and is.
+*/
+{
+    int i;
+
+    if (js > 0) find_row_minimum(js, distances, mindistance, minindex);
+    if (is < n) find_row_minimum(is, distances, mindistance, minindex);
+    for (i = js + 1; i < n; i++) {
+        double distance;
+        if (i == is) continue;
+        if (minindex[i] == js || minindex[i] == is) {
+            find_row_minimum(i, distances, mindistance, minindex);
+            continue;
+        }
+        distance = getdistance(distances, i, js);
+        if (distance < mindistance[i]
+         || (distance == mindistance[i] && js < minindex[i])) {
+            mindistance[i] = distance;
+            minindex[i] = js;
+        }
+        if (i < is) continue;
+        distance = getdistance(distances, i, is);
+        if (distance < mindistance[i]
+         || (distance == mindistance[i] && is < minindex[i])) {
+            mindistance[i] = distance;
+            minindex[i] = is;
+        }
+    }
+}
+
 /* ********************************************************************* */
 
 static int
@@ -1841,51 +2073,16 @@ Otherwise, the distance between two columns in the matrix is calculated.
 /* *********************************************************************    */
 
 static double
-kendall(int n, double** data1, double** data2, int** mask1, int** mask2,
-        const double weight[], int index1, int index2, int transpose)
+kendall_pairwise(int n, double** data1, double** data2, int** mask1, int** mask2,
+                 const double weight[], int index1, int index2, int transpose)
 /*
 Purpose
 =======
 
-The kendall routine calculates the Kendall distance between two
-rows or columns. The Kendall distance is defined as one minus Kendall's tau.
-
-Arguments
-=========
-
-n            (input) int
-The number of elements in a row or column. If transpose == 0, then n is the
-number of columns; otherwise, n is the number of rows.
-
-data1     (input) double array
-The data array containing the first vector.
-
-data2     (input) double array
-The data array containing the second vector.
-
-mask1     (input) int array
-This array which elements in data1 are missing. If mask1[i][j] == 0, then
-data1[i][j] is missing.
-
-mask2     (input) int array
-This array which elements in data2 are missing. If mask2[i][j] == 0, then
-data2[i][j] is missing.
-
-weight    (input) double[ncolumns] if transpose == 0,
-                  double[nrows]    otherwise
-The weights that are used to calculate the distance. This is equivalent
-to including the jth data point weight[j] times in the calculation. The
-weights can be non-integer.
-
-index1    (input) int
-Index of the first row or column.
-
-index2    (input) int
-Index of the second row or column.
-
-transpose (input) int
-If transpose == 0, the distance between two rows in the matrix is calculated.
-Otherwise, the distance between two columns in the matrix is calculated.
+The kendall_pairwise routine calculates the Kendall distance between two rows
+or columns by comparing all pairs of elements, which takes O(n^2) time. It is
+used by kendall for short vectors, and if kendall fails to allocate memory.
+The arguments are the same as for kendall.
 ============================================================================
 */
 {
@@ -1955,109 +2152,622 @@ Otherwise, the distance between two columns in the matrix is calculated.
     return 1.-tau;
 }
 
-/* *********************************************************************    */
+/* ---------------------------------------------------------------------- */
 
-static double(*setmetric(char dist))
-    (int, double**, double**, int**, int**, const double[], int, int, int)
+static double
+merge_sort_index(int n, const double key1[], const double key2[],
+                 const double weight[], int index[], int temp[])
+/* Sorts the index array such that key1[index[]] is in increasing order; ties
+ * are broken by key2[index[]] if key2 is not NULL. The merge sort is stable.
+ * Returns the sum of weight[i]*weight[j] over all pairs (i, j) for which
+ * key1[i] > key1[j] while i came before j in the original index array (i.e.,
+ * the weighted number of inversions); this is only meaningful if key2 is
+ * NULL.
+ */
 {
-    switch(dist) {
-        case 'e': return &euclid;
-        case 'b': return &cityblock;
-        case 'c': return &correlation;
-        case 'a': return &acorrelation;
-        case 'u': return &ucorrelation;
-        case 'x': return &uacorrelation;
-        case 's': return &spearman;
-        case 'k': return &kendall;
-        default: return &euclid;
+    int width, lo, i, j, k;
+    double inversions = 0;
+
+    for (width = 1; width < n; width *= 2) {
+        for (lo = 0; lo < n - width; lo += 2*width) {
+            const int mid = lo + width;
+            const int hi = min(lo + 2*width, n);
+            /* Total weight of the elements remaining in the left run */
+            double remaining = 0;
+            for (i = lo; i < mid; i++) remaining += weight[index[i]];
+            i = lo;
+            j = mid;
+            k = lo;
+            while (i < mid && j < hi) {
+                const int left = index[i];
+                const int right = index[j];
+                if (key1[left] < key1[right]
+                 || (key1[left] == key1[right]
+                  && (!key2 || key2[left] <= key2[right]))) {
+                    temp[k++] = left;
+                    remaining -= weight[left];
+                    i++;
+                }
+                else {
+                    temp[k++] = right;
+                    inversions += weight[right] * remaining;
+                    j++;
+                }
+            }
+            while (i < mid) temp[k++] = index[i++];
+            while (j < hi) temp[k++] = index[j++];
+            for (k = lo; k < hi; k++) index[k] = temp[k];
+        }
     }
+    return inversions;
 }
 
-/* *********************************************************************    */
+/* ---------------------------------------------------------------------- */
 
 static double
-uniform(void)
+kendall(int n, double** data1, double** data2, int** mask1, int** mask2,
+        const double weight[], int index1, int index2, int transpose)
 /*
 Purpose
 =======
 
-This routine returns a uniform random number between 0.0 and 1.0. Both 0.0
-and 1.0 are excluded. This random number generator is described in:
-
-Pierre l'Ecuyer
-Efficient and Portable Combined Random Number Generators
-Communications of the ACM, Volume 31, Number 6, June 1988, pages 742-749, 774.
-
-The first time this routine is called, it initializes the random number
-generator using the current time. First, the current epoch time in seconds is
-used as a seed for the random number generator in the C library. The first two
-random numbers generated by this generator are used to initialize the random
-number generator implemented in this routine.
+The kendall routine calculates the Kendall distance between two
+rows or columns. The Kendall distance is defined as one minus Kendall's tau.
+The pair (i, j) is given the weight weight[i]*weight[j]; pairs tied in one
+vector only enter the denominator for that vector, as in Kendall's tau-b.
 
+Kendall's tau is calculated in O(n log n) time following Knight (1966):
+the elements are sorted by the first vector (ties broken by the second
+vector), after which the weighted number of discordant pairs is equal to the
+weighted number of inversions found by a merge sort on the second vector.
+The concordant pairs then follow from the total weight of all pairs and of
+the tied pairs.
 
 Arguments
 =========
 
-None.
+n            (input) int
+The number of elements in a row or column. If transpose == 0, then n is the
+number of columns; otherwise, n is the number of rows.
 
+data1     (input) double array
+The data array containing the first vector.
 
-Return value
-============
+data2     (input) double array
+The data array containing the second vector.
 
-A double-precison number between 0.0 and 1.0.
+mask1     (input) int array
+This array which elements in data1 are missing. If mask1[i][j] == 0, then
+data1[i][j] is missing.
+
+mask2     (input) int array
+This array which elements in data2 are missing. If mask2[i][j] == 0, then
+data2[i][j] is missing.
+
+weight    (input) double[ncolumns] if transpose == 0,
+                  double[nrows]    otherwise
+The weights that are used to calculate the distance. This is equivalent
+to including the jth data point weight[j] times in the calculation. The
+weights can be non-integer.
+
+index1    (input) int
+Index of the first row or column.
+
+index2    (input) int
+Index of the second row or column.
+
+transpose (input) int
+If transpose == 0, the distance between two rows in the matrix is calculated.
+Otherwise, the distance between two columns in the matrix is calculated.
 ============================================================================
 */
 {
-    int z;
-    static const int m1 = 2147483563;
-    static const int m2 = 2147483399;
-    const double scale = 1.0/m1;
+    int i, m = 0;
+    double* x;
+    double* y;
+    double* w;
+    int* index;
+    int* temp;
+    double total, tiedx, tiedy, tiedxy, dis, con;
+    double denomx, denomy;
+    double partial, partialx, partialxy, partialy;
+    double tau;
+
+    if (n < 16) return kendall_pairwise(n, data1, data2, mask1, mask2, weight,
+                                        index1, index2, transpose);
+    x = malloc(3*n*sizeof(double));
+    index = malloc(2*n*sizeof(int));
+    if (!x || !index) {
+        if (x) free(x);
+        if (index) free(index);
+        return kendall_pairwise(n, data1, data2, mask1, mask2, weight,
+                                index1, index2, transpose);
+    }
+    y = x + n;
+    w = y + n;
+    temp = index + n;
+
+    if (transpose == 0) {
+        for (i = 0; i < n; i++) {
+            if (mask1[index1][i] && mask2[index2][i]) {
+                x[m] = data1[index1][i];
+                y[m] = data2[index2][i];
+                w[m] = weight[i];
+                m++;
+            }
+        }
+    }
+    else {
+        for (i = 0; i < n; i++) {
+            if (mask1[i][index1] && mask2[i][index2]) {
+                x[m] = data1[i][index1];
+                y[m] = data2[i][index2];
+                w[m] = weight[i];
+                m++;
+            }
+        }
+    }
+    if (m < 2) {
+        free(x);
+        free(index);
+        return 0.;
+    }
 
-    static int s1 = 0;
-    static int s2 = 0;
+    /* Sort by x, then by y, and add up the weights of all pairs, of the pairs
+     * tied in x, and of the pairs tied in both x and y */
+    for (i = 0; i < m; i++) index[i] = i;
+    merge_sort_index(m, x, y, w, index, temp);
+    total = tiedx = tiedxy = 0;
+    partial = partialx = partialxy = 0;
+    for (i = 0; i < m; i++) {
+        const int j = index[i];
+        if (i > 0 && x[j] == x[index[i-1]]) {
+            tiedx += w[j] * partialx;
+            if (y[j] == y[index[i-1]]) tiedxy += w[j] * partialxy;
+            else partialxy = 0;
+        }
+        else partialx = partialxy = 0;
+        total += w[j] * partial;
+        partial += w[j];
+        partialx += w[j];
+        partialxy += w[j];
+    }
+    denomy = total - tiedx;
 
-    if (s1 == 0 || s2 == 0) {
-        /* initialize */
-        unsigned int initseed = (unsigned int) time(0);
-        srand(initseed);
-        s1 = rand();
-        s2 = rand();
+    /* Sorting by y now counts the discordant pairs as inversions; pairs tied
+     * in x are already in order of y, and pairs tied in y are not inverted. */
+    dis = merge_sort_index(m, y, NULL, w, index, temp);
+    total = tiedy = 0;
+    partial = partialy = 0;
+    for (i = 0; i < m; i++) {
+        const int j = index[i];
+        if (i > 0 && y[j] == y[index[i-1]]) tiedy += w[j] * partialy;
+        else partialy = 0;
+        total += w[j] * partial;
+        partial += w[j];
+        partialy += w[j];
     }
+    denomx = total - tiedy;
+    free(x);
+    free(index);
 
-    do {
-        int k = s1/53668;
-        s1 = 40014*(s1-k*53668)-k*12211;
-        if (s1 < 0) s1+=m1;
-        k = s2/52774;
-        s2 = 40692*(s2-k*52774)-k*3791;
-        if (s2 < 0) s2 += m2;
-        z = s1-s2;
-        if (z < 1) z += (m1-1);
-    } while (z == m1); /* To avoid returning 1.0 */
-
-    return z*scale;
+    con = total - tiedx - tiedy + tiedxy - dis;
+    if (denomx <= 0) return 1;
+    if (denomy <= 0) return 1;
+    tau = (con-dis)/sqrt(denomx*denomy);
+    return 1.-tau;
 }
 
-/* ************************************************************************ */
+/* *********************************************************************    */
 
-static int
-binomial(int n, double p)
-/*
-Purpose
-=======
+static double(*setmetric(char dist))
+    (int, double**, double**, int**, int**, const double[], int, int, int)
+{
+    switch(dist) {
+        case 'e': return &euclid;
+        case 'b': return &cityblock;
+        case 'c': return &correlation;
+        case 'a': return &acorrelation;
+        case 'u': return &ucorrelation;
+        case 'x': return &uacorrelation;
+        case 's': return &spearman;
+        case 'k': return &kendall;
+        default: return &euclid;
+    }
+}
 
-This routine generates a random number between 0 and n inclusive, following
-the binomial distribution with probability p and n trials. The routine is
-based on the BTPE algorithm, described in:
+/* *********************************************************************    */
 
-Voratas Kachitvichyanukul and Bruce W. Schmeiser:
-Binomial Random Variate Generation
-Communications of the ACM, Volume 31, Number 2, February 1988, pages 216-222.
+/* Blocked distance kernels.
+ *
+ * If no data values are missing, the distances between many pairs of rows or
+ * columns can be calculated in the same way as a matrix product. The vectors
+ * are copied in blocks of BLOCKSIZE into contiguous memory; the second block
+ * is stored transposed, so that neighboring sums read neighboring memory and
+ * can be vectorized by the compiler. For the Pearson correlation distances,
+ * each vector is centered (if needed) and normalized once while it is being
+ * copied, so that the correlation reduces to a weighted dot product. For the
+ * Spearman rank correlation, each vector is replaced by its ranks while it is
+ * being copied, instead of ranking both vectors again for each pair.
+ */
+
+#define BLOCKSIZE 64
+
+static int
+blocked_metric(char dist)
+{
+    switch (dist) {
+        case 'e':
+        case 'c':
+        case 'a':
+        case 'u':
+        case 'x':
+        case 's': return 1;
+        default: return 0;
+    }
+}
+
+static int
+all_present(int ndata, int** mask, int n, const int index[], int transpose)
+/* Return 1 if none of the data values of the selected vectors are missing. */
+{
+    int i, k;
+
+    if (!mask) return 1;
+    if (transpose == 0) {
+        for (i = 0; i < n; i++) {
+            const int* m = mask[index[i]];
+            for (k = 0; k < ndata; k++) if (!m[k]) return 0;
+        }
+    }
+    else {
+        for (k = 0; k < ndata; k++) {
+            const int* m = mask[k];
+            for (i = 0; i < n; i++) if (!m[index[i]]) return 0;
+        }
+    }
+    return 1;
+}
+
+static int
+pack_block(char dist, int ndata, double** data, const double weight[],
+    double tweight, int n, const int index[], int transpose, int kmajor,
+    double block[], double temp[])
+/* Copy n vectors into block, as block[i*ndata+k] if kmajor == 0, and as
+ * block[k*n+i] otherwise. For the correlation distances, each vector is
+ * centered and/or normalized; vectors with zero variance are set to zero,
+ * which gives a distance of 1, as in the correlation routines. For the
+ * Spearman rank correlation, the vectors are replaced by their ranks first,
+ * using temp[ndata] as workspace. Returns 0 if a memory allocation failed. */
+{
+    int i, k;
+    double sum, denom, scale;
+    const int stride = kmajor ? n : 1;
+
+    for (i = 0; i < n; i++) {
+        const int j = index[i];
+        double* x = kmajor ? block + i : block + i*ndata;
+        if (dist == 's') {
+            double* rank;
+            if (transpose == 0) {
+                const double* row = data[j];
+                for (k = 0; k < ndata; k++) temp[k] = row[k];
+            }
+            else {
+                for (k = 0; k < ndata; k++) temp[k] = data[k][j];
+            }
+            rank = getrank(ndata, temp, weight);
+            if (!rank) return 0;
+            for (k = 0; k < ndata; k++) x[k*stride] = rank[k];
+            free(rank);
+        }
+        else if (transpose == 0) {
+            const double* row = data[j];
+            for (k = 0; k < ndata; k++) x[k*stride] = row[k];
+        }
+        else {
+            for (k = 0; k < ndata; k++) x[k*stride] = data[k][j];
+        }
+        if (dist == 'e') continue;
+        sum = 0.;
+        denom = 0.;
+        for (k = 0; k < ndata; k++) {
+            double term = x[k*stride];
+            double w = weight[k];
+            sum += w*term;
+            denom += w*term*term;
+        }
+        if (dist == 'c' || dist == 'a' || dist == 's') {
+            denom -= sum * sum / tweight;
+            sum /= tweight;
+            if (denom <= 0) denom = 0; /* roundoff errors */
+        }
+        else sum = 0;
+        if (denom == 0) {
+            for (k = 0; k < ndata; k++) x[k*stride] = 0;
+            continue;
+        }
+        scale = 1. / sqrt(denom);
+        for (k = 0; k < ndata; k++)
+            x[k*stride] = (x[k*stride] - sum) * scale;
+    }
+    return 1;
+}
+
+static void
+block_distances(char dist, int ndata, const double weight[], double tweight,
+    const double a[], int na, const double bt[], int nb, double result[],
+    int ld)
+/* Calculate the distances between the na vectors stored in a (row by row)
+ * and the nb vectors stored in bt (transposed), and store them in
+ * result[i*ld+j]. The sums are accumulated in 4 x 4 blocks that are kept in
+ * registers while looping over the data, as in a matrix multiplication. */
+{
+    int i, j, k, ii, jj;
+
+    for (i = 0; i < na; i += 4) {
+        const int mi = min(4, na - i);
+        for (j = 0; j < nb; j += 4) {
+            const int mj = min(4, nb - j);
+            double sums[4][4] = {{0}};
+            if (mi == 4 && mj == 4) {
+                const double* x = a + i*ndata;
+                for (k = 0; k < ndata; k++) {
+                    const double* y = bt + k*nb + j;
+                    const double w = weight[k];
+                    if (dist == 'e') {
+                        for (ii = 0; ii < 4; ii++) {
+                            const double t = x[ii*ndata+k];
+                            for (jj = 0; jj < 4; jj++) {
+                                const double d = t - y[jj];
+                                sums[ii][jj] += w*d*d;
+                            }
+                        }
+                    }
+                    else {
+                        for (ii = 0; ii < 4; ii++) {
+                            const double t = w*x[ii*ndata+k];
+                            for (jj = 0; jj < 4; jj++)
+                                sums[ii][jj] += t*y[jj];
+                        }
+                    }
+                }
+            }
+            else {
+                for (ii = 0; ii < mi; ii++) {
+                    const double* x = a + (i+ii)*ndata;
+                    for (jj = 0; jj < mj; jj++) {
+                        const double* y = bt + j + jj;
+                        double sum = 0;
+                        for (k = 0; k < ndata; k++) {
+                            const double w = weight[k];
+                            if (dist == 'e') {
+                                const double d = x[k] - y[k*nb];
+                                sum += w*d*d;
+                            }
+                            else sum += w*x[k]*y[k*nb];
+                        }
+                        sums[ii][jj] = sum;
+                    }
+                }
+            }
+            for (ii = 0; ii < mi; ii++) {
+                double* r = result + (i+ii)*ld + j;
+                for (jj = 0; jj < mj; jj++) {
+                    const double sum = sums[ii][jj];
+                    switch (dist) {
+                        case 'e': r[jj] = sum / tweight; break;
+                        case 'a':
+                        case 'x': r[jj] = 1. - fabs(sum); break;
+                        default: r[jj] = 1. - sum; break;
+                    }
+                }
+            }
+        }
+    }
+}
+
+static int
+blocked_distances(char dist, int ndata, const double weight[], int transpose,
+    double** data1, int** mask1, int n1, const int index1[],
+    double** data2, int** mask2, int n2, const int index2[],
+    double result[])
+/*
+Purpose
+=======
+
+The blocked_distances routine calculates the distances between the vectors
+index1[i] in data1 and index2[j] in data2 for the distance measures for which
+the blocked kernels are available (Euclidean distance, the four Pearson
+correlation distances, and the Spearman rank correlation, which is calculated
+as the Pearson correlation between the ranks). This gives the same distances as the metric functions,
+but much faster, as long as no data values are missing.
+
+Arguments
+=========
+
+dist, ndata, weight, transpose
+As in the metric functions.
+
+data1, mask1  (input) double**, int**
+The data and the mask (which may be NULL if no data are missing) of the first
+set of vectors.
+
+n1, index1   (input) int, int[n1]
+The number of vectors in the first set, and their row (transpose == 0) or
+column (transpose != 0) indices.
+
+data2, mask2, n2, index2
+The same for the second set of vectors.
+
+result       (output) double[n1*n2]
+On return, result[i*n2+j] is the distance between vectors index1[i] and
+index2[j].
+
+Return value
+============
+
+1 if the distances were calculated; 0 if no blocked kernel is available for
+this distance measure, if data values are missing, or if a memory allocation
+failed. The caller should then use the metric function instead.
+
+========================================================================
+*/
+{
+    int i, j, k;
+    int ok = 1;
+    double tweight = 0;
+    double* a;
+    double* bt;
+    double* temp;
+
+    if (!blocked_metric(dist)) return 0;
+    if (!all_present(ndata, mask1, n1, index1, transpose)) return 0;
+    if (!all_present(ndata, mask2, n2, index2, transpose)) return 0;
+    for (k = 0; k < ndata; k++) tweight += weight[k];
+    if (tweight == 0 && dist != 'u' && dist != 'x') {
+        /* usually due to empty clusters */
+        for (i = 0; i < n1*n2; i++) result[i] = 0;
+        return 1;
+    }
+    if (ndata == 0) {
+        for (i = 0; i < n1*n2; i++) result[i] = 0;
+        return 1;
+    }
+    a = malloc(BLOCKSIZE*ndata*sizeof(double));
+    bt = malloc(BLOCKSIZE*ndata*sizeof(double));
+    temp = malloc(ndata*sizeof(double));
+    if (!a || !bt || !temp) ok = 0;
+    for (i = 0; ok && i < n1; i += BLOCKSIZE) {
+        const int na = min(BLOCKSIZE, n1 - i);
+        ok = pack_block(dist, ndata, data1, weight, tweight, na, index1 + i,
+                        transpose, 0, a, temp);
+        for (j = 0; ok && j < n2; j += BLOCKSIZE) {
+            const int nb = min(BLOCKSIZE, n2 - j);
+            ok = pack_block(dist, ndata, data2, weight, tweight, nb,
+                            index2 + j, transpose, 1, bt, temp);
+            if (ok) block_distances(dist, ndata, weight, tweight, a, na, bt,
+                                    nb, result + i*n2 + j, n2);
+        }
+    }
+    if (a) free(a);
+    if (bt) free(bt);
+    if (temp) free(temp);
+    return ok;
+}
+
+/* *********************************************************************    */
+
+typedef struct {unsigned long long s[4];} Random;
+/* The state of the xoshiro256** random number generator used by uniform.
+ * Each pass of k-means, k-medians, or k-medoids clustering uses its own state,
+ * so that the passes can be run in any order, or concurrently, with the same
+ * result. */
+
+static unsigned long long
+splitmix64(unsigned long long* x)
+/* Return the next number generated by the SplitMix64 generator with state x.
+ * This is used to derive the state of uniform from a seed. */
+{
+    unsigned long long z = (*x += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static void
+initrandom(Random* random, unsigned long long seed, int stream)
+/* Initialize the state of the random number generator for the given stream,
+ * using the seed. Different streams give independent random numbers. As the
+ * four words of the state are consecutive outputs of SplitMix64, they cannot
+ * all be zero. */
+{
+    int i;
+    unsigned long long x = (unsigned long long) stream;
+
+    x = splitmix64(&x) ^ seed;
+    for (i = 0; i < 4; i++) random->s[i] = splitmix64(&x);
+}
+
+static inline unsigned long long
+rotl(const unsigned long long x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+/* ************************************************************************ */
+
+static double
+uniform(Random* random)
+/*
+Purpose
+=======
+
+This routine returns a uniform random number between 0.0 and 1.0. Both 0.0
+and 1.0 are excluded. This random number generator is xoshiro256**,
+described in:
+
+David Blackman and Sebastiano Vigna
+Scrambled Linear Pseudorandom Number Generators
+ACM Transactions on Mathematical Software, Volume 47, Number 4, 2021,
+Article 36.
+
+The state of the random number generator should be initialized by calling
+initrandom.
+
+
+Arguments
+=========
+
+random (input/output) Random*
+The state of the random number generator.
+
+
+Return value
+============
+
+A double-precison number between 0.0 and 1.0.
+============================================================================
+*/
+{
+    unsigned long long* s = random->s;
+    const unsigned long long result = rotl(s[1] * 5, 7) * 9;
+    const unsigned long long t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+
+    /* Use the upper 53 bits, shifted by half a unit to exclude 0.0 and 1.0 */
+    return ((result >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+}
+
+/* ************************************************************************ */
+
+static int
+binomial(Random* random, int n, double p)
+/*
+Purpose
+=======
+
+This routine generates a random number between 0 and n inclusive, following
+the binomial distribution with probability p and n trials. The routine is
+based on the BTPE algorithm, described in:
+
+Voratas Kachitvichyanukul and Bruce W. Schmeiser:
+Binomial Random Variate Generation
+Communications of the ACM, Volume 31, Number 2, February 1988, pages 216-222.
 
 
 Arguments
 =========
 
+random (input/output) Random*
+The state of the random number generator.
+
 p    (input) double
 The probability of a single event. This probability should be less than or
 equal to 0.5.
@@ -2081,7 +2791,7 @@ An integer drawn from a binomial distribution with parameters (p, n).
         const double a = (n+1)*s;
         double r = exp(n*log(q)); /* pow() causes a crash on AIX */
         int x = 0;
-        double u = uniform();
+        double u = uniform(random);
         while (1) {
             if (u < r) return x;
             u -= r;
@@ -2109,8 +2819,8 @@ An integer drawn from a binomial distribution with parameters (p, n).
             /* Step 1 */
             int y;
             int k;
-            double u = uniform();
-            double v = uniform();
+            double u = uniform(random);
+            double v = uniform(random);
             u *= p4;
             if (u <= p1) return (int)(xm-p1*v+u);
             /* Step 2 */
@@ -2187,7 +2897,7 @@ An integer drawn from a binomial distribution with parameters (p, n).
 /* ************************************************************************ */
 
 static void
-randomassign(int nclusters, int nelements, int clusterid[])
+randomassign(Random* random, int nclusters, int nelements, int clusterid[])
 /*
 Purpose
 =======
@@ -2201,6 +2911,9 @@ randomly, making sure that each cluster will receive at least one element.
 Arguments
 =========
 
+random       (input/output) Random*
+The state of the random number generator.
+
 nclusters    (input) int
 The number of clusters.
 
@@ -2225,7 +2938,7 @@ The cluster number to which an element was assigned.
      */
     for (i = 0; i < nclusters-1; i++) {
         p = 1.0/(nclusters-i);
-        j = binomial(n, p);
+        j = binomial(random, n, p);
         n -= j;
         j += k+1; /* Assign at least one element to cluster i */
         for ( ; k < j; k++) clusterid[k] = i;
@@ -2235,7 +2948,7 @@ The cluster number to which an element was assigned.
 
     /* Create a random permutation of the cluster assignments */
     for (i = 0; i < nelements; i++) {
-        j = (int) (i + (nelements-i)*uniform());
+        j = (int) (i + (nelements-i)*uniform(random));
         k = clusterid[j];
         clusterid[j] = clusterid[i];
         clusterid[i] = k;
@@ -2556,6 +3269,34 @@ returns 0. If successful, getclustercentroids returns 1.
 
 /* ********************************************************************* */
 
+static void
+find_medoids(int nclusters, int nelements, const Distances* distances,
+    int clusterid[], int centroids[], double errors[])
+/* This function implements getclustermedoids for a distance matrix stored
+ * in double or in single precision.
+ */
+{
+    int i, j, k;
+
+    for (j = 0; j < nclusters; j++) errors[j] = DBL_MAX;
+    for (i = 0; i < nelements; i++) {
+        double d = 0.0;
+        j = clusterid[i];
+        for (k = 0; k < nelements; k++) {
+            if (i == k || clusterid[k]!=j) continue;
+            d += (i < k ? getdistance(distances, k, i)
+                        : getdistance(distances, i, k));
+            if (d > errors[j]) break;
+        }
+        if (d < errors[j]) {
+            errors[j] = d;
+            centroids[j] = i;
+        }
+    }
+}
+
+/* ********************************************************************* */
+
 void
 getclustermedoids(int nclusters, int nelements, double** distance,
     int clusterid[], int centroids[], double errors[])
@@ -2595,243 +3336,650 @@ centroid.
 ========================================================================
 */
 {
-    int i, j, k;
+    const Distances distances = {distance, NULL};
 
-    for (j = 0; j < nclusters; j++) errors[j] = DBL_MAX;
-    for (i = 0; i < nelements; i++) {
-        double d = 0.0;
-        j = clusterid[i];
-        for (k = 0; k < nelements; k++) {
-            if (i == k || clusterid[k]!=j) continue;
-            d += (i < k ? distance[k][i] : distance[i][k]);
-            if (d > errors[j]) break;
-        }
-        if (d < errors[j]) {
-            errors[j] = d;
-            centroids[j] = i;
-        }
-    }
+    find_medoids(nclusters, nelements, &distances, clusterid, centroids,
+                 errors);
 }
 
 /* ********************************************************************* */
 
 static int
-kmeans(int nclusters, int nrows, int ncolumns, double** data, int** mask,
-    double weight[], int transpose, int npass, char dist,
-    double** cdata, int** cmask, int clusterid[], double* error,
-    int tclusterid[], int counts[], int mapping[])
+kcluster_em(int nclusters, int nrows, int ncolumns, double** data, int** mask,
+    double weight[], int transpose, char method, char dist, int clusterid[],
+    double* error)
+/* Perform the EM algorithm for k-means (method == 'a') or k-medians
+ * (method == 'm') clustering, starting from the initial clustering stored in
+ * clusterid. Upon return, clusterid contains the clustering solution, and
+ * error the sum of distances to the cluster centers. This function returns 1
+ * if successful, and 0 if a memory error occurred.
+ *
+ * For the Euclidean and the city-block distance without missing data, the
+ * square root of the Euclidean distance and the city-block distance satisfy
+ * the triangle inequality. A lower bound on the distance of each element to
+ * the second-closest cluster center is then kept as in Hamerly's algorithm:
+ *
+ * Greg Hamerly
+ * Making k-means even faster
+ * Proceedings of the 2010 SIAM International Conference on Data Mining,
+ * pages 130-140.
+ *
+ * The distances to the other cluster centers are calculated only for elements
+ * whose distance to their own cluster center is not smaller than this bound.
+ * This gives the same clustering solution as calculating all distances. */
 {
     int i, j, k;
     const int nelements = (transpose == 0) ? nrows : ncolumns;
     const int ndata = (transpose == 0) ? ncolumns : nrows;
-    int ifound = 1;
-    int ipass = 0;
+    double total = DBL_MAX;
+    int counter = 0;
+    int period = 10;
+    int ok;
+    double** cdata;
+    int** cmask;
+    /* The number of elements in each cluster, which is needed to check for
+     * empty clusters */
+    int* counts;
+    /* Save the clustering solution periodically and check if it reappears */
+    int* saved;
+    double* cache = NULL;
+    /* Distances to the centroids, calculated with the blocked kernels if no
+     * data are missing */
+    int* index;
+    double* table;
+    int present, unmasked, blocked;
+    /* The lower bounds, and the previous cluster centers */
+    int bounded;
+    double* lower = NULL;
+    double** odata = NULL;
+    int** omask = NULL;
+    /* The elements in the current block whose distances to all cluster
+     * centers are needed, their row in table, and their distance to their
+     * own cluster center */
+    const int* scan;
+    int nscan;
+    int buffer[BLOCKSIZE];
+    int row[BLOCKSIZE];
+    double own[BLOCKSIZE];
     /* Set the metric function as indicated by dist */
     double (*metric) (int, double**, double**, int**, int**,
                       const double[], int, int, int) = setmetric(dist);
 
-    /* Save the clustering solution periodically and check if it reappears */
-    int* saved = malloc(nelements*sizeof(int));
-    if (saved == NULL) return -1;
+    /* Allocate space to store the centroid data */
+    if (transpose == 0) ok = makedatamask(nclusters, ndata, &cdata, &cmask);
+    else ok = makedatamask(ndata, nclusters, &cdata, &cmask);
+    if (!ok) return 0;
+    counts = malloc(nclusters*sizeof(int));
+    saved = malloc(nelements*sizeof(int));
+    if (method == 'm') cache = malloc(nelements*sizeof(double));
+    if (!counts || !saved || (method == 'm' && !cache)) {
+        if (counts) free(counts);
+        if (saved) free(saved);
+        if (cache) free(cache);
+        if (transpose == 0) freedatamask(nclusters, cdata, cmask);
+        else freedatamask(ndata, cdata, cmask);
+        return 0;
+    }
+    index = malloc(max(nelements, nclusters)*sizeof(int));
+    table = malloc(BLOCKSIZE*nclusters*sizeof(double));
+    if (index) {
+        for (i = 0; i < max(nelements, nclusters); i++) index[i] = i;
+        present = all_present(ndata, mask, nelements, index, transpose);
+    }
+    else present = 0;
+    unmasked = present && table && blocked_metric(dist);
+
+    bounded = present && (dist == 'e' || dist == 'b');
+    for (i = 0; bounded && i < ndata; i++) if (weight[i] < 0) bounded = 0;
+    if (bounded) {
+        lower = malloc(nelements*sizeof(double));
+        if (transpose == 0) ok = makedatamask(nclusters, ndata, &odata, &omask);
+        else ok = makedatamask(ndata, nclusters, &odata, &omask);
+        if (!ok) odata = NULL;
+        if (!lower || !odata) bounded = 0;
+        /* No bounds are known at the start */
+        else for (i = 0; i < nelements; i++) lower[i] = -1.0;
+    }
 
-    *error = DBL_MAX;
+    for (i = 0; i < nclusters; i++) counts[i] = 0;
+    for (i = 0; i < nelements; i++) counts[clusterid[i]]++;
 
-    do {
-        double total = DBL_MAX;
-        int counter = 0;
-        int period = 10;
+    /* Start the loop */
+    while (1) {
+        double previous = total;
+        total = 0.0;
 
-        /* Perform the EM algorithm.
-         * First, randomly assign elements to clusters. */
-        if (npass != 0) randomassign(nclusters, nelements, tclusterid);
+        if (counter % period == 0) {
+            /* Save the current cluster assignments */
+            for (i = 0; i < nelements; i++) saved[i] = clusterid[i];
+            if (period < INT_MAX / 2) period *= 2;
+        }
+        counter++;
+        blocked = unmasked;
 
-        for (i = 0; i < nclusters; i++) counts[i] = 0;
-        for (i = 0; i < nelements; i++) counts[tclusterid[i]]++;
+        /* Save the previous cluster centers */
+        if (bounded && counter > 1) {
+            if (transpose == 0)
+                for (j = 0; j < nclusters; j++) {
+                    memcpy(odata[j], cdata[j], ndata*sizeof(double));
+                    memcpy(omask[j], cmask[j], ndata*sizeof(int));
+                }
+            else
+                for (i = 0; i < ndata; i++) {
+                    memcpy(odata[i], cdata[i], nclusters*sizeof(double));
+                    memcpy(omask[i], cmask[i], nclusters*sizeof(int));
+                }
+        }
 
-        /* Start the loop */
-        while (1) {
-            double previous = total;
-            total = 0.0;
+        /* Find the center */
+        if (method == 'm')
+            getclustermedians(nclusters, nrows, ncolumns, data, mask,
+                              clusterid, cdata, cmask, transpose, cache);
+        else
+            getclustermeans(nclusters, nrows, ncolumns, data, mask,
+                            clusterid, cdata, cmask, transpose);
 
-            if (counter % period == 0) {
-                /* Save the current cluster assignments */
-                for (i = 0; i < nelements; i++) saved[i] = tclusterid[i];
-                if (period < INT_MAX / 2) period *= 2;
+        /* Lower the bounds by the largest distance moved by another cluster
+         * center, allowing for roundoff errors */
+        if (bounded && counter > 1) {
+            int jmax = 0;
+            double move1 = 0.0;
+            double move2 = 0.0;
+            for (j = 0; j < nclusters; j++) {
+                double move = metric(ndata, odata, cdata, omask, cmask, weight,
+                                     j, j, transpose);
+                if (dist == 'e') move = sqrt(move);
+                move *= 1.0 + 1e-14;
+                if (move > move1) {
+                    move2 = move1;
+                    move1 = move;
+                    jmax = j;
+                }
+                else if (move > move2) move2 = move;
             }
-            counter++;
-
-            /* Find the center */
-            getclustermeans(nclusters, nrows, ncolumns, data, mask, tclusterid,
-                            cdata, cmask, transpose);
-
             for (i = 0; i < nelements; i++) {
-                double distance;
-                /* Calculate the distances */
-                k = tclusterid[i];
-                if (counts[k] == 1) continue;
-                /* No reassignment if that would lead to an empty cluster */
-                /* Treat the present cluster as a special case */
-                distance = metric(ndata, data, cdata, mask, cmask, weight,
-                                  i, k, transpose);
-                for (j = 0; j < nclusters; j++) {
-                    double tdistance;
-                    if (j == k) continue;
-                    tdistance = metric(ndata, data, cdata, mask, cmask, weight,
-                                       i, j, transpose);
-                    if (tdistance < distance) {
-                        distance = tdistance;
-                        counts[tclusterid[i]]--;
-                        tclusterid[i] = j;
-                        counts[j]++;
-                    }
-                }
-                total += distance;
+                const double move = (clusterid[i] == jmax) ? move2 : move1;
+                lower[i] -= move + 1e-14 * (fabs(lower[i]) + move);
             }
-            if (total >= previous) break;
-            /* total >= previous is FALSE on some machines even if total and
-             * previous are bitwise identical. */
-            for (i = 0; i < nelements; i++)
-                if (saved[i]!=tclusterid[i]) break;
-            if (i == nelements)
-                break; /* Identical solution found; break out of this loop */
-        }
-
-        if (npass <= 1) {
-            *error = total;
-            break;
         }
 
-        for (i = 0; i < nclusters; i++) mapping[i] = -1;
         for (i = 0; i < nelements; i++) {
-            j = tclusterid[i];
+            double distance;
+            double second;
+            int r;
+            if (i % BLOCKSIZE == 0) {
+                const int n = min(BLOCKSIZE, nelements - i);
+                if (bounded) {
+                    /* Find the elements that may be closer to another
+                     * cluster center than to their own */
+                    nscan = 0;
+                    for (j = 0; j < n; j++) {
+                        const int ii = i + j;
+                        double upper;
+                        own[j] = metric(ndata, data, cdata, mask, cmask,
+                                        weight, ii, clusterid[ii], transpose);
+                        upper = (dist == 'e') ? sqrt(own[j]) : own[j];
+                        if (upper * (1.0 + 1e-14) < lower[ii]) row[j] = -1;
+                        else {
+                            row[j] = nscan;
+                            buffer[nscan++] = ii;
+                        }
+                    }
+                    scan = buffer;
+                }
+                else {
+                    for (j = 0; j < n; j++) row[j] = j;
+                    nscan = n;
+                    scan = index + i;
+                }
+                /* Calculate the distances */
+                if (blocked && nscan > 0)
+                    blocked = blocked_distances(dist, ndata, weight, transpose,
+                        data, NULL, nscan, scan, cdata, cmask, nclusters,
+                        index, table);
+            }
             k = clusterid[i];
-            if (mapping[k] == -1) mapping[k] = j;
-            else if (mapping[k] != j) {
-                if (total < *error) {
-                    ifound = 1;
-                    *error = total;
-                    for (j = 0; j < nelements; j++)
-                        clusterid[j] = tclusterid[j];
+            if (counts[k] == 1) continue;
+            /* No reassignment if that would lead to an empty cluster */
+            r = row[i % BLOCKSIZE];
+            if (r < 0) {
+                /* No other cluster center can be closer */
+                total += own[i % BLOCKSIZE];
+                continue;
+            }
+            /* Treat the present cluster as a special case */
+            if (blocked)
+                distance = table[r*nclusters+k];
+            else
+                distance = metric(ndata, data, cdata, mask, cmask, weight,
+                                  i, k, transpose);
+            second = DBL_MAX;
+            for (j = 0; j < nclusters; j++) {
+                double tdistance;
+                if (j == k) continue;
+                if (blocked)
+                    tdistance = table[r*nclusters+j];
+                else
+                    tdistance = metric(ndata, data, cdata, mask, cmask,
+                                       weight, i, j, transpose);
+                if (tdistance < distance) {
+                    second = distance;
+                    distance = tdistance;
+                    counts[clusterid[i]]--;
+                    clusterid[i] = j;
+                    counts[j]++;
                 }
-                break;
+                else if (tdistance < second) second = tdistance;
+            }
+            total += distance;
+            if (bounded) {
+                if (dist == 'e') second = sqrt(second);
+                lower[i] = second * (1.0 - 1e-14);
             }
         }
-        if (i == nelements) ifound++; /* break statement not encountered */
-    } while (++ipass < npass);
+        if (total >= previous) break;
+        /* total >= previous is FALSE on some machines even if total and
+         * previous are bitwise identical. */
+        for (i = 0; i < nelements; i++)
+            if (saved[i]!=clusterid[i]) break;
+        if (i == nelements)
+            break; /* Identical solution found; break out of this loop */
+    }
+    *error = total;
 
     free(saved);
-    return ifound;
-}
+    free(counts);
+    if (cache) free(cache);
+    if (index) free(index);
+    if (table) free(table);
+    if (lower) free(lower);
+    if (odata) {
+        if (transpose == 0) freedatamask(nclusters, odata, omask);
+        else freedatamask(ndata, odata, omask);
+    }
+    if (transpose == 0) freedatamask(nclusters, cdata, cmask);
+    else freedatamask(ndata, cdata, cmask);
+    return 1;
+}
 
 /* ---------------------------------------------------------------------- */
 
-static int
-kmedians(int nclusters, int nrows, int ncolumns, double** data, int** mask,
-    double weight[], int transpose, int npass, char dist,
-    double** cdata, int** cmask, int clusterid[], double* error,
-    int tclusterid[], int counts[], int mapping[], double cache[])
+typedef struct {
+    int ndata;
+    double** data;
+    int** mask;
+    int present;  /* nonzero if no data are missing */
+    const double* weight;
+    int transpose;
+    char dist;
+} Items;
+/* The items to be clustered, as needed to calculate their distances while
+ * choosing the initial cluster centers. */
+
+static void
+update_closest(const Items* items, int n, const int index[], int ncenters,
+    const int centers[], int first, double closest[], int nearest[])
+/* For each of the items index[0], ..., index[n-1], check if one of the items
+ * centers[0], ..., centers[ncenters-1] is closer than closest[i]; if so, store
+ * its distance in closest[i] and first plus its number in nearest[i]. The
+ * distances are calculated with the blocked kernels if possible. */
 {
     int i, j, k;
-    const int nelements = (transpose == 0) ? nrows : ncolumns;
-    const int ndata = (transpose == 0) ? ncolumns : nrows;
-    int ifound = 1;
-    int ipass = 0;
-    int* saved;
-    /* Set the metric function as indicated by dist */
+    double* table = NULL;
     double (*metric) (int, double**, double**, int**, int**,
-                      const double[], int, int, int) = setmetric(dist);
+                      const double[], int, int, int) = setmetric(items->dist);
+
+    if (items->present && blocked_metric(items->dist))
+        table = malloc(BLOCKSIZE*ncenters*sizeof(double));
+    for (i = 0; i < n; i += BLOCKSIZE) {
+        const int m = min(BLOCKSIZE, n - i);
+        if (table && !blocked_distances(items->dist, items->ndata,
+                                        items->weight, items->transpose,
+                                        items->data, NULL, m, index + i,
+                                        items->data, NULL, ncenters, centers,
+                                        table)) {
+            free(table);
+            table = NULL;
+        }
+        for (k = 0; k < m; k++) {
+            for (j = 0; j < ncenters; j++) {
+                const double d = table ? table[k*ncenters+j]
+                               : metric(items->ndata, items->data, items->data,
+                                        items->mask, items->mask,
+                                        items->weight, index[i+k], centers[j],
+                                        items->transpose);
+                if (d < closest[i+k]) {
+                    closest[i+k] = d;
+                    nearest[i+k] = first + j;
+                }
+            }
+        }
+    }
+    if (table) free(table);
+}
 
-    /* Save the clustering solution periodically and check if it reappears */
-    saved = malloc(nelements*sizeof(int));
-    if (saved == NULL) return -1;
+static int
+choose_centers(Random* random, const Items* items, int nclusters, int n,
+    const int index[], const double weights[], int centers[], int nearest[])
+/* Choose nclusters of the n items index[0], ..., index[n-1] as cluster
+ * centers using k-means++. The first center is chosen with a probability
+ * proportional to the weight of each item, and each next center with a
+ * probability proportional to its weight times its distance to the closest
+ * center chosen so far. If weights is NULL, all items have equal weight.
+ * Upon return, centers contains the chosen items, and nearest[i] the number of
+ * the center closest to item index[i]. Returns 0 if a memory error occurred.
+ */
+{
+    int i, j;
+    double total;
+    double* closest = malloc(n*sizeof(double));
+    char* chosen = malloc(n);
+
+    if (!closest || !chosen) {
+        if (closest) free(closest);
+        if (chosen) free(chosen);
+        return 0;
+    }
+    for (i = 0; i < n; i++) {
+        closest[i] = DBL_MAX;
+        chosen[i] = 0;
+        nearest[i] = 0;
+    }
+    for (j = 0; j < nclusters; j++) {
+        /* Use the weighted distance to the closest center as the probability
+         * of choosing each item; for the first center, use the weight only */
+        int k = -1;
+        total = 0.0;
+        for (i = 0; i < n; i++) {
+            double p;
+            if (chosen[i]) continue;
+            p = weights ? weights[i] : 1.0;
+            if (j > 0) p *= closest[i];
+            if (p > 0) total += p;
+        }
+        if (total > 0) {
+            double u = total * uniform(random);
+            for (i = 0; i < n; i++) {
+                double p;
+                if (chosen[i]) continue;
+                p = weights ? weights[i] : 1.0;
+                if (j > 0) p *= closest[i];
+                if (p <= 0) continue;
+                k = i;
+                u -= p;
+                if (u < 0) break;
+            }
+        }
+        else {
+            /* All remaining items coincide with a center; choose one of them
+             * at random */
+            int m = (int) ((n - j) * uniform(random));
+            for (i = 0; i < n; i++) {
+                if (chosen[i]) continue;
+                k = i;
+                if (m-- == 0) break;
+            }
+        }
+        if (k < 0) break; /* Only if n < nclusters, which should not occur */
+        chosen[k] = 1;
+        centers[j] = index[k];
+        update_closest(items, n, index, 1, &centers[j], j, closest, nearest);
+    }
+    free(closest);
+    free(chosen);
+    return 1;
+}
 
-    *error = DBL_MAX;
+static int
+initialcenters(Random* random, char initialization, int nclusters,
+    int nrows, int ncolumns, double** data, int** mask, const double weight[],
+    int transpose, char dist, int clusterid[])
+/*
+Purpose
+=======
 
-    do {
-        double total = DBL_MAX;
-        int counter = 0;
-        int period = 10;
+The initialcenters routine chooses nclusters elements as the initial cluster
+centers for k-means or k-median clustering, and assigns each element to the
+cluster of the closest center. For initialization == '+', the centers are
+chosen by k-means++:
 
-        /* Perform the EM algorithm.
-         * First, randomly assign elements to clusters. */
-        if (npass != 0) randomassign(nclusters, nelements, tclusterid);
+David Arthur and Sergei Vassilvitskii
+k-means++: The Advantages of Careful Seeding
+Proceedings of the Eighteenth Annual ACM-SIAM Symposium on Discrete
+Algorithms, 2007, pages 1027-1035.
 
-        for (i = 0; i < nclusters; i++) counts[i] = 0;
-        for (i = 0; i < nelements; i++) counts[tclusterid[i]]++;
+Each next center is chosen with a probability proportional to the distance to
+the closest center chosen so far. As the Euclidean distance in this library is
+the mean squared difference, this corresponds to the squared distance in the
+description of k-means++.
 
-        /* Start the loop */
-        while (1) {
-            double previous = total;
-            total = 0.0;
+For initialization == '|', the centers are chosen by k-means||:
 
-            if (counter % period == 0) {
-                /* Save the current cluster assignments */
-                for (i = 0; i < nelements; i++) saved[i] = tclusterid[i];
-                if (period < INT_MAX / 2) period *= 2;
-            }
-            counter++;
+Bahman Bahmani, Benjamin Moseley, Andrea Vattani, Ravi Kumar, and
+Sergei Vassilvitskii
+Scalable K-Means++
+Proceedings of the VLDB Endowment, Volume 5, Number 7, 2012, pages 622-633.
 
-            /* Find the center */
-            getclustermedians(nclusters, nrows, ncolumns, data, mask,
-                              tclusterid, cdata, cmask, transpose, cache);
+In each of five rounds, each element is chosen as a candidate center
+independently, with a probability equal to 2*nclusters times its distance to
+the closest candidate divided by the sum of these distances. The candidates
+are then weighted by the number of elements closest to them, and reduced to
+nclusters centers by k-means++.
 
-            for (i = 0; i < nelements; i++) {
-                /* Calculate the distances */
-                double distance;
-                k = tclusterid[i];
-                if (counts[k] == 1) continue;
-                /* No reassignment if that would lead to an empty cluster */
-                /* Treat the present cluster as a special case */
-                distance = metric(ndata, data, cdata, mask, cmask, weight,
-                                  i, k, transpose);
-                for (j = 0; j < nclusters; j++) {
-                    double tdistance;
-                    if (j == k) continue;
-                    tdistance = metric(ndata, data, cdata, mask, cmask, weight,
-                                       i, j, transpose);
-                    if (tdistance < distance) {
-                        distance = tdistance;
-                        counts[tclusterid[i]]--;
-                        tclusterid[i] = j;
-                        counts[j]++;
-                    }
-                }
-                total += distance;
-            }
-            if (total >= previous) break;
-            /* total >= previous is FALSE on some machines even if total and
-             * previous are bitwise identical. */
-            for (i = 0; i < nelements; i++)
-                if (saved[i]!=tclusterid[i]) break;
-            if (i == nelements)
-                break; /* Identical solution found; break out of this loop */
-        }
+Arguments
+=========
 
-        if (npass <= 1) {
-            *error = total;
-            break;
-        }
+random, initialization
+The state of the random number generator, and the initialization method.
+
+nclusters, nrows, ncolumns, data, mask, weight, transpose, dist
+See kcluster. The number of clusters should not be larger than the number of
+elements.
+
+clusterid  (output) int[nrows] if transpose == 0
+                    int[ncolumns] otherwise
+The cluster number to which each element was assigned. Each cluster contains
+at least its center.
+
+Return value
+============
+
+If no errors occur, initialcenters returns 1.
+If a memory error occurs, initialcenters returns 0.
+
+========================================================================
+*/
+{
+    const int nelements = (transpose == 0) ? nrows : ncolumns;
+    const int nrounds = 5;
+    const double oversampling = 2.0 * nclusters;
+    int i, j, k, round;
+    int ok = 0;
+    int ncandidates;
+    Items items;
+    int* index = malloc(nelements*sizeof(int));
+    int* centers = malloc(nclusters*sizeof(int));
+    int* candidates = NULL;
+    int* nearest = NULL;
+    double* closest = NULL;
+    double* weights = NULL;
+    char* chosen = NULL;
+
+    if (!index || !centers) goto exit;
+    for (i = 0; i < nelements; i++) index[i] = i;
+    items.ndata = (transpose == 0) ? ncolumns : nrows;
+    items.data = data;
+    items.mask = mask;
+    items.present = all_present(items.ndata, mask, nelements, index,
+                                transpose);
+    items.weight = weight;
+    items.transpose = transpose;
+    items.dist = dist;
+
+    if (initialization == '+') {
+        ok = choose_centers(random, &items, nclusters, nelements, index, NULL,
+                            centers, clusterid);
+        goto exit;
+    }
 
-        for (i = 0; i < nclusters; i++) mapping[i] = -1;
+    candidates = malloc(nelements*sizeof(int));
+    nearest = malloc(nelements*sizeof(int));
+    closest = malloc(nelements*sizeof(double));
+    chosen = malloc(nelements);
+    if (!candidates || !nearest || !closest || !chosen) goto exit;
+
+    /* Start from one element chosen at random */
+    for (i = 0; i < nelements; i++) chosen[i] = 0;
+    k = (int) (nelements * uniform(random));
+    candidates[0] = k;
+    chosen[k] = 1;
+    ncandidates = 1;
+    for (i = 0; i < nelements; i++) closest[i] = DBL_MAX;
+    update_closest(&items, nelements, index, 1, candidates, 0, closest,
+                   nearest);
+
+    for (round = 0; round < nrounds; round++) {
+        const int first = ncandidates;
+        double total = 0.0;
+        for (i = 0; i < nelements; i++)
+            if (!chosen[i] && closest[i] > 0) total += closest[i];
+        if (total <= 0) break;
+        /* Sample the new candidates independently of each other */
         for (i = 0; i < nelements; i++) {
-            j = tclusterid[i];
-            k = clusterid[i];
-            if (mapping[k] == -1) mapping[k] = j;
-            else if (mapping[k] != j) {
-                if (total < *error) {
-                    ifound = 1;
-                    *error = total;
-                    for (j = 0; j < nelements; j++)
-                        clusterid[j] = tclusterid[j];
-                }
-                break;
+            if (chosen[i] || closest[i] <= 0) continue;
+            if (uniform(random) * total < oversampling * closest[i]) {
+                candidates[ncandidates++] = i;
+                chosen[i] = 1;
             }
         }
-        if (i == nelements) ifound++; /* break statement not encountered */
-    } while (++ipass < npass);
+        update_closest(&items, nelements, index, ncandidates - first,
+                       candidates + first, first, closest, nearest);
+    }
+    /* If too few candidates were found, add elements chosen at random */
+    while (ncandidates < nclusters) {
+        int m = (int) ((nelements - ncandidates) * uniform(random));
+        for (i = 0; i < nelements; i++) {
+            if (chosen[i]) continue;
+            k = i;
+            if (m-- == 0) break;
+        }
+        candidates[ncandidates] = k;
+        chosen[k] = 1;
+        update_closest(&items, nelements, index, 1, candidates + ncandidates,
+                       ncandidates, closest, nearest);
+        ncandidates++;
+    }
+    /* A candidate is always closest to itself */
+    for (j = 0; j < ncandidates; j++) nearest[candidates[j]] = j;
+
+    /* Weight each candidate by the number of elements closest to it, and
+     * choose the cluster centers among the candidates */
+    weights = malloc(ncandidates*sizeof(double));
+    if (!weights) goto exit;
+    for (j = 0; j < ncandidates; j++) weights[j] = 0.0;
+    for (i = 0; i < nelements; i++) weights[nearest[i]]++;
+    if (!choose_centers(random, &items, nclusters, ncandidates, candidates,
+                        weights, centers, nearest)) goto exit;
+
+    /* Assign each element to the closest center */
+    for (i = 0; i < nelements; i++) closest[i] = DBL_MAX;
+    update_closest(&items, nelements, index, nclusters, centers, 0, closest,
+                   clusterid);
+    ok = 1;
+
+exit:
+    /* Make sure that no cluster is empty */
+    if (ok) for (j = 0; j < nclusters; j++) clusterid[centers[j]] = j;
+    if (index) free(index);
+    if (centers) free(centers);
+    if (candidates) free(candidates);
+    if (nearest) free(nearest);
+    if (closest) free(closest);
+    if (weights) free(weights);
+    if (chosen) free(chosen);
+    return ok;
+}
 
-    free(saved);
-    return ifound;
+/* ---------------------------------------------------------------------- */
+
+int
+kcluster_pass(int nclusters, int nrows, int ncolumns, double** data,
+    int** mask, double weight[], int transpose, char method, char dist,
+    char initialization, unsigned long long seed, int ipass, int clusterid[],
+    double* error)
+/*
+Purpose
+=======
+
+The kcluster_pass routine performs a single pass of k-means or k-median
+clustering, starting from a random initial assignment of elements to clusters,
+or from initial cluster centers chosen by k-means++ or k-means||.
+The random numbers are taken from the stream identified by seed and ipass, so
+that each pass can be run independently, in any order or concurrently, and
+gives the same result for the same seed and ipass. The kcluster routine
+performs npass such passes and selects the best clustering solution.
+
+Arguments
+=========
+
+nclusters, nrows, ncolumns, data, mask, weight, transpose, method, dist
+See kcluster. The number of clusters should not be larger than the number of
+elements.
+
+initialization (input) char
+Defines how the initial clustering is chosen:
+initialization == 'r': each element is assigned to a random cluster;
+initialization == '+': the cluster centers are chosen by k-means++;
+initialization == '|': the cluster centers are chosen by k-means||.
+See initialcenters for k-means++ and k-means||.
+
+seed       (input) unsigned long long
+The seed of the random number generator.
+
+ipass      (input) int
+The number of the pass, which selects an independent stream of random numbers.
+
+clusterid  (output) int[nrows] if transpose == 0
+                    int[ncolumns] otherwise
+The cluster number to which each element was assigned.
+
+error      (output) double*
+The sum of distances to the cluster center of each item in the clustering
+solution that was found.
+
+Return value
+============
+
+If no errors occur, kcluster_pass returns 1.
+If a memory error occurs, kcluster_pass returns 0.
+
+========================================================================
+*/
+{
+    const int nelements = (transpose == 0) ? nrows : ncolumns;
+    Random random;
+
+    if (transpose) {
+        /* Cluster the rows of a transposed copy of the data */
+        Matrix matrix;
+        int ok;
+        if (!transposedmatrix(&matrix, data, mask, nrows, 0, ncolumns))
+            return 0;
+        ok = kcluster_pass(nclusters, matrix.nrows, matrix.ncols, matrix.rows,
+                           matrix.maskrows, weight, 0, method, dist,
+                           initialization, seed, ipass, clusterid, error);
+        freematrix(&matrix);
+        return ok;
+    }
+    initrandom(&random, seed, ipass);
+    if (initialization == '+' || initialization == '|') {
+        if (!initialcenters(&random, initialization, nclusters, nrows,
+                            ncolumns, data, mask, weight, transpose, dist,
+                            clusterid)) return 0;
+    }
+    else randomassign(&random, nclusters, nelements, clusterid);
+    return kcluster_em(nclusters, nrows, ncolumns, data, mask, weight,
+                       transpose, method, dist, clusterid, error);
 }
 
 /* ********************************************************************* */
@@ -2884,7 +4032,8 @@ npass      (input) int
 The number of times clustering is performed. Clustering is performed npass
 times, each time starting from a different (random) initial assignment of
 genes to clusters. The clustering solution with the lowest within-cluster sum
-of distances is chosen.
+of distances is chosen. The random number generator is seeded with the current
+time; use kcluster_pass to run the passes with a given seed.
 If npass == 0, then the clustering algorithm will be run once, where the
 initial assignment of elements to clusters is taken from the clusterid array.
 
@@ -2926,15 +4075,12 @@ number of clusters is larger than the number of elements being clustered,
 */
 {
     const int nelements = (transpose == 0) ? nrows : ncolumns;
-    const int ndata = (transpose == 0) ? ncolumns : nrows;
-
-    int i;
-    int ok;
+    int i, j, k;
+    int ipass;
+    double total;
     int* tclusterid;
-    int* mapping = NULL;
-    double** cdata;
-    int** cmask;
-    int* counts;
+    int* mapping;
+    unsigned long long seed;
 
     if (nelements < nclusters) {
         *ifound = 0;
@@ -2944,64 +4090,269 @@ number of clusters is larger than the number of elements being clustered,
 
     *ifound = -1;
 
-    /* This will contain the number of elements in each cluster, which is
-     * needed to check for empty clusters. */
-    counts = malloc(nclusters*sizeof(int));
-    if (!counts) return;
-
-    /* Find out if the user specified an initial clustering */
-    if (npass <= 1) tclusterid = clusterid;
-    else {
-        tclusterid = malloc(nelements*sizeof(int));
-        if (!tclusterid) {
-            free(counts);
+    if (transpose) {
+        /* Cluster the rows of a transposed copy of the data */
+        Matrix matrix;
+        if (!transposedmatrix(&matrix, data, mask, nrows, 0, ncolumns))
             return;
+        kcluster(nclusters, matrix.nrows, matrix.ncols, matrix.rows,
+                 matrix.maskrows, weight, 0, npass, method, dist, clusterid,
+                 error, ifound);
+        freematrix(&matrix);
+        return;
+    }
+
+    /* Start from the initial clustering specified by the user */
+    if (npass == 0) {
+        if (kcluster_em(nclusters, nrows, ncolumns, data, mask, weight,
+                        transpose, method, dist, clusterid, error))
+            *ifound = 1;
+        return;
+    }
+
+    tclusterid = malloc(nelements*sizeof(int));
+    if (!tclusterid) return;
+    mapping = malloc(nclusters*sizeof(int));
+    if (!mapping) {
+        free(tclusterid);
+        return;
+    }
+
+    seed = (unsigned long long) time(0);
+    for (ipass = 0; ipass < npass; ipass++) {
+        if (!kcluster_pass(nclusters, nrows, ncolumns, data, mask, weight,
+                           transpose, method, dist, 'r', seed, ipass,
+                           tclusterid, &total)) {
+            *ifound = -1;
+            break;
         }
-        mapping = malloc(nclusters*sizeof(int));
-        if (!mapping) {
-            free(counts);
-            free(tclusterid);
-            return;
+        if (ipass > 0) {
+            /* Check if this solution is identical to the best one so far */
+            for (i = 0; i < nclusters; i++) mapping[i] = -1;
+            for (i = 0; i < nelements; i++) {
+                j = tclusterid[i];
+                k = clusterid[i];
+                if (mapping[k] == -1) mapping[k] = j;
+                else if (mapping[k] != j) break;
+            }
+            if (i == nelements) {
+                (*ifound)++;
+                continue;
+            }
+            if (total >= *error) continue;
         }
-        for (i = 0; i < nelements; i++) clusterid[i] = 0;
+        *ifound = 1;
+        *error = total;
+        for (i = 0; i < nelements; i++) clusterid[i] = tclusterid[i];
     }
 
-    /* Allocate space to store the centroid data */
-    if (transpose == 0) ok = makedatamask(nclusters, ndata, &cdata, &cmask);
-    else ok = makedatamask(ndata, nclusters, &cdata, &cmask);
-    if (!ok) {
-        free(counts);
-        if (npass>1) {
-            free(tclusterid);
-            free(mapping);
-        }
-        return;
+    free(mapping);
+    free(tclusterid);
+}
+
+/* *********************************************************************** */
+
+static int
+kmedoids_em(int nclusters, int nelements, const Distances* distances,
+    int clusterid[], double* error)
+/* Perform the EM algorithm for k-medoids clustering, starting from the initial
+ * clustering stored in clusterid. Upon return, clusterid contains for each
+ * element the number of the element that is the centroid of its cluster, and
+ * error the sum of distances to the cluster centroids. This function returns
+ * 1 if successful, and 0 if a memory error occurred. */
+{
+    int i, j, icluster;
+    int* saved;
+    int* centroids;
+    double* errors;
+    double total = DBL_MAX;
+    int counter = 0;
+    int period = 10;
+
+    /* Save the clustering solution periodically and check if it reappears */
+    saved = malloc(nelements*sizeof(int));
+    if (saved == NULL) return 0;
+
+    centroids = malloc(nclusters*sizeof(int));
+    if (!centroids) {
+        free(saved);
+        return 0;
     }
 
-    if (method == 'm') {
-        double* cache = malloc(nelements*sizeof(double));
-        if (cache) {
-            *ifound = kmedians(nclusters, nrows, ncolumns, data, mask, weight,
-                               transpose, npass, dist, cdata, cmask, clusterid,
-                               error, tclusterid, counts, mapping, cache);
-            free(cache);
+    errors = malloc(nclusters*sizeof(double));
+    if (!errors) {
+        free(saved);
+        free(centroids);
+        return 0;
+    }
+
+    while (1) {
+        double previous = total;
+        total = 0.0;
+
+        if (counter % period == 0) {
+            /* Save the current cluster assignments */
+            for (i = 0; i < nelements; i++) saved[i] = clusterid[i];
+            if (period < INT_MAX / 2) period *= 2;
+        }
+        counter++;
+
+        /* Find the center */
+        find_medoids(nclusters, nelements, distances, clusterid,
+                     centroids, errors);
+
+        for (i = 0; i < nelements; i++) {
+            /* Find the closest cluster */
+            double distance = DBL_MAX;
+            for (icluster = 0; icluster < nclusters; icluster++) {
+                double tdistance;
+                j = centroids[icluster];
+                if (i == j) {
+                    distance = 0.0;
+                    clusterid[i] = icluster;
+                    break;
+                }
+                tdistance = (i > j) ? getdistance(distances, i, j)
+                                    : getdistance(distances, j, i);
+                if (tdistance < distance) {
+                    distance = tdistance;
+                    clusterid[i] = icluster;
+                }
+            }
+            total += distance;
         }
+        if (total >= previous) break;
+        /* total >= previous is FALSE on some machines even if total and
+         * previous are bitwise identical. */
+        for (i = 0; i < nelements; i++)
+            if (saved[i] != clusterid[i]) break;
+        if (i == nelements)
+            break; /* Identical solution found; break out of this loop */
     }
-    else
-        *ifound = kmeans(nclusters, nrows, ncolumns, data, mask, weight,
-                         transpose, npass, dist, cdata, cmask, clusterid,
-                         error, tclusterid, counts, mapping);
+    *error = total;
 
-    /* Deallocate temporarily used space */
-    if (npass > 1) {
-        free(mapping);
-        free(tclusterid);
+    /* Replace by the centroid in each cluster. */
+    for (i = 0; i < nelements; i++) clusterid[i] = centroids[clusterid[i]];
+
+    free(saved);
+    free(centroids);
+    free(errors);
+    return 1;
+}
+
+/* ---------------------------------------------------------------------- */
+
+int
+kmedoids_pass(int nclusters, int nelements, const Distances* distances,
+    unsigned long long seed, int ipass, int clusterid[], double* error)
+/*
+Purpose
+=======
+
+The kmedoids_pass routine performs a single pass of k-medoids clustering,
+starting from a random initial assignment of elements to clusters. As for
+kcluster_pass, the random numbers are taken from the stream identified by seed
+and ipass. The kmedoids routine performs npass such passes and selects the
+best clustering solution.
+
+Arguments
+=========
+
+nclusters  (input) int
+The number of clusters to be found. This should not be larger than the number
+of elements.
+
+nelements  (input) int
+The number of elements to be clustered.
+
+distances  (input) const Distances*
+The distance matrix, stored in double or in single precision.
+
+seed       (input) unsigned long long
+The seed of the random number generator.
+
+ipass      (input) int
+The number of the pass, which selects an independent stream of random numbers.
+
+clusterid  (output) int[nelements]
+The number of the element that is the centroid of the cluster to which each
+element was assigned.
+
+error      (output) double*
+The sum of distances to the cluster centroid of each item in the clustering
+solution that was found.
+
+Return value
+============
+
+If no errors occur, kmedoids_pass returns 1.
+If a memory error occurs, kmedoids_pass returns 0.
+
+========================================================================
+*/
+{
+    Random random;
+
+    initrandom(&random, seed, ipass);
+    randomassign(&random, nclusters, nelements, clusterid);
+    return kmedoids_em(nclusters, nelements, distances, clusterid, error);
+}
+
+/* ---------------------------------------------------------------------- */
+
+static void
+kmedoids_distances(int nclusters, int nelements, const Distances* distances,
+    int npass, int clusterid[], double* error, int* ifound)
+/* This function implements kmedoids for a distance matrix stored in double or
+ * in single precision.
+ */
+{
+    int i;
+    int ipass;
+    double total;
+    int* tclusterid;
+    unsigned long long seed;
+
+    if (nelements < nclusters) {
+        *ifound = 0;
+        return;
+    } /* More clusters asked for than elements available */
+
+    *ifound = -1;
+
+    /* Start from the initial clustering specified by the user */
+    if (npass == 0) {
+        if (kmedoids_em(nclusters, nelements, distances, clusterid, error))
+            *ifound = 1;
+        return;
     }
 
-    if (transpose == 0) freedatamask(nclusters, cdata, cmask);
-    else freedatamask(ndata, cdata, cmask);
+    tclusterid = malloc(nelements*sizeof(int));
+    if (!tclusterid) return;
 
-    free(counts);
+    seed = (unsigned long long) time(0);
+    for (ipass = 0; ipass < npass; ipass++) {
+        if (!kmedoids_pass(nclusters, nelements, distances, seed, ipass,
+                           tclusterid, &total)) {
+            *ifound = -1;
+            break;
+        }
+        if (ipass > 0) {
+            /* Check if this solution is identical to the best one so far */
+            for (i = 0; i < nelements; i++)
+                if (clusterid[i] != tclusterid[i]) break;
+            if (i == nelements) {
+                (*ifound)++;
+                continue;
+            }
+            if (total >= *error) continue;
+        }
+        *ifound = 1;
+        *error = total;
+        for (i = 0; i < nelements; i++) clusterid[i] = tclusterid[i];
+    }
+
+    free(tclusterid);
 }
 
 /* *********************************************************************** */
@@ -3038,7 +4389,8 @@ npass      (input) int
 The number of times clustering is performed. Clustering is performed npass
 times, each time starting from a different (random) initial assignment of genes
 to clusters. The clustering solution with the lowest within-cluster sum of
-distances is chosen.
+distances is chosen. The random number generator is seeded with the current
+time; use kmedoids_pass to run the passes with a given seed.
 If npass == 0, then the clustering algorithm will be run once, where the
 initial assignment of elements to clusters is taken from the clusterid array.
 
@@ -3058,139 +4410,41 @@ k-medoids clustering solution that was found.
 
 ifound     (output) int
 If kmedoids is successful: the number of times the optimal clustering solution
-was found. The value of ifound is at least 1; its maximum value is npass.
-If the user requested more clusters than elements available, ifound is set
-to 0. If kmedoids fails due to a memory allocation error, ifound is set to -1.
-
-========================================================================
-*/
-{
-    int i, j, icluster;
-    int* tclusterid;
-    int* saved;
-    int* centroids;
-    double* errors;
-    int ipass = 0;
-
-    if (nelements < nclusters) {
-        *ifound = 0;
-        return;
-    } /* More clusters asked for than elements available */
-
-    *ifound = -1;
-
-    /* Save the clustering solution periodically and check if it reappears */
-    saved = malloc(nelements*sizeof(int));
-    if (saved == NULL) return;
-
-    centroids = malloc(nclusters*sizeof(int));
-    if (!centroids) {
-        free(saved);
-        return;
-    }
-
-    errors = malloc(nclusters*sizeof(double));
-    if (!errors) {
-        free(saved);
-        free(centroids);
-        return;
-    }
-
-    /* Find out if the user specified an initial clustering */
-    if (npass <= 1) tclusterid = clusterid;
-    else {
-        tclusterid = malloc(nelements*sizeof(int));
-        if (!tclusterid) {
-            free(saved);
-            free(centroids);
-            free(errors);
-            return;
-        }
-        for (i = 0; i < nelements; i++) clusterid[i] = -1;
-    }
-
-    *error = DBL_MAX;
-    do /* Start the loop */ {
-        double total = DBL_MAX;
-        int counter = 0;
-        int period = 10;
-
-        if (npass != 0) randomassign(nclusters, nelements, tclusterid);
-        while (1) {
-            double previous = total;
-            total = 0.0;
+was found. The value of ifound is at least 1; its maximum value is npass.
+If the user requested more clusters than elements available, ifound is set
+to 0. If kmedoids fails due to a memory allocation error, ifound is set to -1.
 
-            if (counter % period == 0) {
-                /* Save the current cluster assignments */
-                for (i = 0; i < nelements; i++) saved[i] = tclusterid[i];
-                if (period < INT_MAX / 2) period *= 2;
-            }
-            counter++;
+========================================================================
+*/
+{
+    const Distances distances = {distmatrix, NULL};
 
-            /* Find the center */
-            getclustermedoids(nclusters, nelements, distmatrix, tclusterid,
-                              centroids, errors);
+    kmedoids_distances(nclusters, nelements, &distances, npass, clusterid,
+                       error, ifound);
+}
 
-            for (i = 0; i < nelements; i++) {
-                /* Find the closest cluster */
-                double distance = DBL_MAX;
-                for (icluster = 0; icluster < nclusters; icluster++) {
-                    double tdistance;
-                    j = centroids[icluster];
-                    if (i == j) {
-                        distance = 0.0;
-                        tclusterid[i] = icluster;
-                        break;
-                    }
-                    tdistance = (i > j) ? distmatrix[i][j] : distmatrix[j][i];
-                    if (tdistance < distance) {
-                        distance = tdistance;
-                        tclusterid[i] = icluster;
-                    }
-                }
-                total += distance;
-            }
-            if (total >= previous) break;
-            /* total >= previous is FALSE on some machines even if total and
-             * previous are bitwise identical. */
-            for (i = 0; i < nelements; i++)
-                if (saved[i] != tclusterid[i]) break;
-            if (i == nelements)
-                break; /* Identical solution found; break out of this loop */
-        }
+/* *********************************************************************** */
 
-        if (npass <= 1) {
-            *ifound = 1;
-            *error = total;
-            /* Replace by the centroid in each cluster. */
-            for (j = 0; j < nelements; j++) {
-                clusterid[j] = centroids[tclusterid[j]];
-            }
-            break;
-        }
+void
+kmedoidsf(int nclusters, int nelements, float** distmatrix, int npass,
+    int clusterid[], double* error, int* ifound)
+/*
+Purpose
+=======
 
-        for (i = 0; i < nelements; i++) {
-            if (clusterid[i]!=centroids[tclusterid[i]]) {
-                if (total < *error) {
-                    *ifound = 1;
-                    *error = total;
-                    /* Replace by the centroid in each cluster. */
-                    for (j = 0; j < nelements; j++) {
-                        clusterid[j] = centroids[tclusterid[j]];
-                    }
-                }
-                break;
-            }
-        }
-        if (i == nelements) (*ifound)++; /* break statement not encountered */
-    } while (++ipass < npass);
+The kmedoidsf routine is identical to kmedoids, except that the distance
+matrix distmatrix is stored in single precision. Each row of distmatrix may
+point into a single contiguous block storing the condensed distance matrix,
+as allocated by allocate_distances; this halves the memory needed for the
+distance matrix compared to kmedoids.
 
-    /* Deallocate temporarily used space */
-    if (npass > 1) free(tclusterid);
+========================================================================
+*/
+{
+    const Distances distances = {NULL, distmatrix};
 
-    free(saved);
-    free(centroids);
-    free(errors);
+    kmedoids_distances(nclusters, nelements, &distances, npass, clusterid,
+                       error, ifound);
 }
 
 /* ******************************************************************** */
@@ -3265,18 +4519,152 @@ the distance matrix are stored in this array.
 {
     /* First determine the size of the distance matrix */
     const int n = (transpose == 0) ? nrows : ncolumns;
+
+    const Distances distances = {matrix, NULL};
+
+    distancematrix_tile(nrows, ncolumns, data, mask, weights, dist, transpose,
+                        0, n, 0, n, &distances);
+}
+
+/* ******************************************************************** */
+
+void
+distancematrix_tile(int nrows, int ncolumns, double** data, int** mask,
+    double weights[], char dist, int transpose, int firstrow, int lastrow,
+    int firstcolumn, int lastcolumn, const Distances* distances)
+/*
+Purpose
+=======
+
+The distancematrix_tile routine calculates the distances in a rectangular
+block of the lower triangular part of the distance matrix. Distances are
+calculated for rows firstrow <= i < lastrow and columns firstcolumn <= j <
+lastcolumn with j < i < n, where n is the number of rows or columns being
+compared; other elements of the distance matrix are not accessed. As different
+blocks write to different elements, they can be calculated concurrently in
+different threads.
+
+Arguments
+=========
+
+nrows, ncolumns, data, mask, weights, dist, transpose
+See distancematrix.
+
+firstrow, lastrow (input) int
+The range of rows of the distance matrix to be calculated.
+
+firstcolumn, lastcolumn (input) int
+The range of columns of the distance matrix to be calculated.
+
+distances  (output) const Distances*
+The distance matrix, stored in double or in single precision; see
+allocate_distances. Upon return, the distances in the block are stored in it.
+
+========================================================================
+*/
+{
+    const int n = (transpose == 0) ? nrows : ncolumns;
     const int ndata = (transpose == 0) ? ncolumns : nrows;
-    int i, j;
+    int i, j, i1, j1, n1, n2;
+    int index1[BLOCKSIZE];
+    int index2[BLOCKSIZE];
+    char present1[BLOCKSIZE];
+    char present2[BLOCKSIZE];
+    double block[BLOCKSIZE*BLOCKSIZE];
+    int blocked = blocked_metric(dist);
+    /* The items in the rows and in the columns of the tile */
+    double** data1 = data;
+    double** data2 = data;
+    int** mask1 = mask;
+    int** mask2 = mask;
+    int offset1 = 0;
+    int offset2 = 0;
+    Matrix matrix1 = {0};
+    Matrix matrix2 = {0};
 
     /* Set the metric function as indicated by dist */
     double (*metric) (int, double**, double**, int**, int**,
                       const double[], int, int, int) = setmetric(dist);
 
-    /* Calculate the distances and save them in the ragged array */
-    for (i = 1; i < n; i++)
-        for (j = 0; j < i; j++)
-            matrix[i][j] = metric(ndata, data, data, mask, mask, weights,
-                                  i, j, transpose);
+    if (lastrow > n) lastrow = n;
+    firstrow = max(firstrow, 1);
+    lastcolumn = min(lastcolumn, lastrow - 1);
+    if (firstrow >= lastrow || firstcolumn >= lastcolumn) return;
+
+    /* If columns are compared, copy the columns in the tile into contiguous
+     * rows; use the data in place if memory cannot be allocated */
+    if (transpose
+     && transposedmatrix(&matrix1, data, mask, ndata, firstrow, lastrow)) {
+        if (transposedmatrix(&matrix2, data, mask, ndata, firstcolumn,
+                             lastcolumn)) {
+            data1 = matrix1.rows;
+            mask1 = matrix1.maskrows;
+            offset1 = firstrow;
+            data2 = matrix2.rows;
+            mask2 = matrix2.maskrows;
+            offset2 = firstcolumn;
+            transpose = 0;
+        }
+        else freematrix(&matrix1);
+    }
+
+    /* Calculate the distances block by block and save them in the ragged
+     * array. The distance between two items without missing data is
+     * calculated by the blocked kernels, and by the metric function
+     * otherwise, so that each distance is calculated in the same way
+     * however the distance matrix is divided into tiles. The blocks are
+     * aligned to multiples of BLOCKSIZE for the same reason. */
+    for (i1 = firstrow - firstrow % BLOCKSIZE; i1 < lastrow; i1 += BLOCKSIZE) {
+        const int istart = max(i1, firstrow);
+        const int iend = min(i1 + BLOCKSIZE, lastrow);
+        const int end = min(lastcolumn, iend - 1);
+        n1 = 0;
+        for (i = istart; i < iend; i++) {
+            const int k = i - offset1;
+            present1[i-i1] = blocked
+                          && all_present(ndata, mask1, 1, &k, transpose);
+            if (present1[i-i1]) index1[n1++] = k;
+        }
+        for (j1 = firstcolumn - firstcolumn % BLOCKSIZE; j1 < end;
+             j1 += BLOCKSIZE) {
+            const int jstart = max(j1, firstcolumn);
+            const int jend = min(j1 + BLOCKSIZE, end);
+            int ok = 0;
+            n2 = 0;
+            for (j = jstart; j < jend; j++) {
+                const int k = j - offset2;
+                present2[j-j1] = blocked
+                              && all_present(ndata, mask2, 1, &k, transpose);
+                if (present2[j-j1]) index2[n2++] = k;
+            }
+            if (n1 > 0 && n2 > 0)
+                ok = blocked_distances(dist, ndata, weights, transpose,
+                                       data1, mask1, n1, index1,
+                                       data2, mask2, n2, index2, block);
+            if (ok) {
+                int a, b;
+                for (a = 0; a < n1; a++) {
+                    i = index1[a] + offset1;
+                    for (b = 0; b < n2; b++) {
+                        j = index2[b] + offset2;
+                        if (j < i) setdistance(distances, i, j,
+                                               block[a*n2+b]);
+                    }
+                }
+            }
+            for (i = istart; i < iend; i++)
+                for (j = jstart; j < min(jend, i); j++)
+                    if (!ok || !present1[i-i1] || !present2[j-j1])
+                        setdistance(distances, i, j,
+                                    metric(ndata, data1, data2, mask1, mask2,
+                                           weights, i - offset1, j - offset2,
+                                           transpose));
+        }
+    }
+    if (data1 != data) {
+        freematrix(&matrix1);
+        freematrix(&matrix2);
+    }
 }
 
 /* ******************************************************************** */
@@ -3362,6 +4750,17 @@ weights array, the function returns NULL.
                       const double[], int, int, int) = setmetric(dist);
     double* result;
 
+    if (transpose) {
+        /* Use the rows of a transposed copy of the data */
+        Matrix matrix;
+        if (!transposedmatrix(&matrix, data, mask, nrows, 0, ncolumns))
+            return NULL;
+        result = calculate_weights(matrix.nrows, matrix.ncols, matrix.rows,
+                                   matrix.maskrows, weights, 0, dist, cutoff,
+                                   exponent);
+        freematrix(&matrix);
+        return result;
+    }
     result = malloc(nelements*sizeof(double));
     if (!result) return NULL;
     memset(result, 0, nelements*sizeof(double));
@@ -3474,7 +4873,7 @@ If a memory error occurs, cuttree returns 0.
 
 static Node*
 pclcluster(int nrows, int ncolumns, double** data, int** mask, double weight[],
-    double** distmatrix, char dist, int transpose)
+    const Distances* distances, char dist, int transpose)
 
 /*
 
@@ -3524,10 +4923,10 @@ dist == 's': Spearman's rank correlation
 dist == 'k': Kendall's tau
 For other values of dist, the default (Euclidean distance) is used.
 
-distmatrix (input) double**
-The distance matrix. This matrix is precalculated by the calling routine
-treecluster. The pclcluster routine modifies the contents of distmatrix, but
-does not deallocate it.
+distances (input) const Distances*
+The distance matrix, stored in double or in single precision. This matrix is
+precalculated by the calling routine treecluster. The pclcluster routine
+modifies the contents of the distance matrix, but does not deallocate it.
 
 Return value
 ============
@@ -3550,6 +4949,8 @@ If a memory error occurs, pclcluster returns NULL.
     double** newdata;
     int** newmask;
     int* distid;
+    double* mindistance;
+    int* minindex;
 
     /* Set the metric function as indicated by dist */
     double (*metric) (int, double**, double**, int**, int**,
@@ -3562,7 +4963,12 @@ If a memory error occurs, pclcluster returns NULL.
         free(distid);
         return NULL;
     }
-    if (!makedatamask(nelements, ndata, &newdata, &newmask)) {
+    mindistance = malloc(nelements*sizeof(double));
+    minindex = malloc(nelements*sizeof(int));
+    if (!mindistance || !minindex
+     || !makedatamask(nelements, ndata, &newdata, &newmask)) {
+        if (mindistance) free(mindistance);
+        if (minindex) free(minindex);
         free(result);
         free(distid);
         return NULL;
@@ -3591,11 +4997,16 @@ If a memory error occurs, pclcluster returns NULL.
         mask = newmask;
     }
 
+    /* Find the nearest neighbor in each row of the distance matrix */
+    for (i = 1; i < nelements; i++)
+        find_row_minimum(i, distances, mindistance, minindex);
+
     for (inode = 0; inode < nnodes; inode++) {
         /* Find the pair with the shortest distance */
         int is = 1;
         int js = 0;
-        result[inode].distance = find_closest_pair(nelements-inode, distmatrix,
+        result[inode].distance = find_closest_pair(nelements-inode,
+                                                   mindistance, minindex,
                                                    &is, &js);
         result[inode].left = distid[js];
         result[inode].right = distid[is];
@@ -3614,17 +5025,23 @@ If a memory error occurs, pclcluster returns NULL.
         /* Fix the distances */
         distid[is] = distid[nnodes-inode];
         for (i = 0; i < is; i++)
-            distmatrix[is][i] = distmatrix[nnodes-inode][i];
+            setdistance(distances, is, i,
+                        getdistance(distances, nnodes-inode, i));
         for (i = is + 1; i < nnodes-inode; i++)
-            distmatrix[i][is] = distmatrix[nnodes-inode][i];
+            setdistance(distances, i, is,
+                        getdistance(distances, nnodes-inode, i));
 
         distid[js] = -inode-1;
         for (i = 0; i < js; i++)
-            distmatrix[js][i] = metric(ndata, data, data, mask, mask, weight,
-                                       js, i, 0);
+            setdistance(distances, js, i,
+                        metric(ndata, data, data, mask, mask, weight,
+                               js, i, 0));
         for (i = js + 1; i < nnodes-inode; i++)
-            distmatrix[i][js] = metric(ndata, data, data, mask, mask, weight,
-                                       js, i, 0);
+            setdistance(distances, i, js,
+                        metric(ndata, data, data, mask, mask, weight,
+                               js, i, 0));
+        update_row_minima(nnodes-inode, distances, is, js,
+                          mindistance, minindex);
     }
 
     /* Free temporarily allocated space */
@@ -3633,6 +5050,8 @@ If a memory error occurs, pclcluster returns NULL.
     free(data);
     free(mask);
     free(distid);
+    free(mindistance);
+    free(minindex);
 
     return result;
 }
@@ -3657,7 +5076,7 @@ nodecompare(const void* a, const void* b)
 
 static Node*
 pslcluster(int nrows, int ncolumns, double** data, int** mask,
-    double weight[], double** distmatrix, char dist, int transpose)
+    double weight[], const Distances* distances, char dist, int transpose)
 
 /*
 
@@ -3716,15 +5135,16 @@ dist == 's': Spearman's rank correlation
 dist == 'k': Kendall's tau
 For other values of dist, the default (Euclidean distance) is used.
 
-distmatrix (input) double**
-The distance matrix. If the distance matrix is passed by the calling routine
-treecluster, it is used by pslcluster to speed up the clustering calculation.
-The pslcluster routine does not modify the contents of distmatrix, and does
-not deallocate it. If distmatrix is NULL, the pairwise distances are calculated
-by the pslcluster routine from the gene expression data (the data and mask
-arrays) and stored in temporary arrays. If distmatrix is passed, the original
-gene expression data (specified by the data and mask arguments) are not needed
-and are therefore ignored.
+distances  (input) const Distances*
+The distance matrix, stored in double or in single precision. If the distance
+matrix is passed by the calling routine treecluster, it is used by pslcluster
+to speed up the clustering calculation. The pslcluster routine does not modify
+the contents of the distance matrix, and does not deallocate it. If distances
+is NULL, the pairwise distances are calculated by the pslcluster routine from
+the gene expression data (the data and mask arrays) and stored in temporary
+arrays. If the distance matrix is passed, the original gene expression data
+(specified by the data and mask arguments) are not needed and are therefore
+ignored.
 
 
 Return value
@@ -3771,10 +5191,10 @@ If a memory error occurs, pslcluster returns NULL.
 
     for (i = 0; i < nnodes; i++) vector[i] = i;
 
-    if (distmatrix) {
+    if (distances) {
         for (i = 0; i < nrows; i++) {
             result[i].distance = DBL_MAX;
-            for (j = 0; j < i; j++) temp[j] = distmatrix[i][j];
+            for (j = 0; j < i; j++) temp[j] = getdistance(distances, i, j);
             for (j = 0; j < i; j++) {
                 k = vector[j];
                 if (result[j].distance >= temp[j]) {
@@ -3839,7 +5259,7 @@ If a memory error occurs, pslcluster returns NULL.
 /* ******************************************************************** */
 
 static Node*
-pmlcluster(int nelements, double** distmatrix)
+pmlcluster(int nelements, const Distances* distances)
 /*
 
 Purpose
@@ -3854,10 +5274,11 @@ Arguments
 nelements         (input) int
 The number of elements to be clustered.
 
-distmatrix (input) double**
+distances  (input) const Distances*
 The distance matrix, with nelements rows, each row being filled up to the
-diagonal. The elements on the diagonal are not used, as they are assumed to be
-zero. The distance matrix will be modified by this routine.
+diagonal, stored in double or in single precision. The elements on the
+diagonal are not used, as they are assumed to be zero. The distance matrix
+will be modified by this routine.
 
 Return value
 ============
@@ -3874,12 +5295,19 @@ If a memory error occurs, pmlcluster returns NULL.
     int j;
     int n;
     int* clusterid;
+    double* mindistance;
+    int* minindex;
     Node* result;
 
     clusterid = malloc(nelements*sizeof(int));
     if (!clusterid) return NULL;
+    mindistance = malloc(nelements*sizeof(double));
+    minindex = malloc(nelements*sizeof(int));
     result = malloc((nelements-1)*sizeof(Node));
-    if (!result) {
+    if (!mindistance || !minindex || !result) {
+        if (mindistance) free(mindistance);
+        if (minindex) free(minindex);
+        if (result) free(result);
         free(clusterid);
         return NULL;
     }
@@ -3887,23 +5315,33 @@ If a memory error occurs, pmlcluster returns NULL.
     /* Setup a list specifying to which cluster a gene belongs */
     for (j = 0; j < nelements; j++) clusterid[j] = j;
 
+    /* Find the nearest neighbor in each row of the distance matrix */
+    for (j = 1; j < nelements; j++)
+        find_row_minimum(j, distances, mindistance, minindex);
+
     for (n = nelements; n > 1; n--) {
         int is = 1;
         int js = 0;
 
-        result[nelements-n].distance = find_closest_pair(n, distmatrix,
-                                                         &is, &js);
+        result[nelements-n].distance = find_closest_pair(n, mindistance,
+                                                         minindex, &is, &js);
 
         /* Fix the distances */
         for (j = 0; j < js; j++)
-            distmatrix[js][j] = max(distmatrix[is][j], distmatrix[js][j]);
+            setdistance(distances, js, j, max(getdistance(distances, is, j),
+                                              getdistance(distances, js, j)));
         for (j = js+1; j < is; j++)
-            distmatrix[j][js] = max(distmatrix[is][j], distmatrix[j][js]);
+            setdistance(distances, j, js, max(getdistance(distances, is, j),
+                                              getdistance(distances, j, js)));
         for (j = is+1; j < n; j++)
-            distmatrix[j][js] = max(distmatrix[j][is], distmatrix[j][js]);
+            setdistance(distances, j, js, max(getdistance(distances, j, is),
+                                              getdistance(distances, j, js)));
 
-        for (j = 0; j < is; j++) distmatrix[is][j] = distmatrix[n-1][j];
-        for (j = is+1; j < n-1; j++) distmatrix[j][is] = distmatrix[n-1][j];
+        for (j = 0; j < is; j++)
+            setdistance(distances, is, j, getdistance(distances, n-1, j));
+        for (j = is+1; j < n-1; j++)
+            setdistance(distances, j, is, getdistance(distances, n-1, j));
+        update_row_minima(n-1, distances, is, js, mindistance, minindex);
 
         /* Update clusterids */
         result[nelements-n].left = clusterid[is];
@@ -3912,6 +5350,8 @@ If a memory error occurs, pmlcluster returns NULL.
         clusterid[is] = clusterid[n-1];
     }
     free(clusterid);
+    free(mindistance);
+    free(minindex);
 
     return result;
 }
@@ -3919,7 +5359,7 @@ If a memory error occurs, pmlcluster returns NULL.
 /* ******************************************************************* */
 
 static Node*
-palcluster(int nelements, double** distmatrix)
+palcluster(int nelements, const Distances* distances)
 /*
 Purpose
 =======
@@ -3933,10 +5373,11 @@ Arguments
 nelements  (input) int
 The number of elements to be clustered.
 
-distmatrix (input) double**
+distances  (input) const Distances*
 The distance matrix, with nelements rows, each row being filled up to the
-diagonal. The elements on the diagonal are not used, as they are assumed to be
-zero. The distance matrix will be modified by this routine.
+diagonal, stored in double or in single precision. The elements on the
+diagonal are not used, as they are assumed to be zero. The distance matrix
+will be modified by this routine.
 
 Return value
 ============
@@ -3954,6 +5395,8 @@ If a memory error occurs, palcluster returns NULL.
     int n;
     int* clusterid;
     int* number;
+    double* mindistance;
+    int* minindex;
     Node* result;
 
     clusterid = malloc(nelements*sizeof(int));
@@ -3963,8 +5406,13 @@ If a memory error occurs, palcluster returns NULL.
         free(clusterid);
         return NULL;
     }
+    mindistance = malloc(nelements*sizeof(double));
+    minindex = malloc(nelements*sizeof(int));
     result = malloc((nelements-1)*sizeof(Node));
-    if (!result) {
+    if (!mindistance || !minindex || !result) {
+        if (mindistance) free(mindistance);
+        if (minindex) free(minindex);
+        if (result) free(result);
         free(clusterid);
         free(number);
         return NULL;
@@ -3978,12 +5426,16 @@ If a memory error occurs, palcluster returns NULL.
         clusterid[j] = j;
     }
 
+    /* Find the nearest neighbor in each row of the distance matrix */
+    for (j = 1; j < nelements; j++)
+        find_row_minimum(j, distances, mindistance, minindex);
+
     for (n = nelements; n > 1; n--) {
         int sum;
         int is = 1;
         int js = 0;
-        result[nelements-n].distance = find_closest_pair(n, distmatrix,
-                                                         &is, &js);
+        result[nelements-n].distance = find_closest_pair(n, mindistance,
+                                                         minindex, &is, &js);
 
         /* Save result */
         result[nelements-n].left = clusterid[is];
@@ -3991,24 +5443,24 @@ If a memory error occurs, palcluster returns NULL.
 
         /* Fix the distances */
         sum = number[is] + number[js];
-        for (j = 0; j < js; j++) {
-            distmatrix[js][j] = distmatrix[is][j]*number[is]
-                              + distmatrix[js][j]*number[js];
-            distmatrix[js][j] /= sum;
-        }
-        for (j = js+1; j < is; j++) {
-            distmatrix[j][js] = distmatrix[is][j]*number[is]
-                              + distmatrix[j][js]*number[js];
-            distmatrix[j][js] /= sum;
-        }
-        for (j = is+1; j < n; j++) {
-            distmatrix[j][js] = distmatrix[j][is]*number[is]
-                              + distmatrix[j][js]*number[js];
-            distmatrix[j][js] /= sum;
-        }
+        for (j = 0; j < js; j++)
+            setdistance(distances, js, j,
+                        (getdistance(distances, is, j)*number[is]
+                       + getdistance(distances, js, j)*number[js]) / sum);
+        for (j = js+1; j < is; j++)
+            setdistance(distances, j, js,
+                        (getdistance(distances, is, j)*number[is]
+                       + getdistance(distances, j, js)*number[js]) / sum);
+        for (j = is+1; j < n; j++)
+            setdistance(distances, j, js,
+                        (getdistance(distances, j, is)*number[is]
+                       + getdistance(distances, j, js)*number[js]) / sum);
 
-        for (j = 0; j < is; j++) distmatrix[is][j] = distmatrix[n-1][j];
-        for (j = is+1; j < n-1; j++) distmatrix[j][is] = distmatrix[n-1][j];
+        for (j = 0; j < is; j++)
+            setdistance(distances, is, j, getdistance(distances, n-1, j));
+        for (j = is+1; j < n-1; j++)
+            setdistance(distances, j, is, getdistance(distances, n-1, j));
+        update_row_minima(n-1, distances, is, js, mindistance, minindex);
 
         /* Update number of elements in the clusters */
         number[js] = sum;
@@ -4020,6 +5472,68 @@ If a memory error occurs, palcluster returns NULL.
     }
     free(clusterid);
     free(number);
+    free(mindistance);
+    free(minindex);
+
+    return result;
+}
+
+/* ******************************************************************* */
+
+static Node*
+treecluster_distances(int nrows, int ncolumns, double** data, int** mask,
+    double weight[], int transpose, char dist, char method,
+    const Distances* distances, int single)
+/* This function implements treecluster and treeclusterf. If distances is NULL
+ * and the distance matrix is needed, it is calculated from the data and
+ * stored in double precision, or in single precision if single is nonzero.
+ */
+{
+    Node* result = NULL;
+    const int nelements = (transpose == 0) ? nrows : ncolumns;
+    const int ldistmatrix = (distances == NULL && method != 's') ? 1 : 0;
+    Distances allocated;
+    Matrix matrix;
+
+    if (nelements < 2) return NULL;
+    if (transpose && (ldistmatrix || method == 's' || method == 'c')) {
+        /* Cluster the rows of a transposed copy of the data */
+        if (!transposedmatrix(&matrix, data, mask, nrows, 0, ncolumns))
+            return NULL;
+        result = treecluster_distances(matrix.nrows, matrix.ncols,
+                                       matrix.rows, matrix.maskrows, weight,
+                                       0, dist, method, distances, single);
+        freematrix(&matrix);
+        return result;
+    }
+
+    /* Calculate the distance matrix if the user didn't give it */
+    if (ldistmatrix) {
+        if (!allocate_distances(nelements, single, &allocated)) return NULL;
+        distancematrix_tile(nrows, ncolumns, data, mask, weight, dist,
+                            transpose, 0, nelements, 0, nelements, &allocated);
+        distances = &allocated;
+    }
+
+    switch(method) {
+        case 's':
+            result = pslcluster(nrows, ncolumns, data, mask, weight,
+                                distances, dist, transpose);
+            break;
+        case 'm':
+            result = pmlcluster(nelements, distances);
+            break;
+        case 'a':
+            result = palcluster(nelements, distances);
+            break;
+        case 'c':
+            result = pclcluster(nrows, ncolumns, data, mask, weight,
+                                distances, dist, transpose);
+            break;
+    }
+
+    /* Deallocate space for distance matrix if allocated by treecluster */
+    if (ldistmatrix) free_distances(&allocated);
 
     return result;
 }
@@ -4093,8 +5607,9 @@ distance matrix itself is available.
 
 distmatrix (input) double**
 The distance matrix. If the distance matrix is zero initially, the distance
-matrix will be allocated and calculated from the data by treecluster, and
-deallocated before treecluster returns. If the distance matrix is passed by the
+matrix will be allocated as a single contiguous block by allocate_distances,
+calculated from the data by treecluster, and deallocated before treecluster
+returns. If the distance matrix is passed by the
 calling routine, treecluster will modify the contents of the distance matrix as
 part of the clustering algorithm, but will not deallocate it. The calling
 routine should deallocate the distance matrix after the return from
@@ -4113,56 +5628,38 @@ If a memory error occurs, treecluster returns NULL.
 ========================================================================
 */
 {
-    Node* result = NULL;
-    const int nelements = (transpose == 0) ? nrows : ncolumns;
-    const int ldistmatrix = (distmatrix == NULL && method != 's') ? 1 : 0;
+    const Distances distances = {distmatrix, NULL};
 
-    if (nelements < 2) return NULL;
+    return treecluster_distances(nrows, ncolumns, data, mask, weight,
+                                 transpose, dist, method,
+                                 distmatrix ? &distances : NULL, 0);
+}
 
-    /* Calculate the distance matrix if the user didn't give it */
-    if (ldistmatrix) {
-        /* Set up the ragged array */
-        int i;
-        distmatrix = malloc(nelements*sizeof(double*));
-        if (distmatrix == NULL) return NULL; /* Not enough memory available */
-        distmatrix[0] = NULL;
-        for (i = 1; i < nelements; i++) {
-            distmatrix[i] = malloc(i*sizeof(double));
-            if (distmatrix[i] == NULL) /* Not enough memory available */ {
-                while (--i > 0) free(distmatrix[i]);
-                free(distmatrix);
-                return NULL;
-            }
-        }
-        distancematrix(nrows, ncolumns, data, mask, weight, dist, transpose,
-                       distmatrix);
-    }
+/* ******************************************************************* */
 
-    switch(method) {
-        case 's':
-            result = pslcluster(nrows, ncolumns, data, mask, weight,
-                                distmatrix, dist, transpose);
-            break;
-        case 'm':
-            result = pmlcluster(nelements, distmatrix);
-            break;
-        case 'a':
-            result = palcluster(nelements, distmatrix);
-            break;
-        case 'c':
-            result = pclcluster(nrows, ncolumns, data, mask, weight,
-                                distmatrix, dist, transpose);
-            break;
-    }
+Node*
+treeclusterf(int nrows, int ncolumns, double** data, int** mask,
+    double weight[], int transpose, char dist, char method,
+    float** distmatrix)
+/*
+Purpose
+=======
 
-    /* Deallocate space for distance matrix if allocated by treecluster */
-    if (ldistmatrix) {
-        int i;
-        for (i = 1; i < nelements; i++) free(distmatrix[i]);
-        free(distmatrix);
-    }
+The treeclusterf routine is identical to treecluster, except that the distance
+matrix is stored in single precision. If distmatrix is zero initially, the
+distance matrix is calculated from the data and stored in single precision in
+a single contiguous block, which needs half the memory used by treecluster.
+Otherwise, distmatrix is used as the distance matrix, and its contents are
+modified as described for treecluster.
 
-    return result;
+========================================================================
+*/
+{
+    const Distances distances = {NULL, distmatrix};
+
+    return treecluster_distances(nrows, ncolumns, data, mask, weight,
+                                 transpose, dist, method,
+                                 distmatrix ? &distances : NULL, 1);
 }
 
 /* ******************************************************************* */
@@ -4240,131 +5737,389 @@ If a memory error occurs, sorttree returns 0.
                 order2 = order[i2];
                 counts2 = 1;
             }
-            if (order1 > order2) {
-                tree[i].left = i2;
-                tree[i].right = i1;
+            if (order1 > order2) {
+                tree[i].left = i2;
+                tree[i].right = i1;
+            }
+            nodecounts[i] = counts1 + counts2;
+            nodeorder[i] = (counts1*order1+counts2*order2) / (counts1+counts2);
+        }
+        free(nodeorder);
+    }
+    else {
+        for (i = 0; i < nnodes; i++) {
+            i1 = tree[i].left;
+            i2 = tree[i].right;
+            /* i1 and i2 are the elements that are to be joined */
+            counts1 = (i1 < 0) ? nodecounts[-i1-1] : 1;
+            counts2 = (i2 < 0) ? nodecounts[-i2-1] : 1;
+            nodecounts[i] = counts1 + counts2;
+        }
+    }
+    i--;
+    nodecounts[i] = 0;
+    for ( ; i >= 0; i--) {
+        i1 = tree[i].left;
+        i2 = tree[i].right;
+        counts1 = (i1<0) ? nodecounts[-i1-1] : 1;
+        index = nodecounts[i];
+        if (i1 >= 0) indices[index] = i1;
+        else nodecounts[-i1-1] = index;
+        index += counts1;
+        if (i2 >= 0) indices[index] = i2;
+        else nodecounts[-i2-1] = index;
+    }
+    free(nodecounts);
+    return 1;
+}
+
+/* ******************************************************************* */
+
+/* Self-organizing maps.
+ *
+ * The nodes of the rectangular SOM grid are numbered ix*nygrid+iy. To find
+ * the node closest to an item, the item is first copied into contiguous
+ * memory, together with its mask and weights, after which its distance to
+ * each node only reads the node data consecutively. For the Euclidean and the
+ * city-block distance, the distances to four nodes are calculated in the same
+ * sweep over the item, keeping the four sums in registers; each sum is
+ * accumulated in the same order as in the metric functions, so the distances
+ * are identical. For the other distance measures, the metric function is
+ * called for each node. When many items are assigned to their closest node
+ * at once, blocks of items without missing values are compared to all nodes
+ * by the blocked distance kernels instead.
+ */
+
+typedef struct {
+    int ndata;
+    char dist;
+    const double* weight;
+    double* x;          /* the item data */
+    int* m;             /* the item mask */
+    double* w;          /* weights, set to zero for missing values */
+    double tweight;     /* sum of the weights of the values present */
+    int** nodemask;     /* nnodes pointers to a row of ones */
+    double (*metric) (int, double**, double**, int**, int**,
+                      const double[], int, int, int);
+} SOMItem;
+
+static int
+allocate_somitem(SOMItem* item, int ndata, int nnodes, const double weight[],
+    char dist)
+/* Allocate the workspace needed to compare an item to nnodes nodes. Returns
+ * 0 if a memory allocation failed. */
+{
+    int i;
+    int* ones;
+
+    item->ndata = ndata;
+    item->dist = dist;
+    item->weight = weight;
+    item->metric = setmetric(dist);
+    item->x = malloc(ndata*sizeof(double));
+    item->w = malloc(ndata*sizeof(double));
+    item->m = malloc(2*ndata*sizeof(int));
+    item->nodemask = malloc(nnodes*sizeof(int*));
+    if (!item->x || !item->w || !item->m || !item->nodemask) {
+        if (item->x) free(item->x);
+        if (item->w) free(item->w);
+        if (item->m) free(item->m);
+        if (item->nodemask) free(item->nodemask);
+        return 0;
+    }
+    ones = item->m + ndata;
+    for (i = 0; i < ndata; i++) ones[i] = 1;
+    for (i = 0; i < nnodes; i++) item->nodemask[i] = ones;
+    return 1;
+}
+
+static void
+free_somitem(SOMItem* item)
+{
+    free(item->x);
+    free(item->w);
+    free(item->m);
+    free(item->nodemask);
+}
+
+static void
+getsomitem(SOMItem* item, double** data, int** mask, int transpose,
+    int index)
+/* Copy row (transpose == 0) or column (transpose != 0) index of the data
+ * into the item workspace. */
+{
+    int k;
+    const int ndata = item->ndata;
+    const double* weight = item->weight;
+    double* x = item->x;
+    double* w = item->w;
+    int* m = item->m;
+    double tweight = 0;
+
+    for (k = 0; k < ndata; k++) {
+        if (transpose == 0) {
+            x[k] = data[index][k];
+            m[k] = mask[index][k];
+        }
+        else {
+            x[k] = data[k][index];
+            m[k] = mask[k][index];
+        }
+        if (m[k]) {
+            w[k] = weight[k];
+            tweight += weight[k];
+        }
+        else {
+            x[k] = 0;
+            w[k] = 0;
+        }
+    }
+    item->tweight = tweight;
+}
+
+static int
+getsomblock(int ndata, double** data, int** mask, int transpose, int first,
+    int n, double* rows[])
+/* Copy the items first, ..., first+n-1 into rows. Returns 0 if any of their
+ * data values are missing. */
+{
+    int i, k;
+
+    for (i = 0; i < n; i++) {
+        const int j = first + i;
+        double* row = rows[i];
+        for (k = 0; k < ndata; k++) {
+            if (transpose == 0) {
+                if (!mask[j][k]) return 0;
+                row[k] = data[j][k];
+            }
+            else {
+                if (!mask[k][j]) return 0;
+                row[k] = data[k][j];
+            }
+        }
+    }
+    return 1;
+}
+
+static int
+bestnode(const SOMItem* item, int nnodes, double** nodes)
+/* Return the node closest to the item stored in the workspace. Of nodes at
+ * the same distance, the first one is returned. */
+{
+    int c, j, k;
+    int best = -1;
+    double closest = 0;
+    const int ndata = item->ndata;
+    const double* x = item->x;
+    const double* w = item->w;
+
+    if (item->dist == 'e' || item->dist == 'b') {
+        const int cityblock = (item->dist == 'b');
+        if (!item->tweight) return 0; /* all distances are zero */
+        for (c = 0; c < nnodes; c += 4) {
+            double sums[4] = {0, 0, 0, 0};
+            const int n = min(4, nnodes - c);
+            if (n == 4) {
+                const double* y0 = nodes[c];
+                const double* y1 = nodes[c+1];
+                const double* y2 = nodes[c+2];
+                const double* y3 = nodes[c+3];
+                double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+                if (cityblock) {
+                    for (k = 0; k < ndata; k++) {
+                        s0 = s0 + w[k]*fabs(x[k] - y0[k]);
+                        s1 = s1 + w[k]*fabs(x[k] - y1[k]);
+                        s2 = s2 + w[k]*fabs(x[k] - y2[k]);
+                        s3 = s3 + w[k]*fabs(x[k] - y3[k]);
+                    }
+                }
+                else {
+                    for (k = 0; k < ndata; k++) {
+                        const double d0 = x[k] - y0[k];
+                        const double d1 = x[k] - y1[k];
+                        const double d2 = x[k] - y2[k];
+                        const double d3 = x[k] - y3[k];
+                        s0 += w[k]*d0*d0;
+                        s1 += w[k]*d1*d1;
+                        s2 += w[k]*d2*d2;
+                        s3 += w[k]*d3*d3;
+                    }
+                }
+                sums[0] = s0;
+                sums[1] = s1;
+                sums[2] = s2;
+                sums[3] = s3;
+            }
+            else {
+                for (j = 0; j < n; j++) {
+                    const double* y = nodes[c+j];
+                    double sum = 0;
+                    for (k = 0; k < ndata; k++) {
+                        const double d = x[k] - y[k];
+                        if (cityblock) sum = sum + w[k]*fabs(d);
+                        else sum += w[k]*d*d;
+                    }
+                    sums[j] = sum;
+                }
+            }
+            for (j = 0; j < n; j++) {
+                const double distance = sums[j] / item->tweight;
+                if (best < 0 || distance < closest) {
+                    best = c + j;
+                    closest = distance;
+                }
             }
-            nodecounts[i] = counts1 + counts2;
-            nodeorder[i] = (counts1*order1+counts2*order2) / (counts1+counts2);
         }
-        free(nodeorder);
     }
     else {
-        for (i = 0; i < nnodes; i++) {
-            i1 = tree[i].left;
-            i2 = tree[i].right;
-            /* i1 and i2 are the elements that are to be joined */
-            counts1 = (i1 < 0) ? nodecounts[-i1-1] : 1;
-            counts2 = (i2 < 0) ? nodecounts[-i2-1] : 1;
-            nodecounts[i] = counts1 + counts2;
+        double* data = item->x;
+        int* mask = item->m;
+        for (c = 0; c < nnodes; c++) {
+            const double distance = item->metric(ndata, &data, nodes, &mask,
+                                                 item->nodemask, item->weight,
+                                                 0, c, 0);
+            if (best < 0 || distance < closest) {
+                best = c;
+                closest = distance;
+            }
         }
     }
-    i--;
-    nodecounts[i] = 0;
-    for ( ; i >= 0; i--) {
-        i1 = tree[i].left;
-        i2 = tree[i].right;
-        counts1 = (i1<0) ? nodecounts[-i1-1] : 1;
-        index = nodecounts[i];
-        if (i1 >= 0) indices[index] = i1;
-        else nodecounts[-i1-1] = index;
-        index += counts1;
-        if (i2 >= 0) indices[index] = i2;
-        else nodecounts[-i2-1] = index;
+    return best;
+}
+
+static double*
+griddistances(int nxgrid, int nygrid)
+/* Return a table of the distances between grid cells; the distance between
+ * cells (ix1, iy1) and (ix2, iy2) is stored in element |ix1-ix2|*nygrid +
+ * |iy1-iy2|. Returns NULL if a memory allocation failed. */
+{
+    int dx, dy;
+    double* table = malloc(nxgrid*nygrid*sizeof(double));
+
+    if (!table) return NULL;
+    for (dx = 0; dx < nxgrid; dx++)
+        for (dy = 0; dy < nygrid; dy++)
+            table[dx*nygrid+dy] = sqrt(dx*dx+dy*dy);
+    return table;
+}
+
+static double
+itemscale(int ndata, const double x[], const int m[])
+/* Return the root mean square of the values present in the item x, or 1 if
+ * they are all zero. The item is divided by this value when updating the
+ * nodes. */
+{
+    int k, n = 0;
+    double sum = 0;
+
+    for (k = 0; k < ndata; k++) {
+        if (m[k]) {
+            const double term = x[k];
+            sum += term * term;
+            n++;
+        }
     }
-    free(nodecounts);
+    if (sum > 0) return sqrt(sum/n);
     return 1;
 }
 
-/* ******************************************************************* */
+static void
+normalizenode(int ndata, double node[])
+/* Scale the node such that its root mean square is 1. */
+{
+    int k;
+    double sum = 0.;
+
+    for (k = 0; k < ndata; k++) {
+        const double term = node[k];
+        sum += term * term;
+    }
+    if (sum > 0) {
+        sum = sqrt(sum/ndata);
+        for (k = 0; k < ndata; k++) node[k] /= sum;
+    }
+}
 
 static void
+initnodes(Random* random, int ndata, int nnodes, double** nodes)
+/* Initialize the nodes randomly, each with a root mean square of 1. */
+{
+    int c, k;
+
+    for (c = 0; c < nnodes; c++) {
+        double* node = nodes[c];
+        double sum = 0.;
+        for (k = 0; k < ndata; k++) {
+            double term = -1.0 + 2.0*uniform(random);
+            node[k] = term;
+            sum += term * term;
+        }
+        sum = sqrt(sum/ndata);
+        for (k = 0; k < ndata; k++) node[k] /= sum;
+    }
+}
+
+static double**
+getnodes(int nxgrid, int nygrid, double*** celldata)
+/* Return an array of pointers to the data of each node. */
+{
+    int ix, iy;
+    double** nodes = malloc(nxgrid*nygrid*sizeof(double*));
+
+    if (!nodes) return NULL;
+    for (ix = 0; ix < nxgrid; ix++)
+        for (iy = 0; iy < nygrid; iy++)
+            nodes[ix*nygrid+iy] = celldata[ix][iy];
+    return nodes;
+}
+
+/* ******************************************************************* */
+
+static int
 somworker(int nrows, int ncolumns, double** data, int** mask,
     const double weights[], int transpose, int nxgrid, int nygrid,
-    double inittau, double*** celldata, int niter, char dist)
-
+    double inittau, double*** celldata, int niter, char dist,
+    unsigned long long seed)
 {
     const int nelements = (transpose == 0) ? nrows : ncolumns;
     const int ndata = (transpose == 0) ? ncolumns : nrows;
-    int i, j;
-    int** dummymask;
+    const int nnodes = nxgrid * nygrid;
+    int i, j, k;
     int ix, iy;
-    int* index;
+    Random random;
+    SOMItem item;
+    int* index = NULL;
     int iter;
+    int ok = 0;
     /* Maximum radius in which nodes are adjusted */
     double maxradius = sqrt(nxgrid*nxgrid+nygrid*nygrid);
-    double* stddata = calloc(nelements, sizeof(double));
+    double* griddistance = griddistances(nxgrid, nygrid);
+    /* The nodes are stored contiguously during the iterations */
+    double* nodedata = malloc(nnodes*ndata*sizeof(double));
+    double** nodes = malloc(nnodes*sizeof(double*));
+    double* stddata = malloc(nelements*sizeof(double));
 
-    /* Set the metric function as indicated by dist */
-    double (*metric) (int, double**, double**, int**, int**,
-                      const double[], int, int, int) = setmetric(dist);
+    if (!allocate_somitem(&item, ndata, nnodes, weights, dist)) goto exit0;
+    index = malloc(nelements*sizeof(int));
+    if (!griddistance || !nodedata || !nodes || !stddata || !index)
+        goto exit;
+    for (i = 0; i < nnodes; i++) nodes[i] = nodedata + i*ndata;
 
     /* Calculate the standard deviation for each row or column */
-    if (transpose == 0) {
-        for (i = 0; i < nelements; i++) {
-            int n = 0;
-            for (j = 0; j < ndata; j++) {
-                if (mask[i][j]) {
-                    double term = data[i][j];
-                    term = term * term;
-                    stddata[i] += term;
-                    n++;
-                }
-            }
-            if (stddata[i] > 0) stddata[i] = sqrt(stddata[i]/n);
-            else stddata[i] = 1;
-        }
-    }
-    else {
-        for (i = 0; i < nelements; i++) {
-            int n = 0;
-            for (j = 0; j < ndata; j++) {
-                if (mask[j][i]) {
-                    double term = data[j][i];
-                    term = term * term;
-                    stddata[i] += term;
-                    n++;
-                }
-            }
-            if (stddata[i] > 0) stddata[i] = sqrt(stddata[i]/n);
-            else stddata[i] = 1;
-        }
-    }
-
-    if (transpose == 0) {
-        dummymask = malloc(nygrid*sizeof(int*));
-        for (i = 0; i < nygrid; i++) {
-            dummymask[i] = malloc(ndata*sizeof(int));
-            for (j = 0; j < ndata; j++) dummymask[i][j] = 1;
-        }
-    }
-    else {
-        dummymask = malloc(ndata*sizeof(int*));
-        for (i = 0; i < ndata; i++) {
-            dummymask[i] = malloc(sizeof(int));
-            dummymask[i][0] = 1;
-        }
+    for (i = 0; i < nelements; i++) {
+        getsomitem(&item, data, mask, transpose, i);
+        stddata[i] = itemscale(ndata, item.x, item.m);
     }
 
     /* Randomly initialize the nodes */
-    for (ix = 0; ix < nxgrid; ix++) {
-        for (iy = 0; iy < nygrid; iy++) {
-            double sum = 0.;
-            for (i = 0; i < ndata; i++) {
-                double term = -1.0 + 2.0*uniform();
-                celldata[ix][iy][i] = term;
-                sum += term * term;
-            }
-            sum = sqrt(sum/ndata);
-            for (i = 0; i < ndata; i++) celldata[ix][iy][i] /= sum;
-        }
-    }
+    initrandom(&random, seed, 0);
+    initnodes(&random, ndata, nnodes, nodes);
 
     /* Randomize the order in which genes or arrays will be used */
-    index = malloc(nelements*sizeof(int));
     for (i = 0; i < nelements; i++) index[i] = i;
     for (i = 0; i < nelements; i++) {
-        j = (int) (i + (nelements-i)*uniform());
+        j = (int) (i + (nelements-i)*uniform(&random));
         ix = index[j];
         index[j] = index[i];
         index[i] = ix;
@@ -4372,206 +6127,345 @@ somworker(int nrows, int ncolumns, double** data, int** mask,
 
     /* Start the iteration */
     for (iter = 0; iter < niter; iter++) {
-        int ixbest = 0;
-        int iybest = 0;
-        int iobject = iter % nelements;
-        iobject = index[iobject];
-        if (transpose == 0) {
-            double closest = metric(ndata, data, celldata[ixbest], mask,
-                                    dummymask, weights, iobject, iybest,
-                                    transpose);
-            double radius = maxradius * (1. - ((double)iter)/((double)niter));
-            double tau = inittau * (1. - ((double)iter)/((double)niter));
-
-            for (ix = 0; ix < nxgrid; ix++) {
-                for (iy = 0; iy < nygrid; iy++) {
-                    double distance = metric(ndata, data, celldata[ix], mask,
-                                             dummymask, weights, iobject, iy,
-                                             transpose);
-                    if (distance < closest) {
-                        ixbest = ix;
-                        iybest = iy;
-                        closest = distance;
-                    }
+        const int iobject = index[iter % nelements];
+        const double* x = item.x;
+        const int* m = item.m;
+        double radius = maxradius * (1. - ((double)iter)/((double)niter));
+        double tau = inittau * (1. - ((double)iter)/((double)niter));
+        int ixbest, iybest;
+
+        getsomitem(&item, data, mask, transpose, iobject);
+        j = bestnode(&item, nnodes, nodes);
+        ixbest = j / nygrid;
+        iybest = j % nygrid;
+        for (ix = 0; ix < nxgrid; ix++) {
+            const double* row = griddistance + abs(ix-ixbest)*nygrid;
+            for (iy = 0; iy < nygrid; iy++) {
+                double* node;
+                if (row[abs(iy-iybest)] >= radius) continue;
+                node = nodes[ix*nygrid+iy];
+                for (k = 0; k < ndata; k++) {
+                    if (m[k] == 0) continue;
+                    node[k] += tau * (x[k]/stddata[iobject] - node[k]);
                 }
+                normalizenode(ndata, node);
             }
-            for (ix = 0; ix < nxgrid; ix++) {
-                for (iy = 0; iy < nygrid; iy++) {
-                    if (sqrt((ix-ixbest)*(ix-ixbest)+(iy-iybest)*(iy-iybest)) <
-                        radius) {
-                        double sum = 0.;
-                        for (i = 0; i < ndata; i++) {
-                            if (mask[iobject][i] == 0) continue;
-                            celldata[ix][iy][i] +=
-                                tau * (data[iobject][i]/stddata[iobject]
-                                      -celldata[ix][iy][i]);
-                        }
-                        for (i = 0; i < ndata; i++) {
-                            double term = celldata[ix][iy][i];
-                            term = term * term;
-                            sum += term;
-                        }
-                        if (sum>0) {
-                            sum = sqrt(sum/ndata);
-                            for (i = 0; i < ndata; i++)
-                                celldata[ix][iy][i] /= sum;
-                        }
-                    }
-                }
+        }
+    }
+    for (ix = 0; ix < nxgrid; ix++)
+        for (iy = 0; iy < nygrid; iy++)
+            memcpy(celldata[ix][iy], nodes[ix*nygrid+iy],
+                   ndata*sizeof(double));
+    ok = 1;
+
+exit:
+    free_somitem(&item);
+exit0:
+    if (griddistance) free(griddistance);
+    if (nodedata) free(nodedata);
+    if (nodes) free(nodes);
+    if (stddata) free(stddata);
+    if (index) free(index);
+    return ok;
+}
+
+/* ******************************************************************* */
+
+void
+sominit(int ndata, int nxgrid, int nygrid, double*** celldata,
+    unsigned long long seed)
+/*
+Purpose
+=======
+
+The sominit routine initializes the nodes of a self-organizing map randomly,
+in the same way as somcluster does.
+
+Arguments
+=========
+
+ndata     (input) int
+The number of data values of each node.
+
+nxgrid, nygrid (input) int
+The dimensions of the rectangular SOM grid.
+
+celldata  (output) double[nxgrid][nygrid][ndata]
+The data of each node.
+
+seed      (input) unsigned long long
+The seed of the random number generator.
+
+========================================================================
+*/
+{
+    int ix, iy;
+    Random random;
+
+    initrandom(&random, seed, 0);
+    for (ix = 0; ix < nxgrid; ix++)
+        for (iy = 0; iy < nygrid; iy++)
+            initnodes(&random, ndata, 1, &celldata[ix][iy]);
+}
+
+/* ******************************************************************* */
+
+int
+somassign(int nrows, int ncolumns, double** data, int** mask,
+    const double weight[], int transpose, int nxgrid, int nygrid,
+    double*** celldata, char dist, int first, int last, int bestnodes[])
+/*
+Purpose
+=======
+
+The somassign routine finds the node of a self-organizing map that is closest
+to each of the items first, ..., last-1. The items are independent of each
+other, so different ranges of items can be assigned concurrently.
+
+Arguments
+=========
+
+nrows, ncolumns, data, mask, weight, transpose, dist
+As in somcluster.
+
+nxgrid, nygrid (input) int
+The dimensions of the rectangular SOM grid.
+
+celldata  (input) double[nxgrid][nygrid][ndata]
+The data of each node, where ndata is ncolumns if transpose == 0, and nrows
+otherwise.
+
+first, last (input) int
+The range of items to be assigned.
+
+bestnodes (output) int[nrows] if transpose == 0;
+                   int[ncolumns] otherwise
+On return, bestnodes[i] for i = first, ..., last-1 is the number
+ix*nygrid+iy of the node (ix, iy) closest to item i.
+
+Return value
+============
+
+1 on success, 0 if a memory allocation failed.
+
+========================================================================
+*/
+{
+    int i, j, k;
+    const int ndata = (transpose == 0) ? ncolumns : nrows;
+    const int nnodes = nxgrid * nygrid;
+    const int nindex = max(BLOCKSIZE, nnodes);
+    int ok = 0;
+    SOMItem item;
+    double** nodes = getnodes(nxgrid, nygrid, celldata);
+    /* Blocks of items without missing values are compared to all nodes by
+     * the blocked kernels */
+    double* rows[BLOCKSIZE];
+    double* block = NULL;
+    int* index = NULL;
+    double* result = NULL;
+
+    if (!nodes) return 0;
+    if (!allocate_somitem(&item, ndata, nnodes, weight, dist)) {
+        free(nodes);
+        return 0;
+    }
+    if (blocked_metric(dist) && ndata > 0) {
+        block = malloc(BLOCKSIZE*ndata*sizeof(double));
+        index = malloc(nindex*sizeof(int));
+        result = malloc(BLOCKSIZE*nnodes*sizeof(double));
+        if (!block || !index || !result) goto exit;
+        for (j = 0; j < nindex; j++) index[j] = j;
+        for (j = 0; j < BLOCKSIZE; j++) rows[j] = block + j*ndata;
+    }
+    for (i = first; i < last; i += BLOCKSIZE) {
+        const int n = min(BLOCKSIZE, last - i);
+        if (block && getsomblock(ndata, data, mask, transpose, i, n, rows)
+         && blocked_distances(dist, ndata, weight, 0, rows, NULL, n, index,
+                              nodes, NULL, nnodes, index, result)) {
+            for (j = 0; j < n; j++) {
+                const double* r = result + j*nnodes;
+                int best = 0;
+                for (k = 1; k < nnodes; k++) if (r[k] < r[best]) best = k;
+                bestnodes[i+j] = best;
             }
         }
         else {
-            double closest;
-            double** celldatavector = malloc(ndata*sizeof(double*));
-            double radius = maxradius * (1. - ((double)iter)/((double)niter));
-            double tau = inittau * (1. - ((double)iter)/((double)niter));
-
-            for (i = 0; i < ndata; i++)
-                celldatavector[i] = &(celldata[ixbest][iybest][i]);
-            closest = metric(ndata, data, celldatavector, mask, dummymask,
-                             weights, iobject, 0, transpose);
-            for (ix = 0; ix < nxgrid; ix++) {
-                for (iy = 0; iy < nygrid; iy++) {
-                    double distance;
-                    for (i = 0; i < ndata; i++)
-                        celldatavector[i] = &(celldata[ixbest][iybest][i]);
-                    distance = metric(ndata, data, celldatavector, mask,
-                                      dummymask, weights, iobject, 0,
-                                      transpose);
-                    if (distance < closest) {
-                        ixbest = ix;
-                        iybest = iy;
-                        closest = distance;
-                    }
-                }
-            }
-            free(celldatavector);
-            for (ix = 0; ix < nxgrid; ix++) {
-                for (iy = 0; iy < nygrid; iy++) {
-                    if (sqrt((ix-ixbest)*(ix-ixbest)+(iy-iybest)*(iy-iybest)) <
-                        radius) {
-                        double sum = 0.;
-                        for (i = 0; i < ndata; i++) {
-                            if (mask[i][iobject] == 0) continue;
-                            celldata[ix][iy][i] +=
-                                tau * (data[i][iobject]/stddata[iobject]
-                                      -celldata[ix][iy][i]);
-                        }
-                        for (i = 0; i < ndata; i++) {
-                            double term = celldata[ix][iy][i];
-                            term = term * term;
-                            sum += term;
-                        }
-                        if (sum>0) {
-                            sum = sqrt(sum/ndata);
-                            for (i = 0; i < ndata; i++)
-                                celldata[ix][iy][i] /= sum;
-                        }
-                    }
-                }
+            for (j = i; j < i + n; j++) {
+                getsomitem(&item, data, mask, transpose, j);
+                bestnodes[j] = bestnode(&item, nnodes, nodes);
             }
         }
     }
-    if (transpose == 0)
-        for (i = 0; i < nygrid; i++) free(dummymask[i]);
-    else
-        for (i = 0; i < ndata; i++) free(dummymask[i]);
-    free(dummymask);
-    free(stddata);
-    free(index);
+    ok = 1;
+
+exit:
+    if (block) free(block);
+    if (index) free(index);
+    if (result) free(result);
+    free_somitem(&item);
+    free(nodes);
+    return ok;
 }
 
 /* ******************************************************************* */
 
-static void
-somassign(int nrows, int ncolumns, double** data, int** mask,
-    const double weights[], int transpose, int nxgrid, int nygrid,
-    double*** celldata, char dist, int clusterid[][2])
-/* Collect clusterids */
+int
+somupdate(int nrows, int ncolumns, double** data, int** mask, int transpose,
+    int nxgrid, int nygrid, int iter, int niter, const int bestnodes[],
+    double*** celldata)
+/*
+Purpose
+=======
+
+The somupdate routine performs one epoch of the batch self-organizing map
+algorithm. Each node is replaced by the weighted mean of the (scaled) items
+whose closest node lies within the neighborhood radius r of that node on the
+grid, after which it is normalized. An item whose closest node is at grid
+distance d from the node has weight exp(-2*(d/r)**2). The neighborhood
+radius decreases linearly from the diagonal of the grid in the first epoch
+to zero after niter epochs. As the new nodes depend only on the assignments
+in bestnodes, the result does not depend on the order of the items.
+
+Arguments
+=========
+
+nrows, ncolumns, data, mask, transpose
+As in somcluster.
+
+nxgrid, nygrid (input) int
+The dimensions of the rectangular SOM grid.
+
+iter, niter (input) int
+The current epoch, and the total number of epochs.
+
+bestnodes (input) int[nrows] if transpose == 0;
+                  int[ncolumns] otherwise
+The node closest to each item, as calculated by somassign.
+
+celldata  (input/output) double[nxgrid][nygrid][ndata]
+The data of each node, where ndata is ncolumns if transpose == 0, and nrows
+otherwise.
+
+Return value
+============
+
+1 on success, 0 if a memory allocation failed.
+
+========================================================================
+*/
 {
+    const int nelements = (transpose == 0) ? nrows : ncolumns;
     const int ndata = (transpose == 0) ? ncolumns : nrows;
-    int i, j;
-
-    /* Set the metric function as indicated by dist */
-    double (*metric) (int, double**, double**, int**, int**,
-                      const double[], int, int, int) = setmetric(dist);
+    const int nnodes = nxgrid * nygrid;
+    const double maxradius = sqrt(nxgrid*nxgrid+nygrid*nygrid);
+    const double radius = maxradius * (1. - ((double)iter)/((double)niter));
+    int i, k, b, c;
+    int ok = 0;
+    /* sums and counts of the scaled items closest to each node */
+    double* sums = calloc(nnodes*ndata, sizeof(double));
+    double* counts = calloc(nnodes*ndata, sizeof(double));
+    double* sum = malloc(ndata*sizeof(double));
+    double* count = malloc(ndata*sizeof(double));
+    double* x = malloc(ndata*sizeof(double));
+    int* m = malloc(ndata*sizeof(int));
+    double* griddistance = griddistances(nxgrid, nygrid);
+    double** nodes = getnodes(nxgrid, nygrid, celldata);
+
+    if (!sums || !counts || !sum || !count || !x || !m || !griddistance
+     || !nodes) goto exit;
 
-    if (transpose == 0) {
-        int** dummymask = malloc(nygrid*sizeof(int*));
-        for (i = 0; i < nygrid; i++) {
-            dummymask[i] = malloc(ncolumns*sizeof(int));
-            for (j = 0; j < ncolumns; j++) dummymask[i][j] = 1;
-        }
-        for (i = 0; i < nrows; i++) {
-            int ixbest = 0;
-            int iybest = 0;
-            double closest = metric(ndata, data, celldata[ixbest], mask,
-                                    dummymask, weights, i, iybest, transpose);
-            int ix, iy;
-            for (ix = 0; ix < nxgrid; ix++) {
-                for (iy = 0; iy < nygrid; iy++) {
-                    double distance = metric(ndata, data, celldata[ix], mask,
-                                             dummymask, weights, i, iy,
-                                             transpose);
-                    if (distance < closest) {
-                        ixbest = ix;
-                        iybest = iy;
-                        closest = distance;
-                    }
-                }
+    for (i = 0; i < nelements; i++) {
+        double* s = sums + bestnodes[i]*ndata;
+        double* n = counts + bestnodes[i]*ndata;
+        double scale;
+        for (k = 0; k < ndata; k++) {
+            if (transpose == 0) {
+                x[k] = data[i][k];
+                m[k] = mask[i][k];
+            }
+            else {
+                x[k] = data[k][i];
+                m[k] = mask[k][i];
             }
-            clusterid[i][0] = ixbest;
-            clusterid[i][1] = iybest;
         }
-        for (i = 0; i < nygrid; i++) free(dummymask[i]);
-        free(dummymask);
+        scale = itemscale(ndata, x, m);
+        for (k = 0; k < ndata; k++) {
+            if (m[k] == 0) continue;
+            s[k] += x[k]/scale;
+            n[k]++;
+        }
     }
-    else {
-        double** celldatavector = malloc(ndata*sizeof(double*));
-        int** dummymask = malloc(nrows*sizeof(int*));
-        int ixbest = 0;
-        int iybest = 0;
-        for (i = 0; i < nrows; i++) {
-            dummymask[i] = malloc(sizeof(int));
-            dummymask[i][0] = 1;
-        }
-        for (i = 0; i < ncolumns; i++) {
-            double closest;
-            int ix, iy;
-            for (j = 0; j < ndata; j++)
-                celldatavector[j] = &(celldata[ixbest][iybest][j]);
-            closest = metric(ndata, data, celldatavector, mask, dummymask,
-                             weights, i, 0, transpose);
-            for (ix = 0; ix < nxgrid; ix++) {
-                for (iy = 0; iy < nygrid; iy++) {
-                    double distance;
-                    for (j = 0; j < ndata; j++)
-                        celldatavector[j] = &(celldata[ix][iy][j]);
-                    distance = metric(ndata, data, celldatavector, mask,
-                                      dummymask, weights, i, 0, transpose);
-                    if (distance < closest) {
-                        ixbest = ix;
-                        iybest = iy;
-                        closest = distance;
-                    }
-                }
+    for (c = 0; c < nnodes; c++) {
+        const int ix = c / nygrid;
+        const int iy = c % nygrid;
+        double* node = nodes[c];
+        for (k = 0; k < ndata; k++) sum[k] = count[k] = 0;
+        for (b = 0; b < nnodes; b++) {
+            const int dx = abs(b / nygrid - ix);
+            const int dy = abs(b % nygrid - iy);
+            const double* s = sums + b*ndata;
+            const double* n = counts + b*ndata;
+            const double d = griddistance[dx*nygrid+dy] / radius;
+            double h;
+            if (d >= 1) continue;
+            h = exp(-2*d*d);
+            for (k = 0; k < ndata; k++) {
+                sum[k] += h*s[k];
+                count[k] += h*n[k];
             }
-            clusterid[i][0] = ixbest;
-            clusterid[i][1] = iybest;
         }
-        free(celldatavector);
-        for (i = 0; i < nrows; i++) free(dummymask[i]);
-        free(dummymask);
+        for (k = 0; k < ndata; k++)
+            if (count[k] > 0) node[k] = sum[k] / count[k];
+        normalizenode(ndata, node);
     }
+    ok = 1;
+
+exit:
+    if (sums) free(sums);
+    if (counts) free(counts);
+    if (sum) free(sum);
+    if (count) free(count);
+    if (x) free(x);
+    if (m) free(m);
+    if (griddistance) free(griddistance);
+    if (nodes) free(nodes);
+    return ok;
 }
 
 /* ******************************************************************* */
 
-void
+static int
+sombatch(int nrows, int ncolumns, double** data, int** mask,
+    const double weights[], int transpose, int nxgrid, int nygrid,
+    double*** celldata, int niter, char dist, unsigned long long seed)
+{
+    const int nelements = (transpose == 0) ? nrows : ncolumns;
+    const int ndata = (transpose == 0) ? ncolumns : nrows;
+    int iter;
+    int ok = 1;
+    int* bestnodes = malloc(nelements*sizeof(int));
+
+    if (!bestnodes) return 0;
+    sominit(ndata, nxgrid, nygrid, celldata, seed);
+    for (iter = 0; ok && iter < niter; iter++) {
+        ok = somassign(nrows, ncolumns, data, mask, weights, transpose,
+                       nxgrid, nygrid, celldata, dist, 0, nelements,
+                       bestnodes)
+          && somupdate(nrows, ncolumns, data, mask, transpose, nxgrid,
+                       nygrid, iter, niter, bestnodes, celldata);
+    }
+    free(bestnodes);
+    return ok;
+}
+
+/* ******************************************************************* */
+
+int
 somcluster(int nrows, int ncolumns, double** data, int** mask,
     const double weight[], int transpose, int nxgrid, int nygrid,
-    double inittau, int niter, char dist, double*** celldata,
-    int clusterid[][2])
+    double inittau, int niter, char dist, unsigned long long seed,
+    int batch, double*** celldata, int clusterid[][2])
 /*
 
 Purpose
@@ -4614,10 +6508,13 @@ nygrid    (input) int
 The number of grid cells horizontally in the rectangular topology of clusters.
 
 inittau   (input) double
-The initial value of tau, representing the neighborhood function.
+The initial value of tau, representing the neighborhood function. This value
+is not used by the batch algorithm.
 
 niter     (input) int
-The number of iterations to be performed.
+The number of iterations to be performed. If batch == 0, one item is used in
+each iteration; otherwise, each iteration is an epoch of the batch algorithm
+using all items.
 
 dist      (input) char
 Defines which distance measure is used, as given by the table:
@@ -4631,6 +6528,17 @@ dist == 's': Spearman's rank correlation
 dist == 'k': Kendall's tau
 For other values of dist, the default (Euclidean distance) is used.
 
+seed      (input) unsigned long long
+The seed of the random number generator used to initialize the nodes and to
+choose the order in which the items are used.
+
+batch     (input) int
+If batch == 0, the nodes are updated after each item, as in the original
+algorithm by Kohonen. Otherwise, the batch algorithm is used, in which all
+items are first assigned to their closest node, after which each node is
+replaced by the mean of the items assigned to the nodes in its neighborhood
+(see somupdate).
+
 celldata  (output) double[nxgrid][nygrid][ncolumns] if transpose == 0;
                    double[nxgrid][nygrid][nrows]    otherwise
 The gene expression data for each node (cell) in the 2D grid. This can be
@@ -4647,38 +6555,74 @@ cluster assignments are not returned. If clusterid is not NULL, enough memory
 should be allocated to store the clustering information before calling
 somcluster.
 
+Return value
+============
+
+1 on success, 0 if a memory allocation failed.
+
 ========================================================================
 */
 {
     const int nobjects = (transpose == 0) ? nrows : ncolumns;
     const int ndata = (transpose == 0) ? ncolumns : nrows;
-    int i, j;
+    int i;
+    int ok = 0;
     const int lcelldata = (celldata == NULL) ? 0 : 1;
+    double* buffer = NULL;
+    double** rows = NULL;
+    int* bestnodes = NULL;
+
+    if (nobjects < 2) return 1;
 
-    if (nobjects < 2) return;
+    if (transpose) {
+        /* Use the rows of a transposed copy of the data */
+        Matrix matrix;
+        if (!transposedmatrix(&matrix, data, mask, nrows, 0, ncolumns))
+            return 0;
+        ok = somcluster(matrix.nrows, matrix.ncols, matrix.rows,
+                        matrix.maskrows, weight, 0, nxgrid, nygrid, inittau,
+                        niter, dist, seed, batch, celldata, clusterid);
+        freematrix(&matrix);
+        return ok;
+    }
 
     if (lcelldata == 0) {
-        celldata = malloc(nxgrid*nygrid*ndata*sizeof(double**));
-        for (i = 0; i < nxgrid; i++) {
-            celldata[i] = malloc(nygrid*ndata*sizeof(double*));
-            for (j = 0; j < nygrid; j++)
-                celldata[i][j] = malloc(ndata*sizeof(double));
+        buffer = malloc(nxgrid*nygrid*ndata*sizeof(double));
+        rows = malloc(nxgrid*nygrid*sizeof(double*));
+        celldata = malloc(nxgrid*sizeof(double**));
+        if (!buffer || !rows || !celldata) goto exit;
+        for (i = 0; i < nxgrid*nygrid; i++) rows[i] = buffer + i*ndata;
+        for (i = 0; i < nxgrid; i++) celldata[i] = rows + i*nygrid;
+    }
+
+    if (batch)
+        ok = sombatch(nrows, ncolumns, data, mask, weight, transpose, nxgrid,
+                      nygrid, celldata, niter, dist, seed);
+    else
+        ok = somworker(nrows, ncolumns, data, mask, weight, transpose,
+                       nxgrid, nygrid, inittau, celldata, niter, dist, seed);
+    if (ok && clusterid) {
+        bestnodes = malloc(nobjects*sizeof(int));
+        ok = bestnodes
+          && somassign(nrows, ncolumns, data, mask, weight, transpose,
+                       nxgrid, nygrid, celldata, dist, 0, nobjects,
+                       bestnodes);
+        if (ok) {
+            for (i = 0; i < nobjects; i++) {
+                clusterid[i][0] = bestnodes[i] / nygrid;
+                clusterid[i][1] = bestnodes[i] % nygrid;
+            }
         }
+        if (bestnodes) free(bestnodes);
     }
 
-    somworker(nrows, ncolumns, data, mask, weight, transpose, nxgrid, nygrid,
-        inittau, celldata, niter, dist);
-    if (clusterid)
-        somassign(nrows, ncolumns, data, mask, weight, transpose,
-            nxgrid, nygrid, celldata, dist, clusterid);
+exit:
     if (lcelldata == 0) {
-        for (i = 0; i < nxgrid; i++)
-            for (j = 0; j < nygrid; j++)
-                free(celldata[i][j]);
-        for (i = 0; i < nxgrid; i++)
-            free(celldata[i]);
-        free(celldata);
+        if (buffer) free(buffer);
+        if (rows) free(rows);
+        if (celldata) free(celldata);
     }
+    return ok;
 }
 
 /* ******************************************************************** */
@@ -5011,49 +6955,50 @@ when samples are being clustered.
                 return distance;
             }
         }
-        case 's': {
+        case 's':
+        case 'x':
+        case 'v': {
             int i1, i2, j1, j2;
             const int n = (transpose == 0) ? ncolumns : nrows;
-            double mindistance = DBL_MAX;
-            for (i1 = 0; i1 < n1; i1++)
-                for (i2 = 0; i2 < n2; i2++) {
-                    double distance;
-                    j1 = index1[i1];
-                    j2 = index2[i2];
-                    distance = metric(n, data, data, mask, mask, weight,
-                                      j1, j2, transpose);
-                    if (distance < mindistance) mindistance = distance;
+            double result = (method == 's') ? DBL_MAX : 0;
+            /* Use the blocked kernels to calculate the pairwise distances
+             * if no data are missing */
+            double* table = NULL;
+            if (blocked_metric(dist)) table = malloc(BLOCKSIZE*n2*sizeof(double));
+            for (i1 = 0; i1 < n1; i1++) {
+                if (table && i1 % BLOCKSIZE == 0
+                 && !blocked_distances(dist, n, weight, transpose,
+                                       data, mask, min(BLOCKSIZE, n1 - i1),
+                                       index1 + i1, data, mask, n2, index2,
+                                       table)) {
+                    free(table);
+                    table = NULL;
                 }
-            return mindistance;
-        }
-        case 'x': {
-            int i1, i2, j1, j2;
-            const int n = (transpose == 0) ? ncolumns : nrows;
-            double maxdistance = 0;
-            for (i1 = 0; i1 < n1; i1++)
                 for (i2 = 0; i2 < n2; i2++) {
                     double distance;
-                    j1 = index1[i1];
-                    j2 = index2[i2];
-                    distance = metric(n, data, data, mask, mask, weight,
-                                      j1, j2, transpose);
-                    if (distance > maxdistance) maxdistance = distance;
-                }
-            return maxdistance;
-        }
-        case 'v': {
-            int i1, i2, j1, j2;
-            const int n = (transpose == 0) ? ncolumns : nrows;
-            double distance = 0;
-            for (i1 = 0; i1 < n1; i1++)
-                for (i2 = 0; i2 < n2; i2++) {
-                    j1 = index1[i1];
-                    j2 = index2[i2];
-                    distance += metric(n, data, data, mask, mask, weight,
-                                       j1, j2, transpose);
+                    if (table) distance = table[(i1 % BLOCKSIZE)*n2+i2];
+                    else {
+                        j1 = index1[i1];
+                        j2 = index2[i2];
+                        distance = metric(n, data, data, mask, mask, weight,
+                                          j1, j2, transpose);
+                    }
+                    switch (method) {
+                        case 's':
+                            if (distance < result) result = distance;
+                            break;
+                        case 'x':
+                            if (distance > result) result = distance;
+                            break;
+                        case 'v':
+                            result += distance;
+                            break;
+                    }
                 }
-            distance /= (n1*n2);
-            return distance;
+            }
+            if (table) free(table);
+            if (method == 'v') result /= (n1*n2);
+            return result;
         }
     }
     /* Never get here */
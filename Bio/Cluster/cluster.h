@@ -37,11 +37,25 @@
 #define CLUSTERVERSION "1.59"
 
 /* Chapter 2 */
+typedef struct {double** values; float** fvalues;} Distances;
+/*
+ * A Distances struct stores the lower triangle of a distance matrix, either
+ * in double precision (values) or in single precision (fvalues); the other
+ * pointer is NULL. Row i contains the distances between element i and
+ * elements 0..i-1. The rows may be allocated separately, or point into a
+ * single contiguous block storing the condensed distance matrix, as allocated
+ * by allocate_distances.
+ */
+int allocate_distances(int n, int single, Distances* distances);
+void free_distances(Distances* distances);
 double clusterdistance(int nrows, int ncolumns, double** data, int** mask,
   double weight[], int n1, int n2, int index1[], int index2[], char dist,
   char method, int transpose);
 void distancematrix(int ngenes, int ndata, double** data, int** mask,
   double* weight, char dist, int transpose, double** distances);
+void distancematrix_tile(int nrows, int ncolumns, double** data, int** mask,
+  double weights[], char dist, int transpose, int firstrow, int lastrow,
+  int firstcolumn, int lastcolumn, const Distances* distances);
 
 /* Chapter 3 */
 int getclustercentroids(int nclusters, int nrows, int ncolumns,
@@ -52,8 +66,16 @@ void getclustermedoids(int nclusters, int nelements, double** distance,
 void kcluster(int nclusters, int ngenes, int ndata, double** data,
   int** mask, double weight[], int transpose, int npass, char method, char dist,
   int clusterid[], double* error, int* ifound);
+int kcluster_pass(int nclusters, int nrows, int ncolumns, double** data,
+  int** mask, double weight[], int transpose, char method, char dist,
+  char initialization, unsigned long long seed, int ipass, int clusterid[],
+  double* error);
 void kmedoids(int nclusters, int nelements, double** distance,
   int npass, int clusterid[], double* error, int* ifound);
+void kmedoidsf(int nclusters, int nelements, float** distance,
+  int npass, int clusterid[], double* error, int* ifound);
+int kmedoids_pass(int nclusters, int nelements, const Distances* distances,
+  unsigned long long seed, int ipass, int clusterid[], double* error);
 
 /* Chapter 4 */
 typedef struct {int left; int right; double distance;} Node;
@@ -69,14 +91,24 @@ typedef struct {int left; int right; double distance;} Node;
 
 Node* treecluster(int nrows, int ncolumns, double** data, int** mask,
   double weight[], int transpose, char dist, char method, double** distmatrix);
+Node* treeclusterf(int nrows, int ncolumns, double** data, int** mask,
+  double weight[], int transpose, char dist, char method, float** distmatrix);
 int sorttree(const int nnodes, Node* tree, const double order[], int indices[]);
 int cuttree(int nelements, const Node* tree, int nclusters, int clusterid[]);
 
 /* Chapter 5 */
-void somcluster(int nrows, int ncolumns, double** data, int** mask,
+int somcluster(int nrows, int ncolumns, double** data, int** mask,
   const double weight[], int transpose, int nxnodes, int nynodes,
-  double inittau, int niter, char dist, double*** celldata,
-  int clusterid[][2]);
+  double inittau, int niter, char dist, unsigned long long seed, int batch,
+  double*** celldata, int clusterid[][2]);
+void sominit(int ndata, int nxgrid, int nygrid, double*** celldata,
+  unsigned long long seed);
+int somassign(int nrows, int ncolumns, double** data, int** mask,
+  const double weight[], int transpose, int nxgrid, int nygrid,
+  double*** celldata, char dist, int first, int last, int bestnodes[]);
+int somupdate(int nrows, int ncolumns, double** data, int** mask,
+  int transpose, int nxgrid, int nygrid, int iter, int niter,
+  const int bestnodes[], double*** celldata);
 
 /* Chapter 6 */
 int pca(int m, int n, double** u, double** v, double* w);
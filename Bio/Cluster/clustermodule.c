@@ -70,6 +70,29 @@ method_kcluster_converter(PyObject* object, void* pointer)
     return 1;
 }
 
+static int
+initialization_converter(PyObject* object, void* pointer)
+{
+    const char* name;
+
+    if (!PyUnicode_Check(object)) {
+        PyErr_SetString(PyExc_ValueError, "initialization should be a string");
+        return 0;
+    }
+    name = PyUnicode_AsUTF8(object);
+    if (!name) return 0;
+    if (strcmp(name, "random") == 0) *((char*)pointer) = 'r';
+    else if (strcmp(name, "kmeans++") == 0) *((char*)pointer) = '+';
+    else if (strcmp(name, "kmeans||") == 0) *((char*)pointer) = '|';
+    else {
+        PyErr_Format(PyExc_ValueError,
+                     "unknown initialization method '%s' (should be one of "
+                     "'random', 'kmeans++', or 'kmeans||')", name);
+        return 0;
+    }
+    return 1;
+}
+
 static int
 method_clusterdistance_converter(PyObject* object, void* pointer)
 {
@@ -316,15 +339,52 @@ check_clusterid(Py_buffer clusterid, int nitems) {
 typedef struct {
     int n;
     double** values;
+    float** fvalues;
     Py_buffer* views;
     Py_buffer view;
 } Distancematrix;
 
+static int
+_set_distancematrix_rows(Distancematrix* distances, char* p,
+                         Py_ssize_t itemsize, Py_ssize_t stride)
+/* Set the row pointers of the distance matrix stored in the buffer p. If
+ * stride is zero, the distance matrix is stored in condensed form, with row i
+ * containing i distances; otherwise, each row contains stride distances. */
+{
+    int i;
+    const int n = distances->n;
+
+    if (itemsize == sizeof(float)) {
+        float** fvalues = PyMem_Malloc(n*sizeof(float*));
+        if (!fvalues) {
+            PyErr_NoMemory();
+            return 0;
+        }
+        for (i = 0; i < n; i++) {
+            fvalues[i] = (float*)p;
+            p += (stride ? stride : i) * itemsize;
+        }
+        distances->fvalues = fvalues;
+    }
+    else {
+        double** values = PyMem_Malloc(n*sizeof(double*));
+        if (!values) {
+            PyErr_NoMemory();
+            return 0;
+        }
+        for (i = 0; i < n; i++) {
+            values[i] = (double*)p;
+            p += (stride ? stride : i) * itemsize;
+        }
+        distances->values = values;
+    }
+    return 1;
+}
+
 static int
 _convert_list_to_distancematrix(PyObject* list, Distancematrix* distances)
 {
     int i;
-    double** values;
     Py_buffer* view;
     Py_buffer* views;
     const int flag = PyBUF_ND | PyBUF_C_CONTIGUOUS;
@@ -334,12 +394,6 @@ _convert_list_to_distancematrix(PyObject* list, Distancematrix* distances)
         PyErr_SetString(PyExc_ValueError, "distance matrix is too large");
         return 0;
     }
-    values = PyMem_Malloc(n*sizeof(double*));
-    if (!values) {
-        PyErr_NoMemory();
-        return 0;
-    }
-    distances->values = values;
     views = PyMem_Malloc(n*sizeof(Py_buffer));
     if (!views) {
         PyErr_NoMemory();
@@ -360,7 +414,9 @@ _convert_list_to_distancematrix(PyObject* list, Distancematrix* distances)
                          i, view->ndim);
             break;
         }
-        if (view->itemsize != sizeof(double)) {
+        if ((view->itemsize != sizeof(double)
+          && view->itemsize != sizeof(float))
+         || view->itemsize != views[0].itemsize) {
             PyErr_Format(PyExc_RuntimeError,
                          "row %d has incorrect data type", i);
             break;
@@ -371,27 +427,45 @@ _convert_list_to_distancematrix(PyObject* list, Distancematrix* distances)
                          i, view->shape[0], i);
             break;
         }
-        values[i] = view->buf;
-    }
-    if (i < n) {
-        for ( ; view >= views; view--) PyBuffer_Release(view);
-        PyMem_Free(views);
-        return 0;
     }
     distances->n = n;
-    distances->view.len = 0;
-    distances->views = views;
-    distances->values = values;
-    return 1;
+    if (i == n) {
+        /* The rows are stored separately; set the row pointers directly */
+        if (n > 0 && views[0].itemsize == sizeof(float)) {
+            float** fvalues = PyMem_Malloc(n*sizeof(float*));
+            if (fvalues) {
+                for (i = 0; i < n; i++) fvalues[i] = views[i].buf;
+                distances->fvalues = fvalues;
+            }
+        }
+        else {
+            double** values = PyMem_Malloc(n*sizeof(double*));
+            if (values) {
+                for (i = 0; i < n; i++) values[i] = views[i].buf;
+                distances->values = values;
+            }
+        }
+        if (distances->values || distances->fvalues) {
+            distances->view.len = 0;
+            distances->views = views;
+            return 1;
+        }
+        PyErr_NoMemory();
+        view = views + n - 1;
+    }
+    for ( ; view >= views; view--) PyBuffer_Release(view);
+    PyMem_Free(views);
+    return 0;
 }
 
 static int
-_convert_array_to_distancematrix(PyObject* array, Distancematrix* distances)
+_convert_array_to_distancematrix(PyObject* array, Distancematrix* distances,
+                                 int allow_empty)
+/* Set the row pointers of the distance matrix stored in array. An empty 1D
+ * array is accepted as the distance matrix of a single item only if
+ * allow_empty is nonzero. */
 {
-    int i;
     int n;
-    double** values;
-    double* p;
     Py_buffer* view = &distances->view;
     const int flag = PyBUF_ND | PyBUF_C_CONTIGUOUS;
 
@@ -401,62 +475,57 @@ _convert_array_to_distancematrix(PyObject* array, Distancematrix* distances)
         return 0;
     }
 
-    if (view->len == 0) {
+    if (view->len == 0 && !(allow_empty && view->ndim == 1)) {
         PyBuffer_Release(view);
         PyErr_SetString(PyExc_ValueError, "distance matrix is empty");
         return 0;
     }
-    if (view->itemsize != sizeof(double)) {
+    if (view->itemsize != sizeof(double) && view->itemsize != sizeof(float)) {
+        PyBuffer_Release(view);
         PyErr_SetString(PyExc_RuntimeError,
                         "distance matrix has an incorrect data type");
         return 0;
     }
     if (view->ndim == 1) {
-        int m = (int) view->shape[0];
-        if (m != view->shape[0]) {
-            PyErr_Format(PyExc_ValueError,
-                         "distance matrix is too large (size = %zd)",
-                         view->shape[0]);
-            return 0;
-        }
-        n = (int)(1+sqrt(1+8*m)/2); /* rounds to (1+sqrt(1+8*m))/2 */
-        if (n*n-n != 2 * m) {
+        const Py_ssize_t m = view->shape[0];
+        n = (int)(1+sqrt(1+8.0*m)/2); /* rounds to (1+sqrt(1+8*m))/2 */
+        if ((Py_ssize_t)n*(n-1) != 2 * m) {
+            PyBuffer_Release(view);
             PyErr_SetString(PyExc_ValueError,
                             "distance matrix has unexpected size.");
             return 0;
         }
         distances->n = n;
-        values = PyMem_Malloc(n*sizeof(double*));
-        if (!values) {
-            PyErr_NoMemory();
+        if (!_set_distancematrix_rows(distances, view->buf, view->itemsize, 0))
+        {
+            PyBuffer_Release(view);
             return 0;
         }
-        distances->values = values;
-        for (p = view->buf, i = 0; i < n; p += i, i++) values[i] = p;
     }
     else if (view->ndim == 2) {
         n = (int) view->shape[0];
         if (n != view->shape[0]) {
+            PyBuffer_Release(view);
             PyErr_Format(PyExc_ValueError,
                          "distance matrix is too large (size = %zd)",
                          view->shape[0]);
             return 0;
         }
-        distances->n = n;
         if (view->shape[1] != n) {
+            PyBuffer_Release(view);
             PyErr_SetString(PyExc_ValueError,
                             "distance matrix is not square.");
             return 0;
         }
-        values = PyMem_Malloc(n*sizeof(double*));
-        if (!values) {
-            PyErr_NoMemory();
+        distances->n = n;
+        if (!_set_distancematrix_rows(distances, view->buf, view->itemsize, n))
+        {
+            PyBuffer_Release(view);
             return 0;
         }
-        distances->values = values;
-        for (p = view->buf, i = 0; i < n; p += n, i++) values[i] = p;
     }
     else {
+        PyBuffer_Release(view);
         PyErr_Format(PyExc_ValueError,
                      "distance matrix has incorrect rank %d (expected 1 or 2)",
                      view->ndim);
@@ -465,11 +534,26 @@ _convert_array_to_distancematrix(PyObject* array, Distancematrix* distances)
     return 1;
 }
 
+static int
+distancematrix_readonly(const Distancematrix* distances)
+/* Return 1 if any part of the distance matrix is stored in a read-only
+ * buffer, and 0 otherwise. */
+{
+    int i;
+
+    if (distances->views) {
+        for (i = 0; i < distances->n; i++)
+            if (distances->views[i].readonly) return 1;
+        return 0;
+    }
+    if (distances->view.obj) return distances->view.readonly;
+    return 0;
+}
+
 static int
 distancematrix_converter(PyObject* argument, void* pointer)
 {
     Distancematrix* distances = pointer;
-    double** values;
 
     if (argument == NULL) goto exit;
     if (argument == Py_None) return 1;
@@ -478,13 +562,12 @@ distancematrix_converter(PyObject* argument, void* pointer)
             return Py_CLEANUP_SUPPORTED;
     }
     else {
-        if (_convert_array_to_distancematrix(argument, distances))
+        if (_convert_array_to_distancematrix(argument, distances, 0))
             return Py_CLEANUP_SUPPORTED;
     }
 
 exit:
-    values = distances->values;
-    if (values == NULL) return 0;
+    if (distances->values == NULL && distances->fvalues == NULL) return 0;
     else {
         int i;
         const int n = distances->n;
@@ -493,10 +576,13 @@ exit:
             for (i = 0; i < n; i++) PyBuffer_Release(&views[i]);
             PyMem_Free(views);
         }
-        else if (distances->view.len) {
+        else if (distances->view.obj) {
             PyBuffer_Release(&distances->view);
         }
-        PyMem_Free(values);
+        if (distances->values) PyMem_Free(distances->values);
+        if (distances->fvalues) PyMem_Free(distances->fvalues);
+        distances->values = NULL;
+        distances->fvalues = NULL;
     }
     return 0;
 }
@@ -652,6 +738,492 @@ exit:
     return 0;
 }
 
+/* -- threads -------------------------------------------------------------- */
+
+typedef struct {
+    void (*task)(void* arg, int index);
+    void* arg;
+    int ntasks;
+    int next;  /* index of the next task to be run */
+    PyThread_type_lock lock;
+} Tasks;
+
+typedef struct {
+    Tasks* tasks;
+    PyThread_type_lock done;  /* released when the worker has finished */
+} Worker;
+
+static void
+run_worker(void* arg)
+/* Run tasks until none are left. This runs without the GIL. */
+{
+    Worker* worker = arg;
+    Tasks* tasks = worker->tasks;
+    int index;
+
+    while (1) {
+        PyThread_acquire_lock(tasks->lock, WAIT_LOCK);
+        index = tasks->next++;
+        PyThread_release_lock(tasks->lock);
+        if (index >= tasks->ntasks) break;
+        tasks->task(tasks->arg, index);
+    }
+    if (worker->done) PyThread_release_lock(worker->done);
+}
+
+static void
+run_tasks(int nthreads, int ntasks, void (*task)(void*, int), void* arg)
+/* Run task(arg, index) for index = 0, ..., ntasks-1 on nthreads threads.
+ * The calling thread takes part in the work, and should have released the
+ * GIL. If threads or locks cannot be allocated, fewer threads are used.
+ */
+{
+    int i;
+    Tasks tasks;
+    Worker* workers = NULL;
+
+    if (nthreads > ntasks) nthreads = ntasks;
+    if (nthreads > 1) workers = malloc(nthreads*sizeof(Worker));
+    if (workers) tasks.lock = PyThread_allocate_lock();
+    if (!workers || !tasks.lock) {
+        if (workers) free(workers);
+        for (i = 0; i < ntasks; i++) task(arg, i);
+        return;
+    }
+    tasks.task = task;
+    tasks.arg = arg;
+    tasks.ntasks = ntasks;
+    tasks.next = 0;
+    for (i = 0; i < nthreads; i++) {
+        workers[i].tasks = &tasks;
+        workers[i].done = NULL;
+        if (i == 0) continue;
+        workers[i].done = PyThread_allocate_lock();
+        if (!workers[i].done) continue;
+        PyThread_acquire_lock(workers[i].done, WAIT_LOCK);
+        if (PyThread_start_new_thread(run_worker, &workers[i])
+            == PYTHREAD_INVALID_THREAD_ID) {
+            PyThread_release_lock(workers[i].done);
+            PyThread_free_lock(workers[i].done);
+            workers[i].done = NULL;
+        }
+    }
+    run_worker(&workers[0]);
+    for (i = 1; i < nthreads; i++) {
+        if (workers[i].done) {
+            PyThread_acquire_lock(workers[i].done, WAIT_LOCK);
+            PyThread_release_lock(workers[i].done);
+            PyThread_free_lock(workers[i].done);
+        }
+    }
+    PyThread_free_lock(tasks.lock);
+    free(workers);
+}
+
+/* -- parallel distance matrix --------------------------------------------- */
+
+#define TILESIZE 64
+
+typedef struct {
+    int nrows;
+    int ncols;
+    double** data;
+    int** mask;
+    double* weight;
+    char dist;
+    int transpose;
+    const Distances* distances;
+} DistancematrixTiles;
+
+static void
+distancematrix_task(void* arg, int index)
+{
+    DistancematrixTiles* tiles = arg;
+    /* Tiles are numbered row by row in the lower triangle */
+    int i = (int)((sqrt(8.0*index+1)-1)/2);
+    int j;
+
+    while (i*(i+1)/2 > index) i--;
+    while ((i+1)*(i+2)/2 <= index) i++;
+    j = index - i*(i+1)/2;
+    distancematrix_tile(tiles->nrows, tiles->ncols, tiles->data, tiles->mask,
+                        tiles->weight, tiles->dist, tiles->transpose,
+                        i*TILESIZE, (i+1)*TILESIZE, j*TILESIZE, (j+1)*TILESIZE,
+                        tiles->distances);
+}
+
+static void
+parallel_distancematrix(int nrows, int ncols, double** data, int** mask,
+    double* weight, char dist, int transpose, const Distances* distances,
+    int nthreads)
+/* Calculate the distance matrix, dividing the lower triangle into tiles that
+ * are distributed over nthreads threads. The distances are stored in double
+ * or in single precision, depending on distances. This function is called
+ * without the GIL. */
+{
+    const int n = (transpose == 0) ? nrows : ncols;
+    const int ntiles = (n + TILESIZE - 1) / TILESIZE;
+    DistancematrixTiles tiles;
+
+    if (nthreads <= 1 || ntiles <= 1) {
+        distancematrix_tile(nrows, ncols, data, mask, weight, dist, transpose,
+                            0, n, 0, n, distances);
+        return;
+    }
+    tiles.nrows = nrows;
+    tiles.ncols = ncols;
+    tiles.data = data;
+    tiles.mask = mask;
+    tiles.weight = weight;
+    tiles.dist = dist;
+    tiles.transpose = transpose;
+    tiles.distances = distances;
+    run_tasks(nthreads, ntiles*(ntiles+1)/2, distancematrix_task, &tiles);
+}
+
+static Node*
+parallel_treecluster(int nrows, int ncols, double** data, int** mask,
+    double* weight, int transpose, char dist, char method, int nthreads,
+    int single)
+/* Perform hierarchical clustering, calculating the distance matrix on
+ * nthreads threads and storing it in double precision, or in single precision
+ * if single is nonzero. This function is called without the GIL. */
+{
+    Node* nodes;
+    Distances distances;
+    const int n = (transpose == 0) ? nrows : ncols;
+
+    /* Single linkage clustering does not store the distance matrix */
+    if (method == 's' || nthreads <= 1 || n < 2) {
+        if (single)
+            return treeclusterf(nrows, ncols, data, mask, weight, transpose,
+                                dist, method, NULL);
+        return treecluster(nrows, ncols, data, mask, weight, transpose, dist,
+                           method, NULL);
+    }
+
+    if (!allocate_distances(n, single, &distances)) return NULL;
+    parallel_distancematrix(nrows, ncols, data, mask, weight, dist, transpose,
+                            &distances, nthreads);
+    if (single)
+        nodes = treeclusterf(nrows, ncols, data, mask, weight, transpose, dist,
+                             method, distances.fvalues);
+    else
+        nodes = treecluster(nrows, ncols, data, mask, weight, transpose, dist,
+                            method, distances.values);
+    free_distances(&distances);
+    return nodes;
+}
+
+/* -- parallel k-means and k-medoids --------------------------------------- */
+
+typedef struct {
+    int nclusters;
+    int nelements;
+    int nrows;
+    int ncols;
+    double** data;
+    int** mask;
+    double* weight;
+    int transpose;
+    char method;
+    char dist;
+    char initialization;
+    const Distances* distances;  /* used by k-medoids only */
+    unsigned long long seed;
+    unsigned long long* hashes;  /* hash of the solution found in each pass */
+    int* best;                   /* best clustering solution found so far */
+    int ibest;                   /* the pass in which it was found */
+    double error;                /* and its within-cluster sum of distances */
+    int memory_error;
+    PyThread_type_lock lock;
+} Passes;
+
+static unsigned long long
+hash_clusterid(int n, const int clusterid[], int* mapping, int nclusters)
+/* Calculate the FNV-1a hash of the clustering solution in clusterid. If
+ * mapping is not NULL, clusters are first renumbered in the order in which
+ * they appear, so that equivalent k-means solutions have the same hash. */
+{
+    int i, j, k = 0;
+    unsigned long long hash = 14695981039346656037ULL;
+
+    if (mapping) for (j = 0; j < nclusters; j++) mapping[j] = -1;
+    for (i = 0; i < n; i++) {
+        j = clusterid[i];
+        if (mapping) {
+            if (mapping[j] == -1) mapping[j] = k++;
+            j = mapping[j];
+        }
+        hash ^= (unsigned int) j;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static void
+store_pass(Passes* passes, int ipass, int* clusterid, double error)
+/* Keep the solution found in this pass if it is the best one so far. Of
+ * solutions with the same error, the one found in the earliest pass is kept,
+ * so that the result does not depend on the number of threads. */
+{
+    PyThread_acquire_lock(passes->lock, WAIT_LOCK);
+    if (passes->best == NULL || error < passes->error
+     || (error == passes->error && ipass < passes->ibest)) {
+        int* previous = passes->best;
+        passes->best = clusterid;
+        passes->ibest = ipass;
+        passes->error = error;
+        clusterid = previous;
+    }
+    PyThread_release_lock(passes->lock);
+    if (clusterid) free(clusterid);
+}
+
+static void
+kcluster_task(void* arg, int ipass)
+{
+    Passes* passes = arg;
+    int* clusterid = malloc(passes->nelements*sizeof(int));
+    int* mapping = malloc(passes->nclusters*sizeof(int));
+    double error;
+
+    if (!clusterid || !mapping
+     || !kcluster_pass(passes->nclusters, passes->nrows, passes->ncols,
+                       passes->data, passes->mask, passes->weight,
+                       passes->transpose, passes->method, passes->dist,
+                       passes->initialization, passes->seed, ipass,
+                       clusterid, &error)) {
+        passes->memory_error = 1;
+        if (clusterid) free(clusterid);
+        if (mapping) free(mapping);
+        return;
+    }
+    passes->hashes[ipass] = hash_clusterid(passes->nelements, clusterid,
+                                           mapping, passes->nclusters);
+    free(mapping);
+    store_pass(passes, ipass, clusterid, error);
+}
+
+static void
+kmedoids_task(void* arg, int ipass)
+{
+    Passes* passes = arg;
+    int* clusterid = malloc(passes->nelements*sizeof(int));
+    double error;
+
+    if (!clusterid
+     || !kmedoids_pass(passes->nclusters, passes->nelements, passes->distances,
+                       passes->seed, ipass, clusterid, &error)) {
+        passes->memory_error = 1;
+        if (clusterid) free(clusterid);
+        return;
+    }
+    /* k-medoids solutions are labeled by their medoids, which are unique */
+    passes->hashes[ipass] = hash_clusterid(passes->nelements, clusterid,
+                                           NULL, 0);
+    store_pass(passes, ipass, clusterid, error);
+}
+
+static void
+run_passes(Passes* passes, void (*task)(void*, int), int npass,
+    int nthreads, int clusterid[], double* error, int* ifound)
+/* Run npass passes of k-means or k-medoids clustering on nthreads threads,
+ * and store the best solution in clusterid. Pass ipass uses the random number
+ * stream identified by the seed and ipass, so the result does not depend on
+ * the number of threads. This function is called without the GIL. */
+{
+    int i;
+
+    *ifound = -1;
+    passes->best = NULL;
+    passes->ibest = 0;
+    passes->error = DBL_MAX;
+    passes->memory_error = 0;
+    passes->hashes = malloc(npass*sizeof(unsigned long long));
+    if (!passes->hashes) return;
+    passes->lock = PyThread_allocate_lock();
+    if (!passes->lock) {
+        free(passes->hashes);
+        return;
+    }
+    run_tasks(nthreads, npass, task, passes);
+    PyThread_free_lock(passes->lock);
+    if (passes->best && !passes->memory_error) {
+        const unsigned long long hash = passes->hashes[passes->ibest];
+        for (i = 0; i < passes->nelements; i++)
+            clusterid[i] = passes->best[i];
+        *error = passes->error;
+        *ifound = 0;
+        for (i = 0; i < npass; i++) if (passes->hashes[i] == hash) (*ifound)++;
+    }
+    if (passes->best) free(passes->best);
+    free(passes->hashes);
+}
+
+static void
+parallel_kcluster(int nclusters, int nrows, int ncols, double** data,
+    int** mask, double* weight, int transpose, int npass, char method,
+    char dist, char initialization, unsigned long long seed, int nthreads,
+    int clusterid[], double* error, int* ifound)
+/* Perform k-means or k-medians clustering, running the passes on nthreads
+ * threads. This function is called without the GIL. */
+{
+    Passes passes;
+
+    if (npass == 0) {
+        kcluster(nclusters, nrows, ncols, data, mask, weight, transpose, 0,
+                 method, dist, clusterid, error, ifound);
+        return;
+    }
+    passes.nclusters = nclusters;
+    passes.nelements = (transpose == 0) ? nrows : ncols;
+    passes.nrows = nrows;
+    passes.ncols = ncols;
+    passes.data = data;
+    passes.mask = mask;
+    passes.weight = weight;
+    passes.transpose = transpose;
+    passes.method = method;
+    passes.dist = dist;
+    passes.initialization = initialization;
+    passes.distances = NULL;
+    passes.seed = seed;
+    run_passes(&passes, kcluster_task, npass, nthreads, clusterid, error,
+               ifound);
+}
+
+static void
+parallel_kmedoids(int nclusters, int nelements, const Distances* distances,
+    int npass, unsigned long long seed, int nthreads, int clusterid[],
+    double* error, int* ifound)
+/* Perform k-medoids clustering, running the passes on nthreads threads.
+ * This function is called without the GIL. */
+{
+    Passes passes;
+
+    if (npass == 0) {
+        if (distances->fvalues)
+            kmedoidsf(nclusters, nelements, distances->fvalues, 0, clusterid,
+                      error, ifound);
+        else
+            kmedoids(nclusters, nelements, distances->values, 0, clusterid,
+                     error, ifound);
+        return;
+    }
+    passes.nclusters = nclusters;
+    passes.nelements = nelements;
+    passes.data = NULL;
+    passes.mask = NULL;
+    passes.weight = NULL;
+    passes.distances = distances;
+    passes.seed = seed;
+    run_passes(&passes, kmedoids_task, npass, nthreads, clusterid, error,
+               ifound);
+}
+
+/* -- parallel self-organizing maps ---------------------------------------- */
+
+#define SOMCHUNKSIZE 256
+
+typedef struct {
+    int nrows;
+    int ncols;
+    double** data;
+    int** mask;
+    const double* weight;
+    int transpose;
+    int nxgrid;
+    int nygrid;
+    double*** celldata;
+    char dist;
+    int nelements;
+    int* bestnodes;
+    int memory_error;
+} SOMItems;
+
+static void
+somassign_task(void* arg, int index)
+{
+    SOMItems* items = arg;
+    const int first = index * SOMCHUNKSIZE;
+    const int last = min(first + SOMCHUNKSIZE, items->nelements);
+
+    if (!somassign(items->nrows, items->ncols, items->data, items->mask,
+                   items->weight, items->transpose, items->nxgrid,
+                   items->nygrid, items->celldata, items->dist, first, last,
+                   items->bestnodes)) items->memory_error = 1;
+}
+
+static int
+parallel_somassign(SOMItems* items, int nthreads)
+/* Find the node closest to each item, distributing chunks of items over
+ * nthreads threads. */
+{
+    const int ntasks = (items->nelements + SOMCHUNKSIZE - 1) / SOMCHUNKSIZE;
+
+    items->memory_error = 0;
+    run_tasks(nthreads, ntasks, somassign_task, items);
+    return !items->memory_error;
+}
+
+static int
+parallel_somcluster(int nrows, int ncols, double** data, int** mask,
+    const double* weight, int transpose, int nxgrid, int nygrid,
+    double inittau, int niter, char dist, unsigned long long seed, int batch,
+    int nthreads, double*** celldata, int clusterid[][2])
+/* Calculate a self-organizing map. In each epoch of the batch algorithm, and
+ * in the final assignment of the items to nodes, the closest nodes of the
+ * items are found on nthreads threads. The online algorithm uses one item at
+ * a time, and is run on a single thread. The result does not depend on the
+ * number of threads. This function is called without the GIL. */
+{
+    int i;
+    int iter;
+    int ok = 0;
+    const int ndata = (transpose == 0) ? ncols : nrows;
+    SOMItems items;
+
+    items.nelements = (transpose == 0) ? nrows : ncols;
+    if (nthreads <= 1 || items.nelements < 2)
+        return somcluster(nrows, ncols, data, mask, weight, transpose, nxgrid,
+                          nygrid, inittau, niter, dist, seed, batch, celldata,
+                          clusterid);
+    items.nrows = nrows;
+    items.ncols = ncols;
+    items.data = data;
+    items.mask = mask;
+    items.weight = weight;
+    items.transpose = transpose;
+    items.nxgrid = nxgrid;
+    items.nygrid = nygrid;
+    items.celldata = celldata;
+    items.dist = dist;
+    items.bestnodes = malloc(items.nelements*sizeof(int));
+    if (!items.bestnodes) return 0;
+    if (batch) {
+        sominit(ndata, nxgrid, nygrid, celldata, seed);
+        for (iter = 0; iter < niter; iter++) {
+            if (!parallel_somassign(&items, nthreads)) goto exit;
+            if (!somupdate(nrows, ncols, data, mask, transpose, nxgrid,
+                           nygrid, iter, niter, items.bestnodes, celldata))
+                goto exit;
+        }
+    }
+    else if (!somcluster(nrows, ncols, data, mask, weight, transpose, nxgrid,
+                         nygrid, inittau, niter, dist, seed, 0, celldata,
+                         NULL)) goto exit;
+    if (!parallel_somassign(&items, nthreads)) goto exit;
+    for (i = 0; i < items.nelements; i++) {
+        clusterid[i][0] = items.bestnodes[i] / nygrid;
+        clusterid[i][1] = items.bestnodes[i] % nygrid;
+    }
+    ok = 1;
+exit:
+    free(items.bestnodes);
+    return ok;
+}
+
 /* ========================================================================= */
 /* -- Classes -------------------------------------------------------------- */
 /* ========================================================================= */
@@ -1203,7 +1775,8 @@ py_version(PyObject* self)
 /* kcluster */
 static char kcluster__doc__[] =
 "kcluster(data, nclusters, mask, weight, transpose, npass, method,\n"
-"         dist, clusterid) -> None\n"
+"         dist, clusterid, threads, seed, initialization)\n"
+"    -> error, nfound\n"
 "\n"
 "This function implements k-means clustering.\n"
 "\n"
@@ -1248,7 +1821,26 @@ static char kcluster__doc__[] =
 "   as an input variable, containing the initial condition from which\n"
 "   the EM algorithm should start. In this case, the k-means algorithm\n"
 "   is fully deterministic.\n"
-"\n";
+"\n"
+" - threads: number of threads used to run the npass passes.\n"
+"\n"
+" - seed: seed of the random number generator. Each pass uses its own\n"
+"   stream of random numbers derived from the seed, so the result does\n"
+"   not depend on the number of threads.\n"
+"\n"
+" - initialization: specifies how the initial clustering of each pass\n"
+"   is chosen:\n"
+"\n"
+"   - initialization == 'random': items are assigned to random clusters\n"
+"   - initialization == 'kmeans++': the cluster centers are chosen by\n"
+"     k-means++\n"
+"   - initialization == 'kmeans||': the cluster centers are chosen by\n"
+"     k-means|| (scalable k-means++)\n"
+"\n"
+"Return values:\n"
+" - error: the within-cluster sum of distances for the returned k-means\n"
+"   clustering solution;\n"
+" - nfound: the number of times this solution was found.\n";
 
 static PyObject*
 py_kcluster(PyObject* self, PyObject* args, PyObject* keywords)
@@ -1265,6 +1857,9 @@ py_kcluster(PyObject* self, PyObject* args, PyObject* keywords)
     char method = 'a';
     char dist = 'e';
     Py_buffer clusterid = {0};
+    char initialization = 'r';
+    int threads = 1;
+    unsigned long long seed = 0;
     double error;
     int ifound = 0;
 
@@ -1277,9 +1872,13 @@ py_kcluster(PyObject* self, PyObject* args, PyObject* keywords)
                              "method",
                              "dist",
                              "clusterid",
+                             "threads",
+                             "seed",
+                             "initialization",
                               NULL};
 
-    if (!PyArg_ParseTupleAndKeywords(args, keywords, "O&iO&O&iiO&O&O&", kwlist,
+    if (!PyArg_ParseTupleAndKeywords(args, keywords, "O&iO&O&iiO&O&O&|iKO&",
+                                     kwlist,
                                      data_converter, &data,
                                      &nclusters,
                                      mask_converter, &mask,
@@ -1288,7 +1887,11 @@ py_kcluster(PyObject* self, PyObject* args, PyObject* keywords)
                                      &npass,
                                      method_kcluster_converter, &method,
                                      distance_converter, &dist,
-                                     index_converter, &clusterid)) return NULL;
+                                     index_converter, &clusterid,
+                                     &threads,
+                                     &seed,
+                                     initialization_converter,
+                                     &initialization)) return NULL;
     if (!data.values) {
         PyErr_SetString(PyExc_RuntimeError, "data is None");
         goto exit;
@@ -1336,24 +1939,30 @@ py_kcluster(PyObject* self, PyObject* args, PyObject* keywords)
             goto exit;
         }
     }
-    kcluster(nclusters,
-             nrows,
-             ncols,
-             data.values,
-             mask.values,
-             weight.buf,
-             transpose,
-             npass,
-             method,
-             dist,
-             clusterid.buf,
-             &error,
-             &ifound);
+    Py_BEGIN_ALLOW_THREADS
+    parallel_kcluster(nclusters,
+                      nrows,
+                      ncols,
+                      data.values,
+                      mask.values,
+                      weight.buf,
+                      transpose,
+                      npass,
+                      method,
+                      dist,
+                      initialization,
+                      seed,
+                      threads,
+                      clusterid.buf,
+                      &error,
+                      &ifound);
+    Py_END_ALLOW_THREADS
 exit:
     data_converter(NULL, &data);
     mask_converter(NULL, &mask);
     vector_converter(NULL, &weight);
     index_converter(NULL, &clusterid);
+    if (ifound == -1) return PyErr_NoMemory();
     if (ifound) return Py_BuildValue("di", error, ifound);
     return NULL;
 }
@@ -1361,7 +1970,8 @@ exit:
 
 /* kmedoids */
 static char kmedoids__doc__[] =
-"kmedoids(distance, nclusters, npass, clusterid) -> error, nfound\n"
+"kmedoids(distance, nclusters, npass, clusterid, threads, seed)\n"
+"    -> error, nfound\n"
 "\n"
 "This function implements k-medoids clustering.\n"
 "\n"
@@ -1390,7 +2000,8 @@ static char kmedoids__doc__[] =
 "       ...             array([2.3, 4.5])]\n"
 "       >>> # (option #3)\n"
 "\n"
-"   These three correspond to the same distance matrix.\n"
+"   These three correspond to the same distance matrix. The distances\n"
+"   may be stored in double (float64) or in single (float32) precision.\n"
 "\n"
 " - nclusters: number of clusters (the 'k' in k-medoids)\n"
 "\n"
@@ -1405,6 +2016,12 @@ static char kmedoids__doc__[] =
 "   the EM algorithm should start. In this case, the k-medoids algorithm\n"
 "   is fully deterministic.\n"
 "\n"
+" - threads: number of threads used to run the npass passes.\n"
+"\n"
+" - seed: seed of the random number generator. Each pass uses its own\n"
+"   stream of random numbers derived from the seed, so the result does\n"
+"   not depend on the number of threads.\n"
+"\n"
 "Return values:\n"
 " - error: the within-cluster sum of distances for the returned k-means\n"
 "   clustering solution;\n"
@@ -1417,6 +2034,9 @@ py_kmedoids(PyObject* self, PyObject* args, PyObject* keywords)
     Distancematrix distances = {0};
     Py_buffer clusterid = {0};
     int npass = 1;
+    int threads = 1;
+    unsigned long long seed = 0;
+    Distances matrix;
     double error;
     int ifound = -2;
 
@@ -1424,13 +2044,17 @@ py_kmedoids(PyObject* self, PyObject* args, PyObject* keywords)
                              "nclusters",
                              "npass",
                              "clusterid",
+                             "threads",
+                             "seed",
                               NULL};
 
-    if (!PyArg_ParseTupleAndKeywords(args, keywords, "O&iiO&", kwlist,
+    if (!PyArg_ParseTupleAndKeywords(args, keywords, "O&iiO&|iK", kwlist,
                                      distancematrix_converter, &distances,
                                      &nclusters,
                                      &npass,
-                                     index_converter, &clusterid)) return NULL;
+                                     index_converter, &clusterid,
+                                     &threads,
+                                     &seed)) return NULL;
     if (npass < 0) {
         PyErr_SetString(PyExc_RuntimeError, "expected a non-negative integer");
         goto exit;
@@ -1454,13 +2078,19 @@ py_kmedoids(PyObject* self, PyObject* args, PyObject* keywords)
                         "more clusters requested than items to be clustered");
         goto exit;
     }
-    kmedoids(nclusters,
-             distances.n,
-             distances.values,
-             npass,
-             clusterid.buf,
-             &error,
-             &ifound);
+    matrix.values = distances.values;
+    matrix.fvalues = distances.fvalues;
+    Py_BEGIN_ALLOW_THREADS
+    parallel_kmedoids(nclusters,
+                      distances.n,
+                      &matrix,
+                      npass,
+                      seed,
+                      threads,
+                      clusterid.buf,
+                      &error,
+                      &ifound);
+    Py_END_ALLOW_THREADS
 
 exit:
     distancematrix_converter(NULL, &distances);
@@ -1483,7 +2113,7 @@ exit:
 /* treecluster */
 static char treecluster__doc__[] =
 "treecluster(tree, data, mask, weight, transpose, dist, method,\n"
-"            distancematrix) -> None\n"
+"            distancematrix, threads, single) -> None\n"
 "\n"
 "This function implements the pairwise single, complete, centroid, and\n"
 "average linkage hierarchical clustering methods.\n"
@@ -1549,7 +2179,8 @@ static char treecluster__doc__[] =
 "       ...             array([2.3, 4.5])]\n"
 "       >>> # option 3.\n"
 "\n"
-"   These three correspond to the same distance matrix.\n"
+"   These three correspond to the same distance matrix. The distances\n"
+"   may be stored in double (float64) or in single (float32) precision.\n"
 "\n"
 "   PLEASE NOTE:\n"
 "   As the treecluster routine may shuffle the values in the\n"
@@ -1557,6 +2188,12 @@ static char treecluster__doc__[] =
 "   to save this array in a different variable before calling\n"
 "   treecluster if you need it later.\n"
 "\n"
+" - threads: the number of threads used to calculate the distance\n"
+"   matrix from the data.\n"
+"\n"
+" - single: if nonzero, the distance matrix calculated from the data is\n"
+"   stored in single precision, which needs half the memory.\n"
+"\n"
 "Either data or distancematrix should be None. If distancematrix is None,\n"
 "the hierarchical clustering solution is calculated from the values in\n"
 "the argument data. Instead if data is None, the hierarchical clustering\n"
@@ -1579,6 +2216,8 @@ py_treecluster(PyObject* self, PyObject* args, PyObject* keywords)
     PyTree* tree = NULL;
     Node* nodes;
     int nitems;
+    int threads = 1;
+    int single = 0;
 
     static char* kwlist[] = {"tree",
                              "data",
@@ -1588,9 +2227,12 @@ py_treecluster(PyObject* self, PyObject* args, PyObject* keywords)
                              "method",
                              "dist",
                              "distancematrix",
+                             "threads",
+                             "single",
                               NULL };
 
-    if (!PyArg_ParseTupleAndKeywords(args, keywords, "O!O&O&O&iO&O&O&", kwlist,
+    if (!PyArg_ParseTupleAndKeywords(args, keywords, "O!O&O&O&iO&O&O&|ii",
+                                     kwlist,
                                      &PyTreeType, &tree,
                                      data_converter, &data,
                                      mask_converter, &mask,
@@ -1598,23 +2240,32 @@ py_treecluster(PyObject* self, PyObject* args, PyObject* keywords)
                                      &transpose,
                                      method_treecluster_converter, &method,
                                      distance_converter, &dist,
-                                     distancematrix_converter, &distances))
+                                     distancematrix_converter, &distances,
+                                     &threads,
+                                     &single))
         return NULL;
 
     if (tree->n != 0) {
         PyErr_SetString(PyExc_RuntimeError, "expected an empty tree");
         goto exit;
     }
-    if (data.values != NULL && distances.values != NULL) {
+    if (data.values != NULL
+     && (distances.values != NULL || distances.fvalues != NULL)) {
         PyErr_SetString(PyExc_ValueError,
             "use either data or distancematrix, do not use both");
         goto exit;
     }
-    if (data.values == NULL && distances.values == NULL) {
+    if (data.values == NULL
+     && distances.values == NULL && distances.fvalues == NULL) {
         PyErr_SetString(PyExc_ValueError,
                         "neither data nor distancematrix was given");
         goto exit;
     }
+    if (distancematrix_readonly(&distances)) {
+        /* treecluster modifies the distance matrix in place */
+        PyErr_SetString(PyExc_ValueError, "distance matrix is read-only");
+        goto exit;
+    }
 
     if (data.values) /* use the values in data, not the distance matrix */ {
         int nrows;
@@ -1647,15 +2298,18 @@ py_treecluster(PyObject* self, PyObject* args, PyObject* keywords)
             goto exit;
         }
 
-        nodes = treecluster(nrows,
-                            ncols,
-                            data.values,
-                            mask.values,
-                            weight.buf,
-                            transpose,
-                            dist,
-                            method,
-                            NULL);
+        Py_BEGIN_ALLOW_THREADS
+        nodes = parallel_treecluster(nrows,
+                                     ncols,
+                                     data.values,
+                                     mask.values,
+                                     weight.buf,
+                                     transpose,
+                                     dist,
+                                     method,
+                                     threads,
+                                     single);
+        Py_END_ALLOW_THREADS
     }
     else { /* use the distance matrix instead of the values in data */
         if (!strchr("sma", method)) {
@@ -1665,15 +2319,28 @@ py_treecluster(PyObject* self, PyObject* args, PyObject* keywords)
             goto exit;
         }
         nitems = distances.n;
-        nodes = treecluster(nitems,
-                            nitems,
-                            0,
-                            0,
-                            0,
-                            transpose,
-                            dist,
-                            method,
-                            distances.values);
+        Py_BEGIN_ALLOW_THREADS
+        if (distances.fvalues)
+            nodes = treeclusterf(nitems,
+                                 nitems,
+                                 0,
+                                 0,
+                                 0,
+                                 transpose,
+                                 dist,
+                                 method,
+                                 distances.fvalues);
+        else
+            nodes = treecluster(nitems,
+                                nitems,
+                                0,
+                                0,
+                                0,
+                                transpose,
+                                dist,
+                                method,
+                                distances.values);
+        Py_END_ALLOW_THREADS
     }
 
     if (!nodes) {
@@ -1697,7 +2364,7 @@ exit:
 /* somcluster */
 static char somcluster__doc__[] =
 "somcluster(clusterid, celldata, data, mask, weight, transpose,\n"
-"           inittau, niter, dist) -> None\n"
+"           inittau, niter, dist, seed, batch, threads) -> None\n"
 "\n"
 "This function implements a self-organizing map on a rectangular grid.\n"
 "\n"
@@ -1730,7 +2397,8 @@ static char somcluster__doc__[] =
 "\n"
 " - inittau: the initial value of tau (the neighborbood function)\n"
 "\n"
-" - niter: the number of iterations\n"
+" - niter: the number of iterations (the number of epochs if batch\n"
+"   is nonzero)\n"
 "\n"
 " - dist: specifies the distance function to be used:\n"
 "\n"
@@ -1741,7 +2409,17 @@ static char somcluster__doc__[] =
 "   - dist == 'u': uncentered correlation\n"
 "   - dist == 'x': absolute uncentered correlation\n"
 "   - dist == 's': Spearman's rank correlation\n"
-"   - dist == 'k': Kendall's tau\n";
+"   - dist == 'k': Kendall's tau\n"
+"\n"
+" - seed: seed of the random number generator.\n"
+"\n"
+" - batch: if nonzero, use the batch algorithm, in which each node is\n"
+"   replaced by a weighted mean of the items in its neighborhood in each\n"
+"   epoch; inittau is then ignored. If zero, the nodes are updated after\n"
+"   each item.\n"
+"\n"
+" - threads: the number of threads used to find the node closest to\n"
+"   each item. The result does not depend on the number of threads.\n";
 
 static PyObject*
 py_somcluster(PyObject* self, PyObject* args, PyObject* keywords)
@@ -1756,6 +2434,10 @@ py_somcluster(PyObject* self, PyObject* args, PyObject* keywords)
     double inittau = 0.02;
     int niter = 1;
     char dist = 'e';
+    unsigned long long seed = 0;
+    int batch = 0;
+    int threads = 1;
+    int ok;
     Py_buffer indices = {0};
     Celldata celldata = {0};
     PyObject* result = NULL;
@@ -1769,9 +2451,13 @@ py_somcluster(PyObject* self, PyObject* args, PyObject* keywords)
                              "inittau",
                              "niter",
                              "dist",
+                             "seed",
+                             "batch",
+                             "threads",
                              NULL};
 
-    if (!PyArg_ParseTupleAndKeywords(args, keywords, "O&O&O&O&O&idiO&", kwlist,
+    if (!PyArg_ParseTupleAndKeywords(args, keywords, "O&O&O&O&O&idiO&|Kii",
+                                     kwlist,
                                      index2d_converter, &indices,
                                      celldata_converter, &celldata,
                                      data_converter, &data,
@@ -1780,7 +2466,10 @@ py_somcluster(PyObject* self, PyObject* args, PyObject* keywords)
                                      &transpose,
                                      &inittau,
                                      &niter,
-                                     distance_converter, &dist)) return NULL;
+                                     distance_converter, &dist,
+                                     &seed,
+                                     &batch,
+                                     &threads)) return NULL;
     if (niter < 1) {
         PyErr_SetString(PyExc_ValueError,
                       "number of iterations (niter) should be positive");
@@ -1815,24 +2504,34 @@ py_somcluster(PyObject* self, PyObject* args, PyObject* keywords)
                     "(last dimension is %d; expected %d)", celldata.nz, ndata);
         goto exit;
     }
-    somcluster(nrows,
-               ncols,
-               data.values,
-               mask.values,
-               weight.buf,
-               transpose,
-               celldata.nx,
-               celldata.ny,
-               inittau,
-               niter,
-               dist,
-               celldata.values,
-               indices.buf);
+    Py_BEGIN_ALLOW_THREADS
+    ok = parallel_somcluster(nrows,
+                             ncols,
+                             data.values,
+                             mask.values,
+                             weight.buf,
+                             transpose,
+                             celldata.nx,
+                             celldata.ny,
+                             inittau,
+                             niter,
+                             dist,
+                             seed,
+                             batch,
+                             threads,
+                             celldata.values,
+                             indices.buf);
+    Py_END_ALLOW_THREADS
+    if (!ok) {
+        PyErr_NoMemory();
+        goto exit;
+    }
     Py_INCREF(Py_None);
     result = Py_None;
 
 exit:
     data_converter(NULL, &data);
+    mask_converter(NULL, &mask);
     vector_converter(NULL, &weight);
     index2d_converter(NULL, &indices);
     celldata_converter(NULL, &celldata);
@@ -2116,8 +2815,8 @@ exit:
 
 /* distancematrix */
 static char distancematrix__doc__[] =
-"distancematrix(data, mask, weight, transpose, dist, distancematrix)\n"
-"              -> None\n"
+"distancematrix(data, mask, weight, transpose, dist, distancematrix,\n"
+"               threads) -> None\n"
 "\n"
 "This function calculuates the distance matrix between the data values.\n"
 "\n"
@@ -2147,7 +2846,10 @@ static char distancematrix__doc__[] =
 "\n"
 " - distancematrix: Upon return, the distance matrix as a list of 1D\n"
 "   arrays. The number of columns in each row is equal to the row number\n"
-"   (i.e., len(distancematrix[i]) == i).\n"
+"   (i.e., len(distancematrix[i]) == i). Alternatively, distancematrix\n"
+"   can be a 1D array of size n*(n-1)/2 storing these rows consecutively.\n"
+"   The distances are stored in double or in single precision, depending\n"
+"   on the data type of distancematrix.\n"
 "   An example of the return value is:\n"
 "\n"
 "    matrix = [[],\n"
@@ -2160,19 +2862,23 @@ static char distancematrix__doc__[] =
 "    [0.\t1.\t7.\t4.]\n"
 "    [1.\t0.\t3.\t2.]\n"
 "    [7.\t3.\t0.\t6.]\n"
-"    [4.\t2.\t6.\t0.]\n";
+"    [4.\t2.\t6.\t0.]\n"
+"\n"
+" - threads: the number of threads used to calculate the distances.\n";
 
 static PyObject*
 py_distancematrix(PyObject* self, PyObject* args, PyObject* keywords)
 {
-    PyObject* list;
+    PyObject* matrix;
     Distancematrix distances = {0};
+    Distances store;
     Data data = {0};
     Mask mask = {0};
     Py_buffer weight = {0};
     int transpose = 0;
     char dist = 'e';
-    int nrows, ncols, ndata;
+    int nrows, ncols, ndata, nitems;
+    int threads = 1;
     PyObject* result = NULL;
 
     /* -- Read the input variables --------------------------------------- */
@@ -2182,15 +2888,17 @@ py_distancematrix(PyObject* self, PyObject* args, PyObject* keywords)
                              "transpose",
                              "dist",
                              "distancematrix",
+                             "threads",
                               NULL};
 
-    if (!PyArg_ParseTupleAndKeywords(args, keywords, "O&O&O&iO&O!", kwlist,
+    if (!PyArg_ParseTupleAndKeywords(args, keywords, "O&O&O&iO&O|i", kwlist,
                                      data_converter, &data,
                                      mask_converter, &mask,
                                      vector_converter, &weight,
                                      &transpose,
                                      distance_converter, &dist,
-                                     &PyList_Type, &list)) return NULL;
+                                     &matrix,
+                                     &threads)) return NULL;
     if (!data.values) {
         PyErr_SetString(PyExc_RuntimeError, "data is None");
         goto exit;
@@ -2214,16 +2922,39 @@ py_distancematrix(PyObject* self, PyObject* args, PyObject* keywords)
                      weight.shape[0], ndata);
         goto exit;
     }
-    if (_convert_list_to_distancematrix(list, &distances) == 0) goto exit;
+    if (PyList_Check(matrix)) {
+        if (!_convert_list_to_distancematrix(matrix, &distances)) goto exit;
+    }
+    else {
+        if (!_convert_array_to_distancematrix(matrix, &distances, 1))
+            goto exit;
+        if (distances.view.ndim != 1) {
+            PyErr_SetString(PyExc_ValueError,
+                            "distancematrix should be one-dimensional");
+            goto exit;
+        }
+    }
+    nitems = (transpose == 0) ? nrows : ncols;
+    if (distances.n != nitems) {
+        PyErr_Format(PyExc_ValueError,
+                     "distancematrix has incorrect size (%d, expected %d)",
+                     distances.n, nitems);
+        goto exit;
+    }
+    store.values = distances.values;
+    store.fvalues = distances.fvalues;
 
-    distancematrix(nrows,
-                   ncols,
-                   data.values,
-                   mask.values,
-                   weight.buf,
-                   dist,
-                   transpose,
-                   distances.values);
+    Py_BEGIN_ALLOW_THREADS
+    parallel_distancematrix(nrows,
+                            ncols,
+                            data.values,
+                            mask.values,
+                            weight.buf,
+                            dist,
+                            transpose,
+                            &store,
+                            threads);
+    Py_END_ALLOW_THREADS
 
     Py_INCREF(Py_None);
     result = Py_None;
@@ -19,6 +19,330 @@
 #define _PRECISION 1000
 #define rint(x) (int)((x)*_PRECISION+0.5)
 
+/* A two-dimensional matrix stored in a malloc'd block of memory, which is
+   exposed through the buffer protocol. This allows the score and trace
+   matrices to be passed to Python (e.g. as NumPy arrays) without copying. */
+
+typedef struct {
+    PyObject_HEAD
+    void *data;
+    Py_ssize_t shape[2];
+    Py_ssize_t strides[2];
+    Py_ssize_t itemsize;
+    char *format;
+} MatrixBuffer;
+
+static void MatrixBuffer_dealloc(MatrixBuffer *self)
+{
+    if(self->data)
+        free(self->data);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static int MatrixBuffer_getbuffer(MatrixBuffer *self, Py_buffer *view,
+                                  int flags)
+{
+    view->obj = (PyObject *)self;
+    Py_INCREF(self);
+    view->buf = self->data;
+    view->len = self->shape[0] * self->shape[1] * self->itemsize;
+    view->readonly = 0;
+    view->itemsize = self->itemsize;
+    view->format = (flags & PyBUF_FORMAT) ? self->format : NULL;
+    view->ndim = 2;
+    view->shape = (flags & PyBUF_ND) ? self->shape : NULL;
+    view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? self->strides : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    return 0;
+}
+
+static PyBufferProcs MatrixBuffer_as_buffer = {
+    (getbufferproc)MatrixBuffer_getbuffer,
+    NULL,
+};
+
+static PyTypeObject MatrixBuffer_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "cpairwise2.MatrixBuffer",      /* tp_name */
+    sizeof(MatrixBuffer),           /* tp_basicsize */
+    0,                              /* tp_itemsize */
+    (destructor)MatrixBuffer_dealloc,  /* tp_dealloc */
+    0,                              /* tp_print */
+    0,                              /* tp_getattr */
+    0,                              /* tp_setattr */
+    0,                              /* tp_reserved */
+    0,                              /* tp_repr */
+    0,                              /* tp_as_number */
+    0,                              /* tp_as_sequence */
+    0,                              /* tp_as_mapping */
+    0,                              /* tp_hash */
+    0,                              /* tp_call */
+    0,                              /* tp_str */
+    0,                              /* tp_getattro */
+    0,                              /* tp_setattro */
+    &MatrixBuffer_as_buffer,        /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,             /* tp_flags */
+    "Matrix stored in a contiguous block of memory",  /* tp_doc */
+};
+
+/* Wrap a malloc'd matrix in a MatrixBuffer object. The object takes
+   ownership of the memory, also if creating the object fails. */
+static PyObject *_create_matrix_buffer(void *data, int nrows, int ncols,
+                                       Py_ssize_t itemsize, char *format)
+{
+    MatrixBuffer *matrix;
+    matrix = PyObject_New(MatrixBuffer, &MatrixBuffer_Type);
+    if(!matrix) {
+        free(data);
+        return NULL;
+    }
+    matrix->data = data;
+    matrix->shape[0] = nrows;
+    matrix->shape[1] = ncols;
+    matrix->strides[0] = ncols * itemsize;
+    matrix->strides[1] = itemsize;
+    matrix->itemsize = itemsize;
+    matrix->format = format;
+    return (PyObject *)matrix;
+}
+
+/* A trace matrix compressed row by row. Each row is divided into blocks
+   of TRACE_BLOCK_SIZE cells. A block is stored as the number k of distinct
+   traces in the block, followed by these k traces (the palette), and the
+   index of each cell's trace in the palette packed into the smallest
+   number of bits that can hold k-1. Long stretches of identical traces
+   therefore take no space beyond the palette, and blocks with two
+   alternating traces take one bit per cell. The offset of each block is
+   stored, so that the trace of any cell can be found directly. */
+
+#define TRACE_BLOCK_SIZE 256
+
+typedef struct {
+    PyObject_HEAD
+    int nrows, ncols;
+    int nblocks;                  /* number of blocks per row */
+    int filled;                   /* number of rows stored so far */
+    unsigned char *data;
+    Py_ssize_t size, allocated;   /* bytes used and allocated in data */
+    Py_ssize_t *row_offsets;      /* offset of each row in data */
+    unsigned int *block_offsets;  /* offset of each block in its row */
+} CompressedTrace;
+
+static void CompressedTrace_dealloc(CompressedTrace *self)
+{
+    if(self->data)
+        free(self->data);
+    if(self->row_offsets)
+        free(self->row_offsets);
+    if(self->block_offsets)
+        free(self->block_offsets);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+/* Number of bits needed to store an index in a palette of k traces. */
+static int _get_trace_bits(int k)
+{
+    int bits = 0;
+    while((1 << bits) < k)
+        bits++;
+    return bits;
+}
+
+/* Append a row of ncols traces. Returns -1 if out of memory, and 0
+   otherwise. This does not use the Python API, and can be called without
+   holding the GIL. */
+static int _append_trace_row(CompressedTrace *self, const unsigned char *row)
+{
+    unsigned char *p, *row_start;
+    int block, i;
+    const int ncols = self->ncols;
+    /* Each block takes at most 1 + 32 bytes for the palette, 5 bits per
+       cell, and 1 byte of padding for reading two bytes at a time. */
+    const Py_ssize_t maximum_size = (Py_ssize_t)self->nblocks*34
+                                  + ((Py_ssize_t)ncols*5+7)/8 + 1;
+
+    if(self->size + maximum_size > self->allocated) {
+        Py_ssize_t allocated = 2*self->allocated + maximum_size;
+        unsigned char *data = realloc(self->data, allocated);
+        if(!data)
+            return -1;
+        self->data = data;
+        self->allocated = allocated;
+    }
+    self->row_offsets[self->filled] = self->size;
+    row_start = self->data + self->size;
+    p = row_start;
+    for(block=0; block<self->nblocks; block++) {
+        const int start = block*TRACE_BLOCK_SIZE;
+        const int end = (start+TRACE_BLOCK_SIZE < ncols) ? start+TRACE_BLOCK_SIZE : ncols;
+        signed char index[32];
+        int k = 0, bits;
+        memset(index, -1, sizeof(index));
+        self->block_offsets[(Py_ssize_t)self->filled*self->nblocks+block]
+            = (unsigned int)(p - row_start);
+        p++;
+        for(i=start; i<end; i++) {
+            const unsigned char trace = row[i] & 31;
+            if(index[trace] < 0) {
+                index[trace] = (signed char)k;
+                p[k++] = trace;
+            }
+        }
+        p[-1] = (unsigned char)k;
+        p += k;
+        bits = _get_trace_bits(k);
+        if(bits) {
+            const int nbytes = ((end-start)*bits+7)/8;
+            memset(p, 0, nbytes+1);
+            for(i=start; i<end; i++) {
+                const int position = (i-start)*bits;
+                const unsigned int value = (unsigned int)index[row[i] & 31]
+                                         << (position & 7);
+                p[position >> 3] |= (unsigned char)value;
+                p[(position >> 3) + 1] |= (unsigned char)(value >> 8);
+            }
+            p += nbytes;
+        }
+    }
+    /* Padding, so that the last block can be read two bytes at a time. */
+    *p++ = 0;
+    self->size = p - self->data;
+    self->filled++;
+    if(self->filled == self->nrows) {
+        /* Release the memory that was reserved for further rows. */
+        unsigned char *data = realloc(self->data, self->size);
+        if(data) {
+            self->data = data;
+            self->allocated = self->size;
+        }
+    }
+    return 0;
+}
+
+static unsigned char _get_compressed_trace(const CompressedTrace *self,
+                                           int row, int col)
+{
+    const int block = col / TRACE_BLOCK_SIZE;
+    const unsigned char *p = self->data + self->row_offsets[row]
+        + self->block_offsets[(Py_ssize_t)row*self->nblocks+block];
+    const int k = p[0];
+    const unsigned char *palette = p + 1;
+    const unsigned char *packed = palette + k;
+    const int bits = _get_trace_bits(k);
+    int position;
+    unsigned int value;
+
+    if(!bits)
+        return palette[0];
+    position = (col % TRACE_BLOCK_SIZE) * bits;
+    value = packed[position >> 3] | ((unsigned int)packed[(position >> 3) + 1] << 8);
+    return palette[(value >> (position & 7)) & ((1u << bits) - 1)];
+}
+
+static PyObject *CompressedTrace_decompress(CompressedTrace *self,
+                                            PyObject *Py_UNUSED(ignored))
+{
+    unsigned char *matrix;
+    int row, col;
+
+    matrix = malloc((size_t)self->nrows*self->ncols*sizeof(*matrix));
+    if(!matrix)
+        return PyErr_NoMemory();
+    for(row=0; row<self->nrows; row++)
+        for(col=0; col<self->ncols; col++)
+            matrix[(Py_ssize_t)row*self->ncols+col] = _get_compressed_trace(self, row, col);
+    return _create_matrix_buffer(matrix, self->nrows, self->ncols,
+                                 sizeof(*matrix), "B");
+}
+
+static PyObject *CompressedTrace_get_nbytes(CompressedTrace *self,
+                                            void *closure)
+{
+    Py_ssize_t nbytes = self->allocated
+                      + (self->nrows+1)*sizeof(*self->row_offsets)
+                      + (Py_ssize_t)self->nrows*self->nblocks*sizeof(*self->block_offsets);
+    return PyLong_FromSsize_t(nbytes);
+}
+
+static PyObject *CompressedTrace_get_shape(CompressedTrace *self,
+                                           void *closure)
+{
+    return Py_BuildValue("(ii)", self->nrows, self->ncols);
+}
+
+static PyMethodDef CompressedTrace_methods[] = {
+    {"decompress", (PyCFunction)CompressedTrace_decompress, METH_NOARGS,
+     "Return the trace matrix as an uncompressed buffer."},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef CompressedTrace_getset[] = {
+    {"nbytes", (getter)CompressedTrace_get_nbytes, NULL,
+     "number of bytes allocated for the compressed trace matrix", NULL},
+    {"shape", (getter)CompressedTrace_get_shape, NULL,
+     "number of rows and columns of the trace matrix", NULL},
+    {NULL}
+};
+
+static PyTypeObject CompressedTrace_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "cpairwise2.CompressedTrace",   /* tp_name */
+    sizeof(CompressedTrace),        /* tp_basicsize */
+    0,                              /* tp_itemsize */
+    (destructor)CompressedTrace_dealloc,  /* tp_dealloc */
+    0,                              /* tp_print */
+    0,                              /* tp_getattr */
+    0,                              /* tp_setattr */
+    0,                              /* tp_reserved */
+    0,                              /* tp_repr */
+    0,                              /* tp_as_number */
+    0,                              /* tp_as_sequence */
+    0,                              /* tp_as_mapping */
+    0,                              /* tp_hash */
+    0,                              /* tp_call */
+    0,                              /* tp_str */
+    0,                              /* tp_getattro */
+    0,                              /* tp_setattro */
+    0,                              /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,             /* tp_flags */
+    "Trace matrix compressed block by block",  /* tp_doc */
+    0,                              /* tp_traverse */
+    0,                              /* tp_clear */
+    0,                              /* tp_richcompare */
+    0,                              /* tp_weaklistoffset */
+    0,                              /* tp_iter */
+    0,                              /* tp_iternext */
+    CompressedTrace_methods,        /* tp_methods */
+    0,                              /* tp_members */
+    CompressedTrace_getset,         /* tp_getset */
+};
+
+/* Create an empty compressed trace matrix of nrows by ncols cells. */
+static CompressedTrace *_create_compressed_trace(int nrows, int ncols)
+{
+    CompressedTrace *trace;
+    trace = PyObject_New(CompressedTrace, &CompressedTrace_Type);
+    if(!trace)
+        return NULL;
+    trace->nrows = nrows;
+    trace->ncols = ncols;
+    trace->nblocks = (ncols + TRACE_BLOCK_SIZE - 1) / TRACE_BLOCK_SIZE;
+    trace->filled = 0;
+    trace->data = NULL;
+    trace->size = 0;
+    trace->allocated = 0;
+    trace->row_offsets = malloc((nrows+1)*sizeof(*trace->row_offsets));
+    trace->block_offsets = malloc(((Py_ssize_t)nrows*trace->nblocks+1)
+                                  *sizeof(*trace->block_offsets));
+    if(!trace->row_offsets || !trace->block_offsets) {
+        Py_DECREF(trace);
+        PyErr_NoMemory();
+        return NULL;
+    }
+    return trace;
+}
+
 /* Functions in this module. */
 
 static double calc_affine_penalty(int length, double open, double extend,
@@ -34,21 +358,104 @@ static double calc_affine_penalty(int length, double open, double extend,
     return penalty;
 }
 
+/* Scores of a dictionary_match for each pair of characters, indexed by
+   256 * (character in A) + (character in B). Pairs that are not in the
+   dictionary are stored as NaN; for those, the match function is called,
+   which raises the appropriate KeyError. */
+#define MATCH_TABLE_SIZE 256
+
+static double *_create_match_table(PyObject *py_match_fn)
+{
+    PyObject *py_score_dict = NULL, *py_symmetric = NULL;
+    PyObject *py_key, *py_value;
+    Py_ssize_t pos = 0;
+    double *table = NULL;
+    double value;
+    int symmetric;
+    int i;
+
+    /* Check if py_match_fn is a dictionary_match. */
+    if(!(py_score_dict = PyObject_GetAttrString(py_match_fn, "score_dict")))
+        goto _create_match_table_failed;
+    if(!PyDict_Check(py_score_dict))
+        goto _create_match_table_failed;
+    if(!(py_symmetric = PyObject_GetAttrString(py_match_fn, "symmetric")))
+        goto _create_match_table_failed;
+    symmetric = PyObject_IsTrue(py_symmetric);
+    if(symmetric < 0)
+        goto _create_match_table_failed;
+
+    table = malloc(MATCH_TABLE_SIZE*MATCH_TABLE_SIZE*sizeof(*table));
+    if(!table)
+        goto _create_match_table_failed;
+    for(i=0; i<MATCH_TABLE_SIZE*MATCH_TABLE_SIZE; i++)
+        table[i] = Py_NAN;
+    while(PyDict_Next(py_score_dict, &pos, &py_key, &py_value)) {
+        PyObject *py_A, *py_B;
+        Py_UCS4 a, b;
+        /* Only keys consisting of two single ASCII characters can match
+           characters in the sequences. */
+        if(!PyTuple_Check(py_key) || PyTuple_GET_SIZE(py_key) != 2)
+            continue;
+        py_A = PyTuple_GET_ITEM(py_key, 0);
+        py_B = PyTuple_GET_ITEM(py_key, 1);
+        if(!PyUnicode_Check(py_A) || PyUnicode_GET_LENGTH(py_A) != 1
+           || !PyUnicode_Check(py_B) || PyUnicode_GET_LENGTH(py_B) != 1)
+            continue;
+        a = PyUnicode_READ_CHAR(py_A, 0);
+        b = PyUnicode_READ_CHAR(py_B, 0);
+        if(a >= 128 || b >= 128)
+            continue;
+        value = PyFloat_AsDouble(py_value);
+        if(value==-1.0 && PyErr_Occurred())
+            goto _create_match_table_failed;
+        table[a*MATCH_TABLE_SIZE+b] = value;
+    }
+    if(symmetric) {
+        /* If (A, B) is missing, the score of (B, A) is used. */
+        int a, b;
+        for(a=0; a<MATCH_TABLE_SIZE; a++)
+            for(b=0; b<MATCH_TABLE_SIZE; b++)
+                if(Py_IS_NAN(table[a*MATCH_TABLE_SIZE+b]))
+                    table[a*MATCH_TABLE_SIZE+b] = table[b*MATCH_TABLE_SIZE+a];
+    }
+    Py_DECREF(py_score_dict);
+    Py_DECREF(py_symmetric);
+    return table;
+
+ _create_match_table_failed:
+    if(PyErr_Occurred())
+        PyErr_Clear();
+    Py_XDECREF(py_score_dict);
+    Py_XDECREF(py_symmetric);
+    if(table)
+        free(table);
+    return NULL;
+}
+
 static double _get_match_score(PyObject *py_sequenceA, PyObject *py_sequenceB,
                                PyObject *py_match_fn, int i, int j,
                                char *sequenceA, char *sequenceB,
                                int use_sequence_cstring,
                                double match, double mismatch,
-                               int use_match_mismatch_scores)
+                               int use_match_mismatch_scores,
+                               const double *match_table)
 {
     PyObject *py_A=NULL, *py_B=NULL;
     PyObject *py_arglist=NULL, *py_result=NULL;
-    double score = 0;
+    double score = -1.0;  /* returned with an exception set on failure */
 
     if(use_sequence_cstring && use_match_mismatch_scores) {
         score = (sequenceA[i] == sequenceB[j]) ? match : mismatch;
         return score;
     }
+    if(use_sequence_cstring && match_table) {
+        score = match_table[(unsigned char)sequenceA[i]*MATCH_TABLE_SIZE
+                            + (unsigned char)sequenceB[j]];
+        if(!Py_IS_NAN(score))
+            return score;
+        score = -1.0;
+    }
     /* Calculate the match score. */
     if(!(py_A = PySequence_GetItem(py_sequenceA, i)))
         goto _get_match_score_cleanup;
@@ -96,6 +503,268 @@ static PyObject* _create_bytes_object(PyObject* o)
 }
 #endif
 
+/* Fixed-point scoring.
+ *
+ * If all scores and gap penalties are multiples of 1/FIXED_POINT_DENOMINATOR,
+ * the score matrix is filled using integers in units of 1/_PRECISION. Ties
+ * between the candidate scores are then found by exact comparison instead
+ * of by rounding each of them with rint(), while the trace matrix is
+ * encoded in the same way. The scores are converted back to doubles when
+ * they are stored in the score matrix.
+ *
+ * Sums of such scores are exact in floating point too, so the score and
+ * trace matrices are identical to those calculated in floating point. Other
+ * multiples of 1/_PRECISION such as 0.1 are not used: floating point sums
+ * of them leave residues such as 1e-17 where a score should be zero, which
+ * decide where local alignments start and end, and the C and Python
+ * implementations must agree on them.
+ */
+
+/* Limit the magnitude of the scores, so that adding a match score and a
+   gap penalty to any score cannot overflow an int. */
+#define FIXED_POINT_MAX (INT_MAX/4)
+/* A power of two that divides _PRECISION. */
+#define FIXED_POINT_DENOMINATOR 8
+#define FIXED_POINT_MISSING INT_MIN
+
+typedef struct {
+    int match, mismatch;
+    const int *match_table;  /* NULL if match/mismatch scores are used */
+    int open_A, extend_A, open_B, extend_B;
+    int penalize_extend_when_opening;
+    int penalize_end_gaps_A, penalize_end_gaps_B;
+    int align_globally;
+} FixedPointParameters;
+
+/* Store x in units of 1/_PRECISION in value and return 1, or return 0 if
+   x is not a multiple of 1/FIXED_POINT_DENOMINATOR. */
+static int _to_fixed_point(double x, int *value)
+{
+    double scaled = x * FIXED_POINT_DENOMINATOR;
+
+    if(scaled != floor(scaled)
+       || fabs(x) * _PRECISION > FIXED_POINT_MAX)
+        return 0;
+    *value = (int)scaled * (_PRECISION / FIXED_POINT_DENOMINATOR);
+    return 1;
+}
+
+/* Convert a table created by _create_match_table to fixed point. Returns
+   NULL if any score in the table cannot be represented. */
+static int *_create_fixed_point_table(const double *match_table,
+                                      double *max_score)
+{
+    int *table;
+    int i;
+
+    table = malloc(MATCH_TABLE_SIZE*MATCH_TABLE_SIZE*sizeof(*table));
+    if(!table)
+        return NULL;
+    for(i=0; i<MATCH_TABLE_SIZE*MATCH_TABLE_SIZE; i++) {
+        if(Py_IS_NAN(match_table[i]))
+            table[i] = FIXED_POINT_MISSING;
+        else if(_to_fixed_point(match_table[i], &table[i])) {
+            if(fabs(match_table[i]) > *max_score)
+                *max_score = fabs(match_table[i]);
+        }
+        else {
+            free(table);
+            return NULL;
+        }
+    }
+    return table;
+}
+
+/* Fill in the fixed point parameters from the gap penalties, and from the
+   match and mismatch scores if match_table is NULL. Returns 1 if the
+   scores of all alignments of sequences of length lenA and lenB can be
+   represented, and 0 otherwise. */
+static int _get_fixed_point_parameters(FixedPointParameters *p,
+                                       double match, double mismatch,
+                                       const int *match_table,
+                                       double max_match_score,
+                                       double open_A, double extend_A,
+                                       double open_B, double extend_B,
+                                       int lenA, int lenB)
+{
+    double max_score;
+
+    if(match_table) {
+        p->match_table = match_table;
+        p->match = p->mismatch = 0;
+    }
+    else {
+        p->match_table = NULL;
+        if(!_to_fixed_point(match, &p->match)
+           || !_to_fixed_point(mismatch, &p->mismatch))
+            return 0;
+        max_match_score = fabs(match) > fabs(mismatch) ? fabs(match) : fabs(mismatch);
+    }
+    if(!_to_fixed_point(open_A, &p->open_A)
+       || !_to_fixed_point(extend_A, &p->extend_A)
+       || !_to_fixed_point(open_B, &p->open_B)
+       || !_to_fixed_point(extend_B, &p->extend_B))
+        return 0;
+    /* Each row and column adds at most a match score and the gap
+       penalties (the caches start from twice the gap open penalty). */
+    max_score = (max_match_score + 2*fabs(open_A) + fabs(extend_A)
+                 + 2*fabs(open_B) + fabs(extend_B))
+              * ((double)lenA + lenB + 2) * _PRECISION;
+    return max_score <= FIXED_POINT_MAX;
+}
+
+static int calc_affine_penalty_fixed_point(int length, int open, int extend,
+    int penalize_extend_when_opening)
+{
+    int penalty;
+
+    if(length <= 0)
+        return 0;
+    penalty = open + extend * length;
+    if(!penalize_extend_when_opening)
+        penalty -= extend;
+    return penalty;
+}
+
+/* Fill in the score and trace matrices in fixed point, using the same
+   recursion as _make_score_matrix_fast. The scores are calculated in two
+   rows kept in cache, which should have space for 3*(lenB+1) ints. If
+   score_matrix and trace_matrix are NULL, only the best score is
+   calculated. If compressed_trace is not NULL, trace_matrix holds a single
+   row, which is appended to compressed_trace when it is complete. Returns
+   -1 if a pair of characters is missing from the match table, -2 if out
+   of memory, and 0 otherwise. No Python objects are used, so this can run
+   without holding the GIL. */
+static int _fill_fixed_point(const FixedPointParameters *p,
+                             const char *sequenceA, int lenA,
+                             const char *sequenceB, int lenB,
+                             int *cache, double *score_matrix,
+                             unsigned char *trace_matrix,
+                             CompressedTrace *compressed_trace,
+                             int *best_score)
+{
+    int row, col;
+    int *col_cache_score = cache;
+    int *score_rows = cache + (lenB+1);
+    int first_A_gap, first_B_gap;
+    int score = 0;
+    int local_max_score = 0;
+
+    first_A_gap = calc_affine_penalty_fixed_point(1, p->open_A, p->extend_A,
+                                      p->penalize_extend_when_opening);
+    first_B_gap = calc_affine_penalty_fixed_point(1, p->open_B, p->extend_B,
+                                      p->penalize_extend_when_opening);
+    for(col=0; col<=lenB; col++) {
+        if(p->penalize_end_gaps_A)
+            score_rows[col] = calc_affine_penalty_fixed_point(col, p->open_A,
+                                    p->extend_A,
+                                    p->penalize_extend_when_opening);
+        else
+            score_rows[col] = 0;
+        col_cache_score[col] = calc_affine_penalty_fixed_point(col,
+                                    (2*p->open_B), p->extend_B,
+                                    p->penalize_extend_when_opening);
+        if(score_matrix)
+            score_matrix[col] = (double)score_rows[col] / _PRECISION;
+    }
+    for(row=1; row<=lenA; row++) {
+        int row_cache_score = calc_affine_penalty_fixed_point(row,
+                                    (2*p->open_A), p->extend_A,
+                                    p->penalize_extend_when_opening);
+        int *prev_row = score_rows + ((row-1) % 2)*(lenB+1);
+        int *cur_row = score_rows + (row % 2)*(lenB+1);
+        unsigned char *trace_row = NULL;
+        const int *match_row = NULL;
+        if(trace_matrix)
+            trace_row = compressed_trace ? trace_matrix
+                                         : trace_matrix + row*(lenB+1);
+        if(p->match_table)
+            match_row = p->match_table
+                      + (unsigned char)sequenceA[row-1]*MATCH_TABLE_SIZE;
+        if(p->penalize_end_gaps_B)
+            cur_row[0] = calc_affine_penalty_fixed_point(row, p->open_B,
+                                    p->extend_B,
+                                    p->penalize_extend_when_opening);
+        else
+            cur_row[0] = 0;
+        if(score_matrix)
+            score_matrix[row*(lenB+1)] = (double)cur_row[0] / _PRECISION;
+        for(col=1; col<=lenB; col++) {
+            int match_score, nogap_score;
+            int row_open, row_extend, col_open, col_extend;
+            unsigned char row_trace_score, col_trace_score, trace_score;
+
+            if(match_row) {
+                match_score = match_row[(unsigned char)sequenceB[col-1]];
+                if(match_score == FIXED_POINT_MISSING)
+                    return -1;
+            }
+            else
+                match_score = (sequenceA[row-1] == sequenceB[col-1])
+                            ? p->match : p->mismatch;
+            nogap_score = prev_row[col-1] + match_score;
+
+            if(!p->penalize_end_gaps_A && row==lenA) {
+                row_open = cur_row[col-1];
+                row_extend = row_cache_score;
+            }
+            else {
+                row_open = cur_row[col-1] + first_A_gap;
+                row_extend = row_cache_score + p->extend_A;
+            }
+            row_cache_score = (row_open > row_extend) ? row_open : row_extend;
+
+            if(!p->penalize_end_gaps_B && col==lenB) {
+                col_open = prev_row[col];
+                col_extend = col_cache_score[col];
+            }
+            else {
+                col_open = prev_row[col] + first_B_gap;
+                col_extend = col_cache_score[col] + p->extend_B;
+            }
+            col_cache_score[col] = (col_open > col_extend) ? col_open : col_extend;
+
+            score = (row_cache_score > col_cache_score[col]) ? row_cache_score : col_cache_score[col];
+            if(nogap_score > score)
+                score = nogap_score;
+            if(score > local_max_score)
+                local_max_score = score;
+            if(!p->align_globally && score < 0)
+                cur_row[col] = 0;
+            else
+                cur_row[col] = score;
+
+            if(score_matrix)
+                score_matrix[row*(lenB+1)+col] = (double)cur_row[col] / _PRECISION;
+            if(trace_row) {
+                row_trace_score = 0;
+                col_trace_score = 0;
+                if(row_open == row_cache_score)
+                    row_trace_score = row_trace_score|1;
+                if(row_extend == row_cache_score)
+                    row_trace_score = row_trace_score|8;
+                if(col_open == col_cache_score[col])
+                    col_trace_score = col_trace_score|4;
+                if(col_extend == col_cache_score[col])
+                    col_trace_score = col_trace_score|16;
+
+                trace_score = 0;
+                if(nogap_score == score)
+                    trace_score = trace_score|2;
+                if(row_cache_score == score)
+                    trace_score += row_trace_score;
+                if(col_cache_score[col] == score)
+                    trace_score += col_trace_score;
+                trace_row[col] = trace_score;
+            }
+        }
+        if(compressed_trace && _append_trace_row(compressed_trace, trace_row) < 0)
+            return -2;
+    }
+    *best_score = p->align_globally ? score : local_max_score;
+    return 0;
+}
+
 /* This function is a more-or-less straightforward port of the
  * equivalent function in pairwise2. Please see there for algorithm
  * documentation.
@@ -114,6 +783,10 @@ static PyObject *cpairwise2__make_score_matrix_fast(PyObject *self,
     double open_A, extend_A, open_B, extend_B;
     int penalize_extend_when_opening, penalize_end_gaps_A, penalize_end_gaps_B;
     int align_globally, score_only;
+    int as_buffers = 0;
+    int compress_trace = 0;
+    int out_of_memory = 0;
+    CompressedTrace *compressed_trace = NULL;
 
     PyObject *py_match=NULL, *py_mismatch=NULL;
     double first_A_gap, first_B_gap;
@@ -123,18 +796,25 @@ static PyObject *cpairwise2__make_score_matrix_fast(PyObject *self,
     double local_max_score = 0;
     int use_match_mismatch_scores;
     int lenA, lenB;
+    double *match_table = NULL;
     double *score_matrix = NULL;
+    int n_score_rows;
     unsigned char *trace_matrix = NULL;
     PyObject *py_score_matrix=NULL, *py_trace_matrix=NULL;
 
     double *col_cache_score = NULL;
+    PyThreadState *thread_state = NULL;
+    FixedPointParameters fixed;
+    int *fixed_table = NULL;
+    int *fixed_cache = NULL;
     PyObject *py_retval = NULL;
 
-    if(!PyArg_ParseTuple(args, "OOOddddi(ii)ii", &py_sequenceA, &py_sequenceB,
+    if(!PyArg_ParseTuple(args, "OOOddddi(ii)ii|ii", &py_sequenceA, &py_sequenceB,
                          &py_match_fn, &open_A, &extend_A, &open_B, &extend_B,
                          &penalize_extend_when_opening,
                          &penalize_end_gaps_A, &penalize_end_gaps_B,
-                         &align_globally, &score_only))
+                         &align_globally, &score_only, &as_buffers,
+                         &compress_trace))
         return NULL;
     if(!PySequence_Check(py_sequenceA) || !PySequence_Check(py_sequenceB)) {
         PyErr_SetString(PyExc_TypeError,
@@ -161,8 +841,10 @@ static PyObject *cpairwise2__make_score_matrix_fast(PyObject *self,
         use_sequence_cstring = 1;
     }
     else {
-        Py_XDECREF(py_bytesA);
-        Py_XDECREF(py_bytesB);
+        if (py_bytesA != NULL && py_bytesA != py_sequenceA) Py_DECREF(py_bytesA);
+        if (py_bytesB != NULL && py_bytesB != py_sequenceB) Py_DECREF(py_bytesB);
+        py_bytesA = NULL;
+        py_bytesB = NULL;
         use_sequence_cstring = 0;
     }
 #endif
@@ -197,6 +879,10 @@ static PyObject *cpairwise2__make_score_matrix_fast(PyObject *self,
     if(py_mismatch) {
         Py_DECREF(py_mismatch);
     }
+    /* Similarly, if py_match_fn is a dictionary_match, look up the scores
+       in a table instead of calling it for every cell. */
+    if(use_sequence_cstring && !use_match_mismatch_scores)
+        match_table = _create_match_table(py_match_fn);
     /* Cache some commonly used gap penalties */
     first_A_gap = calc_affine_penalty(1, open_A, extend_A,
                                       penalize_extend_when_opening);
@@ -206,17 +892,30 @@ static PyObject *cpairwise2__make_score_matrix_fast(PyObject *self,
     /* Allocate matrices for storing the results and initialize first row and col. */
     lenA = PySequence_Length(py_sequenceA);
     lenB = PySequence_Length(py_sequenceB);
-    score_matrix = malloc((lenA+1)*(lenB+1)*sizeof(*score_matrix));
+    /* If we only want the score, keep just two rows of the score matrix
+       and skip the trace matrix, so memory use is O(lenB). */
+    n_score_rows = score_only ? 2 : lenA+1;
+    score_matrix = malloc(n_score_rows*(lenB+1)*sizeof(*score_matrix));
     if(!score_matrix) {
         PyErr_SetString(PyExc_MemoryError, "Out of memory");
         goto _cleanup_make_score_matrix_fast;
     }
-    for(i=0; i<(lenB+1); i++)
-        score_matrix[i] = 0;
-    for(i=0; i<(lenA+1)*(lenB+1); i += (lenB+1))
-        score_matrix[i] = 0;
-    /* If we only want the score, we don't need the trace matrix. */
-    if (!score_only){
+    if (!score_only && as_buffers && compress_trace) {
+        /* Fill in the trace matrix one row at a time, and compress each
+           row when it is complete. */
+        trace_matrix = calloc(lenB+1, sizeof(*trace_matrix));
+        if(!trace_matrix) {
+            PyErr_SetString(PyExc_MemoryError, "Out of memory");
+            goto _cleanup_make_score_matrix_fast;
+        }
+        if(!(compressed_trace = _create_compressed_trace(lenA+1, lenB+1)))
+            goto _cleanup_make_score_matrix_fast;
+        if(_append_trace_row(compressed_trace, trace_matrix) < 0) {
+            PyErr_SetString(PyExc_MemoryError, "Out of memory");
+            goto _cleanup_make_score_matrix_fast;
+        }
+    }
+    else if (!score_only){
         trace_matrix = malloc((lenA+1)*(lenB+1)*sizeof(*trace_matrix));
         if(!trace_matrix) {
             PyErr_SetString(PyExc_MemoryError, "Out of memory");
@@ -227,18 +926,9 @@ static PyObject *cpairwise2__make_score_matrix_fast(PyObject *self,
         for(i=0; i<(lenA+1)*(lenB+1); i += (lenB+1))
             trace_matrix[i] = 0;
         }
-    else
-        trace_matrix = malloc(1);
 
-    /* Initialize the first row and col of the score matrix. */
-    for(i=0; i<=lenA; i++) {
-        if(penalize_end_gaps_B)
-            score = calc_affine_penalty(i, open_B, extend_B,
-                                        penalize_extend_when_opening);
-        else
-            score = 0;
-        score_matrix[i*(lenB+1)] = score;
-    }
+    /* Initialize the first row of the score matrix.  The first col is
+       filled in row by row below. */
     for(i=0; i<=lenB; i++) {
         if(penalize_end_gaps_A)
             score = calc_affine_penalty(i, open_A, extend_A,
@@ -256,10 +946,68 @@ static PyObject *cpairwise2__make_score_matrix_fast(PyObject *self,
                              penalize_extend_when_opening);
     }
 
-    /* Fill in the score matrix. The row cache is calculated on the fly.*/
+    /* Use exact fixed-point arithmetic if all scores allow it. */
+    if(use_sequence_cstring && (use_match_mismatch_scores || match_table)) {
+        double max_match_score = 0;
+        if(!use_match_mismatch_scores)
+            fixed_table = _create_fixed_point_table(match_table,
+                                                    &max_match_score);
+        if((use_match_mismatch_scores || fixed_table)
+           && _get_fixed_point_parameters(&fixed, match, mismatch,
+                                          fixed_table, max_match_score,
+                                          open_A, extend_A, open_B, extend_B,
+                                          lenA, lenB))
+            fixed_cache = malloc(3*(lenB+1)*sizeof(*fixed_cache));
+        if(fixed_cache) {
+            int fixed_best_score, status;
+            fixed.penalize_extend_when_opening = penalize_extend_when_opening;
+            fixed.penalize_end_gaps_A = penalize_end_gaps_A;
+            fixed.penalize_end_gaps_B = penalize_end_gaps_B;
+            fixed.align_globally = align_globally;
+            thread_state = PyEval_SaveThread();
+            status = _fill_fixed_point(&fixed, sequenceA, lenA,
+                                       sequenceB, lenB, fixed_cache,
+                                       score_only ? NULL : score_matrix,
+                                       trace_matrix, compressed_trace,
+                                       &fixed_best_score);
+            PyEval_RestoreThread(thread_state);
+            thread_state = NULL;
+            if(status == 0) {
+                best_score = (double)fixed_best_score / _PRECISION;
+                goto _matrices_filled;
+            }
+            if(status == -2) {
+                PyErr_SetString(PyExc_MemoryError, "Out of memory");
+                goto _cleanup_make_score_matrix_fast;
+            }
+            /* A pair of characters is missing from the match dictionary;
+               the loop below raises the KeyError. */
+            if(compressed_trace) {
+                compressed_trace->filled = 1;
+                compressed_trace->size = compressed_trace->row_offsets[1];
+            }
+        }
+    }
+
+    /* Fill in the score matrix. The row cache is calculated on the fly.
+       If the match scores are calculated in C, no Python objects are
+       touched in the loop, so other threads can run in the meantime. */
+    if(use_sequence_cstring && use_match_mismatch_scores)
+        thread_state = PyEval_SaveThread();
     for(row=1; row<=lenA; row++) {
         double row_cache_score = calc_affine_penalty(row, (2*open_A), extend_A,
                                  penalize_extend_when_opening);
+        double *prev_row = score_matrix + ((row-1) % n_score_rows)*(lenB+1);
+        double *cur_row = score_matrix + (row % n_score_rows)*(lenB+1);
+        unsigned char *trace_row = NULL;
+        if(trace_matrix)
+            trace_row = compressed_trace ? trace_matrix
+                                         : trace_matrix + row*(lenB+1);
+        if(penalize_end_gaps_B)
+            cur_row[0] = calc_affine_penalty(row, open_B, extend_B,
+                                             penalize_extend_when_opening);
+        else
+            cur_row[0] = 0;
         for(col=1; col<=lenB; col++) {
             double match_score, nogap_score;
             double row_open, row_extend, col_open, col_extend;
@@ -272,27 +1020,28 @@ static PyObject *cpairwise2__make_score_matrix_fast(PyObject *self,
                                            sequenceA, sequenceB,
                                            use_sequence_cstring,
                                            match, mismatch,
-                                           use_match_mismatch_scores);
-            if(match_score==-1.0 && PyErr_Occurred())
+                                           use_match_mismatch_scores,
+                                           match_table);
+            if(!thread_state && match_score==-1.0 && PyErr_Occurred())
                 goto _cleanup_make_score_matrix_fast;
-            nogap_score = score_matrix[(row-1)*(lenB+1)+col-1] + match_score;
+            nogap_score = prev_row[col-1] + match_score;
 
             if (!penalize_end_gaps_A && row==lenA) {
-                row_open = score_matrix[(row)*(lenB+1)+col-1];
+                row_open = cur_row[col-1];
                 row_extend = row_cache_score;
             }
             else {
-                row_open = score_matrix[(row)*(lenB+1)+col-1] + first_A_gap;
+                row_open = cur_row[col-1] + first_A_gap;
                 row_extend = row_cache_score + extend_A;
             }
             row_cache_score = (row_open > row_extend) ? row_open : row_extend;
 
             if (!penalize_end_gaps_B && col==lenB){
-                col_open = score_matrix[(row-1)*(lenB+1)+col];
+                col_open = prev_row[col];
                 col_extend = col_cache_score[col];
             }
             else {
-                col_open = score_matrix[(row-1)*(lenB+1)+col] + first_B_gap;
+                col_open = prev_row[col] + first_B_gap;
                 col_extend = col_cache_score[col] + extend_B;
             }
             col_cache_score[col] = (col_open > col_extend) ? col_open : col_extend;
@@ -305,9 +1054,9 @@ static PyObject *cpairwise2__make_score_matrix_fast(PyObject *self,
                 local_max_score = best_score;
 
             if(!align_globally && best_score < 0)
-                score_matrix[row*(lenB+1)+col] = 0;
+                cur_row[col] = 0;
             else
-                score_matrix[row*(lenB+1)+col] = best_score;
+                cur_row[col] = best_score;
 
             if (!score_only) {
                 row_score_rint = rint(row_cache_score);
@@ -331,16 +1080,50 @@ static PyObject *cpairwise2__make_score_matrix_fast(PyObject *self,
                     trace_score += row_trace_score;
                 if (col_score_rint == best_score_rint)
                     trace_score += col_trace_score;
-                trace_matrix[row*(lenB+1)+col] = trace_score;
+                trace_row[col] = trace_score;
             }
         }
+        if(compressed_trace && _append_trace_row(compressed_trace, trace_row) < 0) {
+            out_of_memory = 1;
+            break;
+        }
+    }
+
+    if(thread_state) {
+        PyEval_RestoreThread(thread_state);
+        thread_state = NULL;
+    }
+    if(out_of_memory) {
+        PyErr_SetString(PyExc_MemoryError, "Out of memory");
+        goto _cleanup_make_score_matrix_fast;
     }
 
     if (!align_globally)
         best_score = local_max_score;
 
+ _matrices_filled:
+
     /* Save the score and traceback matrices into real python objects. */
-	if(!score_only) {
+	if(!score_only && as_buffers) {
+		/* Hand the matrices over to buffer objects without copying. */
+		py_score_matrix = _create_matrix_buffer(score_matrix, lenA+1, lenB+1,
+		                                        sizeof(*score_matrix), "d");
+		score_matrix = NULL;
+		if(!py_score_matrix)
+			goto _cleanup_make_score_matrix_fast;
+		if(compressed_trace) {
+			py_trace_matrix = (PyObject *)compressed_trace;
+			compressed_trace = NULL;
+		}
+		else {
+			py_trace_matrix = _create_matrix_buffer(trace_matrix, lenA+1, lenB+1,
+			                                        sizeof(*trace_matrix), "B");
+			trace_matrix = NULL;
+			if(!py_trace_matrix)
+				goto _cleanup_make_score_matrix_fast;
+		}
+	}
+	else if(!score_only) {
 		if(!(py_score_matrix = PyList_New(lenA+1)))
 			goto _cleanup_make_score_matrix_fast;
 		if(!(py_trace_matrix = PyList_New(lenA+1)))
@@ -389,6 +1172,13 @@ static PyObject *cpairwise2__make_score_matrix_fast(PyObject *self,
     py_retval = Py_BuildValue("(OOd)", py_score_matrix, py_trace_matrix, best_score);
 
  _cleanup_make_score_matrix_fast:
+    if(match_table)
+        free(match_table);
+    if(fixed_table)
+        free(fixed_table);
+    if(fixed_cache)
+        free(fixed_cache);
+    Py_XDECREF(compressed_trace);
     if(score_matrix)
         free(score_matrix);
     if(trace_matrix)
@@ -410,6 +1200,858 @@ static PyObject *cpairwise2__make_score_matrix_fast(PyObject *self,
     return py_retval;
 }
 
+/* Scoring many pairs of sequences.
+ *
+ * For string sequences with match/mismatch scores and affine gap
+ * penalties, the score of each pair is calculated in plain C with two rows
+ * of the score matrix, using the same recursion as in
+ * _make_score_matrix_fast, in fixed point if possible. As no Python
+ * objects are involved, the pairs are divided over several native threads
+ * without holding the GIL.
+ */
+
+typedef struct {
+    double match, mismatch;
+    double open_A, extend_A, open_B, extend_B;
+    int penalize_extend_when_opening;
+    int penalize_end_gaps_A, penalize_end_gaps_B;
+    int align_globally;
+} ScoreParameters;
+
+typedef struct {
+    const ScoreParameters *parameters;
+    const FixedPointParameters *fixed;  /* NULL if not using fixed point */
+    const char **sequencesA, **sequencesB;
+    int *lengthsA, *lengthsB;
+    double *scores;
+    Py_ssize_t n;
+    Py_ssize_t next;      /* index of the next pair to be scored */
+    int failed;           /* set if a worker ran out of memory */
+    PyThread_type_lock lock;
+} ScoreBatch;
+
+typedef struct {
+    ScoreBatch *batch;
+    PyThread_type_lock done;  /* released when the worker has finished */
+} ScoreWorker;
+
+/* Return the score of the best alignment of sequenceA and sequenceB.
+   cache should have space for 3*(lenB+1) doubles. */
+static double _score_cstring(const ScoreParameters *p,
+                             const char *sequenceA, int lenA,
+                             const char *sequenceB, int lenB,
+                             double *cache)
+{
+    int row, col;
+    double *col_cache_score = cache;
+    double *score_rows = cache + (lenB+1);
+    double first_A_gap, first_B_gap;
+    double best_score = 0;
+    double local_max_score = 0;
+
+    first_A_gap = calc_affine_penalty(1, p->open_A, p->extend_A,
+                                      p->penalize_extend_when_opening);
+    first_B_gap = calc_affine_penalty(1, p->open_B, p->extend_B,
+                                      p->penalize_extend_when_opening);
+    for(col=0; col<=lenB; col++) {
+        if(p->penalize_end_gaps_A)
+            score_rows[col] = calc_affine_penalty(col, p->open_A, p->extend_A,
+                                    p->penalize_extend_when_opening);
+        else
+            score_rows[col] = 0;
+        col_cache_score[col] = calc_affine_penalty(col, (2*p->open_B),
+                                    p->extend_B,
+                                    p->penalize_extend_when_opening);
+    }
+    for(row=1; row<=lenA; row++) {
+        double row_cache_score = calc_affine_penalty(row, (2*p->open_A),
+                                    p->extend_A,
+                                    p->penalize_extend_when_opening);
+        double *prev_row = score_rows + ((row-1) % 2)*(lenB+1);
+        double *cur_row = score_rows + (row % 2)*(lenB+1);
+        if(p->penalize_end_gaps_B)
+            cur_row[0] = calc_affine_penalty(row, p->open_B, p->extend_B,
+                                    p->penalize_extend_when_opening);
+        else
+            cur_row[0] = 0;
+        for(col=1; col<=lenB; col++) {
+            double nogap_score, row_open, row_extend, col_open, col_extend;
+
+            nogap_score = prev_row[col-1] + ((sequenceA[row-1] == sequenceB[col-1])
+                                             ? p->match : p->mismatch);
+            if(!p->penalize_end_gaps_A && row==lenA) {
+                row_open = cur_row[col-1];
+                row_extend = row_cache_score;
+            }
+            else {
+                row_open = cur_row[col-1] + first_A_gap;
+                row_extend = row_cache_score + p->extend_A;
+            }
+            row_cache_score = (row_open > row_extend) ? row_open : row_extend;
+
+            if(!p->penalize_end_gaps_B && col==lenB) {
+                col_open = prev_row[col];
+                col_extend = col_cache_score[col];
+            }
+            else {
+                col_open = prev_row[col] + first_B_gap;
+                col_extend = col_cache_score[col] + p->extend_B;
+            }
+            col_cache_score[col] = (col_open > col_extend) ? col_open : col_extend;
+
+            best_score = (row_cache_score > col_cache_score[col]) ? row_cache_score : col_cache_score[col];
+            if(nogap_score > best_score)
+                best_score = nogap_score;
+            if(best_score > local_max_score)
+                local_max_score = best_score;
+            if(!p->align_globally && best_score < 0)
+                cur_row[col] = 0;
+            else
+                cur_row[col] = best_score;
+        }
+    }
+    if(!p->align_globally)
+        best_score = local_max_score;
+    return best_score;
+}
+
+/* Score pairs from the batch until none are left. This runs without the
+   GIL and must not touch any Python objects. */
+static void _score_batch_worker(void *arg)
+{
+    ScoreWorker *worker = arg;
+    ScoreBatch *batch = worker->batch;
+    double *cache = NULL;
+    int cache_size = 0;
+    Py_ssize_t i;
+
+    while(1) {
+        PyThread_acquire_lock(batch->lock, WAIT_LOCK);
+        i = batch->next++;
+        PyThread_release_lock(batch->lock);
+        if(i >= batch->n)
+            break;
+        if(batch->lengthsB[i] >= cache_size) {
+            double *new_cache;
+            cache_size = batch->lengthsB[i] + 1;
+            new_cache = realloc(cache, 3*cache_size*sizeof(*cache));
+            if(!new_cache) {
+                batch->failed = 1;
+                break;
+            }
+            cache = new_cache;
+        }
+        if(batch->fixed) {
+            int score = 0;
+            _fill_fixed_point(batch->fixed, batch->sequencesA[i],
+                              batch->lengthsA[i], batch->sequencesB[i],
+                              batch->lengthsB[i], (int *)cache, NULL, NULL,
+                              NULL, &score);
+            batch->scores[i] = (double)score / _PRECISION;
+        }
+        else
+            batch->scores[i] = _score_cstring(batch->parameters,
+                                              batch->sequencesA[i],
+                                              batch->lengthsA[i],
+                                              batch->sequencesB[i],
+                                              batch->lengthsB[i], cache);
+    }
+    if(cache)
+        free(cache);
+    if(worker->done)
+        PyThread_release_lock(worker->done);
+}
+
+static PyObject *cpairwise2__score_pairs_fast(PyObject *self, PyObject *args)
+{
+    PyObject *py_sequencesA, *py_sequencesB;
+    PyObject *py_fastA=NULL, *py_fastB=NULL, *py_bytes=NULL;
+    PyObject *py_retval=NULL;
+    ScoreParameters parameters;
+    FixedPointParameters fixed;
+    ScoreBatch batch;
+    ScoreWorker *workers = NULL;
+    int threads;
+    Py_ssize_t i, n;
+    int maxA = 0, maxB = 0;
+    int t;
+
+    if(!PyArg_ParseTuple(args, "OOddddddi(ii)ii", &py_sequencesA,
+                         &py_sequencesB, &parameters.match,
+                         &parameters.mismatch,
+                         &parameters.open_A, &parameters.extend_A,
+                         &parameters.open_B, &parameters.extend_B,
+                         &parameters.penalize_extend_when_opening,
+                         &parameters.penalize_end_gaps_A,
+                         &parameters.penalize_end_gaps_B,
+                         &parameters.align_globally, &threads))
+        return NULL;
+    memset(&batch, 0, sizeof(batch));
+    batch.parameters = &parameters;
+
+    if(!(py_fastA = PySequence_Fast(py_sequencesA, "expected a sequence")))
+        goto _cleanup_score_pairs_fast;
+    if(!(py_fastB = PySequence_Fast(py_sequencesB, "expected a sequence")))
+        goto _cleanup_score_pairs_fast;
+    n = PySequence_Fast_GET_SIZE(py_fastA);
+    if(PySequence_Fast_GET_SIZE(py_fastB) != n) {
+        PyErr_SetString(PyExc_ValueError,
+                        "expected the same number of sequences A and B");
+        goto _cleanup_score_pairs_fast;
+    }
+    /* Keep the bytes objects alive while the threads are running. */
+    if(!(py_bytes = PyList_New(0)))
+        goto _cleanup_score_pairs_fast;
+    batch.n = n;
+    batch.sequencesA = malloc((n+1)*sizeof(*batch.sequencesA));
+    batch.sequencesB = malloc((n+1)*sizeof(*batch.sequencesB));
+    batch.lengthsA = malloc((n+1)*sizeof(*batch.lengthsA));
+    batch.lengthsB = malloc((n+1)*sizeof(*batch.lengthsB));
+    batch.scores = malloc((n+1)*sizeof(*batch.scores));
+    if(!batch.sequencesA || !batch.sequencesB || !batch.lengthsA
+       || !batch.lengthsB || !batch.scores) {
+        PyErr_SetString(PyExc_MemoryError, "Out of memory");
+        goto _cleanup_score_pairs_fast;
+    }
+    for(i=0; i<2*n; i++) {
+        PyObject *py_sequence, *py_bytes_sequence;
+        Py_ssize_t length;
+        if(i < n)
+            py_sequence = PySequence_Fast_GET_ITEM(py_fastA, i);
+        else
+            py_sequence = PySequence_Fast_GET_ITEM(py_fastB, i-n);
+        py_bytes_sequence = _create_bytes_object(py_sequence);
+        if(!py_bytes_sequence) {
+            /* Let pairwise2.py handle anything but ASCII strings. */
+            Py_INCREF(Py_None);
+            py_retval = Py_None;
+            goto _cleanup_score_pairs_fast;
+        }
+        if(py_bytes_sequence == py_sequence)
+            Py_INCREF(py_bytes_sequence);
+        if(PyList_Append(py_bytes, py_bytes_sequence) < 0) {
+            Py_DECREF(py_bytes_sequence);
+            goto _cleanup_score_pairs_fast;
+        }
+        Py_DECREF(py_bytes_sequence);
+        length = PyBytes_GET_SIZE(py_bytes_sequence);
+        if(length > INT_MAX) {
+            PyErr_SetString(PyExc_OverflowError, "sequence is too long");
+            goto _cleanup_score_pairs_fast;
+        }
+        if(i < n) {
+            batch.sequencesA[i] = PyBytes_AS_STRING(py_bytes_sequence);
+            batch.lengthsA[i] = (int)length;
+            if(length > maxA)
+                maxA = (int)length;
+        }
+        else {
+            batch.sequencesB[i-n] = PyBytes_AS_STRING(py_bytes_sequence);
+            batch.lengthsB[i-n] = (int)length;
+            if(length > maxB)
+                maxB = (int)length;
+        }
+    }
+    if(_get_fixed_point_parameters(&fixed, parameters.match,
+                                   parameters.mismatch, NULL, 0,
+                                   parameters.open_A, parameters.extend_A,
+                                   parameters.open_B, parameters.extend_B,
+                                   maxA, maxB)) {
+        fixed.penalize_extend_when_opening = parameters.penalize_extend_when_opening;
+        fixed.penalize_end_gaps_A = parameters.penalize_end_gaps_A;
+        fixed.penalize_end_gaps_B = parameters.penalize_end_gaps_B;
+        fixed.align_globally = parameters.align_globally;
+        batch.fixed = &fixed;
+    }
+
+    if(threads > n)
+        threads = (int)n;
+    if(threads < 1)
+        threads = 1;
+    if(!(batch.lock = PyThread_allocate_lock())) {
+        PyErr_SetString(PyExc_MemoryError, "Unable to allocate lock");
+        goto _cleanup_score_pairs_fast;
+    }
+    if(!(workers = calloc(threads, sizeof(*workers)))) {
+        PyErr_SetString(PyExc_MemoryError, "Out of memory");
+        goto _cleanup_score_pairs_fast;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    /* The calling thread is worker 0. If a thread cannot be started, the
+       remaining pairs are scored by the other workers. */
+    for(t=0; t<threads; t++) {
+        workers[t].batch = &batch;
+        if(t == 0)
+            continue;
+        workers[t].done = PyThread_allocate_lock();
+        if(!workers[t].done)
+            continue;
+        PyThread_acquire_lock(workers[t].done, WAIT_LOCK);
+        if(PyThread_start_new_thread(_score_batch_worker, &workers[t])
+           == PYTHREAD_INVALID_THREAD_ID) {
+            PyThread_release_lock(workers[t].done);
+            PyThread_free_lock(workers[t].done);
+            workers[t].done = NULL;
+        }
+    }
+    _score_batch_worker(&workers[0]);
+    for(t=1; t<threads; t++) {
+        if(workers[t].done) {
+            PyThread_acquire_lock(workers[t].done, WAIT_LOCK);
+            PyThread_release_lock(workers[t].done);
+            PyThread_free_lock(workers[t].done);
+        }
+    }
+    Py_END_ALLOW_THREADS
+    if(batch.failed) {
+        PyErr_SetString(PyExc_MemoryError, "Out of memory");
+        goto _cleanup_score_pairs_fast;
+    }
+
+    if(!(py_retval = PyList_New(n)))
+        goto _cleanup_score_pairs_fast;
+    for(i=0; i<n; i++) {
+        PyObject *py_score = PyFloat_FromDouble(batch.scores[i]);
+        if(!py_score) {
+            Py_DECREF(py_retval);
+            py_retval = NULL;
+            goto _cleanup_score_pairs_fast;
+        }
+        PyList_SET_ITEM(py_retval, i, py_score);
+    }
+
+ _cleanup_score_pairs_fast:
+    if(workers)
+        free(workers);
+    if(batch.lock)
+        PyThread_free_lock(batch.lock);
+    if(batch.sequencesA)
+        free(batch.sequencesA);
+    if(batch.sequencesB)
+        free(batch.sequencesB);
+    if(batch.lengthsA)
+        free(batch.lengthsA);
+    if(batch.lengthsB)
+        free(batch.lengthsB);
+    if(batch.scores)
+        free(batch.scores);
+    Py_XDECREF(py_bytes);
+    Py_XDECREF(py_fastA);
+    Py_XDECREF(py_fastB);
+    return py_retval;
+}
+
+/* Traceback.
+ *
+ * This is a port of _recover_alignments and _find_gap_open in pairwise2
+ * for the case that both sequences are ASCII strings and the gap penalties
+ * are affine. The partial alignments are stored reversed, as in pairwise2;
+ * each branch point on the stack keeps its own copy of the partial
+ * alignment.
+ */
+
+typedef struct {
+    char *data;             /* partial alignment of A, followed by that of B */
+    Py_ssize_t lengthA;
+    Py_ssize_t lengthB;
+    Py_ssize_t end;         /* 0 if the alignment extends to the end */
+    int row;
+    int col;
+    int col_gap;
+    unsigned char trace;
+} TracebackState;
+
+typedef struct {
+    TracebackState *states;
+    Py_ssize_t n;
+    Py_ssize_t allocated;
+} TracebackStack;
+
+typedef struct {
+    char *A;                /* reversed partial alignment of sequence A */
+    char *B;                /* reversed partial alignment of sequence B */
+    Py_ssize_t lengthA;
+    Py_ssize_t lengthB;
+    Py_ssize_t end;
+    int row;
+    int col;
+    int col_gap;
+} Traceback;
+
+static int _push_traceback(TracebackStack *stack, const Traceback *traceback,
+                           unsigned char trace)
+{
+    TracebackState *state;
+    if(stack->n == stack->allocated) {
+        Py_ssize_t allocated = 2 * stack->allocated + 16;
+        TracebackState *states = realloc(stack->states,
+                                         allocated * sizeof(TracebackState));
+        if(!states)
+            return 0;
+        stack->states = states;
+        stack->allocated = allocated;
+    }
+    state = &stack->states[stack->n];
+    state->data = malloc(traceback->lengthA + traceback->lengthB + 1);
+    if(!state->data)
+        return 0;
+    memcpy(state->data, traceback->A, traceback->lengthA);
+    memcpy(state->data + traceback->lengthA, traceback->B, traceback->lengthB);
+    state->lengthA = traceback->lengthA;
+    state->lengthB = traceback->lengthB;
+    state->end = traceback->end;
+    state->row = traceback->row;
+    state->col = traceback->col;
+    state->col_gap = traceback->col_gap;
+    state->trace = trace;
+    stack->n++;
+    return 1;
+}
+
+static void _pop_traceback(TracebackStack *stack, Traceback *traceback,
+                           unsigned char *trace)
+{
+    TracebackState *state = &stack->states[--stack->n];
+    memcpy(traceback->A, state->data, state->lengthA);
+    memcpy(traceback->B, state->data + state->lengthA, state->lengthB);
+    free(state->data);
+    traceback->lengthA = state->lengthA;
+    traceback->lengthB = state->lengthB;
+    traceback->end = state->end;
+    traceback->row = state->row;
+    traceback->col = state->col;
+    traceback->col_gap = state->col_gap;
+    *trace = state->trace;
+}
+
+static void _clear_traceback_stack(TracebackStack *stack)
+{
+    while(stack->n > 0)
+        free(stack->states[--stack->n].data);
+    if(stack->states)
+        free(stack->states);
+}
+
+static int _compare_cells(const void *a, const void *b)
+{
+    const Py_ssize_t x = *(const Py_ssize_t *)a;
+    const Py_ssize_t y = *(const Py_ssize_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Return the trace of a cell in a compressed trace matrix. The cells in
+   mutated (sorted by their offset in the matrix) are local alignment
+   starts, whose trace has been replaced by 2. */
+static unsigned char _get_traceback_trace(const CompressedTrace *trace,
+                                          const Py_ssize_t *mutated,
+                                          Py_ssize_t nmutated,
+                                          int row, int col)
+{
+    const Py_ssize_t cell = (Py_ssize_t)row*trace->ncols + col;
+    Py_ssize_t low = 0, high = nmutated;
+
+    while(low < high) {
+        const Py_ssize_t middle = (low + high) / 2;
+        if(mutated[middle] < cell)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    if(low < nmutated && mutated[low] == cell)
+        return 2;
+    return _get_compressed_trace(trace, row, col);
+}
+
+static PyObject *cpairwise2__recover_alignments_fast(PyObject *self,
+                                                     PyObject *args)
+{
+    PyObject *py_sequenceA, *py_sequenceB, *py_starts;
+    PyObject *py_score_matrix, *py_trace_matrix, *py_gap_char;
+    PyObject *py_bytesA = NULL, *py_bytesB = NULL, *py_bytes_gap = NULL;
+    PyObject *py_starts_fast = NULL;
+    PyObject *py_tracebacks = NULL;
+    PyObject *py_retval = NULL;
+    Py_buffer score_view = {0};
+    Py_buffer trace_view = {0};
+    const char *sequenceA, *sequenceB;
+    char gap_char;
+    double best_score, score = 0;
+    double open_A, extend_A, open_B, extend_B;
+    int penalize_extend_when_opening_A, penalize_extend_when_opening_B;
+    int align_globally, one_alignment_only, reverse;
+    Py_ssize_t max_alignments;
+    Py_ssize_t i, k, nstarts;
+    int lenA, lenB;
+    int *start_rows = NULL, *start_cols = NULL;
+    double *start_scores = NULL;
+    const double *S;
+    unsigned char *T = NULL;
+    const CompressedTrace *compressed_trace = NULL;
+    Py_ssize_t *mutated = NULL;
+    Py_ssize_t nmutated = 0;
+    Py_ssize_t begin = 0;
+    Traceback traceback = {NULL, NULL, 0, 0, 0, 0, 0, 0};
+    TracebackStack stack = {NULL, 0, 0};
+
+    if(!PyArg_ParseTuple(args, "OOOdOOiOiddiddiin",
+                         &py_sequenceA, &py_sequenceB, &py_starts,
+                         &best_score, &py_score_matrix, &py_trace_matrix,
+                         &align_globally, &py_gap_char, &one_alignment_only,
+                         &open_A, &extend_A, &penalize_extend_when_opening_A,
+                         &open_B, &extend_B, &penalize_extend_when_opening_B,
+                         &reverse, &max_alignments))
+        return NULL;
+
+    /* Only ASCII strings are handled here; return None otherwise, so
+       that the caller can fall back to the Python implementation. */
+    if(!PyUnicode_Check(py_sequenceA) || !PyUnicode_Check(py_sequenceB)
+       || !PyUnicode_Check(py_gap_char))
+        goto _not_handled;
+    py_bytesA = PyUnicode_AsASCIIString(py_sequenceA);
+    py_bytesB = PyUnicode_AsASCIIString(py_sequenceB);
+    py_bytes_gap = PyUnicode_AsASCIIString(py_gap_char);
+    if(!py_bytesA || !py_bytesB || !py_bytes_gap) {
+        PyErr_Clear();
+        goto _not_handled;
+    }
+    if(PyBytes_GET_SIZE(py_bytes_gap) != 1)
+        goto _not_handled;
+    sequenceA = PyBytes_AS_STRING(py_bytesA);
+    sequenceB = PyBytes_AS_STRING(py_bytesB);
+    gap_char = PyBytes_AS_STRING(py_bytes_gap)[0];
+    lenA = (int)PyBytes_GET_SIZE(py_bytesA);
+    lenB = (int)PyBytes_GET_SIZE(py_bytesB);
+
+    if(PyObject_GetBuffer(py_score_matrix, &score_view,
+                          PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) < 0)
+        goto _cleanup_recover_alignments_fast;
+    if(Py_TYPE(py_trace_matrix) == &CompressedTrace_Type) {
+        compressed_trace = (CompressedTrace *)py_trace_matrix;
+        if(compressed_trace->nrows != lenA+1
+           || compressed_trace->ncols != lenB+1
+           || compressed_trace->filled != lenA+1) {
+            PyErr_SetString(PyExc_ValueError,
+                            "compressed trace matrix has unexpected shape");
+            goto _cleanup_recover_alignments_fast;
+        }
+    }
+    else {
+        if(PyObject_GetBuffer(py_trace_matrix, &trace_view,
+                              PyBUF_C_CONTIGUOUS | PyBUF_FORMAT | PyBUF_WRITABLE) < 0)
+            goto _cleanup_recover_alignments_fast;
+        if(trace_view.ndim != 2 || strcmp(trace_view.format, "B") != 0
+           || trace_view.shape[0] != lenA+1 || trace_view.shape[1] != lenB+1) {
+            PyErr_SetString(PyExc_ValueError,
+                            "trace matrix has unexpected format or shape");
+            goto _cleanup_recover_alignments_fast;
+        }
+        T = trace_view.buf;
+    }
+    if(score_view.ndim != 2 || strcmp(score_view.format, "d") != 0
+       || score_view.shape[0] != lenA+1 || score_view.shape[1] != lenB+1) {
+        PyErr_SetString(PyExc_ValueError,
+                        "score matrix has unexpected format or shape");
+        goto _cleanup_recover_alignments_fast;
+    }
+    S = score_view.buf;
+
+#define SCORE(row, col) S[(Py_ssize_t)(row)*(lenB+1)+(col)]
+#define TRACE(row, col) (T ? T[(Py_ssize_t)(row)*(lenB+1)+(col)] \
+    : _get_traceback_trace(compressed_trace, mutated, nmutated, row, col))
+
+    if(!(py_starts_fast = PySequence_Fast(py_starts, "starts must be a sequence")))
+        goto _cleanup_recover_alignments_fast;
+    nstarts = PySequence_Fast_GET_SIZE(py_starts_fast);
+    start_scores = malloc((nstarts+1)*sizeof(double));
+    start_rows = malloc((nstarts+1)*sizeof(int));
+    start_cols = malloc((nstarts+1)*sizeof(int));
+    mutated = malloc((nstarts+1)*sizeof(Py_ssize_t));
+    traceback.A = malloc(lenA+lenB+1);
+    traceback.B = malloc(lenA+lenB+1);
+    if(!start_scores || !start_rows || !start_cols || !mutated
+       || !traceback.A || !traceback.B) {
+        PyErr_NoMemory();
+        goto _cleanup_recover_alignments_fast;
+    }
+    for(i=0; i<nstarts; i++) {
+        PyObject *py_start = PySequence_Fast_GET_ITEM(py_starts_fast, i);
+        if(!PyArg_ParseTuple(py_start, "d(ii)", &start_scores[i],
+                             &start_rows[i], &start_cols[i]))
+            goto _cleanup_recover_alignments_fast;
+        if(start_rows[i] < 0 || start_rows[i] > lenA
+           || start_cols[i] < 0 || start_cols[i] > lenB) {
+            PyErr_SetString(PyExc_ValueError, "start out of range");
+            goto _cleanup_recover_alignments_fast;
+        }
+    }
+
+    if(!(py_tracebacks = PyList_New(0)))
+        goto _cleanup_recover_alignments_fast;
+
+    for(i=0; i<nstarts; i++) {
+        int row = start_rows[i];
+        int col = start_cols[i];
+        unsigned char start_trace = TRACE(row, col);
+        score = start_scores[i];
+        begin = 0;
+        traceback.lengthA = 0;
+        traceback.lengthB = 0;
+        traceback.end = 0;
+        if(!align_globally) {
+            int row_distance = lenA - row;
+            int col_distance = lenB - col;
+            /* If this start is a zero-extension: don't start here! */
+            for(k=0; k<nstarts; k++)
+                if(start_scores[k] == score && start_rows[k] == row-1
+                   && start_cols[k] == col-1)
+                    break;
+            if(k < nstarts)
+                continue;
+            /* Local alignments should start with a positive score! */
+            if(score <= 0)
+                continue;
+            /* Local alignments should not end with a gap! */
+            if((start_trace - start_trace % 2) % 4 == 2) {
+                start_trace = 2;
+                if(T)
+                    T[(Py_ssize_t)row*(lenB+1)+col] = 2;
+                else
+                    mutated[nmutated++] = (Py_ssize_t)row*(lenB+1)+col;
+            }
+            else
+                continue;
+            traceback.end = -((row_distance > col_distance) ? row_distance : col_distance);
+            for(k=0; k<col_distance-row_distance; k++)
+                traceback.A[traceback.lengthA++] = gap_char;
+            for(k=lenA-1; k>row-1 && row>0; k--)
+                traceback.A[traceback.lengthA++] = sequenceA[k];
+            for(k=0; k<row_distance-col_distance; k++)
+                traceback.B[traceback.lengthB++] = gap_char;
+            for(k=lenB-1; k>col-1 && col>0; k--)
+                traceback.B[traceback.lengthB++] = sequenceB[k];
+        }
+        traceback.row = row;
+        traceback.col = col;
+        traceback.col_gap = 0;
+        if(!_push_traceback(&stack, &traceback, start_trace)) {
+            PyErr_NoMemory();
+            goto _cleanup_recover_alignments_fast;
+        }
+    }
+    if(nmutated > 1)
+        qsort(mutated, nmutated, sizeof(Py_ssize_t), _compare_cells);
+
+    while(stack.n > 0 && PyList_GET_SIZE(py_tracebacks) < max_alignments) {
+        /* See _recover_alignments in pairwise2 for a description. */
+        int dead_end = 0;
+        unsigned char trace;
+        _pop_traceback(&stack, &traceback, &trace);
+
+        while((traceback.row > 0 || traceback.col > 0) && !dead_end) {
+            Traceback cache = traceback;
+            int row = traceback.row;
+            int col = traceback.col;
+
+            if(!trace) {
+                if(col && traceback.col_gap)
+                    dead_end = 1;
+                else {
+                    /* Add the remaining sequences and fill with gaps. */
+                    for(k=row-1; k>=0; k--)
+                        traceback.A[traceback.lengthA++] = sequenceA[k];
+                    for(k=col-1; k>=0; k--)
+                        traceback.B[traceback.lengthB++] = sequenceB[k];
+                    if(row > col)
+                        while(traceback.lengthB < traceback.lengthA)
+                            traceback.B[traceback.lengthB++] = gap_char;
+                    else if(col > row)
+                        while(traceback.lengthA < traceback.lengthB)
+                            traceback.A[traceback.lengthA++] = gap_char;
+                }
+                break;
+            }
+            else if(trace % 2 == 1) {  /* row open = open gap in seqA */
+                trace -= 1;
+                if(traceback.col_gap)
+                    dead_end = 1;
+                else {
+                    col--;
+                    traceback.A[traceback.lengthA++] = gap_char;
+                    traceback.B[traceback.lengthB++] = sequenceB[col];
+                    traceback.col_gap = 0;
+                }
+            }
+            else if(trace % 4 == 2) {  /* match/mismatch of seqA with seqB */
+                trace -= 2;
+                row--;
+                col--;
+                traceback.A[traceback.lengthA++] = sequenceA[row];
+                traceback.B[traceback.lengthB++] = sequenceB[col];
+                traceback.col_gap = 0;
+            }
+            else if(trace % 8 == 4) {  /* col open = open gap in seqB */
+                trace -= 4;
+                row--;
+                traceback.A[traceback.lengthA++] = sequenceA[row];
+                traceback.B[traceback.lengthB++] = gap_char;
+                traceback.col_gap = 1;
+            }
+            else if(trace == 8 || trace == 24 || trace == 16) {
+                /* Extend a gap in seqA (8) or in seqB (16); find the
+                   starting point(s) of the extended gap. */
+                const int in_A = (trace != 16);
+                const double target_score = SCORE(row, col);
+                const int target = in_A ? col : row;
+                int n;
+                if(in_A) {
+                    trace -= 8;
+                    if(traceback.col_gap)
+                        dead_end = 1;
+                }
+                else {
+                    trace -= 16;
+                    traceback.col_gap = 1;
+                }
+                if(!dead_end) {
+                    for(n=0; n<target; n++) {
+                        double actual_score;
+                        if(in_A) {
+                            col--;
+                            traceback.A[traceback.lengthA++] = gap_char;
+                            traceback.B[traceback.lengthB++] = sequenceB[col];
+                            actual_score = SCORE(row, col)
+                                         + calc_affine_penalty(n+1, open_A, extend_A,
+                                               penalize_extend_when_opening_A);
+                        }
+                        else {
+                            row--;
+                            traceback.A[traceback.lengthA++] = sequenceA[row];
+                            traceback.B[traceback.lengthB++] = gap_char;
+                            actual_score = SCORE(row, col)
+                                         + calc_affine_penalty(n+1, open_B, extend_B,
+                                               penalize_extend_when_opening_B);
+                        }
+                        if(!align_globally && SCORE(row, col) == best_score) {
+                            /* We have run through a 'zero-score' extension */
+                            dead_end = 1;
+                            break;
+                        }
+                        if(rint(actual_score) == rint(target_score) && n > 0) {
+                            if(!TRACE(row, col))
+                                break;
+                            traceback.row = row;
+                            traceback.col = col;
+                            if(!_push_traceback(&stack, &traceback, TRACE(row, col))) {
+                                PyErr_NoMemory();
+                                goto _cleanup_recover_alignments_fast;
+                            }
+                        }
+                        if(!TRACE(row, col))
+                            dead_end = 1;
+                    }
+                }
+            }
+            traceback.row = row;
+            traceback.col = col;
+
+            if(trace) {  /* There is another path to follow... */
+                if(!_push_traceback(&stack, &cache, trace)) {
+                    PyErr_NoMemory();
+                    goto _cleanup_recover_alignments_fast;
+                }
+            }
+            trace = TRACE(row, col);
+            if(!align_globally) {
+                if(SCORE(row, col) == best_score)
+                    /* We have gone through a 'zero-score' extension */
+                    dead_end = 1;
+                else if(SCORE(row, col) <= 0) {
+                    /* We have reached the end of the backtrace */
+                    begin = (row > col) ? row : col;
+                    trace = 0;
+                }
+            }
+        }
+        if(!dead_end) {
+            PyObject *py_A, *py_B, *py_end, *py_traceback;
+            int status;
+            char *p, *q;
+            /* Reverse the partial alignments in place. */
+            for(p=traceback.A, q=traceback.A+traceback.lengthA-1; p<q; p++, q--) {
+                char c = *p; *p = *q; *q = c;
+            }
+            for(p=traceback.B, q=traceback.B+traceback.lengthB-1; p<q; p++, q--) {
+                char c = *p; *p = *q; *q = c;
+            }
+            py_A = PyUnicode_FromStringAndSize(traceback.A, traceback.lengthA);
+            py_B = PyUnicode_FromStringAndSize(traceback.B, traceback.lengthB);
+            if(traceback.end) {
+                py_end = PyLong_FromSsize_t(traceback.end);
+            }
+            else {
+                Py_INCREF(Py_None);
+                py_end = Py_None;
+            }
+            if(!py_A || !py_B || !py_end) {
+                Py_XDECREF(py_A);
+                Py_XDECREF(py_B);
+                Py_XDECREF(py_end);
+                goto _cleanup_recover_alignments_fast;
+            }
+            if(reverse)
+                py_traceback = Py_BuildValue("(NNdnN)", py_B, py_A, score,
+                                             begin, py_end);
+            else
+                py_traceback = Py_BuildValue("(NNdnN)", py_A, py_B, score,
+                                             begin, py_end);
+            if(!py_traceback)
+                goto _cleanup_recover_alignments_fast;
+            status = PyList_Append(py_tracebacks, py_traceback);
+            Py_DECREF(py_traceback);
+            if(status < 0)
+                goto _cleanup_recover_alignments_fast;
+            if(one_alignment_only)
+                break;
+        }
+    }
+
+#undef SCORE
+#undef TRACE
+
+    py_retval = py_tracebacks;
+    py_tracebacks = NULL;
+    goto _cleanup_recover_alignments_fast;
+
+ _not_handled:
+    Py_INCREF(Py_None);
+    py_retval = Py_None;
+
+ _cleanup_recover_alignments_fast:
+    _clear_traceback_stack(&stack);
+    if(traceback.A)
+        free(traceback.A);
+    if(traceback.B)
+        free(traceback.B);
+    if(start_scores)
+        free(start_scores);
+    if(start_rows)
+        free(start_rows);
+    if(start_cols)
+        free(start_cols);
+    if(mutated)
+        free(mutated);
+    if(score_view.obj)
+        PyBuffer_Release(&score_view);
+    if(trace_view.obj)
+        PyBuffer_Release(&trace_view);
+    Py_XDECREF(py_starts_fast);
+    Py_XDECREF(py_tracebacks);
+    Py_XDECREF(py_bytesA);
+    Py_XDECREF(py_bytesB);
+    Py_XDECREF(py_bytes_gap);
+    return py_retval;
+}
+
 static PyObject *cpairwise2_rint(PyObject *self, PyObject *args,
                                  PyObject *keywds)
 {
@@ -435,6 +2077,10 @@ static PyObject *cpairwise2_rint(PyObject *self, PyObject *args,
 static PyMethodDef cpairwise2Methods[] = {
     {"_make_score_matrix_fast",
      (PyCFunction)cpairwise2__make_score_matrix_fast, METH_VARARGS, ""},
+    {"_recover_alignments_fast",
+     (PyCFunction)cpairwise2__recover_alignments_fast, METH_VARARGS, ""},
+    {"_score_pairs_fast",
+     (PyCFunction)cpairwise2__score_pairs_fast, METH_VARARGS, ""},
     {"rint", (PyCFunction)cpairwise2_rint, METH_VARARGS|METH_KEYWORDS, ""},
     {NULL, NULL, 0, NULL}
 };
@@ -470,7 +2116,10 @@ initcpairwise2(void)
 
 {
 #if PY_MAJOR_VERSION >= 3
-    PyObject* module = PyModule_Create(&moduledef);
+    PyObject* module;
+    if (PyType_Ready(&MatrixBuffer_Type) < 0) return NULL;
+    if (PyType_Ready(&CompressedTrace_Type) < 0) return NULL;
+    module = PyModule_Create(&moduledef);
     if (module==NULL) return NULL;
     return module;
 #else
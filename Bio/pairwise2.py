@@ -262,15 +262,27 @@ Some examples:
   Self-defined match functions must take the two residues to be compared and
   return a score.
 
+- To score many pairs of sequences with match/mismatch scores and affine gap
+  penalties, use ``score_pairs``, which returns the scores as a NumPy array.
+  With the C extension, the pairs are scored in parallel on several threads:
+
+    >>> pairs = [("ACCGT", "ACG"), ("KEVLA", "EVL"), ("GAACT", "GAT")]
+    >>> scores = pairwise2.score_pairs(pairs, "global", 2, -1, -.5, -.1)
+    >>> print(scores.tolist())
+    [5.0, 5.0, 5.4]
+
 To see a description of the parameters for a function, please look at
 the docstring for the function via the help function, e.g.
 type ``help(pairwise2.align.localds)`` at the Python prompt.
 
 """  # noqa: W291
 
+import os
 import warnings
 from collections import namedtuple
 
+import numpy
+
 from Bio import BiopythonWarning
 from Bio import BiopythonDeprecationWarning
 from Bio.Align import substitution_matrices
@@ -285,6 +297,8 @@ warnings.warn(
 
 
 MAX_ALIGNMENTS = 1000  # maximum alignments recovered in traceback
+# minimum number of cells for compressing the trace matrix in C
+COMPRESS_TRACE_MIN_CELLS = 1000000
 
 
 class align:
@@ -515,6 +529,89 @@ where the alignment occurs.
 align = align()
 
 
+def score_pairs(
+    pairs,
+    mode="global",
+    match=1,
+    mismatch=0,
+    open=0,
+    extend=0,
+    penalize_extend_when_opening=False,
+    penalize_end_gaps=None,
+    threads=None,
+):
+    """Return the alignment scores of many pairs of sequences as an array.
+
+    This is equivalent to calling ``align.globalms`` (or ``align.localms`` if
+    mode is "local") with ``score_only=True`` for each pair in pairs, which
+    should be an iterable of (sequenceA, sequenceB) tuples.  If the C
+    extension is available, the pairs of strings are scored in parallel
+    using the given number of threads (by default, the number of CPUs).
+    """
+    if mode not in ("global", "local"):
+        raise ValueError(f"mode should be 'global' or 'local', not {mode!r}")
+    align_globally = mode == "global"
+    if penalize_end_gaps is None:
+        penalize_end_gaps = align_globally
+    try:
+        n = len(penalize_end_gaps)
+    except TypeError:
+        penalize_end_gaps = (penalize_end_gaps, penalize_end_gaps)
+    else:
+        assert n == 2
+    penalize_end_gaps = tuple(penalize_end_gaps)
+    gap_fn = affine_penalty(open, extend, penalize_extend_when_opening)
+    sequencesA = []
+    sequencesB = []
+    for sequenceA, sequenceB in pairs:
+        if not sequenceA or not sequenceB:
+            raise ValueError("sequences should not be empty")
+        if not isinstance(sequenceA, list):
+            sequenceA = str(sequenceA)
+        if not isinstance(sequenceB, list):
+            sequenceB = str(sequenceB)
+        sequencesA.append(sequenceA)
+        sequencesB.append(sequenceB)
+    if threads is None:
+        threads = os.cpu_count() or 1
+    scores = None
+    if _score_pairs_fast is not None:
+        scores = _score_pairs_fast(
+            sequencesA,
+            sequencesB,
+            match,
+            mismatch,
+            open,
+            extend,
+            open,
+            extend,
+            penalize_extend_when_opening,
+            penalize_end_gaps,
+            align_globally,
+            threads,
+        )
+    if scores is None:
+        match_fn = identity_match(match, mismatch)
+        scores = [
+            _align(
+                sequenceA,
+                sequenceB,
+                match_fn,
+                gap_fn,
+                gap_fn,
+                penalize_extend_when_opening,
+                penalize_end_gaps,
+                align_globally,
+                ["-"] if isinstance(sequenceA, list) else "-",
+                False,
+                True,
+                False,
+            )
+            for sequenceA, sequenceB in zip(sequencesA, sequencesB)
+        ]
+    return numpy.array(scores, float)
+
+
 def _align(
     sequenceA,
     sequenceB,
@@ -564,7 +661,16 @@ def _align(
     ):
         open_A, extend_A = gap_A_fn.open, gap_A_fn.extend
         open_B, extend_B = gap_B_fn.open, gap_B_fn.extend
-        matrices = _make_score_matrix_fast(
+        # Compress the trace matrix of large alignments that can be
+        # recovered in C.
+        compress_trace = (
+            not score_only
+            and _recover_alignments_fast is not None
+            and isinstance(sequenceA, str)
+            and isinstance(sequenceB, str)
+            and len(sequenceA) * len(sequenceB) >= COMPRESS_TRACE_MIN_CELLS
+        )
+        score_matrix, trace_matrix, best_score = _make_score_matrix_fast(
             sequenceA,
             sequenceB,
             match_fn,
@@ -576,9 +682,17 @@ def _align(
             penalize_end_gaps,
             align_globally,
             score_only,
+            True,
+            compress_trace,
         )
+        if not score_only:
+            # The matrices are returned as buffers; view them as NumPy arrays
+            # without copying.
+            score_matrix = numpy.asarray(score_matrix)
+            if not compress_trace:
+                trace_matrix = numpy.asarray(trace_matrix)
     else:
-        matrices = _make_score_matrix_generic(
+        score_matrix, trace_matrix, best_score = _make_score_matrix_generic(
             sequenceA,
             sequenceB,
             match_fn,
@@ -589,15 +703,13 @@ def _align(
             score_only,
         )
 
-    score_matrix, trace_matrix, best_score = matrices
-
-    # print("SCORE %s" % print_matrix(score_matrix))
-    # print("TRACEBACK %s" % print_matrix(trace_matrix))
-
     # If they only want the score, then return it.
     if score_only:
         return best_score
 
+    # print("SCORE %s" % print_matrix(score_matrix))
+    # print("TRACEBACK %s" % print_matrix(trace_matrix))
+
     starts = _find_start(score_matrix, best_score, align_globally)
 
     # Recover the alignments and return them.
@@ -616,6 +728,8 @@ def _align(
     )
     if not alignments:
         # This may happen, see recover_alignments for explanation
+        if hasattr(trace_matrix, "decompress"):
+            trace_matrix = numpy.asarray(trace_matrix.decompress())
         score_matrix, trace_matrix = _reverse_matrices(score_matrix, trace_matrix)
         starts = [(z, (y, x)) for z, (x, y) in starts]
         alignments = _recover_alignments(
@@ -762,6 +876,8 @@ def _make_score_matrix_fast(
     penalize_end_gaps,
     align_globally,
     score_only,
+    as_buffers=False,
+    compress_trace=False,
 ):
     """Generate a score and traceback matrix according to Gotoh (PRIVATE).
 
@@ -773,6 +889,18 @@ def _make_score_matrix_fast(
     which holds the best scores, and store only those values from the
     other matrices that are actually used for the next step of calculation.
     The traceback matrix holds the positions for backtracing the alignment.
+
+    If as_buffers is True, the score and traceback matrices are returned as
+    two-dimensional float64 and uint8 arrays instead of nested lists. The C
+    implementation then returns objects owning the memory of the matrices
+    (supporting the buffer protocol), without copying them. If in addition
+    compress_trace is True, the C implementation returns the traceback matrix
+    in compressed form, which can be read by the C traceback (the Python
+    implementation ignores compress_trace). Each row is then divided into
+    blocks of 256 cells; each block stores its distinct traces (its palette)
+    and, for each cell, the index of its trace in the palette, packed into
+    as few bits as needed (none if all cells in the block have the same
+    trace).
     """
     first_A_gap = calc_affine_penalty(1, open_A, extend_A, penalize_extend_when_opening)
     first_B_gap = calc_affine_penalty(1, open_B, extend_B, penalize_extend_when_opening)
@@ -896,6 +1024,12 @@ def _make_score_matrix_fast(
     if not align_globally:
         best_score = local_max_score
 
+    if as_buffers and not score_only:
+        score_matrix = numpy.array(score_matrix, numpy.float64)
+        trace_matrix = numpy.array(
+            [[trace or 0 for trace in row] for row in trace_matrix], numpy.uint8
+        )
+
     return score_matrix, trace_matrix, best_score
 
 
@@ -927,7 +1061,42 @@ def _recover_alignments(
     sequenceA[row] is a string.  Thus, avoid using indexes and use
     slices, e.g. sequenceA[row:row+1].  Assume that client-defined
     sequence classes preserve these semantics.
+
+    If the C extension is available, the matrices are NumPy arrays, the
+    sequences are ASCII strings, and the gap penalties are affine, the
+    traceback is done in C by _recover_alignments_fast. Only the C traceback
+    can read a compressed trace matrix directly.
     """
+    compressed = hasattr(trace_matrix, "decompress")
+    if (
+        _recover_alignments_fast is not None
+        and (compressed or isinstance(trace_matrix, numpy.ndarray))
+        and isinstance(gap_A_fn, affine_penalty)
+        and isinstance(gap_B_fn, affine_penalty)
+    ):
+        tracebacks = _recover_alignments_fast(
+            sequenceA,
+            sequenceB,
+            starts,
+            best_score,
+            score_matrix,
+            trace_matrix,
+            align_globally,
+            gap_char,
+            one_alignment_only,
+            gap_A_fn.open,
+            gap_A_fn.extend,
+            gap_A_fn.penalize_extend_when_opening,
+            gap_B_fn.open,
+            gap_B_fn.extend,
+            gap_B_fn.penalize_extend_when_opening,
+            reverse,
+            MAX_ALIGNMENTS,
+        )
+        if tracebacks is not None:
+            return _clean_alignments(tracebacks)
+    if compressed:
+        trace_matrix = numpy.asarray(trace_matrix.decompress())
     lenA, lenB = len(sequenceA), len(sequenceB)
     ali_seqA, ali_seqB = sequenceA[0:0], sequenceB[0:0]
     tracebacks = []
@@ -1109,6 +1278,15 @@ def _find_start(score_matrix, best_score, align_globally):
     # the bottom right corner of the matrix.
     if align_globally:
         starts = [(best_score, (nrows - 1, ncols - 1))]
+    elif isinstance(score_matrix, numpy.ndarray):
+        # Same as below, but using NumPy to scan the matrix.
+        indices = numpy.argwhere(
+            abs(score_matrix - best_score) * _PRECISION + 0.5 < 1
+        )
+        starts = [
+            (float(score_matrix[row, col]), (int(row), int(col)))
+            for row, col in indices
+        ]
     else:
         # For local alignments, there may be many different start points.
         starts = []
@@ -1125,6 +1303,15 @@ def _find_start(score_matrix, best_score, align_globally):
 
 def _reverse_matrices(score_matrix, trace_matrix):
     """Reverse score and trace matrices (PRIVATE)."""
+    if isinstance(score_matrix, numpy.ndarray):
+        # fmt: off
+        reverse_trace = numpy.array(
+            [0, 4, 2, 6, 1, 5, 3, 7, 16, 20, 18, 22, 17, 21, 19, 23,
+             8, 12, 10, 14, 9, 13, 11, 15, 24, 28, 26, 30, 25, 29, 27, 31],
+            numpy.uint8,
+        )
+        # fmt: on
+        return score_matrix.T.copy(), reverse_trace[trace_matrix].T.copy()
     reverse_score_matrix = []
     reverse_trace_matrix = []
     # fmt: off
@@ -1424,9 +1611,13 @@ def format_alignment(align1, align2, score, begin, end, full_sequences=False):
 
 _python_make_score_matrix_fast = _make_score_matrix_fast
 _python_rint = rint
+_recover_alignments_fast = None
+_score_pairs_fast = None
 
 try:
     from .cpairwise2 import rint, _make_score_matrix_fast  # noqa
+    from .cpairwise2 import _recover_alignments_fast  # noqa
+    from .cpairwise2 import _score_pairs_fast  # noqa
 except ImportError:
     warnings.warn(
         "Import of C module failed. Falling back to pure Python "
@@ -0,0 +1,341 @@
+#!/usr/bin/env python
+# This code is part of the Biopython distribution and governed by its
+# license.  Please see the LICENSE file that should have been included
+# as part of this package.
+
+"""Compare the C and Python implementations of Bio.pairwise2.
+
+This script first checks that the C extension and the pure Python fallback
+functions calculate the same score and trace matrices and find the same
+alignments, for each scoring mode (xx, mx, ms, ds, dd), for global and local
+alignments, and for each setting of penalize_end_gaps.  It then times the
+alignments of random sequences of increasing length, and reports the number
+of cells of the dynamic programming matrix calculated per second and the
+peak memory (resident set size) used by each alignment.
+
+Each timing is done in a separate process, so that the peak memory of one
+alignment does not affect the next.  For example::
+
+    python pairwise2_performance.py --lengths 100,1000,3000 --modes ms,ds
+
+The (slow) pure Python implementations are only timed up to the length
+given by --max-python-length.
+"""
+
+import argparse
+import multiprocessing
+import random
+import sys
+import time
+import warnings
+
+from Bio import BiopythonDeprecationWarning
+
+with warnings.catch_warnings():
+    warnings.simplefilter("ignore", BiopythonDeprecationWarning)
+    from Bio import pairwise2
+from Bio.Align import substitution_matrices
+
+try:
+    import resource
+except ImportError:  # e.g. on Windows
+    resource = None
+
+
+MODES = ("xx", "mx", "ms", "ds", "dd")
+BACKENDS = ("C", "Python", "generic")
+
+blosum62 = substitution_matrices.load("BLOSUM62")
+
+
+def get_arguments(mode):
+    """Return the scoring arguments for an alignment function."""
+    match_args = {
+        "x": (),
+        "m": (2, -1),
+        "d": (blosum62,),
+    }[mode[0]]
+    gap_args = {
+        "x": (),
+        "s": (-2, -0.5),
+        "d": (-10, -0.5, -8, -1),
+    }[mode[1]]
+    return match_args + gap_args
+
+
+def get_alphabet(mode):
+    """Return the letters used for random sequences."""
+    if mode[0] == "d":
+        return "ARNDCQEGHILKMFPSTWYV"
+    return "ACGT"
+
+
+def create_pair(length, alphabet, rng, identity=0.9):
+    """Return a random sequence and a mutated copy of it."""
+    seqA = "".join(rng.choice(alphabet) for i in range(length))
+    seqB = []
+    for letter in seqA:
+        r = rng.random()
+        if r < identity:
+            seqB.append(letter)
+        elif r < (1 + identity) / 2:
+            seqB.append(rng.choice(alphabet))
+        elif r < (3 + identity) / 4:
+            seqB.append(letter + rng.choice(alphabet))
+        # else: deletion
+    return seqA, "".join(seqB)
+
+
+def use_backend(backend):
+    """Switch pairwise2 to the C or to the pure Python implementation."""
+    if backend == "C":
+        if pairwise2.rint is pairwise2._python_rint:
+            raise RuntimeError("the C extension of pairwise2 is not available")
+        return
+    pairwise2._make_score_matrix_fast = pairwise2._python_make_score_matrix_fast
+    pairwise2.rint = pairwise2._python_rint
+    pairwise2._recover_alignments_fast = None
+    pairwise2._score_pairs_fast = None
+
+
+def align(backend, function, seqA, seqB, args, **kwargs):
+    """Align two sequences with the given pairwise2 function name."""
+    if backend == "generic":
+        kwargs["force_generic"] = True
+    return getattr(pairwise2.align, function)(seqA, seqB, *args, **kwargs)
+
+
+def compare_matrices(seqA, seqB, mode, align_globally, penalize_end_gaps):
+    """Count the cells in which the C and Python matrices differ."""
+    if mode[1] == "d":
+        open_A, extend_A, open_B, extend_B = get_arguments(mode)[-4:]
+    elif mode[1] == "s":
+        open_A, extend_A = open_B, extend_B = get_arguments(mode)[-2:]
+    else:
+        open_A = extend_A = open_B = extend_B = 0
+    if mode[0] == "x":
+        match_fn = pairwise2.identity_match()
+    elif mode[0] == "m":
+        match_fn = pairwise2.identity_match(*get_arguments(mode)[:2])
+    else:
+        match_fn = pairwise2.dictionary_match(blosum62)
+    args = (seqA, seqB, match_fn, open_A, extend_A, open_B, extend_B)
+    args += (False, penalize_end_gaps, align_globally, False)
+    c_scores, c_traces, c_best = pairwise2._make_score_matrix_fast(*args)
+    py_scores, py_traces, py_best = pairwise2._python_make_score_matrix_fast(*args)
+    differences = 0
+    for c_row, py_row in zip(c_scores, py_scores):
+        for c_score, py_score in zip(c_row, py_row):
+            if abs(c_score - py_score) > 1e-6:
+                differences += 1
+    for c_row, py_row in zip(c_traces, py_traces):
+        for c_trace, py_trace in zip(c_row, py_row):
+            if c_trace != py_trace:
+                differences += 1
+    if abs(c_best - py_best) > 1e-6:
+        differences += 1
+    return differences
+
+
+def normalize(alignments):
+    """Return alignments in a form that can be compared."""
+    return sorted(
+        (a.seqA, a.seqB, round(a.score, 6), a.start, a.end) for a in alignments
+    )
+
+
+def check_equivalence(modes, ntests, length, seed):
+    """Check that all implementations give the same results."""
+    rng = random.Random(seed)
+    failures = 0
+    print("Checking the equivalence of the C and Python implementations")
+    for mode in modes:
+        args = get_arguments(mode)
+        for align_type in ("global", "local"):
+            function = align_type + mode
+            align_globally = align_type == "global"
+            if align_globally:
+                end_gap_settings = [(True, True), (False, False), (True, False)]
+            else:
+                end_gap_settings = [(False, False)]
+            for penalize_end_gaps in end_gap_settings:
+                differences = 0
+                for i in range(ntests):
+                    seqA, seqB = create_pair(
+                        rng.randint(1, length), get_alphabet(mode), rng
+                    )
+                    if not seqB:
+                        continue
+                    differences += compare_matrices(
+                        seqA, seqB, mode, align_globally, penalize_end_gaps
+                    )
+                    results = []
+                    for backend in BACKENDS:
+                        saved = (
+                            pairwise2._make_score_matrix_fast,
+                            pairwise2.rint,
+                            pairwise2._recover_alignments_fast,
+                            pairwise2._score_pairs_fast,
+                        )
+                        try:
+                            use_backend(backend)
+                            with warnings.catch_warnings():
+                                warnings.simplefilter("ignore")
+                                results.append(
+                                    normalize(
+                                        align(
+                                            backend,
+                                            function,
+                                            seqA,
+                                            seqB,
+                                            args,
+                                            penalize_end_gaps=penalize_end_gaps,
+                                        )
+                                    )
+                                )
+                        finally:
+                            (
+                                pairwise2._make_score_matrix_fast,
+                                pairwise2.rint,
+                                pairwise2._recover_alignments_fast,
+                                pairwise2._score_pairs_fast,
+                            ) = saved
+                    # The generic implementation does not distinguish
+                    # between opening and extending gaps, which may give
+                    # additional alignments; compare the scores only.
+                    if results[0] != results[1]:
+                        differences += 1
+                    if results[0] and results[2]:
+                        if results[0][0][2] != results[2][0][2]:
+                            differences += 1
+                status = "ok" if differences == 0 else f"{differences} differences"
+                print(f"  {function} penalize_end_gaps={penalize_end_gaps}: {status}")
+                if differences:
+                    failures += 1
+    return failures
+
+
+def run_timing(backend, function, length, seed, queue):
+    """Time a single alignment and report it through the queue."""
+    rng = random.Random(seed)
+    mode = function[-2:]
+    seqA, seqB = create_pair(length, get_alphabet(mode), rng)
+    use_backend(backend)
+    if resource is not None:
+        baseline = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+    start = time.perf_counter()
+    with warnings.catch_warnings():
+        warnings.simplefilter("ignore")
+        alignments = align(
+            backend, function, seqA, seqB, get_arguments(mode), one_alignment_only=True
+        )
+    elapsed = time.perf_counter() - start
+    if resource is None:
+        peak = None
+    else:
+        peak = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss - baseline
+        if sys.platform != "darwin":
+            peak *= 1024  # ru_maxrss is in kilobytes on Linux
+    score = alignments[0].score if alignments else None
+    queue.put(((len(seqA) + 1) * (len(seqB) + 1), elapsed, peak, score))
+
+
+def time_alignments(modes, lengths, backends, max_python_length, seed):
+    """Print a table of the time and memory used by each alignment."""
+    print()
+    print(
+        f"{'function':10s} {'backend':8s} {'length':>7s} {'seconds':>9s} "
+        f"{'cells/s':>10s} {'peak RSS (MB)':>14s} {'score':>10s}"
+    )
+    context = multiprocessing.get_context("spawn")
+    for mode in modes:
+        for align_type in ("global", "local"):
+            function = align_type + mode
+            for length in lengths:
+                for backend in backends:
+                    if backend == "generic" and length > max_python_length // 4:
+                        continue
+                    if backend == "Python" and length > max_python_length:
+                        continue
+                    queue = context.Queue()
+                    process = context.Process(
+                        target=run_timing,
+                        args=(backend, function, length, seed, queue),
+                    )
+                    process.start()
+                    cells, elapsed, peak, score = queue.get()
+                    process.join()
+                    peak = "n/a" if peak is None else f"{peak / 1e6:.1f}"
+                    print(
+                        f"{function:10s} {backend:8s} {length:7d} {elapsed:9.3f} "
+                        f"{cells / elapsed:10.3g} {peak:>14s} {score!s:>10s}"
+                    )
+
+
+def main(argv=None):
+    """Run the equivalence checks and the timings."""
+    parser = argparse.ArgumentParser(
+        description="Compare the C and Python implementations of Bio.pairwise2."
+    )
+    parser.add_argument(
+        "--lengths",
+        default="100,300,1000,3000",
+        help="comma-separated sequence lengths to time (default: %(default)s)",
+    )
+    parser.add_argument(
+        "--modes",
+        default=",".join(MODES),
+        help="comma-separated scoring modes (default: %(default)s)",
+    )
+    parser.add_argument(
+        "--backends",
+        default=",".join(BACKENDS),
+        help="comma-separated implementations to time (default: %(default)s)",
+    )
+    parser.add_argument(
+        "--max-python-length",
+        type=int,
+        default=300,
+        help="longest sequence aligned in pure Python (default: %(default)s)",
+    )
+    parser.add_argument(
+        "--tests",
+        type=int,
+        default=20,
+        help="number of random equivalence tests per setting (default: %(default)s)",
+    )
+    parser.add_argument(
+        "--test-length",
+        type=int,
+        default=30,
+        help="maximum sequence length in equivalence tests (default: %(default)s)",
+    )
+    parser.add_argument("--seed", type=int, default=0, help="random seed")
+    parser.add_argument(
+        "--no-check", action="store_true", help="skip the equivalence checks"
+    )
+    parser.add_argument("--no-timing", action="store_true", help="skip the timings")
+    options = parser.parse_args(argv)
+    modes = options.modes.split(",")
+    for mode in modes:
+        if mode not in MODES:
+            parser.error(f"unknown mode {mode!r}")
+    backends = options.backends.split(",")
+    for backend in backends:
+        if backend not in BACKENDS:
+            parser.error(f"unknown backend {backend!r}")
+    lengths = [int(length) for length in options.lengths.split(",")]
+    failures = 0
+    if not options.no_check:
+        failures = check_equivalence(
+            modes, options.tests, options.test_length, options.seed
+        )
+    if not options.no_timing:
+        time_alignments(
+            modes, lengths, backends, options.max_python_length, options.seed
+        )
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
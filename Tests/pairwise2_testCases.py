@@ -12,6 +12,7 @@ with or without complementing C extensions.
 
 """
 
+import random
 import unittest
 import warnings
 
@@ -304,6 +305,83 @@ class TestScoreOnly(unittest.TestCase):
         )
         self.assertEqual(aligns1[0][2], aligns2)
 
+    def test_score_only_end_gaps(self):
+        """Test ``score_only`` with (un)penalized end gaps."""
+        for penalize_end_gaps in [(True, True), (False, True), (True, False)]:
+            for penalize_extend_when_opening in [True, False]:
+                kwargs = {
+                    "penalize_end_gaps": penalize_end_gaps,
+                    "penalize_extend_when_opening": penalize_extend_when_opening,
+                }
+                aligns = pairwise2.align.globalms(
+                    "TTGACCTA", "ACCGTAG", 2, -1, -2, -0.5, **kwargs
+                )
+                score = pairwise2.align.globalms(
+                    "TTGACCTA", "ACCGTAG", 2, -1, -2, -0.5, score_only=True, **kwargs
+                )
+                self.assertEqual(aligns[0][2], score)
+
+
+class TestScorePairs(unittest.TestCase):
+    """Test scoring many pairs of sequences with ``score_pairs``."""
+
+    pairs = [
+        ("GAACT", "GAT"),
+        ("xxxABCDxxx", "zzzABzzCDz"),
+        ("TTGACCTA", "ACCGTAG"),
+        ("A", "T"),
+    ]
+
+    def test_score_pairs_global(self):
+        """Test ``score_pairs`` with global alignments."""
+        for threads in [1, 3]:
+            scores = pairwise2.score_pairs(
+                self.pairs, "global", 2, -1, -2, -0.5, threads=threads
+            )
+            self.assertEqual(len(scores), 4)
+            for (sequenceA, sequenceB), score in zip(self.pairs, scores):
+                self.assertAlmostEqual(
+                    score,
+                    pairwise2.align.globalms(
+                        sequenceA, sequenceB, 2, -1, -2, -0.5, score_only=True
+                    ),
+                )
+
+    def test_score_pairs_local(self):
+        """Test ``score_pairs`` with local alignments."""
+        scores = pairwise2.score_pairs(
+            self.pairs, "local", 1, -0.5, -3, -1, penalize_extend_when_opening=True
+        )
+        for (sequenceA, sequenceB), score in zip(self.pairs, scores):
+            self.assertAlmostEqual(
+                score,
+                pairwise2.align.localms(
+                    sequenceA,
+                    sequenceB,
+                    1,
+                    -0.5,
+                    -3,
+                    -1,
+                    penalize_extend_when_opening=True,
+                    score_only=True,
+                ),
+            )
+
+    def test_score_pairs_lists(self):
+        """Test ``score_pairs`` with sequences as lists."""
+        scores = pairwise2.score_pairs([(["GA", "A", "T"], ["GA", "T"])])
+        self.assertEqual(list(scores), [2.0])
+
+    def test_score_pairs_errors(self):
+        """Test ``score_pairs`` with invalid input."""
+        self.assertEqual(len(pairwise2.score_pairs([])), 0)
+        with self.assertRaises(ValueError):
+            pairwise2.score_pairs([("ACGT", "")])
+        with self.assertRaises(ValueError):
+            pairwise2.score_pairs(self.pairs, "semiglobal")
+        with self.assertRaises(ValueError):
+            pairwise2.score_pairs(self.pairs, open=1)
+
 
 class TestPairwiseOpenPenalty(unittest.TestCase):
     """Alignments with gap-open penalty."""
@@ -705,6 +783,27 @@ AT-T
 """,
         )
 
+    def test_match_dictionary_asymmetric(self):
+        """Test a non-symmetric match dictionary."""
+        match_dict = {("A", "A"): 1, ("T", "T"): 1, ("A", "T"): -1, ("T", "A"): -3}
+        match_fn = pairwise2.dictionary_match(match_dict, symmetric=0)
+        score = pairwise2.align.globalcs("A", "T", match_fn, -5, 0, score_only=True)
+        self.assertEqual(score, -1)
+        score = pairwise2.align.globalcs("T", "A", match_fn, -5, 0, score_only=True)
+        self.assertEqual(score, -3)
+        del match_dict[("T", "A")]
+        match_fn = pairwise2.dictionary_match(match_dict, symmetric=0)
+        with self.assertRaises(KeyError):
+            pairwise2.align.globalcs("T", "A", match_fn, -5, 0, score_only=True)
+        match_fn = pairwise2.dictionary_match(match_dict, symmetric=1)
+        score = pairwise2.align.globalcs("T", "A", match_fn, -5, 0, score_only=True)
+        self.assertEqual(score, -1)
+
+    def test_match_dictionary_missing_pair(self):
+        """Test a pair of letters that is missing from the dictionary."""
+        with self.assertRaises(KeyError):
+            pairwise2.align.globalds("ATG", "ATT", self.match_dict, -1, 0)
+
 
 class TestPairwiseOneCharacter(unittest.TestCase):
     """Alignments where one sequence has length 1."""
@@ -891,6 +990,149 @@ class TestOtherFunctions(unittest.TestCase):
         """One possible start position in local alignment is not a match."""
         self.assertEqual(len(pairwise2.align.localxx("AC", "GA")), 1)
 
+    def test_recover_alignments_fast(self):
+        """The C traceback gives the same alignments as the Python one."""
+        recover_alignments_fast = pairwise2._recover_alignments_fast
+        if recover_alignments_fast is None:
+            self.skipTest("C traceback not available")
+        cases = [
+            ("globalxx", "GAACTGAT", "GATACT", ()),
+            ("localxx", "ACAACA", "CAAC", ()),
+            ("globalms", "GAACTTGAT", "GATTAAC", (2, -1, -3, -0.5)),
+            ("localms", "GAACTTGAT", "GATTAAC", (2, -1, -3, -0.5)),
+            ("globalmd", "AAACAAA", "AAAGAAA", (1, -1, -2, -1, -1, -0.5)),
+        ]
+        for function, seqA, seqB, args in cases:
+            alignments = getattr(pairwise2.align, function)(seqA, seqB, *args)
+            try:
+                pairwise2._recover_alignments_fast = None
+                expected = getattr(pairwise2.align, function)(seqA, seqB, *args)
+            finally:
+                pairwise2._recover_alignments_fast = recover_alignments_fast
+            self.assertEqual(alignments, expected)
+
+    def test_compressed_trace(self):
+        """The compressed trace matrix gives the same alignments."""
+        if pairwise2._recover_alignments_fast is None:
+            self.skipTest("C traceback not available")
+        rng = random.Random(5)
+        seqA = "".join(rng.choice("ACGT") for i in range(400))
+        seqB = seqA[:100] + "T" + seqA[100:250] + seqA[260:]
+        args = (seqA, seqB, pairwise2.identity_match(2, -1))
+        args += (-3, -0.5, -3, -0.5, False, (True, True), True, False, True)
+        trace_matrix = pairwise2._make_score_matrix_fast(*args)[1]
+        compressed = pairwise2._make_score_matrix_fast(*args, True)[1]
+        self.assertEqual(compressed.shape, (len(seqA) + 1, len(seqB) + 1))
+        self.assertLess(compressed.nbytes, (len(seqA) + 1) * (len(seqB) + 1) / 2)
+        self.assertEqual(bytes(compressed.decompress()), bytes(trace_matrix))
+        cases = [
+            ("globalms", seqA, seqB, (2, -1, -3, -0.5)),
+            ("localms", seqA[:100], seqB[50:150], (2, -1, -3, -0.5)),
+            ("localxx", "ACAACA" * 5, "CAAC" * 5, ()),
+            ("globalmd", "AAACAAA" * 3, "AAAGAAA" * 3, (1, -1, -2, -1, -1, -0.5)),
+        ]
+        min_cells = pairwise2.COMPRESS_TRACE_MIN_CELLS
+        for function, seqA, seqB, args in cases:
+            expected = getattr(pairwise2.align, function)(seqA, seqB, *args)
+            try:
+                pairwise2.COMPRESS_TRACE_MIN_CELLS = 0
+                alignments = getattr(pairwise2.align, function)(seqA, seqB, *args)
+            finally:
+                pairwise2.COMPRESS_TRACE_MIN_CELLS = min_cells
+            self.assertEqual(alignments, expected)
+
+    def test_fixed_point_scores(self):
+        """The C and Python score and trace matrices are the same."""
+        make_score_matrix_fast = pairwise2._make_score_matrix_fast
+        python_make_score_matrix_fast = pairwise2._python_make_score_matrix_fast
+        if make_score_matrix_fast is python_make_score_matrix_fast:
+            self.skipTest("C extension not available")
+        # Multiples of 1/8 are calculated in integer arithmetic in C; other
+        # scores are calculated in floating point, as in Python.
+        cases = [
+            ("GAACACA", "GGTGTGC", 1.5, -1, -0.5, -0.25),
+            ("GAACACA", "GGTGTGC", 1.5, -1, -0.5, -0.1),
+            ("GAACACA", "GGTGTGC", 1.5, -1, -0.5, -0.0001),
+            ("CCGTT", "CGAGAAGCGCTC", 1, 0, -0.5, -0.1),
+        ]
+        for seqA, seqB, match, mismatch, open_, extend in cases:
+            for align_globally in (True, False):
+                for penalize_end_gaps in ((True, True), (False, False)):
+                    args = (seqA, seqB, pairwise2.identity_match(match, mismatch))
+                    args += (open_, extend, open_, extend, False)
+                    args += (penalize_end_gaps, align_globally, False)
+                    scores, traces, score = make_score_matrix_fast(*args)
+                    expected = python_make_score_matrix_fast(*args)
+                    self.assertEqual(scores, expected[0])
+                    self.assertEqual(traces[1:], expected[1][1:])
+                    self.assertEqual(score, expected[2])
+
+    def test_local_fractional_gap_penalties(self):
+        """C and Python find the same local alignments with gaps of -0.1."""
+        if pairwise2._recover_alignments_fast is None:
+            self.skipTest("C extension not available")
+        saved = (
+            pairwise2._make_score_matrix_fast,
+            pairwise2.rint,
+            pairwise2._recover_alignments_fast,
+        )
+        cases = [
+            ("localxs", "CCGTT", "CGAGAAGCGCTC", (-0.5, -0.1)),
+            ("localms", "GAACACA", "GGTGTGC", (1.5, -1, -0.5, -0.1)),
+            ("localxs", "AxBx", "zABz", (-0.1, 0)),
+        ]
+        for function, seqA, seqB, args in cases:
+            alignments = getattr(pairwise2.align, function)(seqA, seqB, *args)
+            try:
+                pairwise2._make_score_matrix_fast = (
+                    pairwise2._python_make_score_matrix_fast
+                )
+                pairwise2.rint = pairwise2._python_rint
+                pairwise2._recover_alignments_fast = None
+                expected = getattr(pairwise2.align, function)(seqA, seqB, *args)
+            finally:
+                (
+                    pairwise2._make_score_matrix_fast,
+                    pairwise2.rint,
+                    pairwise2._recover_alignments_fast,
+                ) = saved
+            self.assertEqual(alignments, expected)
+        alignments = pairwise2.align.localxs("CCGTT", "CGAGAAGCGCTC", -0.5, -0.1)
+        self.assertEqual(len(alignments), 2)
+        self.assertEqual(alignments[1].seqA, "C------CGTT-")
+        self.assertEqual(alignments[1].start, 0)
+
+    def test_score_matrix_buffers(self):
+        """Matrices returned as buffers are the same as the nested lists."""
+        import numpy
+
+        args = ("GAACT", "GAT", pairwise2.identity_match(2, -1))
+        args += (-2, -0.5, -2, -0.5, False, (True, True), True, False)
+        score_list, trace_list, best_score = pairwise2._make_score_matrix_fast(*args)
+        matrices = pairwise2._make_score_matrix_fast(*args, True)
+        score_matrix = numpy.asarray(matrices[0])
+        trace_matrix = numpy.asarray(matrices[1])
+        self.assertEqual(score_matrix.dtype, numpy.float64)
+        self.assertEqual(trace_matrix.dtype, numpy.uint8)
+        self.assertEqual(score_matrix.shape, (6, 4))
+        self.assertEqual(trace_matrix.shape, (6, 4))
+        self.assertEqual(score_matrix.tolist(), score_list)
+        # On the edges of the matrix, the trace is None in the nested lists
+        self.assertEqual(
+            trace_matrix.tolist(),
+            [[trace or 0 for trace in row] for row in trace_list],
+        )
+        self.assertEqual(matrices[2], best_score)
+        score_list, trace_list = pairwise2._reverse_matrices(score_list, trace_list)
+        score_matrix, trace_matrix = pairwise2._reverse_matrices(
+            score_matrix, trace_matrix
+        )
+        self.assertEqual(score_matrix.tolist(), score_list)
+        self.assertEqual(
+            trace_matrix.tolist(),
+            [[trace or 0 for trace in row] for row in trace_list],
+        )
+
 
 if __name__ == "__main__":
     if pairwise2.rint != pairwise2._python_rint:
@@ -906,6 +1148,8 @@ if __name__ == "__main__":
     # Now, we switch explicitly to the fallback Python functions:
     pairwise2._make_score_matrix_fast = pairwise2._python_make_score_matrix_fast
     pairwise2.rint = pairwise2._python_rint
+    pairwise2._recover_alignments_fast = None
+    pairwise2._score_pairs_fast = None
 
     runner = unittest.TextTestRunner(verbosity=2)
     unittest.main(testRunner=runner)
@@ -2651,6 +2651,70 @@ class TestCluster(unittest.TestCase):
         self.assertEqual(len(clusterid), len(data))
         self.assertEqual(len(clusterid[0]), 2)
 
+        # The same seed gives the same self-organizing map
+        clusterid1, celldata1 = somcluster(data, mask, nxgrid=4, niter=50, seed=46)
+        clusterid2, celldata2 = somcluster(data, mask, nxgrid=4, niter=50, seed=46)
+        self.assertEqual(clusterid1.tolist(), clusterid2.tolist())
+        self.assertTrue(numpy.array_equal(celldata1, celldata2))
+
+    def test_somcluster_batch(self):
+        if TestCluster.module == "Bio.Cluster":
+            from Bio.Cluster import somcluster
+        elif TestCluster.module == "Pycluster":
+            from Pycluster import somcluster
+
+        # Five well-separated groups, which the batch algorithm should map
+        # onto different cells of the grid
+        rng = numpy.random.default_rng(seed=49)
+        centers = 2 * numpy.eye(5)
+        groups = numpy.repeat(numpy.arange(5), 20)
+        data = centers[groups] + 0.1 * rng.random((100, 5))
+        mask = numpy.ones(data.shape, numpy.int32)
+        mask[7, 1] = 0
+        for dist in ("e", "b", "c"):
+            for m in (None, mask):
+                clusterid, celldata = somcluster(
+                    data,
+                    m,
+                    nxgrid=4,
+                    nygrid=4,
+                    niter=20,
+                    dist=dist,
+                    seed=49,
+                    batch=True,
+                )
+                self.assertEqual(celldata.shape, (4, 4, 5))
+                cells = [{tuple(c) for c in clusterid[groups == g]} for g in range(5)]
+                for g1 in range(5):
+                    for g2 in range(g1):
+                        self.assertFalse(cells[g1] & cells[g2])
+        # The result does not depend on the number of threads
+        for batch in (False, True):
+            clusterid1, celldata1 = somcluster(
+                data, nxgrid=4, nygrid=3, niter=20, seed=1, batch=batch, threads=1
+            )
+            clusterid4, celldata4 = somcluster(
+                data, nxgrid=4, nygrid=3, niter=20, seed=1, batch=batch, threads=4
+            )
+            self.assertEqual(clusterid1.tolist(), clusterid4.tolist())
+            self.assertTrue(numpy.array_equal(celldata1, celldata4))
+        # Clustering the columns of the transposed data gives the same SOM
+        for batch in (False, True):
+            clusterid1, celldata1 = somcluster(
+                data, nxgrid=3, nygrid=2, niter=200, seed=2, batch=batch
+            )
+            clusterid2, celldata2 = somcluster(
+                data.T,
+                transpose=True,
+                nxgrid=3,
+                nygrid=2,
+                niter=200,
+                seed=2,
+                batch=batch,
+            )
+            self.assertEqual(clusterid1.tolist(), clusterid2.tolist())
+            self.assertTrue(numpy.allclose(celldata1, celldata2))
+
     def test_distancematrix_arguments(self):
         # Test if incorrect arguments are caught by the C code
         if TestCluster.module == "Bio.Cluster":
@@ -2907,6 +2971,446 @@ class TestCluster(unittest.TestCase):
         self.assertAlmostEqual(matrix[2][0], 8.61571429, places=3)
         self.assertAlmostEqual(matrix[2][1], 21.24428571, places=3)
 
+    def test_distancematrix_threads(self):
+        if TestCluster.module == "Bio.Cluster":
+            from Bio.Cluster import distancematrix, treecluster
+        elif TestCluster.module == "Pycluster":
+            from Pycluster import distancematrix, treecluster
+
+        # Use enough items to divide the distance matrix into several tiles
+        rng = numpy.random.default_rng(seed=39)
+        data = rng.normal(size=(150, 8))
+        mask = numpy.array(rng.random((150, 8)) > 0.1, numpy.int32)
+        for transpose in (False, True):
+            if transpose:
+                weight = rng.random(150)
+            else:
+                weight = rng.random(8)
+            for dist in "ebcauxsk":
+                matrix1 = distancematrix(
+                    data, mask, weight, transpose, dist=dist, threads=1
+                )
+                matrix4 = distancematrix(
+                    data, mask, weight, transpose, dist=dist, threads=4
+                )
+                self.assertEqual(len(matrix1), len(matrix4))
+                for row1, row4 in zip(matrix1, matrix4):
+                    self.assertTrue(numpy.array_equal(row1, row4))
+            for method in "mac":
+                tree1 = treecluster(
+                    data, mask, weight, transpose, method, dist="c", threads=1
+                )
+                tree4 = treecluster(
+                    data, mask, weight, transpose, method, dist="c", threads=4
+                )
+                self.assertEqual(str(tree1), str(tree4))
+        # With a single missing value, the distances between the other items
+        # are calculated by the blocked kernels, however the distance matrix
+        # is divided into tiles.
+        data = rng.normal(size=(300, 37))
+        mask = numpy.ones((300, 37), numpy.int32)
+        mask[100, 5] = 0
+        for transpose in (False, True):
+            for dist in "ecauxs":
+                matrix1 = distancematrix(data, mask, None, transpose, dist, threads=1)
+                matrix4 = distancematrix(data, mask, None, transpose, dist, threads=4)
+                for row1, row4 in zip(matrix1, matrix4):
+                    self.assertTrue(numpy.array_equal(row1, row4))
+        message = "^threads should be a positive integer$"
+        with self.assertRaisesRegex(ValueError, message):
+            distancematrix(data, threads=0)
+
+    def test_distancematrix_blocked(self):
+        if TestCluster.module == "Bio.Cluster":
+            from Bio.Cluster import clusterdistance, distancematrix
+        elif TestCluster.module == "Pycluster":
+            from Pycluster import clusterdistance, distancematrix
+
+        # Without missing data, the distances are calculated by the blocked
+        # kernels. Adding a column (or row) that is masked out completely
+        # gives the same distances, but calculated pair by pair.
+        rng = numpy.random.default_rng(seed=40)
+        data = rng.normal(size=(70, 9))
+        for transpose in (False, True):
+            if transpose:
+                data2 = numpy.vstack([data, rng.normal(size=(1, 9))])
+                mask2 = numpy.ones(data2.shape, numpy.int32)
+                mask2[-1, :] = 0
+                weight = rng.random(70)
+            else:
+                data2 = numpy.hstack([data, rng.normal(size=(70, 1))])
+                mask2 = numpy.ones(data2.shape, numpy.int32)
+                mask2[:, -1] = 0
+                weight = rng.random(9)
+            weight2 = numpy.append(weight, 1.0)
+            for dist in "ecauxs":
+                matrix = distancematrix(data, None, weight, transpose, dist)
+                matrix2 = distancematrix(data2, mask2, weight2, transpose, dist)
+                for row, row2 in zip(matrix, matrix2):
+                    for value, value2 in zip(row, row2):
+                        self.assertAlmostEqual(value, value2, places=12)
+                index1 = list(range(3))
+                index2 = list(range(3, 8))
+                for method in "sxv":
+                    distance = clusterdistance(
+                        data, None, weight, index1, index2, method, dist, transpose
+                    )
+                    distance2 = clusterdistance(
+                        data2, mask2, weight2, index1, index2, method, dist, transpose
+                    )
+                    self.assertAlmostEqual(distance, distance2, places=12)
+
+    def test_transpose(self):
+        if TestCluster.module == "Bio.Cluster":
+            from Bio.Cluster import distancematrix, kcluster, treecluster
+        elif TestCluster.module == "Pycluster":
+            from Pycluster import distancematrix, kcluster, treecluster
+
+        # Clustering the columns gives the same result as clustering the rows
+        # of the transposed data.
+        rng = numpy.random.default_rng(seed=50)
+        data = rng.normal(size=(7, 150))
+        mask = numpy.array(rng.random((7, 150)) > 0.1, numpy.int32)
+        weight = rng.random(7)
+        for dist in "ecs":
+            matrix1 = distancematrix(data, mask, weight, True, dist, threads=4)
+            matrix2 = distancematrix(data.T, mask.T, weight, False, dist)
+            for row1, row2 in zip(matrix1, matrix2):
+                self.assertTrue(numpy.array_equal(row1, row2))
+            for method in "scm":
+                tree1 = treecluster(data, mask, weight, True, method, dist)
+                tree2 = treecluster(data.T, mask.T, weight, False, method, dist)
+                self.assertEqual(str(tree1), str(tree2))
+            clusterid1, error1, nfound1 = kcluster(
+                data, 4, mask, weight, True, npass=3, dist=dist, seed=50
+            )
+            clusterid2, error2, nfound2 = kcluster(
+                data.T, 4, mask.T, weight, False, npass=3, dist=dist, seed=50
+            )
+            self.assertTrue(numpy.array_equal(clusterid1, clusterid2))
+            self.assertEqual(error1, error2)
+            self.assertEqual(nfound1, nfound2)
+
+    def test_kcluster_initialization(self):
+        if TestCluster.module == "Bio.Cluster":
+            from Bio.Cluster import kcluster
+        elif TestCluster.module == "Pycluster":
+            from Pycluster import kcluster
+
+        # Five well-separated groups, which are found in a single pass if the
+        # initial cluster centers are chosen by k-means++ or k-means||
+        rng = numpy.random.default_rng(seed=48)
+        centers = 20 * numpy.eye(5)
+        groups = numpy.repeat(numpy.arange(5), 20)
+        data = centers[groups] + rng.random((100, 5))
+        mask = numpy.ones(data.shape, numpy.int32)
+        mask[7, 1] = 0
+        for initialization in ("kmeans++", "kmeans||"):
+            for method, dist in (("a", "e"), ("m", "b"), ("a", "c")):
+                for m in (None, mask):
+                    clusterid, error, nfound = kcluster(
+                        data,
+                        5,
+                        m,
+                        npass=1,
+                        method=method,
+                        dist=dist,
+                        seed=48,
+                        initialization=initialization,
+                    )
+                    mapping = dict(zip(groups, clusterid))
+                    self.assertEqual(len(set(mapping.values())), 5)
+                    self.assertEqual([mapping[g] for g in groups], clusterid.tolist())
+            clusterid1, error1, nfound1 = kcluster(
+                data, 8, npass=10, seed=1, threads=1, initialization=initialization
+            )
+            clusterid4, error4, nfound4 = kcluster(
+                data, 8, npass=10, seed=1, threads=4, initialization=initialization
+            )
+            self.assertEqual(clusterid1.tolist(), clusterid4.tolist())
+            self.assertEqual(error1, error4)
+            self.assertEqual(nfound1, nfound4)
+            # More clusters than distinct items
+            clusterid, error, nfound = kcluster(
+                numpy.zeros((10, 2)), 4, initialization=initialization
+            )
+            self.assertEqual(sorted(set(clusterid)), [0, 1, 2, 3])
+            self.assertEqual(error, 0.0)
+        message = "^unknown initialization method 'kmeans' "
+        with self.assertRaisesRegex(ValueError, message):
+            kcluster(data, initialization="kmeans")
+
+    def test_kcluster_bounds(self):
+        if TestCluster.module == "Bio.Cluster":
+            from Bio.Cluster import kcluster
+        elif TestCluster.module == "Pycluster":
+            from Pycluster import kcluster
+
+        # Without missing data, k-means with the Euclidean or city-block
+        # distance uses bounds to skip distance calculations. Adding a column
+        # (or row) that is masked out completely gives the same clustering
+        # solution, but calculated without the bounds.
+        rng = numpy.random.default_rng(seed=47)
+        data = rng.normal(size=(80, 6)) + numpy.repeat(rng.normal(size=(8, 6)), 10, 0)
+        for transpose in (False, True):
+            if transpose:
+                data1 = data.T
+                data2 = numpy.vstack([data1, rng.normal(size=(1, 80))])
+                mask2 = numpy.ones(data2.shape, numpy.int32)
+                mask2[-1, :] = 0
+            else:
+                data1 = data
+                data2 = numpy.hstack([data, rng.normal(size=(80, 1))])
+                mask2 = numpy.ones(data2.shape, numpy.int32)
+                mask2[:, -1] = 0
+            for method in "am":
+                for dist in "eb":
+                    clusterid1, error1, nfound1 = kcluster(
+                        data1,
+                        8,
+                        transpose=transpose,
+                        npass=5,
+                        method=method,
+                        dist=dist,
+                        seed=47,
+                    )
+                    clusterid2, error2, nfound2 = kcluster(
+                        data2,
+                        8,
+                        mask2,
+                        transpose=transpose,
+                        npass=5,
+                        method=method,
+                        dist=dist,
+                        seed=47,
+                    )
+                    self.assertEqual(clusterid1.tolist(), clusterid2.tolist())
+                    self.assertAlmostEqual(error1, error2, places=12)
+                    self.assertEqual(nfound1, nfound2)
+
+    def test_distancematrix_kendall(self):
+        if TestCluster.module == "Bio.Cluster":
+            from Bio.Cluster import distancematrix
+        elif TestCluster.module == "Pycluster":
+            from Pycluster import distancematrix
+
+        # Long vectors with many ties use the O(n log n) algorithm; compare
+        # to Kendall's tau calculated directly from all pairs.
+        rng = numpy.random.default_rng(seed=42)
+        data = numpy.array(rng.integers(0, 5, size=(4, 60)), float)
+        mask = numpy.array(rng.random((4, 60)) > 0.1, numpy.int32)
+        weight = rng.random(60)
+        matrix = distancematrix(data, mask, weight, dist="k")
+        for i in range(4):
+            for j in range(i):
+                con = dis = exx = exy = 0.0
+                for k in range(60):
+                    for l in range(k):
+                        if not (mask[i, k] and mask[j, k]):
+                            continue
+                        if not (mask[i, l] and mask[j, l]):
+                            continue
+                        w = weight[k] * weight[l]
+                        dx = data[i, k] - data[i, l]
+                        dy = data[j, k] - data[j, l]
+                        if dx * dy > 0:
+                            con += w
+                        elif dx * dy < 0:
+                            dis += w
+                        elif dx == 0 and dy != 0:
+                            exx += w
+                        elif dx != 0 and dy == 0:
+                            exy += w
+                tau = (con - dis) / numpy.sqrt((con + dis + exx) * (con + dis + exy))
+                self.assertAlmostEqual(matrix[i][j], 1.0 - tau, places=12)
+
+    def test_treecluster_ties(self):
+        if TestCluster.module == "Bio.Cluster":
+            from Bio.Cluster import treecluster
+        elif TestCluster.module == "Pycluster":
+            from Pycluster import treecluster
+
+        def join(distances, method):
+            # Join the closest pair found by scanning the full distance matrix
+            n = len(distances)
+            d = [list(row[:i]) for i, row in enumerate(distances)]
+            clusterid = list(range(n))
+            number = [1] * n
+            nodes = []
+            for size in range(n, 1, -1):
+                distance, is_, js = d[1][0], 1, 0
+                for i in range(1, size):
+                    for j in range(i):
+                        if d[i][j] < distance:
+                            distance, is_, js = d[i][j], i, j
+                for j in range(size):
+                    if j == is_ or j == js:
+                        continue
+                    d1 = d[max(is_, j)][min(is_, j)]
+                    d2 = d[max(js, j)][min(js, j)]
+                    if method == "m":
+                        value = max(d1, d2)
+                    else:
+                        value = d1 * number[is_] + d2 * number[js]
+                        value /= number[is_] + number[js]
+                    d[max(js, j)][min(js, j)] = value
+                for j in range(size - 1):
+                    if j != is_:
+                        d[max(is_, j)][min(is_, j)] = d[size - 1][j]
+                nodes.append((clusterid[is_], clusterid[js], distance))
+                number[js] += number[is_]
+                number[is_] = number[size - 1]
+                clusterid[js] = size - n - 1
+                clusterid[is_] = clusterid[size - 1]
+            return nodes
+
+        # Many distances are equal, so the order in which ties are resolved
+        # must be the same as for a scan of the full distance matrix.
+        rng = numpy.random.default_rng(seed=43)
+        distances = numpy.array(rng.integers(0, 4, size=(40, 40)), float)
+        distances += distances.T
+        for method in "ma":
+            tree = treecluster(None, distancematrix=distances.copy(), method=method)
+            nodes = [(node.left, node.right, node.distance) for node in tree[:]]
+            self.assertEqual(nodes, join(distances, method))
+
+    def test_distancematrix_single(self):
+        if TestCluster.module == "Bio.Cluster":
+            from Bio.Cluster import distancematrix, kmedoids, treecluster
+        elif TestCluster.module == "Pycluster":
+            from Pycluster import distancematrix, kmedoids, treecluster
+
+        # Three well-separated groups, so that the clustering solutions do
+        # not depend on the precision in which the distances are stored.
+        rng = numpy.random.default_rng(seed=44)
+        centers = numpy.array([[0.0, 0.0, 0.0], [10.0, 0.0, 5.0], [0.0, 20.0, 0.0]])
+        data = numpy.repeat(centers, 30, axis=0) + rng.random((90, 3))
+        rows = distancematrix(data)
+        condensed = distancematrix(data, dtype="d")
+        self.assertEqual(condensed.dtype, numpy.float64)
+        self.assertTrue(numpy.array_equal(condensed, numpy.concatenate(rows)))
+        single = distancematrix(data, dtype="f", threads=2)
+        self.assertEqual(single.dtype, numpy.float32)
+        self.assertTrue(numpy.allclose(single, condensed, rtol=1e-6))
+        for method in "smac":
+            for threads in (1, 2):
+                tree1 = treecluster(data, method=method, threads=threads)
+                tree2 = treecluster(data, method=method, threads=threads, dtype="f")
+                for node1, node2 in zip(tree1[:], tree2[:]):
+                    self.assertEqual(node1.left, node2.left)
+                    self.assertEqual(node1.right, node2.right)
+                    self.assertAlmostEqual(node1.distance, node2.distance, places=4)
+        for method in "sma":
+            tree1 = treecluster(None, distancematrix=condensed.copy(), method=method)
+            tree2 = treecluster(None, distancematrix=single.copy(), method=method)
+            self.assertEqual(tree1.cut(3).tolist(), tree2.cut(3).tolist())
+        initialid = numpy.arange(90) % 3
+        clusterid1, error1, nfound = kmedoids(condensed, 3, initialid=initialid)
+        clusterid2, error2, nfound = kmedoids(single, 3, initialid=initialid)
+        self.assertEqual(clusterid1.tolist(), clusterid2.tolist())
+        self.assertAlmostEqual(error1, error2, places=3)
+        clusterid3, error3, nfound = kmedoids(
+            [row.astype("f") for row in rows], 3, initialid=initialid
+        )
+        self.assertEqual(clusterid1.tolist(), clusterid3.tolist())
+        self.assertAlmostEqual(error2, error3, places=10)
+        # A single item has an empty distance matrix
+        for dtype in ("d", "f"):
+            matrix = distancematrix(numpy.ones((1, 3)), dtype=dtype)
+            self.assertEqual(matrix.dtype, numpy.dtype(dtype))
+            self.assertEqual(matrix.shape, (0,))
+            matrix = distancematrix(numpy.ones((3, 1)), transpose=True, dtype=dtype)
+            self.assertEqual(matrix.shape, (0,))
+        self.assertRaises(ValueError, treecluster, None, distancematrix=matrix)
+        self.assertRaises(ValueError, distancematrix, data, dtype="i")
+        self.assertRaises(ValueError, treecluster, data, dtype="f2")
+
+    def test_distancematrix_readonly(self):
+        if TestCluster.module == "Bio.Cluster":
+            from Bio.Cluster import distancematrix, kmedoids, treecluster
+        elif TestCluster.module == "Pycluster":
+            from Pycluster import distancematrix, kmedoids, treecluster
+        import os
+        import tempfile
+
+        # treecluster modifies the distance matrix in place, so read-only
+        # distance matrices, such as memory-mapped files opened with mode="r",
+        # are copied first.
+        rng = numpy.random.default_rng(seed=44)
+        data = rng.random((40, 3))
+        for dtype in ("f", "d"):
+            condensed = distancematrix(data, dtype=dtype)
+            expected = treecluster(None, distancematrix=condensed.copy())
+            handle, path = tempfile.mkstemp()
+            os.close(handle)
+            try:
+                condensed.tofile(path)
+                matrix = numpy.memmap(path, dtype=dtype, mode="r")
+                tree = treecluster(None, distancematrix=matrix)
+                self.assertEqual(str(tree), str(expected))
+                self.assertTrue(numpy.array_equal(matrix, condensed))
+                clusterid, error, nfound = kmedoids(matrix, 3)
+                del matrix
+            finally:
+                os.remove(path)
+            matrix = condensed.copy()
+            matrix.flags.writeable = False
+            tree = treecluster(None, distancematrix=matrix)
+            self.assertEqual(str(tree), str(expected))
+            self.assertTrue(numpy.array_equal(matrix, condensed))
+            rows = [row.astype(dtype) for row in distancematrix(data)]
+            for row in rows:
+                row.flags.writeable = False
+            tree = treecluster(None, distancematrix=rows)
+            self.assertEqual(str(tree[:]), str(expected[:]))
+            if TestCluster.module == "Bio.Cluster":
+                from Bio.Cluster import _cluster
+
+                message = "^distance matrix is read-only$"
+                with self.assertRaisesRegex(ValueError, message):
+                    _cluster.treecluster(
+                        _cluster.Tree(), None, None, None, 0, "s", "e", matrix
+                    )
+
+    def test_kcluster_seed(self):
+        if TestCluster.module == "Bio.Cluster":
+            from Bio.Cluster import distancematrix, kcluster, kmedoids
+        elif TestCluster.module == "Pycluster":
+            from Pycluster import distancematrix, kcluster, kmedoids
+
+        # The result depends on the seed only, not on the number of threads
+        rng = numpy.random.default_rng(seed=45)
+        data = rng.normal(size=(60, 4))
+        matrix = distancematrix(data, dtype="d")
+        for method in "am":
+            clusterid1, error1, nfound1 = kcluster(
+                data, 5, npass=20, method=method, seed=45, threads=1
+            )
+            clusterid4, error4, nfound4 = kcluster(
+                data, 5, npass=20, method=method, seed=45, threads=4
+            )
+            self.assertEqual(clusterid1.tolist(), clusterid4.tolist())
+            self.assertEqual(error1, error4)
+            self.assertEqual(nfound1, nfound4)
+            self.assertGreaterEqual(nfound1, 1)
+            self.assertLessEqual(nfound1, 20)
+        clusterid1, error1, nfound1 = kmedoids(
+            matrix, 5, npass=20, seed=2**64 - 1, threads=1
+        )
+        clusterid4, error4, nfound4 = kmedoids(
+            matrix, 5, npass=20, seed=2**64 - 1, threads=4
+        )
+        self.assertEqual(clusterid1.tolist(), clusterid4.tolist())
+        self.assertEqual(error1, error4)
+        self.assertEqual(nfound1, nfound4)
+        message = "^seed should be a nonnegative integer smaller than 2\\*\\*64$"
+        with self.assertRaisesRegex(ValueError, message):
+            kcluster(data, seed=-1)
+        with self.assertRaisesRegex(ValueError, message):
+            kmedoids(matrix, seed=2**64)
+        self.assertRaises(TypeError, kcluster, data, seed=1.5)
+        self.assertRaises(ValueError, kmedoids, matrix, threads=0)
+
     def test_pca_arguments(self):
         if TestCluster.module == "Bio.Cluster":
             from Bio.Cluster._cluster import pca
@@ -22,12 +22,18 @@ if __name__ == "__main__":
     # Explicitly using pure Python fallback functions:
     orig_make_score_matrix_fast = pairwise2._make_score_matrix_fast
     orig_rint = pairwise2.rint
+    orig_recover_alignments_fast = pairwise2._recover_alignments_fast
+    orig_score_pairs_fast = pairwise2._score_pairs_fast
     try:
         pairwise2._make_score_matrix_fast = pairwise2._python_make_score_matrix_fast
         pairwise2.rint = pairwise2._python_rint
+        pairwise2._recover_alignments_fast = None
+        pairwise2._score_pairs_fast = None
         unittest.main(testRunner=runner)
     finally:
         # To avoid interfering with the remaining pairwise2 tests,
         # restore the original functions
         pairwise2._make_score_matrix_fast = orig_make_score_matrix_fast
         pairwise2.rint = orig_rint
+        pairwise2._recover_alignments_fast = orig_recover_alignments_fast
+        pairwise2._score_pairs_fast = orig_score_pairs_fast
@@ -42,6 +42,12 @@ class TestAlignerProperties(unittest.TestCase):
         self.assertEqual(aligner.mode, "global")
         aligner.mode = "local"
         self.assertEqual(aligner.mode, "local")
+        aligner.mode = "semiglobal"
+        self.assertEqual(aligner.mode, "semiglobal")
+        aligner.mode = "glocal"
+        self.assertEqual(aligner.mode, "glocal")
+        aligner.mode = "overlap"
+        self.assertEqual(aligner.mode, "overlap")
         with self.assertRaises(ValueError):
             aligner.mode = "wrong"
 
@@ -442,6 +448,149 @@ zA-Bz
         )
 
 
+class TestPairwiseSemiglobal(unittest.TestCase):
+    def test_semiglobal(self):
+        aligner = Align.PairwiseAligner()
+        aligner.mode = "semiglobal"
+        aligner.mismatch_score = -1
+        aligner.gap_score = -1
+        self.assertEqual(aligner.algorithm, "semiglobal Needleman-Wunsch")
+        self.assertAlmostEqual(aligner.score("GGGGACGTACGT", "ACGTACGTCCCC"), 8.0)
+        self.assertAlmostEqual(aligner.score("ACGTACGTCCCC", "GGGGACGTACGT"), 8.0)
+        self.assertAlmostEqual(aligner.score("ACGTAACGT", "GGACGTAACGTGG"), 9.0)
+        alignments = aligner.align("GGGGACGTACGT", "ACGTACGTCCCC")
+        self.assertEqual(len(alignments), 1)
+        alignment = alignments[0]
+        self.assertAlmostEqual(alignment.score, 8.0)
+        self.assertEqual(
+            str(alignment),
+            """\
+GGGGACGTACGT----
+----||||||||----
+----ACGTACGTCCCC
+""",
+        )
+        self.assertTrue(
+            numpy.array_equal(alignment.aligned, numpy.array([[[4, 12]], [[0, 8]]]))
+        )
+        aligner.open_gap_score = -2
+        aligner.extend_gap_score = -1
+        self.assertEqual(aligner.algorithm, "Gotoh semiglobal alignment algorithm")
+        self.assertAlmostEqual(aligner.score("GGGGACGTACGT", "ACGTACGTCCCC"), 8.0)
+        alignments = aligner.align("GGGGACGTACGT", "ACGTACGTCCCC")
+        self.assertEqual(len(alignments), 1)
+        self.assertAlmostEqual(alignments[0].score, 8.0)
+
+    def test_glocal(self):
+        aligner = Align.PairwiseAligner()
+        aligner.mode = "glocal"
+        aligner.mismatch_score = -1
+        aligner.gap_score = -1
+        self.assertEqual(aligner.algorithm, "glocal Needleman-Wunsch")
+        # the query is aligned completely; only the target overhangs are free
+        self.assertAlmostEqual(aligner.score("ACGTACGTCCCC", "GGGGACGTACGT"), 4.0)
+        self.assertAlmostEqual(aligner.score("ACGTAACGT", "GGACGTAACGTGG"), 5.0)
+        alignments = aligner.align("GGGGACGTAACGTGGGG", "ACGTACGT")
+        self.assertEqual(len(alignments), 2)
+        alignment = alignments[0]
+        self.assertAlmostEqual(alignment.score, 7.0)
+        self.assertEqual(
+            str(alignment),
+            """\
+GGGGACGTAACGTGGGG
+----|||||-|||----
+----ACGTA-CGT----
+""",
+        )
+        aligner.open_gap_score = -2
+        aligner.extend_gap_score = -1
+        self.assertEqual(aligner.algorithm, "Gotoh glocal alignment algorithm")
+        self.assertAlmostEqual(aligner.score("GGGGACGTAACGTGGGG", "ACGTACGT"), 6.0)
+        alignments = aligner.align("GGGGACGTAACGTGGGG", "ACGTACGT")
+        self.assertEqual(len(alignments), 2)
+        alignment = alignments[0]
+        self.assertAlmostEqual(alignment.score, 6.0)
+        self.assertEqual(
+            str(alignment),
+            """\
+GGGGACGTAACGTGGGG
+----||||-||||----
+----ACGT-ACGT----
+""",
+        )
+
+    def test_overlap(self):
+        aligner = Align.PairwiseAligner()
+        aligner.mode = "overlap"
+        aligner.mismatch_score = -1
+        aligner.gap_score = -1
+        self.assertEqual(aligner.algorithm, "overlap Needleman-Wunsch")
+        # a suffix of the target overlaps with a prefix of the query
+        self.assertAlmostEqual(aligner.score("GGGGACGTACGT", "ACGTACGTCCCC"), 8.0)
+        self.assertAlmostEqual(aligner.score("ACGTACGTCCCC", "GGGGACGTACGT"), 0.0)
+        self.assertAlmostEqual(aligner.score("ACGTAACGT", "GGACGTAACGTGG"), 7.0)
+        alignments = aligner.align("GGGGACGTACGT", "ACGTACGTCCCC")
+        self.assertEqual(len(alignments), 1)
+        alignment = alignments[0]
+        self.assertAlmostEqual(alignment.score, 8.0)
+        self.assertEqual(
+            str(alignment),
+            """\
+GGGGACGTACGT----
+----||||||||----
+----ACGTACGTCCCC
+""",
+        )
+        aligner.open_gap_score = -2
+        aligner.extend_gap_score = -1
+        self.assertEqual(aligner.algorithm, "Gotoh overlap alignment algorithm")
+        self.assertAlmostEqual(aligner.score("GGGGACGTACGT", "ACGTACGTCCCC"), 8.0)
+        self.assertAlmostEqual(aligner.score("ACGTACGTCCCC", "GGGGACGTACGT"), 0.0)
+
+    def test_gap_function(self):
+        aligner = Align.PairwiseAligner()
+        aligner.mode = "semiglobal"
+        aligner.target_gap_score = lambda i, n: -n
+        with self.assertRaises(ValueError):
+            aligner.score("ACGT", "ACT")
+        with self.assertRaises(ValueError):
+            aligner.align("ACGT", "ACT")
+
+
+class TestPairwiseEditDistance(unittest.TestCase):
+    def test_edit_distance_global(self):
+        aligner = Align.PairwiseAligner()
+        aligner.match_score = 0
+        aligner.mismatch_score = -1
+        aligner.gap_score = -1
+        self.assertEqual(aligner.algorithm, "Needleman-Wunsch")
+        self.assertAlmostEqual(aligner.score("kitten", "sitting"), -3.0)
+        self.assertAlmostEqual(aligner.score("sitting", "kitten"), -3.0)
+        self.assertAlmostEqual(aligner.score("ACGT", "ACGT"), 0.0)
+        # patterns longer than 64 letters span multiple words
+        self.assertAlmostEqual(aligner.score("A" * 100 + "C", "A" * 150), -50.0)
+        target = "ACGT" * 50
+        query = "ACGT" * 20 + "TTT" + "ACGT" * 30
+        self.assertAlmostEqual(aligner.score(target, query), -3.0)
+        alignments = aligner.align("kitten", "sitting")
+        self.assertAlmostEqual(alignments.score, -3.0)
+        aligner.wildcard = "N"
+        self.assertAlmostEqual(aligner.score("ACGTNCGT", "ACNTACGT"), 0.0)
+
+    def test_edit_distance_glocal(self):
+        aligner = Align.PairwiseAligner()
+        aligner.mode = "glocal"
+        aligner.match_score = 0
+        aligner.mismatch_score = -1
+        aligner.gap_score = -1
+        target = "T" * 20 + "ACGT" * 30 + "G" * 20
+        query = "ACGT" * 30
+        self.assertAlmostEqual(aligner.score(target, query), 0.0)
+        query = "ACGT" * 15 + "C" + "ACGT" * 15
+        self.assertAlmostEqual(aligner.score(target, query), -1.0)
+        self.assertAlmostEqual(aligner.score("ACGT", "GGACGTGG"), -4.0)
+
+
 class TestUnknownCharacter(unittest.TestCase):
     def test_needlemanwunsch_simple1(self):
         seq1 = "GACT"
@@ -3869,6 +4018,182 @@ class TestAlignerPickling(unittest.TestCase):
         )
         self.assertEqual(aligner.mode, pickled_aligner.mode)
 
+    def test_pickle_aligner_alphabet_gap_function(self):
+        import pickle
+
+        aligner = Align.PairwiseAligner()
+        aligner.alphabet = "ACGTN"
+        aligner.mismatch_score = -1
+        aligner.target_gap_score = linear_gap_score
+        aligner.query_gap_score = -2
+        state = pickle.dumps(aligner)
+        pickled_aligner = pickle.loads(state)
+        self.assertEqual(pickled_aligner.alphabet, "ACGTN")
+        self.assertIs(pickled_aligner.target_gap_score, linear_gap_score)
+        self.assertAlmostEqual(pickled_aligner.query_gap_score, -2)
+        self.assertEqual(
+            pickled_aligner.algorithm, "Waterman-Smith-Beyer global alignment algorithm"
+        )
+        self.assertAlmostEqual(
+            pickled_aligner.score("ACGTACGT", "ACGACGT"),
+            aligner.score("ACGTACGT", "ACGACGT"),
+        )
+        with self.assertRaises(ValueError):
+            pickled_aligner.score("ACGU", "ACG")
+
+    def test_unpickle_aligner_dictionary(self):
+        # state as stored by older versions of Biopython
+        aligner = Align.PairwiseAligner.__new__(Align.PairwiseAligner)
+        aligner.__setstate__(
+            {"mode": "local", "match_score": 2.0, "mismatch_score": -1.0}
+        )
+        self.assertEqual(aligner.mode, "local")
+        self.assertAlmostEqual(aligner.match_score, 2.0)
+        self.assertAlmostEqual(aligner.mismatch_score, -1.0)
+        self.assertAlmostEqual(aligner.score("AAAGGG", "CCGGG"), 6.0)
+
+
+class TestMemoryLimit(unittest.TestCase):
+    def test_memory_limit(self):
+        aligner = Align.PairwiseAligner()
+        self.assertIsNone(aligner.memory_limit)
+        aligner.memory_limit = 100000
+        self.assertEqual(aligner.memory_limit, 100000)
+        seqA = "A" * 1000
+        seqB = "A" * 1000
+        # scoring only needs memory proportional to the sequence lengths
+        self.assertAlmostEqual(aligner.score(seqA, seqB), 1000.0)
+        with self.assertRaises(MemoryError):
+            aligner.align(seqA, seqB)
+        alignments = aligner.align("A" * 100, "A" * 100)
+        self.assertEqual(len(alignments), 1)
+        self.assertAlmostEqual(alignments.score, 100.0)
+        aligner.memory_limit = None
+        alignments = aligner.align(seqA, seqB)
+        self.assertEqual(len(alignments), 1)
+
+    def test_memory_limit_gap_function(self):
+        aligner = Align.PairwiseAligner()
+        aligner.target_gap_score = linear_gap_score
+        aligner.memory_limit = 100000
+        with self.assertRaises(MemoryError):
+            aligner.score("A" * 1000, "A" * 1000)
+        self.assertAlmostEqual(aligner.score("AAAA", "AA"), 2.0)
+
+    def test_memory_limit_errors(self):
+        aligner = Align.PairwiseAligner()
+        with self.assertRaises(ValueError):
+            aligner.memory_limit = -1
+        with self.assertRaises(TypeError):
+            aligner.memory_limit = 1.5
+        self.assertIsNone(aligner.memory_limit)
+
+    def test_pickle_memory_limit(self):
+        import pickle
+
+        aligner = Align.PairwiseAligner(memory_limit=12345)
+        pickled_aligner = pickle.loads(pickle.dumps(aligner))
+        self.assertEqual(pickled_aligner.memory_limit, 12345)
+
+
+class TestAlignerStatistics(unittest.TestCase):
+    def test_statistics_disabled(self):
+        aligner = Align.PairwiseAligner()
+        self.assertFalse(aligner.collect_statistics)
+        aligner.score("GAACT", "GAT")
+        alignments = aligner.align("GAACT", "GAT")
+        self.assertEqual(len(list(alignments)), 2)
+        statistics = aligner.statistics
+        self.assertIsNone(statistics["algorithm"])
+        self.assertEqual(statistics["score_calls"], 0)
+        self.assertEqual(statistics["align_calls"], 0)
+        self.assertEqual(statistics["cells"], 0)
+        self.assertEqual(statistics["paths"], 0)
+
+    def test_statistics_needlemanwunsch(self):
+        aligner = Align.PairwiseAligner()
+        aligner.collect_statistics = True
+        self.assertTrue(aligner.collect_statistics)
+        self.assertAlmostEqual(aligner.score("GAACT", "GAT"), 3.0)
+        alignments = aligner.align("GAACT", "GAT")
+        self.assertEqual(len(alignments), 2)
+        self.assertEqual(len(list(alignments)), 2)
+        statistics = aligner.statistics
+        self.assertEqual(statistics["algorithm"], "Needleman-Wunsch")
+        self.assertEqual(statistics["score_calls"], 1)
+        self.assertEqual(statistics["align_calls"], 1)
+        self.assertEqual(statistics["cells"], 30)
+        self.assertGreater(statistics["trace_bytes"], 0)
+        self.assertGreater(statistics["count_bytes"], 0)
+        self.assertEqual(statistics["paths"], 2)
+        self.assertGreaterEqual(statistics["fill_time"], 0)
+        self.assertGreaterEqual(statistics["traceback_time"], 0)
+        aligner.reset_statistics()
+        self.assertTrue(aligner.collect_statistics)
+        statistics = aligner.statistics
+        self.assertIsNone(statistics["algorithm"])
+        self.assertEqual(statistics["score_calls"], 0)
+        self.assertEqual(statistics["align_calls"], 0)
+        self.assertEqual(statistics["cells"], 0)
+        self.assertEqual(statistics["trace_bytes"], 0)
+        self.assertEqual(statistics["count_bytes"], 0)
+        self.assertEqual(statistics["paths"], 0)
+        self.assertEqual(statistics["fill_time"], 0)
+        self.assertEqual(statistics["traceback_time"], 0)
+
+    def test_statistics_myers(self):
+        aligner = Align.PairwiseAligner()
+        aligner.match_score = 0
+        aligner.mismatch_score = -1
+        aligner.gap_score = -1
+        aligner.collect_statistics = True
+        seqA = "ACGT" * 25
+        seqB = "ACGA" * 20
+        self.assertAlmostEqual(aligner.score(seqA, seqB), -35.0)
+        statistics = aligner.statistics
+        self.assertEqual(statistics["algorithm"], "Myers bit-vector algorithm")
+        self.assertEqual(statistics["score_calls"], 1)
+        # The pattern of 80 letters is stored in two 64-bit words, which are
+        # calculated for each of the 100 letters of the text.
+        self.assertEqual(statistics["cells"], 200)
+        aligner.mode = "local"
+        self.assertAlmostEqual(aligner.score(seqA, seqB), 0.0)
+        statistics = aligner.statistics
+        self.assertEqual(statistics["algorithm"], "Smith-Waterman")
+        self.assertEqual(statistics["score_calls"], 2)
+        self.assertEqual(statistics["cells"], 200 + 100 * 80)
+        aligner.mode = "global"
+        aligner.align(seqA, seqB)
+        statistics = aligner.statistics
+        self.assertEqual(statistics["algorithm"], "Needleman-Wunsch")
+
+    def test_statistics_gotoh_local(self):
+        aligner = Align.PairwiseAligner()
+        aligner.mode = "local"
+        aligner.open_gap_score = -2
+        aligner.extend_gap_score = -0.5
+        aligner.collect_statistics = True
+        alignments = aligner.align("TTGAACTT", "GAACT")
+        self.assertEqual(len(list(alignments)), 1)
+        statistics = aligner.statistics
+        self.assertEqual(statistics["algorithm"], "Gotoh local alignment algorithm")
+        self.assertEqual(statistics["align_calls"], 1)
+        self.assertEqual(statistics["cells"], 40)
+        self.assertEqual(statistics["paths"], 1)
+
+    def test_statistics_generator_outlives_collection(self):
+        aligner = Align.PairwiseAligner()
+        aligner.collect_statistics = True
+        alignments = aligner.align("GAACT", "GAT")
+        aligner.reset_statistics()
+        del aligner
+        self.assertEqual(len(list(alignments)), 2)
+
+
+def linear_gap_score(i, n):
+    """Gap score function used to test pickling."""
+    return -2.0 * n
+
 
 class TestAlignmentFormat(unittest.TestCase):
     def test_alignment_simple(self):